@@ -0,0 +1,21 @@
+#ifndef SHD_BE_BYTECODE_H
+#define SHD_BE_BYTECODE_H
+
+#include "shady/ir/base.h"
+
+typedef struct BytecodeProgram_ BytecodeProgram;
+
+typedef struct CompilerConfig_ CompilerConfig;
+/// Compiles a module that went through the compiler passes, with a subgroup size of 1, into a compact register-based bytecode
+BytecodeProgram* shd_emit_bytecode(const CompilerConfig* compiler_config, Module* mod, Module** new_mod);
+void shd_destroy_bytecode(BytecodeProgram* program);
+
+/// A listing of the bytecode, for debugging
+void shd_print_bytecode(const BytecodeProgram* program, size_t* output_size, char** output);
+
+/// Runs a compute entry point over a grid of workgroups on the calling thread, without any GPU or native compilation involved.
+/// Workgroups run one after the other, and their invocations take turns at barriers. @p args points to each argument, like for the C11
+/// runners. Global variables keep their contents from one run to the next. Returns false if the program traps.
+bool shd_interpret_bytecode(const BytecodeProgram* program, String entry_point, void** args, const uint32_t num_workgroups[3]);
+
+#endif
@@ -15,6 +15,18 @@ typedef struct {
     bool explicitly_sized_types;
     bool allow_compound_literals;
     bool decay_unsized_arrays;
+    /// C11 only: packed types become GCC/Clang vector extension types, so that packed arithmetic compiles to SIMD instructions.
+    /// Packs of booleans, pointers and odd widths, comparisons and maths are still done one lane at a time.
+    bool native_vectors;
+    /// C11 only: the invocations of a workgroup run as the innermost loop of the compute entry points' runners, annotated with
+    /// `#pragma omp simd` so that the C compiler vectorises across them, the way ISPC runs a gang. Needs -fopenmp-simd to take effect.
+    bool simd_workgroups;
+    /// C11 and CUDA only: promises that the buffers given to an entry point never overlap, so its pointer params are declared `restrict`.
+    /// Passing the same buffer twice, or two views of it, is then undefined behaviour.
+    bool restrict_kernel_args;
+    /// C11 only: also emits `void __shady_dispatch_<entry point>(x, y, z, args)` for each compute entry point, which runs that many
+    /// workgroups spread over one pthread per core (or SHADY_THREADS), so that host code can call kernels directly. Needs -pthread.
+    bool dispatch_harness;
     int glsl_version;
 } CEmitterConfig;
 
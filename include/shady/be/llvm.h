@@ -0,0 +1,23 @@
+#ifndef SHD_BE_LLVM_H
+#define SHD_BE_LLVM_H
+
+#include "shady/ir/base.h"
+
+typedef struct {
+    /// Gives global, shared and constant memory the numbering NVPTX and AMDGPU use for them (1, 3 and 4), instead of putting
+    /// everything in the flat address space 0, which is what CPUs want.
+    bool explicit_address_spaces;
+} LLVMEmitterConfig;
+
+LLVMEmitterConfig shd_default_llvm_emitter_config(void);
+
+typedef struct CompilerConfig_ CompilerConfig;
+/// Prints the module as textual LLVM IR, without a target triple or data layout
+void shd_emit_llvm(const CompilerConfig* compiler_config, LLVMEmitterConfig config, Module* mod, size_t* output_size, char** output, Module** new_mod);
+
+struct LLVMOpaqueModule;
+/// Emits into an existing, empty LLVMModuleRef instead, for compiling it in-process. Its context, target triple and data layout are
+/// left as the caller set them, the latter two matter for the sizes the entry point runners export.
+void shd_emit_llvm_module(const CompilerConfig* compiler_config, LLVMEmitterConfig config, Module* mod, struct LLVMOpaqueModule* dst, Module** new_mod);
+
+#endif
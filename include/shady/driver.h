@@ -6,6 +6,7 @@
 
 #include "shady/be/c.h"
 #include "shady/be/spirv.h"
+#include "shady/be/llvm.h"
 
 struct List;
 
@@ -20,6 +21,7 @@ typedef enum {
     IncorrectLogLevel = 16,
     InvalidTarget,
     ClangInvocationFailed,
+    OutputFileIOError,
 } ShadyErrorCodes;
 
 typedef enum {
@@ -39,6 +41,10 @@ typedef enum {
     TgtSPV,
     TgtGLSL,
     TgtISPC,
+    /// Textual LLVM IR, only available when the LLVM backend is built
+    TgtLLVM,
+    /// SPIR-V for every entry point along with their layouts, see KernelBundle
+    TgtBundle,
 } CodegenTarget;
 
 CodegenTarget shd_guess_target(const char* filename);
@@ -55,6 +61,7 @@ void shd_driver_parse_input_files(struct List* list, int* pargc, char** argv);
 typedef struct {
     CompilerConfig config;
     CEmitterConfig c_emitter_config;
+    LLVMEmitterConfig llvm_emitter_config;
     struct List* input_filenames;
     CodegenTarget target;
     const char*     output_filename;
@@ -77,4 +84,57 @@ typedef enum CompilationResult_ {
 
 CompilationResult shd_run_compiler_passes(CompilerConfig* config, Module** pmod);
 
+/// Hashes the parts of the configuration that change the generated code, the entry point aside.
+/// Code compiled with configurations sharing a fingerprint is interchangeable.
+uint64_t shd_driver_config_fingerprint(const CompilerConfig* config);
+
+/// A resource that a kernel reaches through a descriptor, as laid out in its final module.
+/// Descriptors point to blocks holding the addresses of the constants, which are resources of their own.
+typedef struct {
+    /// Index of the block holding the address of this constant, -1 for the blocks themselves
+    int parent;
+    /// Where the block is bound, unused for constants
+    int set, binding;
+    AddressSpace as;
+    /// Where the address of this constant lives in its parent
+    size_t offset;
+    size_t size;
+    /// Initial contents of a constant, NULL if it starts zeroed
+    const unsigned char* default_data;
+} KernelResourceLayout;
+
+/// Everything needed to launch an entry point without running the compiler again
+typedef struct {
+    String entry_point;
+    size_t spirv_size;
+    const char* spirv;
+
+    /// Arguments are passed as push constants
+    size_t args_count;
+    const size_t* arg_offsets;
+    const size_t* arg_sizes;
+    size_t args_size;
+
+    size_t resources_count;
+    const KernelResourceLayout* resources;
+} CompiledKernel;
+
+/// Compiled kernels, along with the fingerprint of the configuration they were compiled with.
+/// The compiled kernels and everything they point to are owned by the bundle.
+typedef struct KernelBundle_ KernelBundle;
+
+KernelBundle* shd_new_kernel_bundle(uint64_t config_fingerprint);
+void shd_destroy_kernel_bundle(KernelBundle* bundle);
+/// Recovers the layout of the kernel from its final module, as returned by shd_emit_spirv, and copies the SPIR-V
+const CompiledKernel* shd_kernel_bundle_add(KernelBundle* bundle, String entry_point, Module* final_mod, size_t spirv_size, const char* spirv);
+uint64_t shd_kernel_bundle_fingerprint(const KernelBundle* bundle);
+size_t shd_kernel_bundle_count(const KernelBundle* bundle);
+const CompiledKernel* shd_kernel_bundle_get(const KernelBundle* bundle, size_t i);
+/// Returns NULL if the bundle has no such entry point
+const CompiledKernel* shd_kernel_bundle_find(const KernelBundle* bundle, String entry_point);
+
+bool shd_write_kernel_bundle(const KernelBundle* bundle, const char* filename);
+/// Returns NULL if the file could not be read or is not a bundle from this version of shady
+KernelBundle* shd_read_kernel_bundle(const char* filename);
+
 #endif
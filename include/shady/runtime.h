@@ -9,6 +9,14 @@ typedef struct {
     bool use_validation;
     bool dump_spv;
     bool allow_no_devices;
+    /// Directory where compiled pipelines are persisted across runs, NULL disables persistence
+    const char* pipeline_cache_path;
+    /// Threads used to specialise kernels in the background, 0 picks one per CPU
+    size_t worker_threads;
+    /// Times every launch on the host and on the device, see shd_rt_get_kernel_profiles
+    bool profile;
+    /// Where to write a Chrome trace of the run on shutdown, NULL to skip it. Implies `profile`.
+    const char* profile_trace_path;
 } RuntimeConfig;
 
 RuntimeConfig shd_rt_default_config();
@@ -19,7 +27,13 @@ typedef struct Device_   Device;
 typedef struct Program_  Program;
 typedef struct Command_  Command;
 typedef struct Buffer_   Buffer;
+typedef struct KernelFuture_ KernelFuture;
+typedef struct Batch_    Batch;
+typedef struct KernelLaunchTemplate_ KernelLaunchTemplate;
 
+/// Devices, programs and buffers can be used from any number of threads at once: each thread records into command pools
+/// of its own, and threads only wait on each other to submit. Batches and launch templates are the exception,
+/// they must only be used by one thread at a time.
 Runtime* shd_rt_initialize(RuntimeConfig config);
 void shd_rt_shutdown(Runtime* runtime);
 
@@ -32,23 +46,115 @@ typedef struct CompilerConfig_ CompilerConfig;
 typedef struct Module_ Module;
 
 Program* shd_rt_new_program_from_module(Runtime* runtime, const CompilerConfig* base_config, Module* mod);
+/// Loads kernels compiled ahead of time with `--target bundle`, which skips the compiler entirely when launching them.
+/// The bundle must have been compiled for the configuration each device derives from `base_config`,
+/// in particular with the device's subgroup size and SPIR-V version. Not supported by the CUDA backend.
+Program* shd_rt_load_program_bundle(Runtime* runtime, const CompilerConfig* base_config, const char* path);
 
 typedef struct {
+    /// Filled with the device time the kernel took, in nanoseconds, once the command completes
     uint64_t* profiled_gpu_time;
+    /// Commands that must complete before the kernel runs, see shd_rt_copy_to_buffer_async
+    Command** dependencies;
+    size_t dependencies_count;
 } ExtraKernelOptions;
 
 Command* shd_rt_launch_kernel(Program* p, Device* d, const char* entry_point, int dimx, int dimy, int dimz, int args_count, void** args, ExtraKernelOptions* extra_options);
+/// Like shd_rt_launch_kernel, but the workgroup counts are read by the device from `dimensions` when the kernel starts:
+/// three consecutive uint32_t at `offset`, which must be a multiple of 4. Lets a kernel size the launches that follow it.
+Command* shd_rt_launch_kernel_indirect(Program* p, Device* d, const char* entry_point, Buffer* dimensions, size_t offset, int args_count, void** args, ExtraKernelOptions* extra_options);
 bool shd_rt_wait_completion(Command* cmd);
 
+/// Records several launches to be submitted at once. Each launch waits for the memory writes of the previous ones.
+Batch* shd_rt_begin_batch(Device* d);
+bool shd_rt_launch_kernel_in_batch(Batch* b, Program* p, const char* entry_point, int dimx, int dimy, int dimz, int args_count, void** args);
+/// The dimensions may have been written by an earlier launch in the same batch.
+bool shd_rt_launch_kernel_indirect_in_batch(Batch* b, Program* p, const char* entry_point, Buffer* dimensions, size_t offset, int args_count, void** args);
+/// Submits the batch and frees it, the returned command completes once every launch in the batch did.
+Command* shd_rt_submit_batch(Batch* b);
+
+/// Captures a sequence of launches once, ordered like in a batch, so that they can be submitted many times over.
+/// Arguments passed as NULL are patched in at every submission instead. Templates without any are submitted as-is,
+/// the others are re-recorded from their captured state, which skips the lookups and descriptor updates of a regular launch.
+KernelLaunchTemplate* shd_rt_begin_launch_template(Device* d);
+bool shd_rt_record_launch(KernelLaunchTemplate* t, Program* p, const char* entry_point, int dimx, int dimy, int dimz, int args_count, void** args);
+bool shd_rt_record_launch_indirect(KernelLaunchTemplate* t, Program* p, const char* entry_point, Buffer* dimensions, size_t offset, int args_count, void** args);
+/// `patches` holds one value for each NULL argument given while recording, in order. No launches can be recorded afterwards.
+Command* shd_rt_submit_launch_template(KernelLaunchTemplate* t, size_t patches_count, void** patches, size_t dependencies_count, Command** dependencies);
+/// The template must not be in flight anymore.
+void shd_rt_destroy_launch_template(KernelLaunchTemplate* t);
+
+/// Starts specialising the given entry point on the runtime's worker threads and returns immediately.
+/// Launches of that entry point only block if compilation is still in flight. The future is owned by the device.
+KernelFuture* shd_rt_prepare_kernel(Program* p, Device* d, const char* entry_point);
+/// Kicks off the specialisation of every entry point in the program, in parallel.
+void shd_rt_prepare_all_kernels(Program* p, Device* d);
+bool shd_rt_is_kernel_ready(KernelFuture* f);
+/// Returns false if the kernel failed to compile.
+bool shd_rt_wait_kernel(KernelFuture* f);
+
+/// Compiles the given entry point ahead of its first launch, so that the pipeline cache gets populated.
+bool shd_rt_prewarm_kernel(Program* p, Device* d, const char* entry_point);
+/// Writes the device's pipeline cache to the configured `pipeline_cache_path`. This also happens on shutdown.
+bool shd_rt_flush_pipeline_cache(Device* d);
+
 Buffer* shd_rt_allocate_buffer_device(Device* device, size_t bytes);
 bool shd_rt_can_import_host_memory(Device* device);
 Buffer* shd_rt_import_buffer_host(Device* device, void* ptr, size_t bytes);
 void shd_rt_destroy_buffer(Buffer* buf);
 
+typedef struct {
+    /// Large device memory blocks that small buffers are carved out of
+    size_t blocks_count;
+    size_t reserved_bytes;
+    /// Space taken in those blocks, rounded up to the allocator's granularity
+    size_t used_bytes;
+    /// What was actually asked for by the buffers living in the blocks, the gap to used_bytes is internal fragmentation
+    size_t requested_bytes;
+    /// Biggest buffer that fits in the existing blocks, compare with reserved_bytes - used_bytes for external fragmentation
+    size_t largest_free_range;
+    /// Buffers too large for a block get their own allocation
+    size_t dedicated_count;
+    size_t dedicated_bytes;
+    size_t allocations_count;
+    size_t frees_count;
+    /// Host time spent allocating and freeing buffer memory
+    uint64_t allocator_time_ns;
+} BufferAllocatorStats;
+
+/// Returns false if the device does not sub-allocate its buffers.
+bool shd_rt_get_buffer_allocator_stats(Device* d, BufferAllocatorStats* stats);
+
+typedef struct {
+    const char* entry_point;
+    size_t count;
+    /// Device time of the launches, in nanoseconds
+    uint64_t total_ns;
+    uint64_t min_ns;
+    uint64_t mean_ns;
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+} KernelProfile;
+
+/// Aggregates the device timings of the completed launches, by entry point and in decreasing order of total time.
+/// Launches are accounted for once their command has been waited on. Returns the number of profiled entry points,
+/// of which up to `capacity` are written to `profiles`. The entry point names stay valid as long as the device does.
+size_t shd_rt_get_kernel_profiles(Device* d, size_t capacity, KernelProfile* profiles);
+void shd_rt_print_kernel_profiles(Device* d);
+/// Writes the host and device timelines of every device to a file that chrome://tracing or Perfetto can open.
+bool shd_rt_export_profile_trace(Runtime* r, const char* path);
+
 void* shd_rt_get_buffer_host_pointer(Buffer* buf);
 uint64_t shd_rt_get_buffer_device_pointer(Buffer* buf);
 
 bool shd_rt_copy_to_buffer(Buffer* dst, size_t buffer_offset, void* src, size_t size);
 bool shd_rt_copy_from_buffer(Buffer* src, size_t buffer_offset, void* dst, size_t size);
 
+/// Asynchronous variants of the above. Copies use a dedicated transfer queue when the device has one, so they overlap with kernels.
+/// The host memory must stay valid until the command completes, readbacks are only written once shd_rt_wait_completion returns.
+/// Launches and copies only start once their dependencies completed, which the device tracks on its own when it supports timeline semaphores.
+/// Dependencies must not have been waited on yet, and still need to be waited on (in any order) afterwards.
+Command* shd_rt_copy_to_buffer_async(Buffer* dst, size_t buffer_offset, void* src, size_t size, size_t dependencies_count, Command** dependencies);
+Command* shd_rt_copy_from_buffer_async(Buffer* src, size_t buffer_offset, void* dst, size_t size, size_t dependencies_count, Command** dependencies);
+
 #endif
@@ -0,0 +1,159 @@
+#ifndef SHADY_BYTECODE_H
+#define SHADY_BYTECODE_H
+
+#include "shady/be/bytecode.h"
+#include "shady/ir/builtin.h"
+
+#include "arena.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+/// Every instruction starts with a word holding its opcode in the low 16 bits and a small immediate in the high 16 bits, which is
+/// usually the width in bits of the integers it works on. Its operands follow: register numbers, immediates, and branch targets, which
+/// are offsets into the code of the function. Registers are 64-bit and untyped, integers are kept zero-extended to their width,
+/// booleans are 0 or 1, floats are kept as their bits and pointers are host addresses.
+#define BC_OPCODE(word) ((word) & 0xFFFF)
+#define BC_AUX(word) ((word) >> 16)
+#define BC_WORD(op, aux) ((uint32_t) (op) | ((uint32_t) (aux) << 16))
+
+/// Floating-point instructions come in pairs, the 64-bit one right after the 32-bit one
+#define BC_FLOAT_OP(O, name, operands) O(name##32, operands) O(name##64, operands)
+
+/// O(name, operands), where operands is -1 for variable-length instructions
+#define BC_OPS(O) \
+O(Unreachable, 0)                      \
+O(Const, 3)         /* dst, lo, hi */  \
+O(Mov, 2)           /* dst, src */ \
+O(Select, 4)        /* dst, condition, if_true, if_false */ \
+O(Pick, -1)         /* dst, index, count, src...: dst = src[index] */ \
+O(GlobalAddr, 2)    /* dst, offset; aux = BcStorageClass */ \
+O(Add, 3)  O(Sub, 3)  O(Mul, 3)        \
+O(UDiv, 3) O(SDiv, 3) O(UMod, 3) O(SMod, 3) \
+O(And, 3)  O(Or, 3)   O(Xor, 3)  O(Not, 2) O(Neg, 2) \
+O(Shl, 3)  O(LShr, 3) O(AShr, 3)       \
+O(Eq, 3)   O(Ne, 3)   O(ULt, 3)  O(ULe, 3) O(SLt, 3) O(SLe, 3) \
+O(UMin, 3) O(UMax, 3) O(SMin, 3) O(SMax, 3) O(SAbs, 2) O(SSign, 2) \
+O(AddCarry, 4)      /* dst, carry, a, b */ \
+O(SubBorrow, 4)     /* dst, borrow, a, b */ \
+O(UMulExtended, 4)  /* lo, hi, a, b */ \
+O(SMulExtended, 4)  /* lo, hi, a, b */ \
+O(Trunc, 2)         /* aux = destination width, also zero-extends */ \
+O(SExt, 2)          /* aux = source width | destination width << 8 */ \
+BC_FLOAT_OP(O, FAdd, 3) BC_FLOAT_OP(O, FSub, 3) BC_FLOAT_OP(O, FMul, 3) BC_FLOAT_OP(O, FDiv, 3) \
+BC_FLOAT_OP(O, FMod, 3) BC_FLOAT_OP(O, FPow, 3) BC_FLOAT_OP(O, FMin, 3) BC_FLOAT_OP(O, FMax, 3) \
+BC_FLOAT_OP(O, FNeg, 2) BC_FLOAT_OP(O, FAbs, 2) BC_FLOAT_OP(O, FSign, 2) BC_FLOAT_OP(O, FSqrt, 2) \
+BC_FLOAT_OP(O, FInvSqrt, 2) BC_FLOAT_OP(O, FExp, 2) BC_FLOAT_OP(O, FFloor, 2) BC_FLOAT_OP(O, FCeil, 2) \
+BC_FLOAT_OP(O, FRound, 2) BC_FLOAT_OP(O, FFract, 2) BC_FLOAT_OP(O, FSin, 2) BC_FLOAT_OP(O, FCos, 2) \
+BC_FLOAT_OP(O, FFma, 4) \
+BC_FLOAT_OP(O, FEq, 3) BC_FLOAT_OP(O, FNe, 3) BC_FLOAT_OP(O, FLt, 3) BC_FLOAT_OP(O, FLe, 3) \
+BC_FLOAT_OP(O, SToF, 2) BC_FLOAT_OP(O, UToF, 2) /* aux = source width */ \
+BC_FLOAT_OP(O, FToS, 2) BC_FLOAT_OP(O, FToU, 2) /* aux = destination width */ \
+O(F32ToF64, 2) O(F64ToF32, 2) \
+O(Load, 3)          /* dst, ptr, offset; aux = size in bytes */ \
+O(LoadBool, 3)      /* dst, ptr, offset; aux = size in bytes */ \
+O(Store, 3)         /* ptr, offset, src; aux = size in bytes */ \
+O(PtrAdd, 3)        /* dst, ptr, offset as a signed 32-bit immediate */ \
+O(PtrIndex, 4)      /* dst, ptr, index, stride; aux = width the index gets sign-extended from */ \
+O(MemCpy, 3)        /* dst, src, count */ \
+O(MemSet, 3)        /* dst, byte, count */ \
+O(Alloca, 3)        /* dst, size, alignment */ \
+O(Jump, 1)          /* target */ \
+O(Branch, 3)        /* condition, if_true, if_false */ \
+O(Switch, -1)       /* value, count, default, (lo, hi, target)... */ \
+O(Call, -1)         /* function, count, args..., count, results... */ \
+O(CallIndirect, -1) /* function register, then like Call */ \
+O(Ret, -1)          /* count, values... */ \
+O(Barrier, 0)       \
+O(Printf, -1)       /* string, count, (BcPrintfArg, src)... */ \
+
+typedef enum {
+#define O(name, operands) Bc##name,
+BC_OPS(O)
+#undef O
+    BcOpsCount
+} BcOp;
+
+typedef enum {
+    /// Allocated along with the program and kept across runs, like global memory
+    BcStorageProgram,
+    /// Allocated for each workgroup
+    BcStorageWorkgroup,
+    /// Allocated for each invocation, this includes the builtins
+    BcStorageInvocation,
+    BcStorageClassesCount
+} BcStorageClass;
+
+/// How Printf passes a register to the C library: a kind, and the width of integers in the high bits
+typedef enum {
+    BcPrintfUnsigned,
+    BcPrintfSigned,
+    BcPrintfF32,
+    BcPrintfF64,
+    BcPrintfPtr,
+} BcPrintfArgKind;
+
+#define BC_PRINTF_ARG(kind, width) ((uint32_t) (kind) | ((uint32_t) (width) << 8))
+
+typedef struct {
+    String name;
+    uint32_t* code;
+    size_t code_size;
+    uint32_t registers_count;
+    /// the arguments get copied into the first registers
+    uint32_t params_count;
+} BcFunction;
+
+/// A scalar in memory
+typedef struct {
+    uint32_t offset;
+    uint8_t size;
+    bool is_bool;
+} BcMemScalar;
+
+typedef struct {
+    String name;
+    uint32_t function;
+    uint32_t workgroup_size[3];
+    size_t args_count;
+    /// one entry per parameter register, which tells where the runner fetches it from
+    uint32_t* arg_of_param;
+    BcMemScalar* params;
+} BcEntryPoint;
+
+typedef struct {
+    bool present;
+    BcStorageClass storage;
+    uint32_t offset;
+    uint32_t components_count;
+    uint8_t component_size;
+} BcBuiltinSlot;
+
+struct BytecodeProgram_ {
+    /// holds the names, strings and tables, but not the code
+    Arena* arena;
+
+    size_t functions_count;
+    BcFunction* functions;
+
+    size_t entry_points_count;
+    BcEntryPoint* entry_points;
+
+    size_t strings_count;
+    String* strings;
+
+    size_t storage_size[BcStorageClassesCount];
+    /// what the storage of each class is reset to when allocated, all zeroes where the globals have no initialiser
+    char* storage_init[BcStorageClassesCount];
+    char* program_storage;
+
+    BcBuiltinSlot builtins[BuiltinsCount];
+
+    /// bytes each invocation has for Alloca
+    size_t stack_size;
+};
+
+extern const char* bc_op_names[];
+extern const int bc_op_operands[];
+
+#endif
@@ -0,0 +1,533 @@
+#include "emit_bc.h"
+
+#include "shady/pass.h"
+#include "shady/ir/annotation.h"
+#include "shady/ir/memory_layout.h"
+
+#include "../shady/ir_private.h"
+#include "../shady/analysis/cfg.h"
+#include "../shady/analysis/scheduler.h"
+#include "../shady/passes/passes.h"
+
+#include "list.h"
+#include "dict.h"
+#include "log.h"
+#include "portability.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+KeyHash shd_hash_node(Node** pnode);
+bool shd_compare_node(Node** pa, Node** pb);
+
+#pragma GCC diagnostic error "-Wswitch"
+
+const Type* bc_strip_type(const Type* t) {
+    while (true) {
+        switch (t->tag) {
+            case QualifiedType_TAG: t = t->payload.qualified_type.type; continue;
+            case TypeDeclRef_TAG: t = t->payload.type_decl_ref.decl->payload.nom_type.body; continue;
+            default: return t;
+        }
+    }
+}
+
+size_t bc_elements_count(const Type* t) {
+    t = bc_strip_type(t);
+    switch (t->tag) {
+        case PackType_TAG: return t->payload.pack_type.width;
+        case ArrType_TAG: {
+            const Node* size = t->payload.arr_type.size;
+            if (!size)
+                shd_error("Arrays of unknown size cannot be held in registers");
+            return shd_get_int_literal_value(*shd_resolve_to_int_literal(size), false);
+        }
+        default: shd_error("not an array or a pack");
+    }
+}
+
+const Type* bc_element_type(const Type* t) {
+    t = bc_strip_type(t);
+    switch (t->tag) {
+        case PackType_TAG: return t->payload.pack_type.element_type;
+        case ArrType_TAG: return t->payload.arr_type.element_type;
+        default: shd_error("not an array or a pack");
+    }
+}
+
+size_t bc_leaves_count(const Type* t) {
+    t = bc_strip_type(t);
+    switch (t->tag) {
+        case Int_TAG:
+        case Bool_TAG:
+        case Float_TAG:
+        case PtrType_TAG: return 1;
+        case PackType_TAG:
+        case ArrType_TAG: return bc_elements_count(t) * bc_leaves_count(bc_element_type(t));
+        case RecordType_TAG: {
+            Nodes members = t->payload.record_type.members;
+            size_t count = 0;
+            for (size_t i = 0; i < members.count; i++)
+                count += bc_leaves_count(members.nodes[i]);
+            return count;
+        }
+        default: shd_error("The bytecode has no representation for %s", shd_get_node_tag_string(t->tag));
+    }
+}
+
+void bc_get_leaves(BcEmitter* emitter, const Type* t, size_t offset, BcLeaf* leaves) {
+    t = bc_strip_type(t);
+    switch (t->tag) {
+        case Int_TAG:
+        case Bool_TAG:
+        case Float_TAG:
+        case PtrType_TAG: {
+            leaves[0] = (BcLeaf) { .type = t, .offset = offset };
+            return;
+        }
+        case PackType_TAG:
+        case ArrType_TAG: {
+            const Type* element_t = bc_element_type(t);
+            size_t stride = shd_get_mem_layout(emitter->arena, element_t).size_in_bytes;
+            size_t element_leaves = bc_leaves_count(element_t);
+            for (size_t i = 0; i < bc_elements_count(t); i++)
+                bc_get_leaves(emitter, element_t, offset + i * stride, leaves + i * element_leaves);
+            return;
+        }
+        case RecordType_TAG: {
+            Nodes members = t->payload.record_type.members;
+            if (members.count == 0)
+                return;
+            LARRAY(FieldLayout, fields, members.count);
+            shd_get_record_layout(emitter->arena, t, fields);
+            for (size_t i = 0; i < members.count; i++) {
+                bc_get_leaves(emitter, members.nodes[i], offset + fields[i].offset_in_bytes, leaves);
+                leaves += bc_leaves_count(members.nodes[i]);
+            }
+            return;
+        }
+        default: shd_error("The bytecode has no representation for %s", shd_get_node_tag_string(t->tag));
+    }
+}
+
+uint8_t bc_scalar_size(BcEmitter* emitter, const Type* t) {
+    return (uint8_t) shd_get_mem_layout(emitter->arena, t).size_in_bytes;
+}
+
+uint32_t bc_scalar_width(const Type* t) {
+    t = bc_strip_type(t);
+    switch (t->tag) {
+        case Int_TAG: return int_size_in_bytes(t->payload.int_type.width) * 8;
+        case Bool_TAG: return 1;
+        case Float_TAG: {
+            if (t->payload.float_type.width == FloatTy16)
+                shd_error("The bytecode interpreter does not support half-precision floats");
+            return float_size_in_bytes(t->payload.float_type.width) * 8;
+        }
+        case PtrType_TAG: return 64;
+        default: shd_error("%s is not a scalar", shd_get_node_tag_string(t->tag));
+    }
+}
+
+BcRegs bc_new_registers(BcEmitter* emitter, BcFnEmitter* fn, size_t count) {
+    uint32_t* regs = shd_arena_alloc(emitter->regs_arena, sizeof(uint32_t) * count);
+    for (size_t i = 0; i < count; i++)
+        regs[i] = fn->registers_count++;
+    return (BcRegs) { .count = count, .regs = regs };
+}
+
+void bc_register_emitted(BcFnEmitter* fn, const Node* node, BcRegs regs) {
+    shd_dict_insert(const Node*, BcRegs, fn->emitted, node, regs);
+}
+
+BcRegs* bc_search_emitted(BcFnEmitter* fn, const Node* node) {
+    return shd_dict_find_value(const Node*, BcRegs, fn->emitted, node);
+}
+
+uint32_t bc_function_index(BcEmitter* emitter, const Node* fn) {
+    uint32_t* found = shd_dict_find_value(const Node*, uint32_t, emitter->functions, fn);
+    assert(found);
+    return *found;
+}
+
+BcGlobal bc_emit_global(BcEmitter* emitter, const Node* decl) {
+    BcGlobal* found = shd_dict_find_value(const Node*, BcGlobal, emitter->globals, decl);
+    assert(found);
+    return *found;
+}
+
+uint32_t bc_intern_string(BcEmitter* emitter, String string) {
+    size_t length = strlen(string);
+    char* copy = shd_arena_alloc(emitter->program->arena, length + 1);
+    memcpy(copy, string, length + 1);
+    String interned = copy;
+    shd_list_append(String, emitter->strings, interned);
+    return (uint32_t) (shd_list_count(emitter->strings) - 1);
+}
+
+void bc_emit_words(Growy* g, size_t count, const uint32_t words[]) {
+    shd_growy_append_bytes(g, count * sizeof(uint32_t), (const char*) words);
+}
+
+void bc_emit_const(Growy* g, uint32_t dst, uint64_t value) {
+    BC_EMIT(g, BC_WORD(BcConst, 0), dst, (uint32_t) value, (uint32_t) (value >> 32));
+}
+
+static BcStorageClass get_storage_class(AddressSpace as) {
+    switch (as) {
+        case AsShared: return BcStorageWorkgroup;
+        // builtins live in invocation storage, where the runner writes them
+        case AsPrivate:
+        case AsSubgroup:
+        case AsInput:
+        case AsUInput:
+        case AsOutput: return BcStorageInvocation;
+        default: return BcStorageProgram;
+    }
+}
+
+static void allocate_global(BcEmitter* emitter, const Node* decl) {
+    const GlobalVariable* gvar = &decl->payload.global_variable;
+    BytecodeProgram* program = emitter->program;
+    TypeMemLayout layout = shd_get_mem_layout(emitter->arena, gvar->type);
+    BcStorageClass storage = get_storage_class(gvar->address_space);
+    size_t align = layout.alignment_in_bytes ? layout.alignment_in_bytes : 1;
+    size_t offset = (program->storage_size[storage] + align - 1) / align * align;
+    program->storage_size[storage] = offset + layout.size_in_bytes;
+
+    BcGlobal global = { .storage = storage, .offset = (uint32_t) offset };
+    shd_dict_insert(const Node*, BcGlobal, emitter->globals, decl, global);
+
+    if (shd_is_decl_builtin(decl)) {
+        const Type* t = bc_strip_type(gvar->type);
+        bool is_composite = t->tag == PackType_TAG || t->tag == ArrType_TAG;
+        program->builtins[shd_get_decl_builtin(decl)] = (BcBuiltinSlot) {
+            .present = true,
+            .storage = storage,
+            .offset = (uint32_t) offset,
+            .components_count = is_composite ? bc_elements_count(t) : 1,
+            .component_size = bc_scalar_size(emitter, is_composite ? bc_element_type(t) : t),
+        };
+    }
+}
+
+/// Lays out a constant in memory, the way a load would find it
+static void write_constant(BcEmitter* emitter, const Node* value, char* dst) {
+    switch (value->tag) {
+        case IntLiteral_TAG: {
+            IntLiteral literal = value->payload.int_literal;
+            uint64_t bits = shd_get_int_literal_value(literal, false);
+            memcpy(dst, &bits, int_size_in_bytes(literal.width));
+            return;
+        }
+        case FloatLiteral_TAG: {
+            FloatLiteral literal = value->payload.float_literal;
+            memcpy(dst, &literal.value, float_size_in_bytes(literal.width));
+            return;
+        }
+        case True_TAG:
+        case False_TAG: {
+            uint64_t bits = value->tag == True_TAG;
+            memcpy(dst, &bits, bc_scalar_size(emitter, value->type));
+            return;
+        }
+        // the storage is zeroed already
+        case NullPtr_TAG:
+        case Undef_TAG: return;
+        case Composite_TAG: {
+            const Type* t = bc_strip_type(value->type);
+            Nodes contents = value->payload.composite.contents;
+            if (t->tag == RecordType_TAG) {
+                if (contents.count == 0)
+                    return;
+                LARRAY(FieldLayout, fields, contents.count);
+                shd_get_record_layout(emitter->arena, t, fields);
+                for (size_t i = 0; i < contents.count; i++)
+                    write_constant(emitter, contents.nodes[i], dst + fields[i].offset_in_bytes);
+                return;
+            }
+            size_t stride = shd_get_mem_layout(emitter->arena, bc_element_type(t)).size_in_bytes;
+            for (size_t i = 0; i < contents.count; i++)
+                write_constant(emitter, contents.nodes[i], dst + i * stride);
+            return;
+        }
+        case Fill_TAG: {
+            const Type* t = value->payload.fill.type;
+            size_t stride = shd_get_mem_layout(emitter->arena, bc_element_type(t)).size_in_bytes;
+            for (size_t i = 0; i < bc_elements_count(t); i++)
+                write_constant(emitter, value->payload.fill.value, dst + i * stride);
+            return;
+        }
+        case RefDecl_TAG: {
+            const Node* decl = value->payload.ref_decl.decl;
+            if (decl->tag == Constant_TAG) {
+                write_constant(emitter, decl->payload.constant.value, dst);
+                return;
+            }
+            break;
+        }
+        case FnAddr_TAG: {
+            uint64_t index = bc_function_index(emitter, value->payload.fn_addr.fn);
+            memcpy(dst, &index, sizeof(index));
+            return;
+        }
+        default: break;
+    }
+    shd_error("Global variables can only be initialised with constants in the bytecode, not %s", shd_get_node_tag_string(value->tag));
+}
+
+static void emit_basic_block(BcEmitter* emitter, BcFnEmitter* fn, const CFNode* cf_node) {
+    const Node* abs = cf_node->node;
+    assert(is_basic_block(abs) || cf_node == fn->cfg->entry);
+    bc_emit_terminator(emitter, fn, cf_node->rpo_index, abs, get_abstraction_body(abs));
+
+    for (size_t i = 0; i < shd_list_count(cf_node->dominates); i++) {
+        CFNode* dominated = shd_read_list(CFNode*, cf_node->dominates)[i];
+        emit_basic_block(emitter, fn, dominated);
+    }
+}
+
+/// Lays the blocks out in reverse post-order, each followed by its terminator, and resolves the branch targets
+static void link_function(BcFnEmitter* fn, BcFunction* dst) {
+    size_t blocks_count = fn->cfg->size;
+    LARRAY(size_t, block_starts, blocks_count);
+    LARRAY(size_t, terminator_starts, blocks_count);
+    Growy* code = shd_new_growy();
+    for (size_t i = 0; i < blocks_count; i++) {
+        // blocks the dominator tree does not reach are never jumped to
+        if (shd_growy_size(fn->terminators[i]) == 0)
+            BC_EMIT(fn->terminators[i], BC_WORD(BcUnreachable, 0));
+        block_starts[i] = shd_growy_size(code) / sizeof(uint32_t);
+        shd_growy_append_bytes(code, shd_growy_size(fn->blocks[i]), shd_growy_data(fn->blocks[i]));
+        terminator_starts[i] = shd_growy_size(code) / sizeof(uint32_t);
+        shd_growy_append_bytes(code, shd_growy_size(fn->terminators[i]), shd_growy_data(fn->terminators[i]));
+    }
+
+    dst->code_size = shd_growy_size(code) / sizeof(uint32_t);
+    dst->code = (uint32_t*) shd_growy_deconstruct(code);
+    BcRelocation* relocations = shd_read_list(BcRelocation, fn->relocations);
+    for (size_t i = 0; i < shd_list_count(fn->relocations); i++) {
+        BcRelocation relocation = relocations[i];
+        uint32_t* target = &dst->code[terminator_starts[relocation.block] + relocation.offset];
+        *target = (uint32_t) (relocation.local ? terminator_starts[relocation.block] + *target : block_starts[*target]);
+    }
+}
+
+static void emit_function(BcEmitter* emitter, const Node* decl, BcFunction* dst) {
+    assert(decl->tag == Function_TAG);
+    BcFnEmitter fn = {
+        .emitted = shd_new_dict(Node*, BcRegs, (HashFn) shd_hash_node, (CmpFn) shd_compare_node),
+    };
+
+    Nodes params = decl->payload.fun.params;
+    for (size_t i = 0; i < params.count; i++)
+        bc_register_emitted(&fn, params.nodes[i], bc_new_registers(emitter, &fn, bc_leaves_count(params.nodes[i]->type)));
+    *dst = (BcFunction) {
+        .name = decl->payload.fun.name,
+        .params_count = fn.registers_count,
+    };
+
+    if (decl->payload.fun.body) {
+        fn.cfg = build_fn_cfg(decl);
+        fn.scheduler = shd_new_scheduler(fn.cfg);
+        fn.relocations = shd_new_list(BcRelocation);
+        fn.blocks = calloc(sizeof(Growy*), fn.cfg->size);
+        fn.terminators = calloc(sizeof(Growy*), fn.cfg->size);
+
+        // block params get their registers upfront, so that jumps can copy their arguments there
+        for (size_t i = 0; i < fn.cfg->size; i++) {
+            fn.blocks[i] = shd_new_growy();
+            fn.terminators[i] = shd_new_growy();
+            if (i == 0)
+                continue;
+            Nodes bb_params = get_abstraction_params(fn.cfg->rpo[i]->node);
+            for (size_t j = 0; j < bb_params.count; j++)
+                bc_register_emitted(&fn, bb_params.nodes[j], bc_new_registers(emitter, &fn, bc_leaves_count(bb_params.nodes[j]->type)));
+        }
+
+        emit_basic_block(emitter, &fn, fn.cfg->entry);
+        link_function(&fn, dst);
+
+        for (size_t i = 0; i < fn.cfg->size; i++) {
+            shd_destroy_growy(fn.blocks[i]);
+            shd_destroy_growy(fn.terminators[i]);
+        }
+        free(fn.blocks);
+        free(fn.terminators);
+        shd_destroy_list(fn.relocations);
+        shd_destroy_scheduler(fn.scheduler);
+        shd_destroy_cfg(fn.cfg);
+    } else {
+        // there is nothing to link against, calling it traps
+        dst->code = malloc(sizeof(uint32_t));
+        dst->code[0] = BC_WORD(BcUnreachable, 0);
+        dst->code_size = 1;
+    }
+
+    dst->registers_count = fn.registers_count;
+    shd_destroy_dict(fn.emitted);
+}
+
+static void get_workgroup_size(BcEmitter* emitter, const Node* fn, uint32_t size[3]) {
+    const uint32_t* specialized = emitter->arena->config.specializations.workgroup_size;
+    if (specialized[0]) {
+        for (size_t i = 0; i < 3; i++)
+            size[i] = specialized[i] ? specialized[i] : 1;
+        return;
+    }
+    const Node* annotation = shd_lookup_annotation(fn, "WorkgroupSize");
+    Nodes values = annotation ? shd_get_annotation_values(annotation) : shd_empty(emitter->arena);
+    for (size_t i = 0; i < 3; i++)
+        size[i] = i < values.count ? (uint32_t) shd_get_int_literal_value(*shd_resolve_to_int_literal(values.nodes[i]), false) : 1;
+}
+
+static BcEntryPoint emit_entry_point(BcEmitter* emitter, const Node* fn) {
+    Arena* arena = emitter->program->arena;
+    const BcFunction* function = &emitter->program->functions[bc_function_index(emitter, fn)];
+    Nodes params = fn->payload.fun.params;
+
+    BcEntryPoint entry_point = {
+        .name = function->name,
+        .function = bc_function_index(emitter, fn),
+        .args_count = params.count,
+        .arg_of_param = shd_arena_alloc(arena, sizeof(uint32_t) * function->params_count),
+        .params = shd_arena_alloc(arena, sizeof(BcMemScalar) * function->params_count),
+    };
+    get_workgroup_size(emitter, fn, entry_point.workgroup_size);
+
+    // arguments are passed in memory, the way a C caller would lay them out
+    size_t reg = 0;
+    for (size_t i = 0; i < params.count; i++) {
+        size_t count = bc_leaves_count(params.nodes[i]->type);
+        if (count == 0)
+            continue;
+        LARRAY(BcLeaf, leaves, count);
+        bc_get_leaves(emitter, params.nodes[i]->type, 0, leaves);
+        for (size_t j = 0; j < count; j++, reg++) {
+            entry_point.arg_of_param[reg] = (uint32_t) i;
+            entry_point.params[reg] = (BcMemScalar) {
+                .offset = (uint32_t) leaves[j].offset,
+                .size = bc_scalar_size(emitter, leaves[j].type),
+                .is_bool = leaves[j].type->tag == Bool_TAG,
+            };
+        }
+    }
+    assert(reg == function->params_count);
+    return entry_point;
+}
+
+static Module* run_backend_specific_passes(const CompilerConfig* config, Module* initial_mod) {
+    IrArena* initial_arena = initial_mod->arena;
+    Module** pmod = &initial_mod;
+
+    // array sizes need to be known to lay out registers
+    RUN_PASS(shd_pass_eliminate_constants)
+    return *pmod;
+}
+
+BytecodeProgram* shd_emit_bytecode(const CompilerConfig* compiler_config, Module* mod, Module** new_mod) {
+    IrArena* initial_arena = shd_module_get_arena(mod);
+    mod = run_backend_specific_passes(compiler_config, mod);
+    IrArena* arena = shd_module_get_arena(mod);
+    if (arena->config.memory.ptr_size != IntTy64)
+        shd_error("The bytecode interpreter works with host pointers, which need to be 64-bit");
+
+    BytecodeProgram* program = calloc(1, sizeof(BytecodeProgram));
+    program->arena = shd_new_arena();
+    program->stack_size = compiler_config->per_thread_stack_size;
+
+    BcEmitter emitter = {
+        .module = mod,
+        .arena = arena,
+        .compiler_config = compiler_config,
+        .program = program,
+        .regs_arena = shd_new_arena(),
+        .functions = shd_new_dict(Node*, uint32_t, (HashFn) shd_hash_node, (CmpFn) shd_compare_node),
+        .globals = shd_new_dict(Node*, BcGlobal, (HashFn) shd_hash_node, (CmpFn) shd_compare_node),
+        .strings = shd_new_list(String),
+    };
+
+    // functions get numbered and globals get laid out first, code and initialisers refer to them in any order
+    Nodes decls = shd_module_get_declarations(mod);
+    for (size_t i = 0; i < decls.count; i++) {
+        const Node* decl = decls.nodes[i];
+        switch (decl->tag) {
+            case Function_TAG: {
+                uint32_t index = (uint32_t) program->functions_count++;
+                shd_dict_insert(const Node*, uint32_t, emitter.functions, decl, index);
+                break;
+            }
+            case GlobalVariable_TAG: allocate_global(&emitter, decl); break;
+            default: break;
+        }
+    }
+
+    for (size_t i = 0; i < BcStorageClassesCount; i++)
+        program->storage_init[i] = calloc(1, program->storage_size[i] ? program->storage_size[i] : 1);
+    for (size_t i = 0; i < decls.count; i++) {
+        const Node* decl = decls.nodes[i];
+        if (decl->tag != GlobalVariable_TAG || !decl->payload.global_variable.init)
+            continue;
+        BcGlobal global = bc_emit_global(&emitter, decl);
+        write_constant(&emitter, decl->payload.global_variable.init, program->storage_init[global.storage] + global.offset);
+    }
+    program->program_storage = malloc(program->storage_size[BcStorageProgram] ? program->storage_size[BcStorageProgram] : 1);
+    memcpy(program->program_storage, program->storage_init[BcStorageProgram], program->storage_size[BcStorageProgram]);
+
+    program->functions = shd_arena_alloc(program->arena, sizeof(BcFunction) * program->functions_count);
+    for (size_t i = 0; i < decls.count; i++) {
+        const Node* decl = decls.nodes[i];
+        if (decl->tag == Function_TAG)
+            emit_function(&emitter, decl, &program->functions[bc_function_index(&emitter, decl)]);
+    }
+
+    struct List* entry_points = shd_new_list(BcEntryPoint);
+    for (size_t i = 0; i < decls.count; i++) {
+        const Node* decl = decls.nodes[i];
+        if (decl->tag == Function_TAG && decl->payload.fun.body && shd_lookup_annotation_with_string_payload(decl, "EntryPoint", "Compute")) {
+            BcEntryPoint entry_point = emit_entry_point(&emitter, decl);
+            shd_list_append(BcEntryPoint, entry_points, entry_point);
+        }
+    }
+    program->entry_points_count = shd_list_count(entry_points);
+    program->entry_points = shd_arena_alloc(program->arena, sizeof(BcEntryPoint) * program->entry_points_count);
+    memcpy(program->entry_points, shd_read_list(BcEntryPoint, entry_points), sizeof(BcEntryPoint) * program->entry_points_count);
+    shd_destroy_list(entry_points);
+
+    program->strings_count = shd_list_count(emitter.strings);
+    program->strings = shd_arena_alloc(program->arena, sizeof(String) * program->strings_count);
+    memcpy(program->strings, shd_read_list(String, emitter.strings), sizeof(String) * program->strings_count);
+
+    // function names come from the IR arena, which might not outlive the program
+    for (size_t i = 0; i < program->functions_count; i++) {
+        BcFunction* function = &program->functions[i];
+        size_t length = strlen(function->name);
+        char* name = shd_arena_alloc(program->arena, length + 1);
+        memcpy(name, function->name, length + 1);
+        function->name = name;
+    }
+    for (size_t i = 0; i < program->entry_points_count; i++)
+        program->entry_points[i].name = program->functions[program->entry_points[i].function].name;
+
+    shd_destroy_dict(emitter.functions);
+    shd_destroy_dict(emitter.globals);
+    shd_destroy_list(emitter.strings);
+    shd_destroy_arena(emitter.regs_arena);
+
+    if (new_mod)
+        *new_mod = mod;
+    else if (initial_arena != arena)
+        shd_destroy_ir_arena(arena);
+    return program;
+}
+
+void shd_destroy_bytecode(BytecodeProgram* program) {
+    for (size_t i = 0; i < program->functions_count; i++)
+        free(program->functions[i].code);
+    for (size_t i = 0; i < BcStorageClassesCount; i++)
+        free(program->storage_init[i]);
+    free(program->program_storage);
+    shd_destroy_arena(program->arena);
+    free(program);
+}
@@ -0,0 +1,96 @@
+#ifndef SHADY_EMIT_BC_H
+#define SHADY_EMIT_BC_H
+
+#include "bytecode.h"
+
+#include "shady/ir.h"
+
+#include "growy.h"
+
+typedef struct CFG_ CFG;
+typedef struct Scheduler_ Scheduler;
+
+/// Values are flattened into one register per scalar, aggregates are just lists of registers and never need to be copied
+typedef struct {
+    size_t count;
+    const uint32_t* regs;
+} BcRegs;
+
+typedef struct {
+    CFG* cfg;
+    Scheduler* scheduler;
+    struct Dict* emitted;
+    /// indexed like the reverse post-order of the CFG: the instructions of each block, and the terminator that leaves it, which
+    /// stay apart so that values can still be scheduled into blocks whose terminator was already emitted
+    Growy** blocks;
+    Growy** terminators;
+    /// branch targets that only get known once all the blocks are laid out, see BcRelocation
+    struct List* relocations;
+    uint32_t registers_count;
+} BcFnEmitter;
+
+typedef struct {
+    /// the block whose terminator holds the target
+    size_t block;
+    /// in words, from the start of that terminator
+    size_t offset;
+    /// targets either hold the index of a block, or a position within the same terminator
+    bool local;
+} BcRelocation;
+
+typedef struct {
+    BcStorageClass storage;
+    uint32_t offset;
+} BcGlobal;
+
+typedef struct {
+    Module* module;
+    IrArena* arena;
+    const CompilerConfig* compiler_config;
+    BytecodeProgram* program;
+    /// the register lists of values, freed once the program is emitted
+    Arena* regs_arena;
+    struct Dict* functions;
+    struct Dict* globals;
+    struct List* strings;
+} BcEmitter;
+
+/// A scalar member of a type, and where it goes in memory
+typedef struct {
+    const Type* type;
+    size_t offset;
+} BcLeaf;
+
+/// Looks through qualifiers and nominal types
+const Type* bc_strip_type(const Type* t);
+size_t bc_elements_count(const Type* t);
+const Type* bc_element_type(const Type* t);
+size_t bc_leaves_count(const Type* t);
+/// Lists the scalars a value of type @p t is made of, in the order of its registers. Takes the memory layout into account.
+void bc_get_leaves(BcEmitter*, const Type* t, size_t offset, BcLeaf* leaves);
+/// Bytes a scalar takes in memory
+uint8_t bc_scalar_size(BcEmitter*, const Type* t);
+/// Width in bits of the integer a scalar is kept as in a register, 1 for booleans and 64 for pointers
+uint32_t bc_scalar_width(const Type* t);
+
+BcRegs bc_new_registers(BcEmitter*, BcFnEmitter*, size_t count);
+/// Keeps integers zero-extended to their width, see BC_OPCODE
+static inline uint64_t bc_normalize(uint64_t value, uint32_t width) {
+    return width >= 64 ? value : value & ((UINT64_C(1) << width) - 1);
+}
+uint32_t bc_function_index(BcEmitter*, const Node* fn);
+BcGlobal bc_emit_global(BcEmitter*, const Node* decl);
+uint32_t bc_intern_string(BcEmitter*, String);
+
+void bc_emit_words(Growy*, size_t count, const uint32_t words[]);
+#define BC_EMIT(g, ...) bc_emit_words(g, sizeof((uint32_t[]) { __VA_ARGS__ }) / sizeof(uint32_t), (uint32_t[]) { __VA_ARGS__ })
+void bc_emit_const(Growy*, uint32_t dst, uint64_t value);
+
+BcRegs bc_emit_value(BcEmitter*, BcFnEmitter*, const Node*);
+void bc_emit_mem(BcEmitter*, BcFnEmitter*, const Node*);
+void bc_emit_terminator(BcEmitter*, BcFnEmitter*, size_t block, const Node* abs, const Node* terminator);
+
+void bc_register_emitted(BcFnEmitter*, const Node*, BcRegs);
+BcRegs* bc_search_emitted(BcFnEmitter*, const Node*);
+
+#endif
@@ -0,0 +1,288 @@
+#include "emit_bc.h"
+
+#include "../shady/analysis/cfg.h"
+
+#include "list.h"
+#include "log.h"
+#include "portability.h"
+
+#include <assert.h>
+
+static size_t find_block(BcFnEmitter* fn, const Node* abs) {
+    CFNode* cf_node = shd_cfg_lookup(fn->cfg, abs);
+    assert(cf_node);
+    return cf_node->rpo_index;
+}
+
+/// Turns the parallel copy of a jump's arguments into Movs, going through a fresh register only where params get swapped around
+static void emit_parallel_copy(BcFnEmitter* fn, Growy* g, size_t count, uint32_t dsts[], uint32_t srcs[]) {
+    size_t pending = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (dsts[i] == srcs[i])
+            continue;
+        dsts[pending] = dsts[i];
+        srcs[pending] = srcs[i];
+        pending++;
+    }
+
+    while (pending > 0) {
+        bool progress = false;
+        for (size_t i = 0; i < pending; i++) {
+            bool still_read = false;
+            for (size_t j = 0; j < pending; j++)
+                still_read |= j != i && srcs[j] == dsts[i];
+            if (still_read)
+                continue;
+            BC_EMIT(g, BC_WORD(BcMov, 0), dsts[i], srcs[i]);
+            dsts[i] = dsts[pending - 1];
+            srcs[i] = srcs[pending - 1];
+            pending--;
+            progress = true;
+            break;
+        }
+        if (progress)
+            continue;
+        // only cycles are left: save one destination and read it from there instead
+        uint32_t saved = fn->registers_count++;
+        BC_EMIT(g, BC_WORD(BcMov, 0), saved, dsts[0]);
+        for (size_t j = 0; j < pending; j++)
+            if (srcs[j] == dsts[0])
+                srcs[j] = saved;
+    }
+}
+
+/// Copies the arguments of a jump into the params of its target
+static void emit_moves(BcEmitter* emitter, BcFnEmitter* fn, Growy* g, const Node* dst, Nodes args) {
+    // because it's forbidden to jump back into the entry block of a function
+    // (which is actually a Function in this IR, not a BasicBlock)
+    // we assert that the destination must be an actual BasicBlock
+    assert(is_basic_block(dst));
+    Nodes params = get_abstraction_params(dst);
+    assert(params.count == args.count);
+    LARRAY(BcRegs, srcs, args.count);
+    size_t count = 0;
+    for (size_t i = 0; i < args.count; i++) {
+        srcs[i] = bc_emit_value(emitter, fn, args.nodes[i]);
+        count += srcs[i].count;
+    }
+    if (count == 0)
+        return;
+
+    LARRAY(uint32_t, dst_regs, count);
+    LARRAY(uint32_t, src_regs, count);
+    size_t at = 0;
+    for (size_t i = 0; i < args.count; i++) {
+        BcRegs param_regs = *bc_search_emitted(fn, params.nodes[i]);
+        assert(param_regs.count == srcs[i].count);
+        for (size_t j = 0; j < param_regs.count; j++, at++) {
+            dst_regs[at] = param_regs.regs[j];
+            src_regs[at] = srcs[i].regs[j];
+        }
+    }
+    emit_parallel_copy(fn, g, count, dst_regs, src_regs);
+}
+
+static bool has_moves(const Node* dst) {
+    Nodes params = get_abstraction_params(dst);
+    for (size_t i = 0; i < params.count; i++)
+        if (bc_leaves_count(params.nodes[i]->type) > 0)
+            return true;
+    return false;
+}
+
+static void emit_target(BcFnEmitter* fn, size_t block, uint32_t target, bool local) {
+    Growy* g = fn->terminators[block];
+    BcRelocation relocation = { .block = block, .offset = shd_growy_size(g) / sizeof(uint32_t), .local = local };
+    shd_list_append(BcRelocation, fn->relocations, relocation);
+    BC_EMIT(g, target);
+}
+
+static void emit_jump_edge(BcEmitter* emitter, BcFnEmitter* fn, size_t block, const Node* dst, Nodes args) {
+    emit_moves(emitter, fn, fn->terminators[block], dst, args);
+    BC_EMIT(fn->terminators[block], BC_WORD(BcJump, 0));
+    emit_target(fn, block, (uint32_t) find_block(fn, dst), false);
+}
+
+typedef struct {
+    const Node* dst;
+    Nodes args;
+} Edge;
+
+static Edge jump_edge(const Node* jump) {
+    assert(jump->tag == Jump_TAG);
+    return (Edge) { jump->payload.jump.target, jump->payload.jump.args };
+}
+
+/// Fills in the targets of a conditional branch, which were left as placeholders at @p positions. Edges that carry arguments go
+/// through a stub that copies them, placed after the branch.
+static void emit_edge_targets(BcEmitter* emitter, BcFnEmitter* fn, size_t block, size_t count, const size_t positions[], const Edge edges[]) {
+    Growy* g = fn->terminators[block];
+    for (size_t i = 0; i < count; i++) {
+        bool stub = has_moves(edges[i].dst);
+        uint32_t target = stub ? (uint32_t) (shd_growy_size(g) / sizeof(uint32_t)) : (uint32_t) find_block(fn, edges[i].dst);
+        BcRelocation relocation = { .block = block, .offset = positions[i], .local = stub };
+        shd_list_append(BcRelocation, fn->relocations, relocation);
+        ((uint32_t*) shd_growy_data(g))[positions[i]] = target;
+        if (stub)
+            emit_jump_edge(emitter, fn, block, edges[i].dst, edges[i].args);
+    }
+}
+
+static size_t terminator_position(BcFnEmitter* fn, size_t block) {
+    return shd_growy_size(fn->terminators[block]) / sizeof(uint32_t);
+}
+
+static uint64_t case_value(const Node* literal) {
+    const IntLiteral* value = shd_resolve_to_int_literal(literal);
+    assert(value);
+    return bc_normalize(shd_get_int_literal_value(*value, false), int_size_in_bytes(value->width) * 8);
+}
+
+static void emit_switch(BcEmitter* emitter, BcFnEmitter* fn, size_t block, uint32_t value, Edge default_edge, size_t count, const Node* const literals[], const Edge edges[]) {
+    Growy* g = fn->terminators[block];
+    size_t at = terminator_position(fn, block);
+    BC_EMIT(g, BC_WORD(BcSwitch, 0), value, (uint32_t) count, 0);
+    LARRAY(size_t, positions, count + 1);
+    LARRAY(Edge, all_edges, count + 1);
+    positions[0] = at + 3;
+    all_edges[0] = default_edge;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t lo_hi = case_value(literals[i]);
+        BC_EMIT(g, (uint32_t) lo_hi, (uint32_t) (lo_hi >> 32), 0);
+        positions[i + 1] = at + 4 + 3 * i + 2;
+        all_edges[i + 1] = edges[i];
+    }
+    emit_edge_targets(emitter, fn, block, count + 1, positions, all_edges);
+}
+
+typedef enum {
+    SelectionConstruct,
+    LoopConstruct,
+} Construct;
+
+static const Node* find_construct(BcFnEmitter* fn, const Node* abs, Construct construct) {
+    const Node* oabs = abs;
+    for (CFNode* n = shd_cfg_lookup(fn->cfg, abs); n; oabs = n->node, n = n->idom) {
+        const Node* terminator = get_abstraction_body(n->node);
+        assert(terminator);
+        if (is_structured_construct(terminator) && get_structured_construct_tail(terminator) == oabs)
+            continue;
+        if (construct == LoopConstruct && terminator->tag == Loop_TAG)
+            return terminator;
+        if (construct == SelectionConstruct && (terminator->tag == If_TAG || terminator->tag == Match_TAG))
+            return terminator;
+    }
+    return NULL;
+}
+
+// Like in the LLVM backend, structured constructs become plain branches.
+void bc_emit_terminator(BcEmitter* emitter, BcFnEmitter* fn, size_t block, const Node* abs, const Node* terminator) {
+    Growy* g = fn->terminators[block];
+    switch (is_terminator(terminator)) {
+        case Return_TAG: {
+            Return payload = terminator->payload.fn_ret;
+            bc_emit_mem(emitter, fn, payload.mem);
+            LARRAY(BcRegs, values, payload.args.count);
+            size_t count = 0;
+            for (size_t i = 0; i < payload.args.count; i++) {
+                values[i] = bc_emit_value(emitter, fn, payload.args.nodes[i]);
+                count += values[i].count;
+            }
+            BC_EMIT(g, BC_WORD(BcRet, 0), (uint32_t) count);
+            for (size_t i = 0; i < payload.args.count; i++)
+                bc_emit_words(g, values[i].count, values[i].regs);
+            return;
+        }
+        case Unreachable_TAG: {
+            Unreachable payload = terminator->payload.unreachable;
+            bc_emit_mem(emitter, fn, payload.mem);
+            BC_EMIT(g, BC_WORD(BcUnreachable, 0));
+            return;
+        }
+        case Jump_TAG: {
+            Jump payload = terminator->payload.jump;
+            bc_emit_mem(emitter, fn, payload.mem);
+            emit_jump_edge(emitter, fn, block, payload.target, payload.args);
+            return;
+        }
+        case Branch_TAG: {
+            Branch payload = terminator->payload.branch;
+            bc_emit_mem(emitter, fn, payload.mem);
+            uint32_t condition = bc_emit_value(emitter, fn, payload.condition).regs[0];
+            size_t at = terminator_position(fn, block);
+            BC_EMIT(g, BC_WORD(BcBranch, 0), condition, 0, 0);
+            Edge edges[] = { jump_edge(payload.true_jump), jump_edge(payload.false_jump) };
+            emit_edge_targets(emitter, fn, block, 2, (size_t[]) { at + 2, at + 3 }, edges);
+            return;
+        }
+        case Switch_TAG: {
+            Switch payload = terminator->payload.br_switch;
+            bc_emit_mem(emitter, fn, payload.mem);
+            uint32_t value = bc_emit_value(emitter, fn, payload.switch_value).regs[0];
+            LARRAY(Edge, edges, payload.case_jumps.count);
+            for (size_t i = 0; i < payload.case_jumps.count; i++)
+                edges[i] = jump_edge(payload.case_jumps.nodes[i]);
+            emit_switch(emitter, fn, block, value, jump_edge(payload.default_jump), payload.case_jumps.count, payload.case_values.nodes, edges);
+            return;
+        }
+        case If_TAG: {
+            If payload = terminator->payload.if_instr;
+            bc_emit_mem(emitter, fn, payload.mem);
+            uint32_t condition = bc_emit_value(emitter, fn, payload.condition).regs[0];
+            size_t at = terminator_position(fn, block);
+            BC_EMIT(g, BC_WORD(BcBranch, 0), condition, 0, 0);
+            Nodes no_args = shd_empty(emitter->arena);
+            Edge edges[] = { { payload.if_true, no_args }, { payload.if_false ? payload.if_false : payload.tail, no_args } };
+            emit_edge_targets(emitter, fn, block, 2, (size_t[]) { at + 2, at + 3 }, edges);
+            return;
+        }
+        case Match_TAG: {
+            Match payload = terminator->payload.match_instr;
+            bc_emit_mem(emitter, fn, payload.mem);
+            uint32_t inspectee = bc_emit_value(emitter, fn, payload.inspect).regs[0];
+            Nodes no_args = shd_empty(emitter->arena);
+            LARRAY(Edge, edges, payload.cases.count);
+            for (size_t i = 0; i < payload.cases.count; i++)
+                edges[i] = (Edge) { payload.cases.nodes[i], no_args };
+            emit_switch(emitter, fn, block, inspectee, (Edge) { payload.default_case, no_args }, payload.cases.count, payload.literals.nodes, edges);
+            return;
+        }
+        case Loop_TAG: {
+            Loop payload = terminator->payload.loop_instr;
+            bc_emit_mem(emitter, fn, payload.mem);
+            emit_jump_edge(emitter, fn, block, payload.body, payload.initial_args);
+            return;
+        }
+        case MergeSelection_TAG: {
+            MergeSelection payload = terminator->payload.merge_selection;
+            bc_emit_mem(emitter, fn, payload.mem);
+            const Node* construct = find_construct(fn, abs, SelectionConstruct);
+            assert(construct);
+            const Node* tail = get_structured_construct_tail(construct);
+            assert(tail != abs);
+            emit_jump_edge(emitter, fn, block, tail, payload.args);
+            return;
+        }
+        case MergeContinue_TAG: {
+            MergeContinue payload = terminator->payload.merge_continue;
+            bc_emit_mem(emitter, fn, payload.mem);
+            const Node* construct = find_construct(fn, abs, LoopConstruct);
+            assert(construct);
+            emit_jump_edge(emitter, fn, block, construct->payload.loop_instr.body, payload.args);
+            return;
+        }
+        case MergeBreak_TAG: {
+            MergeBreak payload = terminator->payload.merge_break;
+            bc_emit_mem(emitter, fn, payload.mem);
+            const Node* construct = find_construct(fn, abs, LoopConstruct);
+            assert(construct);
+            emit_jump_edge(emitter, fn, block, construct->payload.loop_instr.tail, payload.args);
+            return;
+        }
+        case Terminator_Control_TAG:
+        case TailCall_TAG:
+        case Join_TAG: shd_error("Lower me");
+        case NotATerminator: shd_error("TODO: emit terminator %s", shd_get_node_tag_string(terminator->tag));
+    }
+    SHADY_UNREACHABLE;
+}
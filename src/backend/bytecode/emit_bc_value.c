@@ -0,0 +1,741 @@
+#include "emit_bc.h"
+
+#include "shady/ir/memory_layout.h"
+
+#include "../shady/analysis/cfg.h"
+#include "../shady/analysis/scheduler.h"
+
+#include "log.h"
+#include "list.h"
+#include "dict.h"
+#include "portability.h"
+
+#include <spirv/unified1/spirv.h>
+
+#include <assert.h>
+#include <string.h>
+
+typedef enum {
+    Custom, Lanewise
+} InstrClass;
+
+typedef enum {
+    Signed, Unsigned, FP, Logical, Ptr, OperandClassCount
+} OperandClass;
+
+/// The scalar type of the lanes of a value
+static const Type* get_scalar_type(const Type* type) {
+    type = bc_strip_type(type);
+    if (type->tag == PackType_TAG)
+        return bc_strip_type(type->payload.pack_type.element_type);
+    return type;
+}
+
+static OperandClass classify_scalar(const Type* type) {
+    switch (type->tag) {
+        case Int_TAG:     return type->payload.int_type.is_signed ? Signed : Unsigned;
+        case Bool_TAG:    return Logical;
+        case PtrType_TAG: return Ptr;
+        case Float_TAG:   return FP;
+        default: shd_error("we don't know what to do with this")
+    }
+}
+
+static const Type* get_operand_scalar_type(const Node* operand) {
+    return get_scalar_type(shd_get_unqualified_type(operand->type));
+}
+
+typedef struct {
+    InstrClass class;
+    /// 0 (Unreachable) where the operation makes no sense for that class of operands, floating-point ones name the 32-bit variant
+    BcOp op[OperandClassCount];
+    /// gt and gte are lt and lte with their operands swapped
+    bool swap;
+} ISelTableEntry;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmissing-field-initializers"
+
+static const ISelTableEntry isel_table[] = {
+    [add_op] = { Lanewise, { BcAdd,  BcAdd,  BcFAdd32 } },
+    [sub_op] = { Lanewise, { BcSub,  BcSub,  BcFSub32 } },
+    [mul_op] = { Lanewise, { BcMul,  BcMul,  BcFMul32 } },
+    [div_op] = { Lanewise, { BcSDiv, BcUDiv, BcFDiv32 } },
+    [mod_op] = { Lanewise, { BcSMod, BcUMod, BcFMod32 } },
+    [neg_op] = { Lanewise, { BcNeg,  BcNeg,  BcFNeg32 } },
+
+    [not_op] = { Lanewise, { BcNot, BcNot, 0, BcNot } },
+    [and_op] = { Lanewise, { BcAnd, BcAnd, 0, BcAnd } },
+    [or_op]  = { Lanewise, { BcOr,  BcOr,  0, BcOr  } },
+    [xor_op] = { Lanewise, { BcXor, BcXor, 0, BcXor } },
+
+    [lshift_op]         = { Lanewise, { BcShl,  BcShl  } },
+    [rshift_logical_op] = { Lanewise, { BcLShr, BcLShr } },
+    [rshift_arithm_op]  = { Lanewise, { BcAShr, BcAShr } },
+
+    // logical and pointer operands get compared as unsigned integers
+    [eq_op]  = { Lanewise, { BcEq,  BcEq,  BcFEq32, BcEq, BcEq } },
+    [neq_op] = { Lanewise, { BcNe,  BcNe,  BcFNe32, BcNe, BcNe } },
+    [lt_op]  = { Lanewise, { BcSLt, BcULt, BcFLt32 } },
+    [lte_op] = { Lanewise, { BcSLe, BcULe, BcFLe32 } },
+    [gt_op]  = { Lanewise, { BcSLt, BcULt, BcFLt32 }, true },
+    [gte_op] = { Lanewise, { BcSLe, BcULe, BcFLe32 }, true },
+
+    [min_op]  = { Lanewise, { BcSMin, BcUMin, BcFMin32 } },
+    [max_op]  = { Lanewise, { BcSMax, BcUMax, BcFMax32 } },
+    [sign_op] = { Lanewise, { BcSSign, 0, BcFSign32 } },
+
+    [sqrt_op]     = { Lanewise, { [FP] = BcFSqrt32 } },
+    [inv_sqrt_op] = { Lanewise, { [FP] = BcFInvSqrt32 } },
+    [floor_op]    = { Lanewise, { [FP] = BcFFloor32 } },
+    [ceil_op]     = { Lanewise, { [FP] = BcFCeil32 } },
+    [round_op]    = { Lanewise, { [FP] = BcFRound32 } },
+    [fract_op]    = { Lanewise, { [FP] = BcFFract32 } },
+    [sin_op]      = { Lanewise, { [FP] = BcFSin32 } },
+    [cos_op]      = { Lanewise, { [FP] = BcFCos32 } },
+    [exp_op]      = { Lanewise, { [FP] = BcFExp32 } },
+    [pow_op]      = { Lanewise, { [FP] = BcFPow32 } },
+    [fma_op]      = { Lanewise, { [FP] = BcFFma32 } },
+};
+
+#pragma GCC diagnostic pop
+
+static const ISelTableEntry* lookup_entry(Op op) {
+    if (op < sizeof(isel_table) / sizeof(isel_table[0]))
+        return &isel_table[op];
+    return NULL;
+}
+
+static uint32_t fresh_register(BcFnEmitter* fn) {
+    return fn->registers_count++;
+}
+
+static uint32_t* alloc_regs(BcEmitter* emitter, size_t count) {
+    return shd_arena_alloc(emitter->regs_arena, sizeof(uint32_t) * count);
+}
+
+/// Picks the 64-bit variant of floating-point instructions
+static BcOp float_op(BcOp op32, uint32_t width) {
+    return width == 64 ? op32 + 1 : op32;
+}
+
+/// Applies a scalar instruction to each lane. Operands with a single register, like shift amounts, are used for all the lanes.
+static BcRegs emit_lanes(BcEmitter* emitter, BcFnEmitter* fn, Growy* g, BcOp op, uint32_t aux, size_t lanes, size_t operands_count, const BcRegs operands[], bool swap) {
+    assert(operands_count <= 3);
+    BcRegs result = bc_new_registers(emitter, fn, lanes);
+    for (size_t lane = 0; lane < lanes; lane++) {
+        uint32_t words[5] = { BC_WORD(op, aux), result.regs[lane] };
+        for (size_t i = 0; i < operands_count; i++) {
+            const BcRegs* operand = &operands[swap ? operands_count - 1 - i : i];
+            words[2 + i] = operand->count == 1 ? operand->regs[0] : operand->regs[lane];
+        }
+        bc_emit_words(g, 2 + operands_count, words);
+    }
+    return result;
+}
+
+static uint32_t emit_convert_scalar(BcFnEmitter* fn, Growy* g, uint32_t src, const Type* src_type, const Type* dst_type) {
+    OperandClass from = classify_scalar(src_type);
+    OperandClass to = classify_scalar(dst_type);
+    uint32_t from_width = bc_scalar_width(src_type);
+    uint32_t to_width = bc_scalar_width(dst_type);
+    // booleans are 0 or 1 already, they convert like unsigned integers
+    bool from_int = from == Signed || from == Unsigned || from == Logical || from == Ptr;
+    bool to_int = to == Signed || to == Unsigned || to == Ptr;
+
+    uint32_t dst = fresh_register(fn);
+    if (from_int && to_int) {
+        if (from == Signed && to_width > from_width)
+            BC_EMIT(g, BC_WORD(BcSExt, from_width | to_width << 8), dst, src);
+        else if (to_width < from_width)
+            BC_EMIT(g, BC_WORD(BcTrunc, to_width), dst, src);
+        else
+            return src;
+        return dst;
+    }
+    if (from_int && to == FP) {
+        BC_EMIT(g, BC_WORD(float_op(from == Signed ? BcSToF32 : BcUToF32, to_width), from_width), dst, src);
+        return dst;
+    }
+    if (from == FP && to_int) {
+        BC_EMIT(g, BC_WORD(float_op(to == Signed ? BcFToS32 : BcFToU32, from_width), to_width), dst, src);
+        return dst;
+    }
+    if (from == FP && to == FP) {
+        if (from_width == to_width)
+            return src;
+        BC_EMIT(g, BC_WORD(to_width == 64 ? BcF32ToF64 : BcF64ToF32, 0), dst, src);
+        return dst;
+    }
+    if (to == Logical) {
+        uint32_t zero = fresh_register(fn);
+        bc_emit_const(g, zero, 0);
+        if (from == FP)
+            BC_EMIT(g, BC_WORD(float_op(BcFNe32, from_width), from_width), dst, src, zero);
+        else
+            BC_EMIT(g, BC_WORD(BcNe, from_width), dst, src, zero);
+        return dst;
+    }
+    shd_error("Unsupported conversion");
+}
+
+static uint32_t emit_reinterpret_scalar(BcFnEmitter* fn, Growy* g, uint32_t src, const Type* src_type, const Type* dst_type) {
+    uint32_t from_width = bc_scalar_width(src_type);
+    uint32_t to_width = bc_scalar_width(dst_type);
+    // pointers are 64-bit host addresses, integers are zero-extended already
+    if (classify_scalar(dst_type) == Ptr || from_width == to_width)
+        return src;
+    if (classify_scalar(src_type) == Ptr && to_width < from_width) {
+        uint32_t dst = fresh_register(fn);
+        BC_EMIT(g, BC_WORD(BcTrunc, to_width), dst, src);
+        return dst;
+    }
+    shd_error("Can't reinterpret between types of different sizes");
+}
+
+/// Where the registers of the element at @p index of a composite start, among those of the whole composite
+static size_t get_element_start(const Type* t, size_t index, const Type** element_t) {
+    t = bc_strip_type(t);
+    if (t->tag == RecordType_TAG) {
+        Nodes members = t->payload.record_type.members;
+        assert(index < members.count);
+        size_t start = 0;
+        for (size_t i = 0; i < index; i++)
+            start += bc_leaves_count(members.nodes[i]);
+        *element_t = members.nodes[index];
+        return start;
+    }
+    *element_t = bc_element_type(t);
+    assert(index < bc_elements_count(t));
+    return index * bc_leaves_count(*element_t);
+}
+
+static BcRegs insert_at(BcEmitter* emitter, const Type* t, BcRegs into, BcRegs value, size_t indices_count, const size_t indices[]) {
+    if (indices_count == 0)
+        return value;
+    const Type* element_t;
+    size_t start = get_element_start(t, indices[0], &element_t);
+    BcRegs element = { .count = bc_leaves_count(element_t), .regs = into.regs + start };
+    BcRegs inner = insert_at(emitter, element_t, element, value, indices_count - 1, indices + 1);
+    uint32_t* regs = alloc_regs(emitter, into.count);
+    memcpy(regs, into.regs, sizeof(uint32_t) * into.count);
+    memcpy(regs + start, inner.regs, sizeof(uint32_t) * inner.count);
+    return (BcRegs) { .count = into.count, .regs = regs };
+}
+
+static BcRegs emit_primop(BcEmitter* emitter, BcFnEmitter* fn, Growy* g, const Node* instr) {
+    PrimOp the_op = instr->payload.prim_op;
+    Nodes args = the_op.operands;
+    Nodes type_arguments = the_op.type_arguments;
+
+    LARRAY(BcRegs, emitted_args, args.count);
+    const ISelTableEntry* entry = lookup_entry(the_op.op);
+    if (entry && entry->class == Lanewise) {
+        const Type* scalar_t = get_operand_scalar_type(shd_first(args));
+        BcOp op = entry->op[classify_scalar(scalar_t)];
+        if (!op)
+            shd_error("%s is not defined for these operands", shd_get_primop_name(the_op.op));
+        uint32_t width = bc_scalar_width(scalar_t);
+        if (classify_scalar(scalar_t) == FP)
+            op = float_op(op, width);
+        for (size_t i = 0; i < args.count; i++)
+            emitted_args[i] = bc_emit_value(emitter, fn, args.nodes[i]);
+        return emit_lanes(emitter, fn, g, op, width, bc_leaves_count(instr->type), args.count, emitted_args, entry->swap);
+    }
+
+    switch (the_op.op) {
+        case abs_op: {
+            const Type* scalar_t = get_operand_scalar_type(shd_first(args));
+            BcRegs x = bc_emit_value(emitter, fn, shd_first(args));
+            uint32_t width = bc_scalar_width(scalar_t);
+            switch (classify_scalar(scalar_t)) {
+                case Unsigned: return x;
+                case Signed: return emit_lanes(emitter, fn, g, BcSAbs, width, x.count, 1, &x, false);
+                case FP: return emit_lanes(emitter, fn, g, float_op(BcFAbs32, width), width, x.count, 1, &x, false);
+                default: shd_error("abs is not defined for these operands");
+            }
+        }
+        case add_carry_op:
+        case sub_borrow_op:
+        case mul_extended_op: {
+            const Type* scalar_t = get_operand_scalar_type(shd_first(args));
+            BcOp op = the_op.op == add_carry_op ? BcAddCarry : the_op.op == sub_borrow_op ? BcSubBorrow : classify_scalar(scalar_t) == Signed ? BcSMulExtended : BcUMulExtended;
+            BcRegs x = bc_emit_value(emitter, fn, args.nodes[0]);
+            BcRegs y = bc_emit_value(emitter, fn, args.nodes[1]);
+            // the result is a record of two values like the operands: the lanes of the first, then the lanes of the second
+            BcRegs result = bc_new_registers(emitter, fn, 2 * x.count);
+            for (size_t lane = 0; lane < x.count; lane++)
+                BC_EMIT(g, BC_WORD(op, bc_scalar_width(scalar_t)), result.regs[lane], result.regs[x.count + lane], x.regs[lane], y.regs[lane]);
+            return result;
+        }
+        case size_of_op:
+        case align_of_op:
+        case offset_of_op: {
+            const Type* t = shd_first(type_arguments);
+            uint64_t value;
+            if (the_op.op == offset_of_op)
+                value = shd_get_record_field_offset_in_bytes(emitter->arena, bc_strip_type(t), shd_get_int_literal_value(*shd_resolve_to_int_literal(shd_first(args)), false));
+            else {
+                TypeMemLayout layout = shd_get_mem_layout(emitter->arena, t);
+                value = the_op.op == size_of_op ? layout.size_in_bytes : layout.alignment_in_bytes;
+            }
+            BcRegs result = bc_new_registers(emitter, fn, 1);
+            bc_emit_const(g, result.regs[0], bc_normalize(value, bc_scalar_width(shd_get_unqualified_type(instr->type))));
+            return result;
+        }
+        case select_op: {
+            assert(args.count == 3);
+            for (size_t i = 0; i < args.count; i++)
+                emitted_args[i] = bc_emit_value(emitter, fn, args.nodes[i]);
+            BcRegs condition = emitted_args[0];
+            BcRegs result = bc_new_registers(emitter, fn, emitted_args[1].count);
+            for (size_t i = 0; i < result.count; i++)
+                BC_EMIT(g, BC_WORD(BcSelect, 0), result.regs[i], condition.count == 1 ? condition.regs[0] : condition.regs[i], emitted_args[1].regs[i], emitted_args[2].regs[i]);
+            return result;
+        }
+        case convert_op:
+        case reinterpret_op: {
+            const Type* src_type = shd_get_unqualified_type(shd_first(args)->type);
+            const Type* dst_type = shd_first(type_arguments);
+            BcRegs src = bc_emit_value(emitter, fn, shd_first(args));
+            if (src.count != bc_leaves_count(dst_type))
+                shd_error("Can't %s between these types", shd_get_primop_name(the_op.op));
+            uint32_t* regs = alloc_regs(emitter, src.count);
+            for (size_t i = 0; i < src.count; i++) {
+                if (the_op.op == convert_op)
+                    regs[i] = emit_convert_scalar(fn, g, src.regs[i], get_scalar_type(src_type), get_scalar_type(dst_type));
+                else
+                    regs[i] = emit_reinterpret_scalar(fn, g, src.regs[i], get_scalar_type(src_type), get_scalar_type(dst_type));
+            }
+            return (BcRegs) { .count = src.count, .regs = regs };
+        }
+        case insert_op: {
+            assert(args.count > 2);
+            size_t indices_count = args.count - 2;
+            LARRAY(size_t, indices, indices_count);
+            for (size_t i = 0; i < indices_count; i++)
+                indices[i] = shd_get_int_literal_value(*shd_resolve_to_int_literal(args.nodes[2 + i]), false);
+            BcRegs into = bc_emit_value(emitter, fn, shd_first(args));
+            BcRegs value = bc_emit_value(emitter, fn, args.nodes[1]);
+            return insert_at(emitter, shd_get_unqualified_type(shd_first(args)->type), into, value, indices_count, indices);
+        }
+        case extract_dynamic_op:
+        case extract_op: {
+            assert(args.count > 1);
+            BcRegs acc = bc_emit_value(emitter, fn, shd_first(args));
+            const Type* t = shd_get_unqualified_type(shd_first(args)->type);
+            for (size_t i = 1; i < args.count; i++) {
+                const Node* index = args.nodes[i];
+                const IntLiteral* static_index = shd_resolve_to_int_literal(index);
+                const Type* element_t;
+                if (static_index) {
+                    size_t start = get_element_start(t, shd_get_int_literal_value(*static_index, false), &element_t);
+                    acc = (BcRegs) { .count = bc_leaves_count(element_t), .regs = acc.regs + start };
+                    t = element_t;
+                    continue;
+                }
+                if (bc_strip_type(t)->tag == RecordType_TAG)
+                    shd_error("Records can only be indexed by constants");
+                // registers can't be indexed, so each register of the element gets picked among the matching ones of all elements
+                element_t = bc_element_type(t);
+                size_t elements_count = bc_elements_count(t);
+                size_t element_leaves = bc_leaves_count(element_t);
+                uint32_t dynamic_index = bc_emit_value(emitter, fn, index).regs[0];
+                BcRegs picked = bc_new_registers(emitter, fn, element_leaves);
+                for (size_t j = 0; j < element_leaves; j++) {
+                    BC_EMIT(g, BC_WORD(BcPick, 0), picked.regs[j], dynamic_index, (uint32_t) elements_count);
+                    for (size_t k = 0; k < elements_count; k++)
+                        BC_EMIT(g, acc.regs[k * element_leaves + j]);
+                }
+                acc = picked;
+                t = element_t;
+            }
+            return acc;
+        }
+        case shuffle_op: {
+            BcRegs lhs = bc_emit_value(emitter, fn, args.nodes[0]);
+            BcRegs rhs = bc_emit_value(emitter, fn, args.nodes[1]);
+            uint32_t* regs = alloc_regs(emitter, args.count - 2);
+            for (size_t i = 2; i < args.count; i++) {
+                int64_t lane = shd_get_int_literal_value(*shd_resolve_to_int_literal(args.nodes[i]), true);
+                if (lane < 0)
+                    regs[i - 2] = fresh_register(fn);
+                else
+                    regs[i - 2] = (size_t) lane < lhs.count ? lhs.regs[lane] : rhs.regs[lane - lhs.count];
+            }
+            return (BcRegs) { .count = args.count - 2, .regs = regs };
+        }
+        case subgroup_assume_uniform_op: return bc_emit_value(emitter, fn, shd_first(args));
+        case sample_texture_op: shd_error("Images and samplers are not supported by the bytecode interpreter")
+        case empty_mask_op:
+        case mask_is_thread_active_op: shd_error("lower_mask should have taken care of those")
+        default: break;
+    }
+    shd_error("TODO: implement %s in the bytecode backend", shd_get_primop_name(the_op.op));
+}
+
+static BcRegs emit_zeroes(BcEmitter* emitter, BcFnEmitter* fn, Growy* g, const Type* t) {
+    BcRegs result = bc_new_registers(emitter, fn, bc_leaves_count(t));
+    for (size_t i = 0; i < result.count; i++)
+        bc_emit_const(g, result.regs[i], 0);
+    return result;
+}
+
+/// Like in the LLVM backend, subgroups have a single invocation, which makes every subgroup operation trivial.
+static BcRegs emit_ext_instr(BcEmitter* emitter, BcFnEmitter* fn, Growy* g, const Node* instr) {
+    ExtInstr payload = instr->payload.ext_instr;
+    bc_emit_mem(emitter, fn, payload.mem);
+    if (strcmp(payload.set, "spirv.core") != 0 || emitter->compiler_config->specialization.subgroup_size != 1)
+        shd_error("Unsupported extended instruction: (set = %s, opcode = %d )", payload.set, payload.opcode);
+
+    Nodes operands = payload.operands;
+    switch (payload.opcode) {
+        case SpvOpControlBarrier: {
+            BC_EMIT(g, BC_WORD(BcBarrier, 0));
+            return (BcRegs) { 0 };
+        }
+        // memory is coherent, invocations only ever switch at barriers
+        case SpvOpMemoryBarrier: return (BcRegs) { 0 };
+        case SpvOpGroupNonUniformBroadcastFirst: {
+            assert(operands.count == 2);
+            return bc_emit_value(emitter, fn, operands.nodes[1]);
+        }
+        case SpvOpGroupNonUniformElect:
+        case SpvOpGroupNonUniformAllEqual: {
+            BcRegs result = bc_new_registers(emitter, fn, 1);
+            bc_emit_const(g, result.regs[0], 1);
+            return result;
+        }
+        case SpvOpGroupNonUniformAll:
+        case SpvOpGroupNonUniformAny: return bc_emit_value(emitter, fn, operands.nodes[1]);
+        case SpvOpGroupNonUniformBallot: {
+            // the predicate is 0 or 1, which is the mask we want in the first word
+            BcRegs predicate = bc_emit_value(emitter, fn, operands.nodes[1]);
+            BcRegs result = emit_zeroes(emitter, fn, g, payload.result_t);
+            uint32_t* regs = alloc_regs(emitter, result.count);
+            memcpy(regs, result.regs, sizeof(uint32_t) * result.count);
+            regs[0] = predicate.regs[0];
+            return (BcRegs) { .count = result.count, .regs = regs };
+        }
+        case SpvOpGroupIAdd: case SpvOpGroupNonUniformIAdd:
+        case SpvOpGroupFAdd: case SpvOpGroupNonUniformFAdd:
+        case SpvOpGroupSMin: case SpvOpGroupNonUniformSMin:
+        case SpvOpGroupUMin: case SpvOpGroupNonUniformUMin:
+        case SpvOpGroupFMin: case SpvOpGroupNonUniformFMin:
+        case SpvOpGroupSMax: case SpvOpGroupNonUniformSMax:
+        case SpvOpGroupUMax: case SpvOpGroupNonUniformUMax:
+        case SpvOpGroupFMax: case SpvOpGroupNonUniformFMax:
+        case SpvOpGroupNonUniformIMul: case SpvOpGroupNonUniformFMul:
+        case SpvOpGroupNonUniformBitwiseAnd: case SpvOpGroupNonUniformBitwiseOr: case SpvOpGroupNonUniformBitwiseXor:
+        case SpvOpGroupNonUniformLogicalAnd: case SpvOpGroupNonUniformLogicalOr: case SpvOpGroupNonUniformLogicalXor: {
+            assert(operands.count == 3);
+            SpvGroupOperation group_op = (SpvGroupOperation) shd_get_int_literal_value(*shd_resolve_to_int_literal(operands.nodes[1]), false);
+            switch (group_op) {
+                case SpvGroupOperationReduce:
+                case SpvGroupOperationInclusiveScan: return bc_emit_value(emitter, fn, operands.nodes[2]);
+                case SpvGroupOperationExclusiveScan: {
+                    switch (payload.opcode) {
+                        // zero is the identity of addition, for integers and floats alike
+                        case SpvOpGroupIAdd: case SpvOpGroupNonUniformIAdd:
+                        case SpvOpGroupFAdd: case SpvOpGroupNonUniformFAdd: return emit_zeroes(emitter, fn, g, payload.result_t);
+                        default: break;
+                    }
+                    break;
+                }
+                default: break;
+            }
+            break;
+        }
+        default: break;
+    }
+    shd_error("Unsupported extended instruction: (set = %s, opcode = %d )", payload.set, payload.opcode);
+}
+
+static BcRegs emit_call(BcEmitter* emitter, BcFnEmitter* fn, Growy* g, const Node* instr) {
+    Call payload = instr->payload.call;
+    bc_emit_mem(emitter, fn, payload.mem);
+    LARRAY(BcRegs, args, payload.args.count);
+    size_t args_count = 0;
+    for (size_t i = 0; i < payload.args.count; i++) {
+        args[i] = bc_emit_value(emitter, fn, payload.args.nodes[i]);
+        args_count += args[i].count;
+    }
+
+    bool direct = payload.callee->tag == FnAddr_TAG;
+    uint32_t callee = direct ? bc_function_index(emitter, payload.callee->payload.fn_addr.fn) : bc_emit_value(emitter, fn, payload.callee).regs[0];
+    BcRegs results = bc_new_registers(emitter, fn, bc_leaves_count(instr->type));
+    BC_EMIT(g, BC_WORD(direct ? BcCall : BcCallIndirect, 0), callee, (uint32_t) args_count);
+    for (size_t i = 0; i < payload.args.count; i++)
+        bc_emit_words(g, args[i].count, args[i].regs);
+    BC_EMIT(g, (uint32_t) results.count);
+    bc_emit_words(g, results.count, results.regs);
+    return results;
+}
+
+static uint32_t get_printf_arg(const Type* t) {
+    uint32_t width = bc_scalar_width(t);
+    switch (classify_scalar(t)) {
+        case Signed: return BC_PRINTF_ARG(BcPrintfSigned, width);
+        case Unsigned:
+        case Logical: return BC_PRINTF_ARG(BcPrintfUnsigned, width);
+        case FP: return BC_PRINTF_ARG(width == 64 ? BcPrintfF64 : BcPrintfF32, width);
+        case Ptr: return BC_PRINTF_ARG(BcPrintfPtr, width);
+        default: SHADY_UNREACHABLE;
+    }
+}
+
+static BcRegs emit_debug_printf(BcEmitter* emitter, BcFnEmitter* fn, Growy* g, const Node* instr) {
+    DebugPrintf payload = instr->payload.debug_printf;
+    bc_emit_mem(emitter, fn, payload.mem);
+    LARRAY(BcRegs, args, payload.args.count);
+    size_t count = 0;
+    for (size_t i = 0; i < payload.args.count; i++) {
+        args[i] = bc_emit_value(emitter, fn, payload.args.nodes[i]);
+        count += args[i].count;
+    }
+
+    // vectors are passed one lane at a time
+    BC_EMIT(g, BC_WORD(BcPrintf, 0), bc_intern_string(emitter, payload.string), (uint32_t) count);
+    for (size_t i = 0; i < payload.args.count; i++) {
+        const Type* t = shd_get_unqualified_type(payload.args.nodes[i]->type);
+        if (args[i].count > 1 && bc_strip_type(t)->tag != PackType_TAG)
+            shd_error("Only scalars and vectors can be printed");
+        uint32_t arg = get_printf_arg(get_scalar_type(t));
+        for (size_t j = 0; j < args[i].count; j++)
+            BC_EMIT(g, arg, args[i].regs[j]);
+    }
+    return (BcRegs) { 0 };
+}
+
+/// Offsets a pointer by a constant, which lets loads and stores through it fold the offset in later
+static BcRegs emit_ptr_add(BcEmitter* emitter, BcFnEmitter* fn, Growy* g, BcRegs ptr, int64_t offset) {
+    if (offset == 0)
+        return ptr;
+    if (offset != (int32_t) offset)
+        shd_error("Pointer offsets are limited to 32 bits in the bytecode");
+    BcRegs result = bc_new_registers(emitter, fn, 1);
+    BC_EMIT(g, BC_WORD(BcPtrAdd, 0), result.regs[0], ptr.regs[0], (uint32_t) offset);
+    return result;
+}
+
+static BcRegs emit_ptr_index(BcEmitter* emitter, BcFnEmitter* fn, Growy* g, BcRegs ptr, const Node* index, size_t stride) {
+    const IntLiteral* static_index = shd_resolve_to_int_literal(index);
+    if (static_index)
+        return emit_ptr_add(emitter, fn, g, ptr, shd_get_int_literal_value(*static_index, static_index->is_signed) * (int64_t) stride);
+    const Type* index_t = get_operand_scalar_type(index);
+    uint32_t sign_width = classify_scalar(index_t) == Signed ? bc_scalar_width(index_t) : 64;
+    uint32_t dynamic_index = bc_emit_value(emitter, fn, index).regs[0];
+    BcRegs result = bc_new_registers(emitter, fn, 1);
+    BC_EMIT(g, BC_WORD(BcPtrIndex, sign_width), result.regs[0], ptr.regs[0], dynamic_index, (uint32_t) stride);
+    return result;
+}
+
+static const Type* get_pointee_type(const Node* ptr) {
+    const Type* ptr_type = shd_get_unqualified_type(ptr->type);
+    assert(ptr_type->tag == PtrType_TAG);
+    return ptr_type->payload.ptr_type.pointed_type;
+}
+
+static BcRegs emit_instruction(BcEmitter* emitter, BcFnEmitter* fn, Growy* g, const Node* instruction) {
+    switch (is_instruction(instruction)) {
+        case NotAnInstruction: shd_error("");
+        case Instruction_PushStack_TAG:
+        case Instruction_PopStack_TAG:
+        case Instruction_GetStackSize_TAG:
+        case Instruction_SetStackSize_TAG:
+        case Instruction_GetStackBaseAddr_TAG: shd_error("Stack operations need to be lowered.");
+        case Instruction_ExtInstr_TAG: return emit_ext_instr(emitter, fn, g, instruction);
+        case Instruction_Call_TAG: return emit_call(emitter, fn, g, instruction);
+        case Instruction_DebugPrintf_TAG: return emit_debug_printf(emitter, fn, g, instruction);
+        case PrimOp_TAG: return emit_primop(emitter, fn, g, instruction);
+        case Comment_TAG: {
+            bc_emit_mem(emitter, fn, instruction->payload.comment.mem);
+            return (BcRegs) { 0 };
+        }
+        case Instruction_StackAlloc_TAG:
+        case Instruction_LocalAlloc_TAG: {
+            const Type* t = instruction->tag == StackAlloc_TAG ? instruction->payload.stack_alloc.type : instruction->payload.local_alloc.type;
+            bc_emit_mem(emitter, fn, instruction->tag == StackAlloc_TAG ? instruction->payload.stack_alloc.mem : instruction->payload.local_alloc.mem);
+            TypeMemLayout layout = shd_get_mem_layout(emitter->arena, t);
+            BcRegs result = bc_new_registers(emitter, fn, 1);
+            BC_EMIT(g, BC_WORD(BcAlloca, 0), result.regs[0], (uint32_t) layout.size_in_bytes, (uint32_t) layout.alignment_in_bytes);
+            return result;
+        }
+        case Instruction_Load_TAG: {
+            Load payload = instruction->payload.load;
+            bc_emit_mem(emitter, fn, payload.mem);
+            uint32_t ptr = bc_emit_value(emitter, fn, payload.ptr).regs[0];
+            BcRegs result = bc_new_registers(emitter, fn, bc_leaves_count(instruction->type));
+            if (result.count == 0)
+                return result;
+            LARRAY(BcLeaf, leaves, result.count);
+            bc_get_leaves(emitter, instruction->type, 0, leaves);
+            for (size_t i = 0; i < result.count; i++) {
+                BcOp op = leaves[i].type->tag == Bool_TAG ? BcLoadBool : BcLoad;
+                BC_EMIT(g, BC_WORD(op, bc_scalar_size(emitter, leaves[i].type)), result.regs[i], ptr, (uint32_t) leaves[i].offset);
+            }
+            return result;
+        }
+        case Instruction_Store_TAG: {
+            Store payload = instruction->payload.store;
+            bc_emit_mem(emitter, fn, payload.mem);
+            uint32_t ptr = bc_emit_value(emitter, fn, payload.ptr).regs[0];
+            BcRegs value = bc_emit_value(emitter, fn, payload.value);
+            if (value.count == 0)
+                return (BcRegs) { 0 };
+            LARRAY(BcLeaf, leaves, value.count);
+            bc_get_leaves(emitter, shd_get_unqualified_type(payload.value->type), 0, leaves);
+            for (size_t i = 0; i < value.count; i++)
+                BC_EMIT(g, BC_WORD(BcStore, bc_scalar_size(emitter, leaves[i].type)), ptr, (uint32_t) leaves[i].offset, value.regs[i]);
+            return (BcRegs) { 0 };
+        }
+        case Instruction_PtrCompositeElement_TAG: {
+            PtrCompositeElement payload = instruction->payload.ptr_composite_element;
+            BcRegs ptr = bc_emit_value(emitter, fn, payload.ptr);
+            const Type* pointee = bc_strip_type(get_pointee_type(payload.ptr));
+            if (pointee->tag == RecordType_TAG) {
+                size_t index = shd_get_int_literal_value(*shd_resolve_to_int_literal(payload.index), false);
+                return emit_ptr_add(emitter, fn, g, ptr, (int64_t) shd_get_record_field_offset_in_bytes(emitter->arena, pointee, index));
+            }
+            size_t stride = shd_get_mem_layout(emitter->arena, bc_element_type(pointee)).size_in_bytes;
+            return emit_ptr_index(emitter, fn, g, ptr, payload.index, stride);
+        }
+        case Instruction_PtrArrayElementOffset_TAG: {
+            PtrArrayElementOffset payload = instruction->payload.ptr_array_element_offset;
+            BcRegs ptr = bc_emit_value(emitter, fn, payload.ptr);
+            const IntLiteral* static_offset = shd_resolve_to_int_literal(payload.offset);
+            // checked first, unsized pointees have no stride to speak of
+            if (static_offset && shd_get_int_literal_value(*static_offset, false) == 0)
+                return ptr;
+            size_t stride = shd_get_mem_layout(emitter->arena, get_pointee_type(payload.ptr)).size_in_bytes;
+            return emit_ptr_index(emitter, fn, g, ptr, payload.offset, stride);
+        }
+        case Instruction_CopyBytes_TAG: {
+            CopyBytes payload = instruction->payload.copy_bytes;
+            bc_emit_mem(emitter, fn, payload.mem);
+            uint32_t dst = bc_emit_value(emitter, fn, payload.dst).regs[0];
+            uint32_t src = bc_emit_value(emitter, fn, payload.src).regs[0];
+            uint32_t count = bc_emit_value(emitter, fn, payload.count).regs[0];
+            BC_EMIT(g, BC_WORD(BcMemCpy, 0), dst, src, count);
+            return (BcRegs) { 0 };
+        }
+        case Instruction_FillBytes_TAG: {
+            FillBytes payload = instruction->payload.fill_bytes;
+            bc_emit_mem(emitter, fn, payload.mem);
+            uint32_t dst = bc_emit_value(emitter, fn, payload.dst).regs[0];
+            uint32_t byte = bc_emit_value(emitter, fn, payload.src).regs[0];
+            uint32_t count = bc_emit_value(emitter, fn, payload.count).regs[0];
+            BC_EMIT(g, BC_WORD(BcMemSet, 0), dst, byte, count);
+            return (BcRegs) { 0 };
+        }
+    }
+    SHADY_UNREACHABLE;
+}
+
+static BcRegs emit_value_(BcEmitter* emitter, BcFnEmitter* fn, Growy* g, const Node* node) {
+    if (is_instruction(node))
+        return emit_instruction(emitter, fn, g, node);
+
+    switch (is_value(node)) {
+        case NotAValue: shd_error("");
+        case Param_TAG: shd_error("tried to emit a param: all params should be emitted by their binding abstraction !");
+        case IntLiteral_TAG:
+        case FloatLiteral_TAG:
+        case True_TAG:
+        case False_TAG:
+        case Value_NullPtr_TAG: {
+            uint64_t value = 0;
+            switch (node->tag) {
+                case IntLiteral_TAG: value = bc_normalize(shd_get_int_literal_value(node->payload.int_literal, false), bc_scalar_width(node->type)); break;
+                case FloatLiteral_TAG: {
+                    if (node->payload.float_literal.width == FloatTy16)
+                        shd_error("The bytecode interpreter does not support half-precision floats");
+                    value = node->payload.float_literal.value;
+                    break;
+                }
+                case True_TAG: value = 1; break;
+                default: break;
+            }
+            BcRegs result = bc_new_registers(emitter, fn, 1);
+            bc_emit_const(g, result.regs[0], value);
+            return result;
+        }
+        case Value_StringLiteral_TAG: {
+            uint32_t index = bc_intern_string(emitter, node->payload.string_lit.string);
+            String string = shd_read_list(String, emitter->strings)[index];
+            BcRegs result = bc_new_registers(emitter, fn, 1);
+            bc_emit_const(g, result.regs[0], (uint64_t) (uintptr_t) string);
+            return result;
+        }
+        // registers are only read once they have been written, except for these, where any value will do
+        case Value_Undef_TAG: return bc_new_registers(emitter, fn, bc_leaves_count(node->payload.undef.type));
+        case Composite_TAG: {
+            Nodes contents = node->payload.composite.contents;
+            uint32_t* regs = alloc_regs(emitter, bc_leaves_count(node->type));
+            size_t count = 0;
+            for (size_t i = 0; i < contents.count; i++) {
+                BcRegs member = bc_emit_value(emitter, fn, contents.nodes[i]);
+                memcpy(regs + count, member.regs, sizeof(uint32_t) * member.count);
+                count += member.count;
+            }
+            return (BcRegs) { .count = count, .regs = regs };
+        }
+        case Value_Fill_TAG: {
+            const Type* t = node->payload.fill.type;
+            BcRegs value = bc_emit_value(emitter, fn, node->payload.fill.value);
+            size_t count = bc_elements_count(t);
+            uint32_t* regs = alloc_regs(emitter, count * value.count);
+            for (size_t i = 0; i < count; i++)
+                memcpy(regs + i * value.count, value.regs, sizeof(uint32_t) * value.count);
+            return (BcRegs) { .count = count * value.count, .regs = regs };
+        }
+        case RefDecl_TAG: {
+            const Node* decl = node->payload.ref_decl.decl;
+            switch (decl->tag) {
+                case GlobalVariable_TAG: {
+                    BcGlobal global = bc_emit_global(emitter, decl);
+                    BcRegs result = bc_new_registers(emitter, fn, 1);
+                    BC_EMIT(g, BC_WORD(BcGlobalAddr, global.storage), result.regs[0], global.offset);
+                    return result;
+                }
+                case Constant_TAG: return bc_emit_value(emitter, fn, decl->payload.constant.value);
+                default: shd_error("RefDecl must reference a constant or global");
+            }
+        }
+        // function pointers are indices into the function table
+        case FnAddr_TAG: {
+            BcRegs result = bc_new_registers(emitter, fn, 1);
+            bc_emit_const(g, result.regs[0], bc_function_index(emitter, node->payload.fn_addr.fn));
+            return result;
+        }
+        case Value_MemAndValue_TAG: {
+            bc_emit_mem(emitter, fn, node->payload.mem_and_value.mem);
+            return bc_emit_value(emitter, fn, node->payload.mem_and_value.value);
+        }
+        default: shd_error("Unhandled value for code generation: %s", shd_get_node_tag_string(node->tag));
+    }
+}
+
+BcRegs bc_emit_value(BcEmitter* emitter, BcFnEmitter* fn, const Node* node) {
+    BcRegs* existing = bc_search_emitted(fn, node);
+    if (existing)
+        return *existing;
+
+    // Unscheduled values go in the entry block of the current fn
+    CFNode* where = shd_schedule_instruction(fn->scheduler, node);
+    Growy* g = fn->blocks[where ? where->rpo_index : 0];
+    BcRegs emitted = emit_value_(emitter, fn, g, node);
+    bc_register_emitted(fn, node, emitted);
+    return emitted;
+}
+
+void bc_emit_mem(BcEmitter* emitter, BcFnEmitter* fn, const Node* mem) {
+    assert(is_mem(mem));
+    if (mem->tag == AbsMem_TAG)
+        return;
+    if (is_instruction(mem) || mem->tag == MemAndValue_TAG) {
+        bc_emit_value(emitter, fn, mem);
+        return;
+    }
+    shd_error("What sort of mem is this ?");
+}
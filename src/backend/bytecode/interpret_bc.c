@@ -0,0 +1,647 @@
+#include "bytecode.h"
+
+#include "log.h"
+#include "portability.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+#include <tgmath.h>
+
+/// Dispatch jumps straight from one handler to the next where the compiler knows about computed gotos, and goes through a switch otherwise
+#if defined(__GNUC__)
+#define BC_THREADED_DISPATCH
+#endif
+
+/// Past those, an invocation is assumed to be recursing endlessly
+#define BC_MAX_REGISTERS (1 << 24)
+#define BC_MAX_FRAMES (1 << 16)
+
+typedef uint64_t Reg;
+
+typedef struct {
+    const BcFunction* fn;
+    size_t regs_base;
+    /// where to resume: for the callers of the current function, the call they are in
+    const uint32_t* pc;
+    size_t stack_base;
+} Frame;
+
+typedef enum {
+    InvocationReady,
+    InvocationAtBarrier,
+    InvocationDone,
+    InvocationTrapped,
+} InvocationState;
+
+/// Invocations are coroutines: they run until they reach a barrier, and pick up from there once the others have reached it too
+typedef struct {
+    Reg* regs;
+    size_t regs_size;
+    Frame* frames;
+    size_t frames_count;
+    size_t frames_size;
+    char* storage;
+    /// for Alloca, only allocated when used
+    char* stack;
+    size_t stack_top;
+    InvocationState state;
+} Invocation;
+
+typedef struct {
+    const BytecodeProgram* program;
+    char* workgroup_storage;
+} Run;
+
+static inline uint64_t mask(uint64_t value, uint32_t width) {
+    return width >= 64 ? value : value & ((UINT64_C(1) << width) - 1);
+}
+
+static inline int64_t sext(uint64_t value, uint32_t width) {
+    if (width >= 64)
+        return (int64_t) value;
+    uint32_t shift = 64 - width;
+    return (int64_t) (value << shift) >> shift;
+}
+
+static inline float as_f32(Reg r) {
+    uint32_t bits = (uint32_t) r;
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+static inline Reg from_f32(float f) {
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+static inline double as_f64(Reg r) {
+    double d;
+    memcpy(&d, &r, sizeof(d));
+    return d;
+}
+
+static inline Reg from_f64(double d) {
+    Reg r;
+    memcpy(&r, &d, sizeof(r));
+    return r;
+}
+
+static inline void* as_ptr(Reg r) {
+    return (void*) (uintptr_t) r;
+}
+
+// memory is laid out for a little-endian host, like the C and LLVM backends assume too
+static inline uint64_t load_scalar(const char* at, size_t size) {
+    uint64_t value = 0;
+    memcpy(&value, at, size);
+    return value;
+}
+
+static inline void store_scalar(char* at, uint64_t value, size_t size) {
+    memcpy(at, &value, size);
+}
+
+// division by zero and overflow are undefined in the IR, here they are at least not fatal to the host
+static uint64_t signed_div(uint64_t a, uint64_t b, uint32_t width) {
+    int64_t x = sext(a, width), y = sext(b, width);
+    if (y == 0)
+        return 0;
+    if (y == -1)
+        return mask(0 - a, width);
+    return mask((uint64_t) (x / y), width);
+}
+
+static uint64_t signed_mod(uint64_t a, uint64_t b, uint32_t width) {
+    int64_t x = sext(a, width), y = sext(b, width);
+    if (y == 0 || y == -1)
+        return 0;
+    return mask((uint64_t) (x % y), width);
+}
+
+static void mul_extended(uint64_t a, uint64_t b, uint32_t width, bool is_signed, Reg* lo, Reg* hi) {
+    if (width < 64) {
+        uint64_t product = is_signed ? (uint64_t) (sext(a, width) * sext(b, width)) : a * b;
+        *lo = mask(product, width);
+        *hi = mask(is_signed ? (uint64_t) ((int64_t) product >> width) : product >> width, width);
+        return;
+    }
+    // schoolbook multiplication of the 32-bit halves
+    uint64_t a_lo = a & 0xFFFFFFFF, a_hi = a >> 32;
+    uint64_t b_lo = b & 0xFFFFFFFF, b_hi = b >> 32;
+    uint64_t ll = a_lo * b_lo, lh = a_lo * b_hi, hl = a_hi * b_lo, hh = a_hi * b_hi;
+    uint64_t middle = (ll >> 32) + (lh & 0xFFFFFFFF) + (hl & 0xFFFFFFFF);
+    uint64_t high = hh + (lh >> 32) + (hl >> 32) + (middle >> 32);
+    if (is_signed) {
+        if ((int64_t) a < 0)
+            high -= b;
+        if ((int64_t) b < 0)
+            high -= a;
+    }
+    *lo = (middle << 32) | (ll & 0xFFFFFFFF);
+    *hi = high;
+}
+
+// out of range conversions saturate, like they do on GPUs
+static int64_t to_signed(double d) {
+    if (isnan(d))
+        return 0;
+    if (d <= -9223372036854775808.0)
+        return INT64_MIN;
+    if (d >= 9223372036854775808.0)
+        return INT64_MAX;
+    return (int64_t) d;
+}
+
+static uint64_t to_unsigned(double d) {
+    if (!(d > 0))
+        return 0;
+    if (d >= 18446744073709551616.0)
+        return UINT64_MAX;
+    return (uint64_t) d;
+}
+
+static bool reserve(Invocation* invocation, size_t regs_needed, size_t frames_needed) {
+    if (regs_needed > BC_MAX_REGISTERS || frames_needed > BC_MAX_FRAMES)
+        return false;
+    if (regs_needed > invocation->regs_size) {
+        size_t size = regs_needed > invocation->regs_size * 2 ? regs_needed : invocation->regs_size * 2;
+        Reg* regs = realloc(invocation->regs, size * sizeof(Reg));
+        if (!regs)
+            return false;
+        invocation->regs = regs;
+        invocation->regs_size = size;
+    }
+    if (frames_needed > invocation->frames_size) {
+        size_t size = frames_needed > invocation->frames_size * 2 ? frames_needed : invocation->frames_size * 2;
+        Frame* frames = realloc(invocation->frames, size * sizeof(Frame));
+        if (!frames)
+            return false;
+        invocation->frames = frames;
+        invocation->frames_size = size;
+    }
+    return true;
+}
+
+/// Prints one conversion at a time, each with its argument converted to the C type the conversion expects
+static void interpret_printf(const BytecodeProgram* program, const uint32_t* pc, const Reg* regs) {
+    const char* at = program->strings[pc[1]];
+    uint32_t count = pc[2];
+    const uint32_t* args = pc + 3;
+    uint32_t next = 0;
+    while (*at) {
+        const char* percent = strchr(at, '%');
+        if (!percent) {
+            fputs(at, stdout);
+            break;
+        }
+        fwrite(at, 1, percent - at, stdout);
+        if (percent[1] == '%') {
+            putchar('%');
+            at = percent + 2;
+            continue;
+        }
+
+        // flags, width and precision are kept, length modifiers get replaced with ones that match the argument
+        const char* end = percent + 1;
+        while (*end && strchr("-+ #0123456789.", *end))
+            end++;
+        size_t kept = end - percent;
+        while (*end && strchr("hljztL", *end))
+            end++;
+        char conversion = *end;
+        if (!conversion || next == count || kept > 16) {
+            fputs(percent, stdout);
+            break;
+        }
+        at = end + 1;
+
+        uint32_t kind = args[2 * next] & 0xFF;
+        uint32_t width = args[2 * next] >> 8;
+        Reg value = regs[args[2 * next + 1]];
+        next++;
+        char spec[24];
+        memcpy(spec, percent, kept);
+        switch (conversion) {
+            case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': {
+                memcpy(spec + kept, "ll", 2);
+                spec[kept + 2] = conversion;
+                spec[kept + 3] = '\0';
+                long long integer = kind == BcPrintfSigned ? (long long) sext(value, width) : (long long) value;
+                printf(spec, integer);
+                break;
+            }
+            case 'c': printf("%c", (int) value); break;
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': {
+                spec[kept] = conversion;
+                spec[kept + 1] = '\0';
+                double real;
+                switch (kind) {
+                    case BcPrintfF32: real = as_f32(value); break;
+                    case BcPrintfF64: real = as_f64(value); break;
+                    case BcPrintfSigned: real = (double) sext(value, width); break;
+                    default: real = (double) value; break;
+                }
+                printf(spec, real);
+                break;
+            }
+            case 's': {
+                spec[kept] = 's';
+                spec[kept + 1] = '\0';
+                printf(spec, (const char*) as_ptr(value));
+                break;
+            }
+            case 'p': printf("%p", as_ptr(value)); break;
+            default: fwrite(percent, 1, at - percent, stdout); break;
+        }
+    }
+}
+
+static InvocationState run_invocation(Run* run, Invocation* invocation) {
+    const BytecodeProgram* program = run->program;
+    char* storage[BcStorageClassesCount] = { program->program_storage, run->workgroup_storage, invocation->storage };
+
+    Frame* frame = &invocation->frames[invocation->frames_count - 1];
+    const uint32_t* code = frame->fn->code;
+    const uint32_t* pc = frame->pc;
+    Reg* regs = invocation->regs + frame->regs_base;
+    uint64_t callee_index;
+
+#define R(i) regs[pc[i]]
+#define AUX BC_AUX(pc[0])
+
+#ifdef BC_THREADED_DISPATCH
+    static const void* const handlers[] = {
+#define O(name, operands) &&handle_##name,
+BC_OPS(O)
+#undef O
+    };
+#define HANDLE(name) handle_##name:
+#define NEXT() goto *handlers[BC_OPCODE(*pc)]
+    NEXT();
+#else
+#define HANDLE(name) case Bc##name:
+#define NEXT() goto dispatch
+dispatch:
+    switch ((BcOp) BC_OPCODE(*pc)) {
+#endif
+
+HANDLE(Unreachable) {
+    shd_error_print("Reached unreachable code in %s\n", frame->fn->name);
+    goto trap;
+}
+HANDLE(Const) { R(1) = (Reg) pc[2] | (Reg) pc[3] << 32; pc += 4; NEXT(); }
+HANDLE(Mov) { R(1) = R(2); pc += 3; NEXT(); }
+HANDLE(Select) { R(1) = R(2) ? R(3) : R(4); pc += 5; NEXT(); }
+HANDLE(Pick) {
+    Reg index = R(2);
+    uint32_t count = pc[3];
+    R(1) = index < count ? regs[pc[4 + index]] : 0;
+    pc += 4 + count;
+    NEXT();
+}
+HANDLE(GlobalAddr) { R(1) = (Reg) (uintptr_t) (storage[AUX] + pc[2]); pc += 3; NEXT(); }
+
+#define INT_BINOP(name, expr) HANDLE(name) { uint32_t w = AUX; uint64_t a = R(2), b = R(3); (void) w; (void) b; R(1) = mask(expr, w); pc += 4; NEXT(); }
+#define INT_UNOP(name, expr) HANDLE(name) { uint32_t w = AUX; uint64_t a = R(2); (void) w; R(1) = mask(expr, w); pc += 3; NEXT(); }
+INT_BINOP(Add, a + b)
+INT_BINOP(Sub, a - b)
+INT_BINOP(Mul, a * b)
+INT_BINOP(UDiv, b ? a / b : 0)
+INT_BINOP(SDiv, signed_div(a, b, w))
+INT_BINOP(UMod, b ? a % b : 0)
+INT_BINOP(SMod, signed_mod(a, b, w))
+INT_BINOP(And, a & b)
+INT_BINOP(Or, a | b)
+INT_BINOP(Xor, a ^ b)
+INT_UNOP(Not, ~a)
+INT_UNOP(Neg, 0 - a)
+INT_BINOP(Shl, b >= w ? 0 : a << b)
+INT_BINOP(LShr, b >= w ? 0 : a >> b)
+INT_BINOP(AShr, (uint64_t) (sext(a, w) >> (b >= w ? w - 1 : b)))
+INT_BINOP(Eq, a == b)
+INT_BINOP(Ne, a != b)
+INT_BINOP(ULt, a < b)
+INT_BINOP(ULe, a <= b)
+INT_BINOP(SLt, sext(a, w) < sext(b, w))
+INT_BINOP(SLe, sext(a, w) <= sext(b, w))
+INT_BINOP(UMin, a < b ? a : b)
+INT_BINOP(UMax, a > b ? a : b)
+INT_BINOP(SMin, sext(a, w) < sext(b, w) ? a : b)
+INT_BINOP(SMax, sext(a, w) > sext(b, w) ? a : b)
+INT_UNOP(SAbs, sext(a, w) < 0 ? 0 - a : a)
+INT_UNOP(SSign, sext(a, w) > 0 ? 1 : sext(a, w) < 0 ? UINT64_MAX : 0)
+INT_UNOP(Trunc, a)
+#undef INT_BINOP
+#undef INT_UNOP
+
+HANDLE(SExt) { R(1) = mask((uint64_t) sext(R(2), AUX & 0xFF), AUX >> 8); pc += 3; NEXT(); }
+HANDLE(AddCarry) {
+    uint64_t a = R(3), sum = mask(a + R(4), AUX);
+    R(1) = sum;
+    R(2) = sum < a;
+    pc += 5;
+    NEXT();
+}
+HANDLE(SubBorrow) {
+    uint64_t a = R(3), b = R(4);
+    R(1) = mask(a - b, AUX);
+    R(2) = a < b;
+    pc += 5;
+    NEXT();
+}
+HANDLE(UMulExtended) { mul_extended(R(3), R(4), AUX, false, &R(1), &R(2)); pc += 5; NEXT(); }
+HANDLE(SMulExtended) { mul_extended(R(3), R(4), AUX, true, &R(1), &R(2)); pc += 5; NEXT(); }
+
+// tgmath picks the float or double variant of the math functions
+#define FLOAT_BINOP(name, expr) \
+HANDLE(name##32) { float a = as_f32(R(2)), b = as_f32(R(3)); R(1) = from_f32(expr); pc += 4; NEXT(); } \
+HANDLE(name##64) { double a = as_f64(R(2)), b = as_f64(R(3)); R(1) = from_f64(expr); pc += 4; NEXT(); }
+#define FLOAT_UNOP(name, expr) \
+HANDLE(name##32) { float a = as_f32(R(2)); R(1) = from_f32(expr); pc += 3; NEXT(); } \
+HANDLE(name##64) { double a = as_f64(R(2)); R(1) = from_f64(expr); pc += 3; NEXT(); }
+#define FLOAT_CMP(name, expr) \
+HANDLE(name##32) { float a = as_f32(R(2)), b = as_f32(R(3)); R(1) = expr; pc += 4; NEXT(); } \
+HANDLE(name##64) { double a = as_f64(R(2)), b = as_f64(R(3)); R(1) = expr; pc += 4; NEXT(); }
+FLOAT_BINOP(FAdd, a + b)
+FLOAT_BINOP(FSub, a - b)
+FLOAT_BINOP(FMul, a * b)
+FLOAT_BINOP(FDiv, a / b)
+FLOAT_BINOP(FMod, fmod(a, b))
+FLOAT_BINOP(FPow, pow(a, b))
+FLOAT_BINOP(FMin, fmin(a, b))
+FLOAT_BINOP(FMax, fmax(a, b))
+FLOAT_UNOP(FNeg, -a)
+FLOAT_UNOP(FAbs, fabs(a))
+FLOAT_UNOP(FSign, a > 0 ? 1 : a < 0 ? -1 : 0)
+FLOAT_UNOP(FSqrt, sqrt(a))
+FLOAT_UNOP(FInvSqrt, 1 / sqrt(a))
+FLOAT_UNOP(FExp, exp(a))
+FLOAT_UNOP(FFloor, floor(a))
+FLOAT_UNOP(FCeil, ceil(a))
+FLOAT_UNOP(FRound, round(a))
+FLOAT_UNOP(FFract, a - floor(a))
+FLOAT_UNOP(FSin, sin(a))
+FLOAT_UNOP(FCos, cos(a))
+HANDLE(FFma32) { R(1) = from_f32(fma(as_f32(R(2)), as_f32(R(3)), as_f32(R(4)))); pc += 5; NEXT(); }
+HANDLE(FFma64) { R(1) = from_f64(fma(as_f64(R(2)), as_f64(R(3)), as_f64(R(4)))); pc += 5; NEXT(); }
+FLOAT_CMP(FEq, a == b)
+FLOAT_CMP(FNe, a < b || a > b)
+FLOAT_CMP(FLt, a < b)
+FLOAT_CMP(FLe, a <= b)
+#undef FLOAT_BINOP
+#undef FLOAT_UNOP
+#undef FLOAT_CMP
+
+HANDLE(SToF32) { R(1) = from_f32((float) sext(R(2), AUX)); pc += 3; NEXT(); }
+HANDLE(SToF64) { R(1) = from_f64((double) sext(R(2), AUX)); pc += 3; NEXT(); }
+HANDLE(UToF32) { R(1) = from_f32((float) R(2)); pc += 3; NEXT(); }
+HANDLE(UToF64) { R(1) = from_f64((double) R(2)); pc += 3; NEXT(); }
+HANDLE(FToS32) { R(1) = mask((uint64_t) to_signed(as_f32(R(2))), AUX); pc += 3; NEXT(); }
+HANDLE(FToS64) { R(1) = mask((uint64_t) to_signed(as_f64(R(2))), AUX); pc += 3; NEXT(); }
+HANDLE(FToU32) { R(1) = mask(to_unsigned(as_f32(R(2))), AUX); pc += 3; NEXT(); }
+HANDLE(FToU64) { R(1) = mask(to_unsigned(as_f64(R(2))), AUX); pc += 3; NEXT(); }
+HANDLE(F32ToF64) { R(1) = from_f64((double) as_f32(R(2))); pc += 3; NEXT(); }
+HANDLE(F64ToF32) { R(1) = from_f32((float) as_f64(R(2))); pc += 3; NEXT(); }
+
+HANDLE(Load) { R(1) = load_scalar((const char*) as_ptr(R(2)) + pc[3], AUX); pc += 4; NEXT(); }
+HANDLE(LoadBool) { R(1) = load_scalar((const char*) as_ptr(R(2)) + pc[3], AUX) != 0; pc += 4; NEXT(); }
+HANDLE(Store) { store_scalar((char*) as_ptr(R(1)) + pc[2], R(3), AUX); pc += 4; NEXT(); }
+HANDLE(PtrAdd) { R(1) = R(2) + (uint64_t) (int64_t) (int32_t) pc[3]; pc += 4; NEXT(); }
+HANDLE(PtrIndex) { R(1) = R(2) + (uint64_t) sext(R(3), AUX) * pc[4]; pc += 5; NEXT(); }
+HANDLE(MemCpy) { memmove(as_ptr(R(1)), as_ptr(R(2)), R(3)); pc += 4; NEXT(); }
+HANDLE(MemSet) { memset(as_ptr(R(1)), (int) R(2), R(3)); pc += 4; NEXT(); }
+HANDLE(Alloca) {
+    size_t align = pc[3] ? pc[3] : 1;
+    size_t at = (invocation->stack_top + align - 1) / align * align;
+    if (!invocation->stack)
+        invocation->stack = malloc(program->stack_size);
+    if (!invocation->stack || at + pc[2] > program->stack_size) {
+        shd_error_print("Stack overflow in %s\n", frame->fn->name);
+        goto trap;
+    }
+    invocation->stack_top = at + pc[2];
+    R(1) = (Reg) (uintptr_t) (invocation->stack + at);
+    pc += 4;
+    NEXT();
+}
+
+HANDLE(Jump) { pc = code + pc[1]; NEXT(); }
+HANDLE(Branch) { pc = code + (R(1) ? pc[2] : pc[3]); NEXT(); }
+HANDLE(Switch) {
+    Reg value = R(1);
+    uint32_t count = pc[2];
+    uint32_t target = pc[3];
+    const uint32_t* cases = pc + 4;
+    for (uint32_t i = 0; i < count; i++, cases += 3) {
+        if (((Reg) cases[0] | (Reg) cases[1] << 32) == value) {
+            target = cases[2];
+            break;
+        }
+    }
+    pc = code + target;
+    NEXT();
+}
+HANDLE(Call) { callee_index = pc[1]; goto call; }
+HANDLE(CallIndirect) {
+    callee_index = R(1);
+    if (callee_index >= program->functions_count) {
+        shd_error_print("Called an invalid function pointer in %s\n", frame->fn->name);
+        goto trap;
+    }
+    goto call;
+}
+HANDLE(Ret) {
+    uint32_t count = pc[1];
+    const uint32_t* values = pc + 2;
+    invocation->stack_top = frame->stack_base;
+    // entry points don't return anything
+    if (invocation->frames_count == 1) {
+        invocation->frames_count = 0;
+        return InvocationDone;
+    }
+    Frame* caller = &invocation->frames[invocation->frames_count - 2];
+    Reg* caller_regs = invocation->regs + caller->regs_base;
+    // the call the caller stopped at says where the results go
+    const uint32_t* results = caller->pc + 3 + caller->pc[2];
+    assert(results[0] == count);
+    for (uint32_t i = 0; i < count; i++)
+        caller_regs[results[1 + i]] = regs[values[i]];
+    invocation->frames_count--;
+    frame = caller;
+    code = frame->fn->code;
+    regs = caller_regs;
+    pc = results + 1 + count;
+    NEXT();
+}
+HANDLE(Barrier) {
+    frame->pc = pc + 1;
+    return InvocationAtBarrier;
+}
+HANDLE(Printf) {
+    interpret_printf(program, pc, regs);
+    pc += 3 + 2 * pc[2];
+    NEXT();
+}
+
+#ifndef BC_THREADED_DISPATCH
+        case BcOpsCount: break;
+    }
+    SHADY_UNREACHABLE;
+#endif
+
+call: {
+    const BcFunction* callee = &program->functions[callee_index];
+    uint32_t args_count = pc[2];
+    const uint32_t* args = pc + 3;
+    frame->pc = pc;
+    size_t base = frame->regs_base + frame->fn->registers_count;
+    if (!reserve(invocation, base + callee->registers_count, invocation->frames_count + 1)) {
+        shd_error_print("Call stack overflow in %s\n", frame->fn->name);
+        goto trap;
+    }
+    // the registers and frames might have moved
+    regs = invocation->regs + invocation->frames[invocation->frames_count - 1].regs_base;
+    Reg* callee_regs = invocation->regs + base;
+    for (uint32_t i = 0; i < args_count; i++)
+        callee_regs[i] = regs[args[i]];
+    frame = &invocation->frames[invocation->frames_count++];
+    *frame = (Frame) { .fn = callee, .regs_base = base, .pc = callee->code, .stack_base = invocation->stack_top };
+    code = callee->code;
+    pc = code;
+    regs = callee_regs;
+    NEXT();
+}
+
+trap:
+    return InvocationTrapped;
+
+#undef R
+#undef AUX
+#undef HANDLE
+#undef NEXT
+}
+
+static void write_builtin(const BytecodeProgram* program, char* storage[], Builtin builtin, const uint32_t values[3]) {
+    const BcBuiltinSlot* slot = &program->builtins[builtin];
+    if (!slot->present)
+        return;
+    char* at = storage[slot->storage] + slot->offset;
+    for (size_t i = 0; i < slot->components_count && i < 3; i++)
+        store_scalar(at + i * slot->component_size, values[i], slot->component_size);
+}
+
+static bool start_invocation(Run* run, Invocation* invocation, const BcEntryPoint* entry_point, const Reg* params, uint32_t index, const uint32_t workgroup_id[3], const uint32_t num_workgroups[3]) {
+    const BytecodeProgram* program = run->program;
+    size_t storage_size = program->storage_size[BcStorageInvocation];
+    if (!invocation->storage)
+        invocation->storage = malloc(storage_size ? storage_size : 1);
+    memcpy(invocation->storage, program->storage_init[BcStorageInvocation], storage_size);
+
+    const uint32_t* size = entry_point->workgroup_size;
+    uint32_t local_id[3] = { index % size[0], index / size[0] % size[1], index / (size[0] * size[1]) };
+    uint32_t global_id[3];
+    for (size_t i = 0; i < 3; i++)
+        global_id[i] = workgroup_id[i] * size[i] + local_id[i];
+    uint32_t invocations_count = size[0] * size[1] * size[2];
+
+    // subgroups have a single invocation, like on the CPU backends
+    char* storage[BcStorageClassesCount] = { program->program_storage, run->workgroup_storage, invocation->storage };
+    write_builtin(program, storage, BuiltinLocalInvocationId, local_id);
+    write_builtin(program, storage, BuiltinLocalInvocationIndex, (uint32_t[]) { index });
+    write_builtin(program, storage, BuiltinGlobalInvocationId, global_id);
+    write_builtin(program, storage, BuiltinWorkgroupId, workgroup_id);
+    write_builtin(program, storage, BuiltinWorkgroupSize, size);
+    write_builtin(program, storage, BuiltinNumWorkgroups, num_workgroups);
+    write_builtin(program, storage, BuiltinNumSubgroups, (uint32_t[]) { invocations_count });
+    write_builtin(program, storage, BuiltinSubgroupId, (uint32_t[]) { index });
+    write_builtin(program, storage, BuiltinSubgroupSize, (uint32_t[]) { 1 });
+    write_builtin(program, storage, BuiltinSubgroupLocalInvocationId, (uint32_t[]) { 0 });
+
+    const BcFunction* fn = &program->functions[entry_point->function];
+    invocation->frames_count = 0;
+    invocation->stack_top = 0;
+    if (!reserve(invocation, fn->registers_count, 1))
+        return false;
+    memcpy(invocation->regs, params, sizeof(Reg) * fn->params_count);
+    invocation->frames[invocation->frames_count++] = (Frame) { .fn = fn, .regs_base = 0, .pc = fn->code, .stack_base = 0 };
+    invocation->state = InvocationReady;
+    return true;
+}
+
+/// Invocations take turns until they are all done, each running until it finishes or reaches a barrier
+static bool run_workgroup(Run* run, Invocation* invocations, size_t count) {
+    while (true) {
+        bool waiting = false;
+        for (size_t i = 0; i < count; i++) {
+            Invocation* invocation = &invocations[i];
+            if (invocation->state == InvocationDone)
+                continue;
+            invocation->state = run_invocation(run, invocation);
+            if (invocation->state == InvocationTrapped)
+                return false;
+            waiting |= invocation->state == InvocationAtBarrier;
+        }
+        if (!waiting)
+            return true;
+    }
+}
+
+bool shd_interpret_bytecode(const BytecodeProgram* program, String entry_point_name, void** args, const uint32_t num_workgroups[3]) {
+    const BcEntryPoint* entry_point = NULL;
+    for (size_t i = 0; i < program->entry_points_count; i++)
+        if (strcmp(program->entry_points[i].name, entry_point_name) == 0)
+            entry_point = &program->entry_points[i];
+    if (!entry_point) {
+        shd_error_print("No compute entry point named %s\n", entry_point_name);
+        return false;
+    }
+
+    // every invocation starts from the same parameter registers
+    const BcFunction* fn = &program->functions[entry_point->function];
+    Reg* params = calloc(fn->params_count ? fn->params_count : 1, sizeof(Reg));
+    for (size_t i = 0; i < fn->params_count; i++) {
+        BcMemScalar param = entry_point->params[i];
+        Reg value = load_scalar((const char*) args[entry_point->arg_of_param[i]] + param.offset, param.size);
+        params[i] = param.is_bool ? value != 0 : value;
+    }
+
+    const uint32_t* size = entry_point->workgroup_size;
+    size_t invocations_count = (size_t) size[0] * size[1] * size[2];
+    Invocation* invocations = calloc(invocations_count, sizeof(Invocation));
+    size_t workgroup_storage_size = program->storage_size[BcStorageWorkgroup];
+    Run run = {
+        .program = program,
+        .workgroup_storage = malloc(workgroup_storage_size ? workgroup_storage_size : 1),
+    };
+
+    // workgroups run one after the other
+    bool ok = true;
+    uint64_t workgroups_count = (uint64_t) num_workgroups[0] * num_workgroups[1] * num_workgroups[2];
+    for (uint64_t w = 0; w < workgroups_count && ok; w++) {
+        uint32_t workgroup_id[3] = {
+            (uint32_t) (w % num_workgroups[0]),
+            (uint32_t) (w / num_workgroups[0] % num_workgroups[1]),
+            (uint32_t) (w / num_workgroups[0] / num_workgroups[1]),
+        };
+        memcpy(run.workgroup_storage, program->storage_init[BcStorageWorkgroup], workgroup_storage_size);
+        for (size_t i = 0; i < invocations_count && ok; i++)
+            ok = start_invocation(&run, &invocations[i], entry_point, params, (uint32_t) i, workgroup_id, num_workgroups);
+        if (ok)
+            ok = run_workgroup(&run, invocations, invocations_count);
+    }
+
+    for (size_t i = 0; i < invocations_count; i++) {
+        free(invocations[i].regs);
+        free(invocations[i].frames);
+        free(invocations[i].storage);
+        free(invocations[i].stack);
+    }
+    free(invocations);
+    free(run.workgroup_storage);
+    free(params);
+    return ok;
+}
@@ -0,0 +1,61 @@
+#include "bytecode.h"
+
+#include "growy.h"
+
+#include <assert.h>
+
+const char* bc_op_names[] = {
+#define O(name, operands) #name,
+BC_OPS(O)
+#undef O
+};
+
+const int bc_op_operands[] = {
+#define O(name, operands) operands,
+BC_OPS(O)
+#undef O
+};
+
+/// Words taken by a variable-length instruction, opcode included
+static size_t get_variable_length(const uint32_t* pc) {
+    switch (BC_OPCODE(*pc)) {
+        case BcPick: return 4 + pc[3];
+        case BcSwitch: return 4 + 3 * pc[2];
+        case BcCall:
+        case BcCallIndirect: return 3 + pc[2] + 1 + pc[3 + pc[2]];
+        case BcRet: return 2 + pc[1];
+        case BcPrintf: return 3 + 2 * pc[2];
+        default: assert(false); return 1;
+    }
+}
+
+void shd_print_bytecode(const BytecodeProgram* program, size_t* output_size, char** output) {
+    Growy* g = shd_new_growy();
+    for (size_t i = 0; i < program->functions_count; i++) {
+        const BcFunction* fn = &program->functions[i];
+        shd_growy_append_formatted(g, "fn %zu %s (%u params, %u registers)\n", i, fn->name, fn->params_count, fn->registers_count);
+        for (size_t at = 0; at < fn->code_size;) {
+            const uint32_t* pc = fn->code + at;
+            uint32_t op = BC_OPCODE(*pc);
+            assert(op < BcOpsCount);
+            size_t length = bc_op_operands[op] < 0 ? get_variable_length(pc) : 1 + (size_t) bc_op_operands[op];
+            shd_growy_append_formatted(g, "%6zu  %s", at, bc_op_names[op]);
+            if (BC_AUX(*pc))
+                shd_growy_append_formatted(g, ".%u", BC_AUX(*pc));
+            for (size_t j = 1; j < length; j++)
+                shd_growy_append_formatted(g, " %u", pc[j]);
+            shd_growy_append_formatted(g, "\n");
+            at += length;
+        }
+    }
+    for (size_t i = 0; i < program->entry_points_count; i++) {
+        const BcEntryPoint* entry_point = &program->entry_points[i];
+        shd_growy_append_formatted(g, "entry point %s = fn %u, workgroup size %u %u %u\n", entry_point->name, entry_point->function, entry_point->workgroup_size[0], entry_point->workgroup_size[1], entry_point->workgroup_size[2]);
+    }
+    for (size_t i = 0; i < BcStorageClassesCount; i++)
+        shd_growy_append_formatted(g, "storage %zu: %zu bytes\n", i, program->storage_size[i]);
+
+    *output_size = shd_growy_size(g);
+    shd_growy_append_bytes(g, 1, "\0");
+    *output = shd_growy_deconstruct(g);
+}
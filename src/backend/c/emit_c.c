@@ -9,6 +9,7 @@
 #include "shady_cuda_runtime_src.h"
 #include "shady_glsl_runtime_120_src.h"
 #include "shady_ispc_runtime_src.h"
+#include "shady_c11_runtime_src.h"
 
 #include "portability.h"
 #include "dict.h"
@@ -162,8 +163,14 @@ void shd_c_emit_global_variable_definition(Emitter* emitter, AddressSpace as, St
     // GLSL wants 'const' to go on the left to start the declaration, but in C const should go on the right (east const convention)
     switch (emitter->config.dialect) {
         case CDialect_C11: {
-            if (as != AsGeneric) shd_warn_print_once(c11_non_generic_as, "warning: standard C does not have address spaces\n");
             prefix = "";
+            // invocations and workgroups never span host threads, so thread-locals give them storage of their own
+            if (as == AsPrivate || as == AsShared) {
+                prefix = "_Thread_local ";
+                emitter->lanes_share_globals = true;
+            }
+            else if (as != AsGeneric)
+                shd_warn_print_once(c11_non_generic_as, "warning: standard C does not have address spaces\n");
             if (constant)
                 name = shd_format_string_arena(emitter->arena->arena, "const %s", name);
             break;
@@ -268,6 +275,11 @@ void shd_c_emit_decl(Emitter* emitter, const Node* decl) {
                 Builtin b = shd_get_decl_builtin(decl);
                 CTerm t = shd_c_emit_builtin(emitter, b);
                 shd_c_register_emitted(emitter, NULL, decl, t);
+                if (emitter->config.dialect == CDialect_C11 && !emitter->host_builtins[b]) {
+                    // each host thread runs one invocation at a time, see emit_c11_host_entry_point
+                    emitter->host_builtins[b] = decl->payload.global_variable.type;
+                    shd_print(emitter->fn_decls, "\nstatic _Thread_local %s;", shd_c_emit_type(emitter, decl->payload.global_variable.type, t.var));
+                }
                 return;
             }
 
@@ -307,6 +319,7 @@ void shd_c_emit_decl(Emitter* emitter, const Node* decl) {
                 FnEmitter fn = {
                     .cfg = build_fn_cfg(decl),
                     .emitted_terms = shd_new_dict(Node*, CTerm, (HashFn) shd_hash_node, (CmpFn) shd_compare_node),
+                    .has_lane_builtins = shd_c_has_lane_builtins(emitter, decl),
                 };
                 fn.scheduler = shd_new_scheduler(fn.cfg);
                 fn.instruction_printers = calloc(sizeof(Printer*), fn.cfg->size);
@@ -381,8 +394,12 @@ static Module* run_backend_specific_passes(const CompilerConfig* config, CEmitte
     if (econfig->dialect == CDialect_ISPC) {
         RUN_PASS(shd_pass_lower_workgroups)
         RUN_PASS(shd_pass_lower_inclusive_scan)
+        // ISPC makes values uniform or varying from their types, it pays to have as many of them uniform as possible
+        RUN_PASS(shd_pass_infer_uniformity)
     }
-    if (econfig->dialect != CDialect_GLSL) {
+    if (econfig->dialect == CDialect_C11 && econfig->native_vectors) {
+        RUN_PASS(shd_pass_lower_vec_arr_partial)
+    } else if (econfig->dialect != CDialect_GLSL) {
         RUN_PASS(shd_pass_lower_vec_arr)
     }
     return *pmod;
@@ -415,6 +432,141 @@ static String collect_private_globals_in_struct(Emitter* emitter, Module* m) {
     return shd_printer_growy_unwrap(p);
 }
 
+static void emit_host_builtin_value(Emitter* emitter, Printer* p, Builtin b, String dst, String values[3]) {
+    const Type* t = emitter->host_builtins[b];
+    if (!t)
+        return;
+    if (t->tag == ArrType_TAG) {
+        for (size_t i = 0; i < 3; i++)
+            shd_print(p, "\n%s.arr[%zu] = %s;", dst, i, values[i]);
+    } else
+        shd_print(p, "\n%s = %s;", dst, values[0]);
+}
+
+static void emit_host_builtin(Emitter* emitter, Printer* p, Builtin b, String values[3]) {
+    emit_host_builtin_value(emitter, p, b, shd_get_builtin_name(b), values);
+}
+
+/// Expects the local invocation id in x, y and z, and its index in `index`
+static void get_lane_builtin_values(Emitter* emitter, Builtin b, const uint32_t size[3], String index, String values[3]) {
+    switch (b) {
+        case BuiltinLocalInvocationId: values[0] = "x"; values[1] = "y"; values[2] = "z"; break;
+        case BuiltinLocalInvocationIndex:
+        case BuiltinSubgroupId: values[0] = index; break;
+        case BuiltinGlobalInvocationId:
+            values[0] = shd_fmt_string_irarena(emitter->arena, "wid[0] * %uu + x", size[0]);
+            values[1] = shd_fmt_string_irarena(emitter->arena, "wid[1] * %uu + y", size[1]);
+            values[2] = shd_fmt_string_irarena(emitter->arena, "wid[2] * %uu + z", size[2]);
+            break;
+        default: assert(false);
+    }
+}
+
+/// Private and shared globals are thread-locals that outlive an invocation or a workgroup, so the runner puts their initial value
+/// back before each invocation, respectively each workgroup. Those without an initialiser start from zeroes, as they did the first time.
+static void emit_c11_reset_globals(Emitter* emitter, Printer* p, Nodes decls, AddressSpace as) {
+    for (size_t i = 0; i < decls.count; i++) {
+        const Node* decl = decls.nodes[i];
+        if (decl->tag != GlobalVariable_TAG || decl->payload.global_variable.address_space != as || shd_is_decl_builtin(decl))
+            continue;
+        CTerm* var = shd_c_lookup_existing_term(emitter, NULL, decl);
+        assert(var && var->var);
+        const Node* init = decl->payload.global_variable.init;
+        String initial = shd_c_emit_type(emitter, decl->payload.global_variable.type, "const __shady_initial_value");
+        if (init)
+            shd_print(p, "\n{ static %s = %s; %s = __shady_initial_value; }", initial, shd_c_to_ssa(emitter, shd_c_emit_value(emitter, NULL, init)), var->var);
+        else
+            shd_print(p, "\n{ static %s; %s = __shady_initial_value; }", initial, var->var);
+    }
+}
+
+/// C has no notion of a dispatch: for each compute entry point, we emit a function that runs a range of workgroups,
+/// one invocation after the other, filling in the builtins and resetting the private and shared globals as it goes. Arguments are passed by address, like to shd_rt_launch_kernel,
+/// and their sizes are exported so that they can be copied ahead of time. Subgroups are made of a single invocation.
+/// In simd_workgroups mode the entry point takes the per-invocation builtins as parameters instead, leaving the invocations of a
+/// workgroup independent from one another, so that the C compiler can vectorise the loop over x like ISPC would run a gang.
+/// With dispatch_harness, a `__shady_dispatch_` function also runs all the workgroups of a dispatch over a pool of pthreads.
+static void emit_c11_host_entry_point(Emitter* emitter, Nodes decls, const Node* fn) {
+    Printer* p = emitter->fn_defs;
+    String name = shd_c_legalize_identifier(emitter, get_declaration_name(fn));
+    Nodes params = fn->payload.fun.params;
+    bool simd = shd_c_has_lane_builtins(emitter, fn);
+
+    uint32_t size[3];
+    for (size_t i = 0; i < 3; i++)
+        size[i] = emitter->arena->config.specializations.workgroup_size[i] ? emitter->arena->config.specializations.workgroup_size[i] : 1;
+
+    shd_print(p, "\n\nconst size_t __shady_args_count_%s = %zu;", name, params.count);
+    shd_print(p, "\nconst size_t __shady_arg_sizes_%s[] = { ", name);
+    for (size_t i = 0; i < params.count; i++)
+        shd_print(p, "sizeof(%s), ", shd_c_emit_type(emitter, params.nodes[i]->type, NULL));
+    shd_print(p, "0 };");
+
+    shd_print(p, "\nvoid __shady_run_%s(void** args, const uint32_t num_workgroups[3], uint64_t first_workgroup, uint64_t workgroups_count) {", name);
+    shd_printer_indent(p);
+    // the arguments are the same for all invocations, no need to fetch them again for each one
+    for (size_t i = 0; i < params.count; i++)
+        shd_print(p, "\n%s = *(%s) args[%zu];", shd_c_emit_type(emitter, params.nodes[i]->type, shd_fmt_string_irarena(emitter->arena, "__shady_arg_%zu", i)), shd_c_emit_type(emitter, params.nodes[i]->type, "*"), i);
+    emit_host_builtin(emitter, p, BuiltinNumWorkgroups, (String[]) { "num_workgroups[0]", "num_workgroups[1]", "num_workgroups[2]" });
+    emit_host_builtin(emitter, p, BuiltinWorkgroupSize, (String[]) {
+        shd_fmt_string_irarena(emitter->arena, "%uu", size[0]),
+        shd_fmt_string_irarena(emitter->arena, "%uu", size[1]),
+        shd_fmt_string_irarena(emitter->arena, "%uu", size[2]),
+    });
+    emit_host_builtin(emitter, p, BuiltinNumSubgroups, (String[]) { shd_fmt_string_irarena(emitter->arena, "%uu", size[0] * size[1] * size[2]) });
+    emit_host_builtin(emitter, p, BuiltinSubgroupSize, (String[]) { "1u" });
+    emit_host_builtin(emitter, p, BuiltinSubgroupLocalInvocationId, (String[]) { "0u" });
+    shd_print(p, "\nfor (uint64_t w = first_workgroup; w < first_workgroup + workgroups_count; w++) {");
+    shd_printer_indent(p);
+    shd_print(p, "\nconst uint32_t wid[3] = { (uint32_t) (w %% num_workgroups[0]), (uint32_t) (w / num_workgroups[0] %% num_workgroups[1]), (uint32_t) (w / num_workgroups[0] / num_workgroups[1]) };");
+    emit_host_builtin(emitter, p, BuiltinWorkgroupId, (String[]) { "wid[0]", "wid[1]", "wid[2]" });
+    emit_c11_reset_globals(emitter, p, decls, AsShared);
+    shd_print(p, "\nfor (uint32_t z = 0; z < %uu; z++) for (uint32_t y = 0; y < %uu; y++) {", size[2], size[1]);
+    shd_printer_indent(p);
+    // lanes may only run in lockstep if nothing they write is shared
+    if (simd && !emitter->lanes_share_globals && !emitter->lane_builtins_in_globals)
+        shd_print(p, "\n#pragma omp simd");
+    shd_print(p, "\nfor (uint32_t x = 0; x < %uu; x++) {", size[0]);
+    shd_printer_indent(p);
+    String index = shd_fmt_string_irarena(emitter->arena, "((z * %uu + y) * %uu + x)", size[1], size[0]);
+    emit_c11_reset_globals(emitter, p, decls, AsPrivate);
+    for (Builtin b = 0; b < BuiltinsCount; b++) {
+        if (!shd_c_is_lane_builtin(b) || !emitter->host_builtins[b])
+            continue;
+        String values[3];
+        get_lane_builtin_values(emitter, b, size, index, values);
+        // functions other than the entry point still read the globals
+        if (!simd || emitter->lane_builtins_in_globals)
+            emit_host_builtin(emitter, p, b, values);
+        if (simd) {
+            String lane = shd_fmt_string_irarena(emitter->arena, "__shady_lane_%s", shd_get_builtin_name(b));
+            shd_print(p, "\n%s;", shd_c_emit_type(emitter, emitter->host_builtins[b], lane));
+            emit_host_builtin_value(emitter, p, b, lane, values);
+        }
+    }
+    shd_print(p, "\n%s(", name);
+    for (size_t i = 0; i < params.count; i++)
+        shd_print(p, "%s__shady_arg_%zu", i > 0 ? ", " : "", i);
+    size_t printed = params.count;
+    for (Builtin b = 0; simd && b < BuiltinsCount; b++) {
+        if (shd_c_is_lane_builtin(b) && emitter->host_builtins[b])
+            shd_print(p, "%s__shady_lane_%s", printed++ > 0 ? ", " : "", shd_get_builtin_name(b));
+    }
+    shd_print(p, ");");
+    shd_printer_deindent(p);
+    shd_print(p, "\n}");
+    shd_printer_deindent(p);
+    shd_print(p, "\n}");
+    shd_printer_deindent(p);
+    shd_print(p, "\n}");
+    shd_printer_deindent(p);
+    shd_print(p, "\n}");
+
+    // see runtime.c
+    if (emitter->config.dispatch_harness)
+        shd_print(p, "\nvoid __shady_dispatch_%s(uint32_t x, uint32_t y, uint32_t z, void** args) { __shady_dispatch(__shady_run_%s, x, y, z, args); }", name, name);
+}
+
 CEmitterConfig shd_default_c_emitter_config(void) {
     return (CEmitterConfig) {
         .glsl_version = 420,
@@ -457,6 +609,8 @@ void shd_emit_c(const CompilerConfig* compiler_config, CEmitterConfig config, Mo
             shd_print(finalp, "\n#include <stddef.h>");
             shd_print(finalp, "\n#include <stdio.h>");
             shd_print(finalp, "\n#include <math.h>");
+            if (emitter.config.dispatch_harness)
+                shd_print(finalp, "\n%s", shady_c11_runtime_src);
             break;
         case CDialect_GLSL:
             shd_print(finalp, "#version %d\n", emitter.config.glsl_version);
@@ -498,9 +652,22 @@ void shd_emit_c(const CompilerConfig* compiler_config, CEmitterConfig config, Mo
     }
 
     Nodes decls = shd_module_get_declarations(mod);
+    // the heads of the entry points need to know all the builtins in simd_workgroups mode
+    for (size_t i = 0; i < decls.count; i++)
+        if (decls.nodes[i]->tag == GlobalVariable_TAG && shd_is_decl_builtin(decls.nodes[i]))
+            shd_c_emit_decl(&emitter, decls.nodes[i]);
     for (size_t i = 0; i < decls.count; i++)
         shd_c_emit_decl(&emitter, decls.nodes[i]);
 
+    if (emitter.config.dialect == CDialect_C11) {
+        for (size_t i = 0; i < decls.count; i++) {
+            const Node* decl = decls.nodes[i];
+            const Node* ep = decl->tag == Function_TAG ? shd_lookup_annotation(decl, "EntryPoint") : NULL;
+            if (ep && decl->payload.fun.body && strcmp(shd_get_annotation_string_payload(ep), "Compute") == 0)
+                emit_c11_host_entry_point(&emitter, decls, decl);
+        }
+    }
+
     shd_print(finalp, "\n/* types: */\n");
     shd_growy_append_bytes(final, shd_growy_size(type_decls_g), shd_growy_data(type_decls_g));
 
@@ -49,6 +49,13 @@ typedef struct {
     Printer* entrypoint_prelude;
 
     bool need_64b_ext;
+
+    /// C11 only: the builtins used by the module, with the type they were declared with, for the host entry points to fill in
+    const Type* host_builtins[BuiltinsCount];
+    /// C11 simd_workgroups only: lanes cannot run in lockstep if they share private or shared globals,
+    /// or if functions other than the entry points read the per-invocation builtins
+    bool lanes_share_globals;
+    bool lane_builtins_in_globals;
 } Emitter;
 
 typedef struct {
@@ -56,6 +63,8 @@ typedef struct {
     Printer** instruction_printers;
     CFG* cfg;
     Scheduler* scheduler;
+    /// C11 simd_workgroups only: the per-invocation builtins are parameters of this function, shadowing their globals
+    bool has_lane_builtins;
 } FnEmitter;
 
 void shd_c_register_emitted(Emitter* emitter, FnEmitter* fn, const Node* node, CTerm as);
@@ -76,6 +85,8 @@ CTerm shd_ispc_varying_ptr_helper(Emitter* emitter, Printer* block_printer, cons
 void shd_c_emit_decl(Emitter* emitter, const Node* decl);
 void shd_c_emit_global_variable_definition(Emitter* emitter, AddressSpace as, String name, const Type* type, bool constant, String init);
 CTerm shd_c_emit_builtin(Emitter* emitter, Builtin b);
+bool shd_c_is_lane_builtin(Builtin b);
+bool shd_c_has_lane_builtins(Emitter* emitter, const Node* fn);
 
 CType shd_c_emit_type(Emitter* emitter, const Type* type, const char* center);
 String shd_c_get_record_field_name(const Type* t, size_t i);
@@ -2,6 +2,8 @@
 
 #include "log.h"
 
+#include <string.h>
+
 #pragma GCC diagnostic error "-Wswitch"
 
 static String ispc_builtins[BuiltinsCount] = {
@@ -29,3 +31,21 @@ CTerm shd_c_emit_builtin(Emitter* emitter, Builtin b) {
         return term_from_cvar(name);
     return term_from_cvar(shd_get_builtin_name(b));
 }
+
+/// The builtins that differ between the invocations of a workgroup
+bool shd_c_is_lane_builtin(Builtin b) {
+    switch (b) {
+        case BuiltinLocalInvocationId:
+        case BuiltinLocalInvocationIndex:
+        case BuiltinGlobalInvocationId:
+        case BuiltinSubgroupId: return true;
+        default: return false;
+    }
+}
+
+bool shd_c_has_lane_builtins(Emitter* emitter, const Node* fn) {
+    if (emitter->config.dialect != CDialect_C11 || !emitter->config.simd_workgroups)
+        return false;
+    const Node* ep = shd_lookup_annotation(fn, "EntryPoint");
+    return ep && fn->payload.fun.body && strcmp(shd_get_annotation_string_payload(ep), "Compute") == 0;
+}
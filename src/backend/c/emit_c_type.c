@@ -42,6 +42,18 @@ void shd_c_emit_nominal_type_body(Emitter* emitter, String name, const Type* typ
     shd_destroy_printer(p);
 }
 
+/// Only the pointers into buffers, see CEmitterConfig.restrict_kernel_args
+static String get_restrict_qualifier(Emitter* emitter, const Type* param_type) {
+    const Type* t = shd_get_unqualified_type(param_type);
+    if (!emitter->config.restrict_kernel_args || t->tag != PtrType_TAG || t->payload.ptr_type.address_space != AsGlobal)
+        return NULL;
+    switch (emitter->config.dialect) {
+        case CDialect_C11: return "restrict";
+        case CDialect_CUDA: return "__restrict__";
+        default: return NULL;
+    }
+}
+
 String shd_c_emit_fn_head(Emitter* emitter, const Node* fn_type, String center, const Node* fn) {
     assert(fn_type->tag == FnType_TAG);
     assert(!fn || fn->type == fn_type);
@@ -52,7 +64,11 @@ String shd_c_emit_fn_head(Emitter* emitter, const Node* fn_type, String center,
     Growy* paramg = shd_new_growy();
     Printer* paramp = shd_new_printer_from_growy(paramg);
     Nodes dom = fn_type->payload.fn_type.param_types;
-    if (dom.count == 0 && emitter->config.dialect == CDialect_C11)
+    bool lane_builtins = fn && shd_c_has_lane_builtins(emitter, fn);
+    size_t lane_params = 0;
+    for (Builtin b = 0; lane_builtins && b < BuiltinsCount; b++)
+        lane_params += shd_c_is_lane_builtin(b) && emitter->host_builtins[b];
+    if (dom.count + lane_params == 0 && emitter->config.dialect == CDialect_C11)
         shd_print(paramp, "void");
     else if (fn) {
         Nodes params = fn->payload.fun.params;
@@ -66,11 +82,21 @@ String shd_c_emit_fn_head(Emitter* emitter, const Node* fn_type, String center,
             String param_name;
             String variable_name = shd_get_value_name_unsafe(fn->payload.fun.params.nodes[i]);
             param_name = shd_fmt_string_irarena(emitter->arena, "%s_%d", shd_c_legalize_identifier(emitter, variable_name), fn->payload.fun.params.nodes[i]->id);
+            String restrict_qualifier = entry_point ? get_restrict_qualifier(emitter, params.nodes[i]->type) : NULL;
+            if (restrict_qualifier)
+                param_name = shd_format_string_arena(emitter->arena->arena, "%s %s", restrict_qualifier, param_name);
             shd_print(paramp, shd_c_emit_type(emitter, params.nodes[i]->type, param_name));
             if (i + 1 < dom.count) {
                 shd_print(paramp, ", ");
             }
         }
+        // named like the globals they shadow, see emit_c11_host_entry_point
+        size_t printed = dom.count;
+        for (Builtin b = 0; lane_params > 0 && b < BuiltinsCount; b++) {
+            if (!shd_c_is_lane_builtin(b) || !emitter->host_builtins[b])
+                continue;
+            shd_print(paramp, "%s%s", printed++ > 0 ? ", " : "", shd_c_emit_type(emitter, emitter->host_builtins[b], shd_get_builtin_name(b)));
+        }
     } else {
         if (emitter->use_private_globals) {
             shd_print(paramp, "__shady_PrivateGlobals*");
@@ -102,6 +128,9 @@ String shd_c_emit_fn_head(Emitter* emitter, const Node* fn_type, String center,
     if (entry_point) {
         switch (emitter->config.dialect) {
             case CDialect_C11:
+                // only the runner calls it, and it ought to be inlined into the lane loop there
+                if (lane_builtins)
+                    c_decl = shd_format_string_arena(emitter->arena->arena, "static inline %s", c_decl);
                 break;
             case CDialect_GLSL:
                 break;
@@ -302,8 +331,10 @@ String shd_c_emit_type(Emitter* emitter, const Type* type, const char* center) {
                 }
                 case CDialect_ISPC: shd_error("Please lower to something else")
                 case CDialect_C11: {
-                    emitted = shd_c_emit_type(emitter, element_type, NULL);
-                    emitted = shd_format_string_arena(emitter->arena->arena, "__attribute__ ((vector_size (%d * sizeof(%s) ))) %s", width, emitted, emitted);
+                    // vectors are only as aligned as their elements in memory, see shd_get_mem_layout
+                    String element = shd_c_emit_type(emitter, element_type, NULL);
+                    emitted = shd_make_unique_name(emitter->arena, "Vector");
+                    shd_print(emitter->type_decls, "\ntypedef %s __attribute__ ((vector_size (%d * sizeof(%s)), aligned (_Alignof(%s)))) %s;\n", element, width, element, element, emitted);
                     break;
                 }
             }
@@ -1,5 +1,7 @@
 #include "emit_c.h"
 
+#include "shady/ir/memory_layout.h"
+
 #include "portability.h"
 #include "log.h"
 #include "dict.h"
@@ -215,6 +217,11 @@ static CTerm c_emit_value_(Emitter* emitter, FnEmitter* fn, Printer* p, const No
             const Node* decl = value->payload.ref_decl.decl;
             shd_c_emit_decl(emitter, decl);
 
+            if (emitter->config.dialect == CDialect_C11 && emitter->config.simd_workgroups && shd_is_decl_builtin(decl)) {
+                if (shd_c_is_lane_builtin(shd_get_decl_builtin(decl)) && !(fn && fn->has_lane_builtins))
+                    emitter->lane_builtins_in_globals = true;
+            }
+
             if (emitter->config.dialect == CDialect_ISPC && decl->tag == GlobalVariable_TAG) {
                 if (!shd_is_addr_space_uniform(emitter->arena, decl->payload.global_variable.address_space) && !shd_is_decl_builtin(
                         decl)) {
@@ -429,14 +436,22 @@ static String index_into_array(Emitter* emitter, const Type* arr_type, CTerm exp
         return shd_format_string_arena(arena->arena, "(%s.arr[%s])", shd_c_deref(emitter, expr), index2);
 }
 
+/// ISPC only: reads a varying value in the program instance `lane`, which has to be uniform
+static CTerm extract_lane(Emitter* emitter, CValue value, const Type* value_type, CValue lane) {
+    // nothing to pick between
+    if (shd_is_qualified_type_uniform(value_type))
+        return term_from_cvalue(value);
+    const Type* t = shd_get_unqualified_type(value_type);
+    if (t->tag == PtrType_TAG)
+        return term_from_cvalue(shd_format_string_arena(emitter->arena->arena, "extract_ptr(%s, %s)", value, lane));
+    return term_from_cvalue(shd_format_string_arena(emitter->arena->arena, "extract(%s, %s)", value, lane));
+}
+
 static CTerm broadcast_first(Emitter* emitter, CValue value, const Type* value_type) {
     switch (emitter->config.dialect) {
-        case CDialect_ISPC: {
-            const Type* t = shd_get_unqualified_type(value_type);
-            if (t->tag == PtrType_TAG)
-                return term_from_cvalue(shd_format_string_arena(emitter->arena->arena, "extract_ptr(%s, count_trailing_zeros(lanemask()))", value));
-            return term_from_cvalue(shd_format_string_arena(emitter->arena->arena, "extract(%s, count_trailing_zeros(lanemask()))", value));
-        }
+        case CDialect_ISPC: return extract_lane(emitter, value, value_type, "count_trailing_zeros(lanemask())");
+        // invocations are alone in their subgroup
+        case CDialect_C11: return term_from_cvalue(value);
         default: shd_error("TODO");
     }
 }
@@ -545,6 +560,10 @@ static CTerm emit_primop(Emitter* emitter, FnEmitter* fn, Printer* p, const Node
                     term = term_from_cvalue(shd_format_string_arena(emitter->arena->arena, "%s(%s)", t, shd_c_to_ssa(emitter, src)));
                 } else
                     assert(false);
+            } else if (emitter->config.dialect == CDialect_C11 && src_type->tag == PackType_TAG) {
+                // casting vector extension types reinterprets their bits instead
+                CType t = shd_c_emit_type(emitter, dst_type, NULL);
+                term = term_from_cvalue(shd_format_string_arena(emitter->arena->arena, "__builtin_convertvector(%s, %s)", shd_c_to_ssa(emitter, src), t));
             } else {
                 CType t = shd_c_emit_type(emitter, dst_type, NULL);
                 term = term_from_cvalue(shd_format_string_arena(emitter->arena->arena, "((%s) %s)", t, shd_c_to_ssa(emitter, src)));
@@ -658,6 +677,11 @@ static CTerm emit_primop(Emitter* emitter, FnEmitter* fn, Printer* p, const Node
                     }
                     case Type_PackType_TAG: {
                         assert(static_index);
+                        // vector extensions are subscripted like arrays
+                        if (emitter->config.dialect == CDialect_C11) {
+                            acc = shd_format_string_arena(emitter->arena->arena, "(%s[%d])", acc, static_index->value);
+                            break;
+                        }
                         assert(static_index->value < 4 && static_index->value < t->payload.pack_type.width);
                         String suffixes = "xyzw";
                         acc = shd_format_string_arena(emitter->arena->arena, "(%s.%c)", acc, suffixes[static_index->value]);
@@ -691,6 +715,15 @@ static CTerm emit_primop(Emitter* emitter, FnEmitter* fn, Printer* p, const Node
             bool lhs_u = shd_deconstruct_qualified_type(&lhs_t);
             bool rhs_u = shd_deconstruct_qualified_type(&rhs_t);
             size_t left_size = lhs_t->payload.pack_type.width;
+            if (emitter->config.dialect == CDialect_C11) {
+                // both sides have the same type once lowered, shorter results are lowered to composites beforehand
+                shd_print(p, "\n%s = __builtin_shufflevector(%s, %s", shd_c_emit_type(emitter, node->type, dst), lhs_e, rhs_e);
+                for (size_t i = 2; i < prim_op->operands.count; i++)
+                    shd_print(p, ", %d", (int) shd_resolve_to_int_literal(prim_op->operands.nodes[i])->value);
+                shd_print(p, ");");
+                term = term_from_cvalue(dst);
+                break;
+            }
             // size_t total_size = lhs_t->payload.pack_type.width + rhs_t->payload.pack_type.width;
             String suffixes = "xyzw";
             shd_print(p, "\n%s = vec%d(", shd_c_emit_type(emitter, node->type, dst), prim_op->operands.count - 2);
@@ -735,6 +768,7 @@ typedef struct {
 
 #define mk_prefix(...) .prefix_len = sizeof((uint32_t[]) {__VA_ARGS__}) / sizeof(uint32_t), .prefix = (uint32_t[]) {__VA_ARGS__}
 #define subgroup_reduction mk_prefix(SpvScopeSubgroup, SpvGroupOperationReduce)
+#define subgroup_exclusive_scan mk_prefix(SpvScopeSubgroup, SpvGroupOperationExclusiveScan)
 
 typedef struct {
     ExtISelPattern match;
@@ -761,6 +795,16 @@ ExtISelEntry ext_isel_ispc_entries[] = {
     {{ "spirv.core", SpvOpGroupNonUniformSMax, subgroup_reduction }, { IsMono, OsCall, .op = "reduce_max" }},
     {{ "spirv.core", SpvOpGroupNonUniformUMax, subgroup_reduction }, { IsMono, OsCall, .op = "reduce_max" }},
     {{ "spirv.core", SpvOpGroupNonUniformFMax, subgroup_reduction }, { IsMono, OsCall, .op = "reduce_max" }},
+    // scans, inclusive ones are lowered into these
+    {{ "spirv.core", SpvOpGroupIAdd, subgroup_exclusive_scan }, { IsMono, OsCall, .op = "exclusive_scan_add" }},
+    {{ "spirv.core", SpvOpGroupFAdd, subgroup_exclusive_scan }, { IsMono, OsCall, .op = "exclusive_scan_add" }},
+    {{ "spirv.core", SpvOpGroupNonUniformIAdd, subgroup_exclusive_scan }, { IsMono, OsCall, .op = "exclusive_scan_add" }},
+    {{ "spirv.core", SpvOpGroupNonUniformFAdd, subgroup_exclusive_scan }, { IsMono, OsCall, .op = "exclusive_scan_add" }},
+    {{ "spirv.core", SpvOpGroupNonUniformBitwiseAnd, subgroup_exclusive_scan }, { IsMono, OsCall, .op = "exclusive_scan_and" }},
+    {{ "spirv.core", SpvOpGroupNonUniformBitwiseOr, subgroup_exclusive_scan }, { IsMono, OsCall, .op = "exclusive_scan_or" }},
+    // votes
+    {{ "spirv.core", SpvOpGroupNonUniformAll, mk_prefix(SpvScopeSubgroup) }, { IsMono, OsCall, .op = "all" }},
+    {{ "spirv.core", SpvOpGroupNonUniformAny, mk_prefix(SpvScopeSubgroup) }, { IsMono, OsCall, .op = "any" }},
     // rest
     {{ "spirv.core", SpvOpGroupNonUniformAllEqual, mk_prefix(SpvScopeSubgroup) }, { IsMono, OsCall, .op = "reduce_equal" }},
     {{ "spirv.core", SpvOpGroupNonUniformBallot, mk_prefix(SpvScopeSubgroup) }, { IsMono, OsCall, .op = "packmask" }},
@@ -805,21 +849,154 @@ static const ExtISelEntry* find_ext_entry(Emitter* e, ExtInstr instr) {
     return NULL;
 }
 
+/// What an exclusive scan leaves the first invocation with, which in a subgroup of one is the only one there is
+static String scan_identity(Emitter* emitter, SpvOp opcode, const Type* t) {
+    switch (opcode) {
+        case SpvOpGroupNonUniformIMul: case SpvOpGroupNonUniformFMul: return "1";
+        case SpvOpGroupNonUniformBitwiseAnd:
+        case SpvOpGroupUMin: case SpvOpGroupNonUniformUMin: return "~0";
+        case SpvOpGroupNonUniformLogicalAnd: return "true";
+        case SpvOpGroupSMin: case SpvOpGroupNonUniformSMin: return shd_format_string_arena(emitter->arena->arena, "INT%zu_MAX", shd_get_type_bitwidth(t));
+        case SpvOpGroupSMax: case SpvOpGroupNonUniformSMax: return shd_format_string_arena(emitter->arena->arena, "INT%zu_MIN", shd_get_type_bitwidth(t));
+        case SpvOpGroupFMin: case SpvOpGroupNonUniformFMin: return "INFINITY";
+        case SpvOpGroupFMax: case SpvOpGroupNonUniformFMax: return "-INFINITY";
+        default: return "0";
+    }
+}
+
+/// Casts a scalar C expression to t, repeating it in every lane if t is a vector
+static CTerm splat_scalar(Emitter* emitter, const Type* t, String scalar) {
+    if (t->tag != PackType_TAG)
+        return term_from_cvalue(shd_format_string_arena(emitter->arena->arena, "((%s) %s)", shd_c_emit_type(emitter, t, NULL), scalar));
+    Growy* g = shd_new_growy();
+    for (size_t i = 0; i < t->payload.pack_type.width; i++)
+        shd_growy_append_formatted(g, i > 0 ? ", %s" : "%s", scalar);
+    shd_growy_append_bytes(g, 1, "\0");
+    String emitted = shd_format_string_arena(emitter->arena->arena, "((%s) { %s })", shd_c_emit_type(emitter, t, NULL), shd_growy_data(g));
+    shd_destroy_growy(g);
+    return term_from_cvalue(emitted);
+}
+
+/// C11 only: invocations are alone in their subgroup, so the subgroup operations have nothing to exchange and fold away.
+/// Returns an empty term for the ones that are not subgroup operations, or that work over a wider scope than the subgroup.
+static CTerm emit_single_lane_subgroup_op(Emitter* emitter, FnEmitter* fn, ExtInstr instr) {
+    Nodes operands = instr.operands;
+    if (operands.count == 0)
+        return empty_term();
+    const IntLiteral* scope = shd_resolve_to_int_literal(shd_first(operands));
+    if (!scope || (scope->value != SpvScopeSubgroup && scope->value != SpvScopeInvocation))
+        return empty_term();
+    switch (instr.opcode) {
+        case SpvOpGroupNonUniformElect:
+        case SpvOpGroupNonUniformAllEqual: return term_from_cvalue("true");
+        case SpvOpGroupNonUniformAll:
+        case SpvOpGroupNonUniformAny:
+        case SpvOpGroupNonUniformBroadcast:
+        case SpvOpGroupNonUniformShuffle:
+        case SpvOpGroupNonUniformShuffleXor:
+        case SpvOpGroupNonUniformShuffleUp:
+        case SpvOpGroupNonUniformShuffleDown: return shd_c_emit_value(emitter, fn, operands.nodes[1]);
+        case SpvOpGroupNonUniformBallot: {
+            const Type* t = shd_get_unqualified_type(instr.result_t);
+            CValue predicate = shd_c_to_ssa(emitter, shd_c_emit_value(emitter, fn, operands.nodes[1]));
+            if (t->tag != PackType_TAG)
+                return term_from_cvalue(shd_format_string_arena(emitter->arena->arena, "((%s) %s)", shd_c_emit_type(emitter, t, NULL), predicate));
+            // the only lane is the lowest bit of the first word
+            Growy* g = shd_new_growy();
+            shd_growy_append_formatted(g, "(%s) %s", shd_c_emit_type(emitter, t->payload.pack_type.element_type, NULL), predicate);
+            for (size_t i = 1; i < t->payload.pack_type.width; i++)
+                shd_growy_append_formatted(g, ", 0");
+            shd_growy_append_bytes(g, 1, "\0");
+            String emitted = shd_format_string_arena(emitter->arena->arena, "((%s) { %s })", shd_c_emit_type(emitter, t, NULL), shd_growy_data(g));
+            shd_destroy_growy(g);
+            return term_from_cvalue(emitted);
+        }
+        case SpvOpGroupIAdd: case SpvOpGroupNonUniformIAdd:
+        case SpvOpGroupFAdd: case SpvOpGroupNonUniformFAdd:
+        case SpvOpGroupSMin: case SpvOpGroupNonUniformSMin:
+        case SpvOpGroupUMin: case SpvOpGroupNonUniformUMin:
+        case SpvOpGroupFMin: case SpvOpGroupNonUniformFMin:
+        case SpvOpGroupSMax: case SpvOpGroupNonUniformSMax:
+        case SpvOpGroupUMax: case SpvOpGroupNonUniformUMax:
+        case SpvOpGroupFMax: case SpvOpGroupNonUniformFMax:
+        case SpvOpGroupNonUniformIMul: case SpvOpGroupNonUniformFMul:
+        case SpvOpGroupNonUniformBitwiseAnd: case SpvOpGroupNonUniformBitwiseOr: case SpvOpGroupNonUniformBitwiseXor:
+        case SpvOpGroupNonUniformLogicalAnd: case SpvOpGroupNonUniformLogicalOr: case SpvOpGroupNonUniformLogicalXor: {
+            // clustered reductions also take the cluster size
+            assert(operands.count >= 3);
+            SpvGroupOperation group_op = (SpvGroupOperation) shd_get_int_literal_value(*shd_resolve_to_int_literal(operands.nodes[1]), false);
+            switch (group_op) {
+                case SpvGroupOperationReduce:
+                case SpvGroupOperationInclusiveScan:
+                case SpvGroupOperationClusteredReduce: return shd_c_emit_value(emitter, fn, operands.nodes[2]);
+                case SpvGroupOperationExclusiveScan: {
+                    const Type* t = shd_get_unqualified_type(instr.result_t);
+                    return splat_scalar(emitter, t, scan_identity(emitter, instr.opcode, t->tag == PackType_TAG ? t->payload.pack_type.element_type : t));
+                }
+                // partitioned operations are left to the generic path
+                default: return empty_term();
+            }
+        }
+        default: return empty_term();
+    }
+}
+
+/// ISPC only: subgroup shuffles map to the gang's own shuffle(), one vector permute in the common case.
+static CTerm emit_ispc_shuffle(Emitter* emitter, FnEmitter* fn, ExtInstr instr) {
+    assert(instr.operands.count == 3);
+    CValue value = shd_c_to_ssa(emitter, shd_c_emit_value(emitter, fn, instr.operands.nodes[1]));
+    CValue operand = shd_c_to_ssa(emitter, shd_c_emit_value(emitter, fn, instr.operands.nodes[2]));
+    String lane;
+    switch (instr.opcode) {
+        case SpvOpGroupNonUniformShuffle: lane = operand; break;
+        case SpvOpGroupNonUniformShuffleXor: lane = shd_format_string_arena(emitter->arena->arena, "programIndex ^ %s", operand); break;
+        case SpvOpGroupNonUniformShuffleUp: lane = shd_format_string_arena(emitter->arena->arena, "programIndex - %s", operand); break;
+        case SpvOpGroupNonUniformShuffleDown: lane = shd_format_string_arena(emitter->arena->arena, "programIndex + %s", operand); break;
+        default: assert(false);
+    }
+    // reading from outside the subgroup is undefined, wrapping around is as good a result as any
+    return term_from_cvalue(shd_format_string_arena(emitter->arena->arena, "shuffle(%s, (int) ((%s) & (programCount - 1)))", value, lane));
+}
+
 static CTerm emit_ext_instruction(Emitter* emitter, FnEmitter* fn, Printer* p, ExtInstr instr) {
     shd_c_emit_mem(emitter, fn, instr.mem);
     if (strcmp(instr.set, "spirv.core") == 0) {
+        if (emitter->config.dialect == CDialect_C11) {
+            CTerm folded = emit_single_lane_subgroup_op(emitter, fn, instr);
+            if (!is_term_empty(folded))
+                return folded;
+        }
         switch (instr.opcode) {
             case SpvOpGroupNonUniformBroadcastFirst: {
                 assert(instr.operands.count == 2);
                 CValue value = shd_c_to_ssa(emitter, shd_c_emit_value(emitter, fn, instr.operands.nodes[1]));
                 return broadcast_first(emitter, value, instr.operands.nodes[1]->type);
             }
+            case SpvOpGroupNonUniformBroadcast: {
+                assert(instr.operands.count == 3);
+                if (emitter->config.dialect != CDialect_ISPC)
+                    break;
+                CValue value = shd_c_to_ssa(emitter, shd_c_emit_value(emitter, fn, instr.operands.nodes[1]));
+                // the index is dynamically uniform, but ISPC only takes it if it is typed as such
+                CValue lane = shd_c_to_ssa(emitter, shd_c_emit_value(emitter, fn, instr.operands.nodes[2]));
+                lane = shd_c_to_ssa(emitter, broadcast_first(emitter, lane, instr.operands.nodes[2]->type));
+                return extract_lane(emitter, value, instr.operands.nodes[1]->type, lane);
+            }
+            case SpvOpGroupNonUniformShuffle:
+            case SpvOpGroupNonUniformShuffleXor:
+            case SpvOpGroupNonUniformShuffleUp:
+            case SpvOpGroupNonUniformShuffleDown: {
+                if (emitter->config.dialect == CDialect_ISPC)
+                    return emit_ispc_shuffle(emitter, fn, instr);
+                break;
+            }
             case SpvOpGroupNonUniformElect: {
                 assert(instr.operands.count == 1);
                 const IntLiteral* scope = shd_resolve_to_int_literal(shd_first(instr.operands));
                 assert(scope && scope->value == SpvScopeSubgroup);
                 switch (emitter->config.dialect) {
                     case CDialect_ISPC: return term_from_cvalue(shd_format_string_arena(emitter->arena->arena, "(programIndex == count_trailing_zeros(lanemask()))"));
+                    case CDialect_C11: return term_from_cvalue("true");
                     default: break;
                 }
                 break;
@@ -927,11 +1104,15 @@ static CTerm emit_ptr_composite_element(Emitter* emitter, FnEmitter* fn, Printer
         case Type_PackType_TAG: {
             size_t static_index = shd_get_int_literal_value(*shd_resolve_to_int_literal(selector), false);
             String suffixes = "xyzw";
-            acc = term_from_cvar(shd_format_string_arena(emitter->arena->arena, "(%s.%c)", shd_c_deref(emitter, acc), suffixes[static_index]));
             curr_ptr_type = ptr_type(arena, (PtrType) {
                     .pointed_type = pointee_type->payload.pack_type.element_type,
                     .address_space = curr_ptr_type->payload.ptr_type.address_space
             });
+            // the elements of vector extension types have no address of their own, so we go through a pointer to the first one
+            if (emitter->config.dialect == CDialect_C11)
+                acc = term_from_cvar(shd_format_string_arena(emitter->arena->arena, "(((%s) &%s)[%zu])", shd_c_emit_type(emitter, curr_ptr_type, NULL), shd_c_deref(emitter, acc), static_index));
+            else
+                acc = term_from_cvar(shd_format_string_arena(emitter->arena->arena, "(%s.%c)", shd_c_deref(emitter, acc), suffixes[static_index]));
             break;
         }
         default: shd_error("lea can't work on this");
@@ -0,0 +1,58 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef void (*__shady_RunFn)(void** args, const uint32_t num_workgroups[3], uint64_t first_workgroup, uint64_t workgroups_count);
+
+typedef struct {
+    __shady_RunFn run;
+    void** args;
+    uint32_t num_workgroups[3];
+    uint64_t workgroups_count;
+    uint64_t next_workgroup;
+} __shady_Dispatch;
+
+/// Takes workgroups one at a time until there are none left, so that threads getting the cheap ones end up running more of them
+static void* __shady_dispatch_worker(void* data) {
+    __shady_Dispatch* dispatch = (__shady_Dispatch*) data;
+    while (true) {
+        uint64_t w = __atomic_fetch_add(&dispatch->next_workgroup, 1, __ATOMIC_RELAXED);
+        if (w >= dispatch->workgroups_count)
+            return NULL;
+        dispatch->run(dispatch->args, dispatch->num_workgroups, w, 1);
+    }
+}
+
+/// One per core, unless SHADY_THREADS says otherwise
+static size_t __shady_get_threads_count(void) {
+    const char* env = getenv("SHADY_THREADS");
+    long count = env ? strtol(env, NULL, 10) : sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (size_t) count : 1;
+}
+
+/// Runs a whole dispatch with the help of the calling thread, and returns once all the workgroups are done.
+/// The builtins and the private and shared memory are thread-locals: the runner resets shared memory for each workgroup,
+/// and the builtins and private memory for each invocation.
+static void __shady_dispatch(__shady_RunFn run, uint32_t x, uint32_t y, uint32_t z, void** args) {
+    __shady_Dispatch dispatch = {
+        .run = run,
+        .args = args,
+        .num_workgroups = { x, y, z },
+        .workgroups_count = (uint64_t) x * y * z,
+    };
+    if (dispatch.workgroups_count == 0)
+        return;
+    size_t threads_count = __shady_get_threads_count();
+    if (threads_count > dispatch.workgroups_count)
+        threads_count = (size_t) dispatch.workgroups_count;
+
+    // if some threads can't be started, the others just take their share
+    pthread_t* threads = threads_count > 1 ? malloc(sizeof(pthread_t) * (threads_count - 1)) : NULL;
+    size_t started = 0;
+    while (threads && started + 1 < threads_count && pthread_create(&threads[started], NULL, __shady_dispatch_worker, &dispatch) == 0)
+        started++;
+    __shady_dispatch_worker(&dispatch);
+    for (size_t i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+}
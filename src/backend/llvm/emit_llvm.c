@@ -0,0 +1,382 @@
+#include "emit_llvm.h"
+
+#include "shady/pass.h"
+#include "shady/ir/annotation.h"
+
+#include "../shady/ir_private.h"
+#include "../shady/analysis/cfg.h"
+#include "../shady/analysis/scheduler.h"
+#include "../shady/passes/passes.h"
+
+#include "list.h"
+#include "dict.h"
+#include "log.h"
+#include "portability.h"
+
+#include "llvm-c/Target.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+KeyHash shd_hash_node(Node** pnode);
+bool shd_compare_node(Node** pa, Node** pb);
+
+#pragma GCC diagnostic error "-Wswitch"
+
+void llvm_register_emitted(Emitter* emitter, FnEmitter* fn, const Node* node, LLVMValueRef value) {
+    // constants are uniqued by LLVM and globals are named after their declaration already
+    if (value && is_value(node) && !LLVMIsAConstant(value) && LLVMGetTypeKind(LLVMTypeOf(value)) != LLVMVoidTypeKind) {
+        String name = shd_get_value_name_unsafe(node);
+        if (name)
+            LLVMSetValueName2(value, name, strlen(name));
+    }
+    struct Dict* map = fn ? fn->emitted : emitter->emitted_values;
+    shd_dict_insert_get_result(const Node*, LLVMValueRef, map, node, value);
+}
+
+LLVMValueRef* llvm_search_emitted(Emitter* emitter, FnEmitter* fn, const Node* node) {
+    LLVMValueRef* found = NULL;
+    if (fn)
+        found = shd_dict_find_value(const Node*, LLVMValueRef, fn->emitted, node);
+    if (!found)
+        found = shd_dict_find_value(const Node*, LLVMValueRef, emitter->emitted_values, node);
+    return found;
+}
+
+static void emit_basic_block(Emitter* emitter, FnEmitter* fn, const CFNode* cf_node) {
+    const Node* bb_node = cf_node->node;
+    assert(is_basic_block(bb_node) || cf_node == fn->cfg->entry);
+
+    LLVMBuilderRef b = llvm_new_builder_in_block(emitter, fn->blocks[cf_node->rpo_index]);
+    llvm_emit_terminator(emitter, fn, b, bb_node, get_abstraction_body(bb_node));
+    LLVMDisposeBuilder(b);
+
+    for (size_t i = 0; i < shd_list_count(cf_node->dominates); i++) {
+        CFNode* dominated = shd_read_list(CFNode*, cf_node->dominates)[i];
+        emit_basic_block(emitter, fn, dominated);
+    }
+}
+
+static void emit_function(Emitter* emitter, const Node* node, LLVMValueRef fn_value) {
+    assert(node->tag == Function_TAG);
+    FnEmitter fn = {
+        .fn = fn_value,
+        .emitted = shd_new_dict(Node*, LLVMValueRef, (HashFn) shd_hash_node, (CmpFn) shd_compare_node),
+    };
+
+    Nodes params = node->payload.fun.params;
+    for (size_t i = 0; i < params.count; i++)
+        llvm_register_emitted(emitter, &fn, params.nodes[i], LLVMGetParam(fn_value, i));
+
+    if (node->payload.fun.body) {
+        fn.cfg = build_fn_cfg(node);
+        fn.scheduler = shd_new_scheduler(fn.cfg);
+        fn.blocks = calloc(sizeof(LLVMBasicBlockRef), fn.cfg->size);
+
+        // create all the blocks upfront, with phis standing for their params, so that jumps can refer to them
+        LLVMBuilderRef b = LLVMCreateBuilderInContext(emitter->context);
+        for (size_t i = 0; i < fn.cfg->size; i++) {
+            const Node* bb = fn.cfg->rpo[i]->node;
+            String name = shd_get_abstraction_name_safe(bb);
+            fn.blocks[i] = LLVMAppendBasicBlockInContext(emitter->context, fn_value, i == 0 || !name ? "" : name);
+            if (i == 0)
+                continue;
+            LLVMPositionBuilderAtEnd(b, fn.blocks[i]);
+            Nodes bb_params = get_abstraction_params(bb);
+            for (size_t j = 0; j < bb_params.count; j++)
+                llvm_register_emitted(emitter, &fn, bb_params.nodes[j], LLVMBuildPhi(b, llvm_emit_type(emitter, bb_params.nodes[j]->type), ""));
+        }
+        LLVMDisposeBuilder(b);
+
+        emit_basic_block(emitter, &fn, fn.cfg->entry);
+
+        // blocks the dominator tree does not reach are never jumped to
+        for (size_t i = 0; i < fn.cfg->size; i++) {
+            if (LLVMGetBasicBlockTerminator(fn.blocks[i]))
+                continue;
+            LLVMBuilderRef ub = llvm_new_builder_in_block(emitter, fn.blocks[i]);
+            LLVMBuildUnreachable(ub);
+            LLVMDisposeBuilder(ub);
+        }
+
+        free(fn.blocks);
+        shd_destroy_scheduler(fn.scheduler);
+        shd_destroy_cfg(fn.cfg);
+    }
+
+    shd_destroy_dict(fn.emitted);
+}
+
+LLVMValueRef llvm_emit_decl(Emitter* emitter, const Node* decl) {
+    LLVMValueRef* existing = llvm_search_emitted(emitter, NULL, decl);
+    if (existing)
+        return *existing;
+
+    switch (is_declaration(decl)) {
+        case NotADeclaration: shd_error("");
+        case Declaration_GlobalVariable_TAG: {
+            const GlobalVariable* gvar = &decl->payload.global_variable;
+            LLVMTypeRef t = llvm_emit_type(emitter, gvar->type);
+            LLVMValueRef global = LLVMAddGlobalInAddressSpace(emitter->dst, t, gvar->name, llvm_emit_addr_space(emitter, gvar->address_space));
+            llvm_register_emitted(emitter, NULL, decl, global);
+            LLVMSetInitializer(global, gvar->init ? llvm_emit_value(emitter, NULL, gvar->init) : LLVMConstNull(t));
+            switch (gvar->address_space) {
+                // workgroups run on a single thread, invocations one after the other, like in the C11 backend
+                case AsPrivate:
+                case AsShared: LLVMSetThreadLocal(global, true); break;
+                default: break;
+            }
+            if (shd_is_decl_builtin(decl)) {
+                // filled in by the entry point runners
+                LLVMSetThreadLocal(global, true);
+                LLVMSetLinkage(global, LLVMInternalLinkage);
+                emitter->builtins[shd_get_decl_builtin(decl)] = global;
+            }
+            return global;
+        }
+        case Declaration_Function_TAG: {
+            LLVMValueRef fn = LLVMAddFunction(emitter->dst, decl->payload.fun.name, llvm_emit_type(emitter, decl->type));
+            llvm_register_emitted(emitter, NULL, decl, fn);
+            emit_function(emitter, decl, fn);
+            return fn;
+        }
+        case Declaration_Constant_TAG: {
+            // Like in the SPIR-V backend, constants are not emitted on their own: RefDecl emits the underlying value where it's used.
+            return NULL;
+        }
+        case Declaration_NominalType_TAG: {
+            // named structs are created when something refers to them
+            return NULL;
+        }
+    }
+    SHADY_UNREACHABLE;
+}
+
+static Module* run_backend_specific_passes(const CompilerConfig* config, Module* initial_mod) {
+    IrArena* initial_arena = initial_mod->arena;
+    Module** pmod = &initial_mod;
+
+    // array sizes need to be known when emitting types
+    RUN_PASS(shd_pass_eliminate_constants)
+    return *pmod;
+}
+
+/// Fills in a builtin that the module uses, @p values are one i32 per component
+static void store_host_builtin(Emitter* emitter, LLVMBuilderRef b, Builtin builtin, LLVMValueRef values[3]) {
+    LLVMValueRef global = emitter->builtins[builtin];
+    if (!global)
+        return;
+    LLVMTypeRef t = LLVMGlobalGetValueType(global);
+    LLVMValueRef value = LLVMGetUndef(t);
+    switch (LLVMGetTypeKind(t)) {
+        case LLVMVectorTypeKind: {
+            for (unsigned i = 0; i < LLVMGetVectorSize(t); i++) {
+                LLVMValueRef component = LLVMBuildIntCast2(b, values[i], LLVMGetElementType(t), false, "");
+                value = LLVMBuildInsertElement(b, value, component, LLVMConstInt(LLVMInt32TypeInContext(emitter->context), i, false), "");
+            }
+            break;
+        }
+        case LLVMArrayTypeKind: {
+            for (unsigned i = 0; i < LLVMGetArrayLength(t); i++)
+                value = LLVMBuildInsertValue(b, value, LLVMBuildIntCast2(b, values[i], LLVMGetElementType(t), false, ""), i, "");
+            break;
+        }
+        default: value = LLVMBuildIntCast2(b, values[0], t, false, ""); break;
+    }
+    LLVMBuildStore(b, value, global);
+}
+
+/// Invocations and workgroups run one after the other on the same thread, so their private and shared globals need to start over
+static void reset_host_globals(Emitter* emitter, LLVMBuilderRef b, AddressSpace as) {
+    Nodes decls = shd_module_get_declarations(emitter->module);
+    for (size_t i = 0; i < decls.count; i++) {
+        const Node* decl = decls.nodes[i];
+        if (decl->tag != GlobalVariable_TAG || decl->payload.global_variable.address_space != as || shd_is_decl_builtin(decl))
+            continue;
+        LLVMValueRef global = llvm_emit_decl(emitter, decl);
+        LLVMBuildStore(b, LLVMGetInitializer(global), global);
+    }
+}
+
+/// Same ABI as the runners the C11 backend emits, so the CPU runtime can use either:
+/// `void __shady_run_<name>(void** args, const uint32_t num_workgroups[3], uint64_t first_workgroup, uint64_t workgroups_count)`
+/// runs the invocations of a range of workgroups one after the other, and the sizes of the arguments are exported next to it.
+static void emit_host_entry_point(Emitter* emitter, const Node* fn) {
+    LLVMContextRef ctx = emitter->context;
+    LLVMModuleRef dst = emitter->dst;
+    String name = get_declaration_name(fn);
+    Nodes params = fn->payload.fun.params;
+
+    uint32_t size[3];
+    for (size_t i = 0; i < 3; i++)
+        size[i] = emitter->arena->config.specializations.workgroup_size[i] ? emitter->arena->config.specializations.workgroup_size[i] : 1;
+
+    LLVMTypeRef i32 = LLVMInt32TypeInContext(ctx);
+    LLVMTypeRef i64 = LLVMInt64TypeInContext(ctx);
+    LLVMTypeRef i8p = LLVMPointerType(LLVMInt8TypeInContext(ctx), 0);
+    LLVMTargetDataRef layout = LLVMGetModuleDataLayout(dst);
+    LLVMTypeRef size_t_type = LLVMIntPtrTypeInContext(ctx, layout);
+
+    LLVMValueRef args_count = LLVMAddGlobal(dst, size_t_type, shd_fmt_string_irarena(emitter->arena, "__shady_args_count_%s", name));
+    LLVMSetInitializer(args_count, LLVMConstInt(size_t_type, params.count, false));
+    LLVMSetGlobalConstant(args_count, true);
+    LARRAY(LLVMValueRef, arg_sizes, params.count + 1);
+    for (size_t i = 0; i < params.count; i++)
+        arg_sizes[i] = LLVMConstInt(size_t_type, LLVMABISizeOfType(layout, llvm_emit_type(emitter, params.nodes[i]->type)), false);
+    arg_sizes[params.count] = LLVMConstInt(size_t_type, 0, false);
+    LLVMTypeRef arg_sizes_t = LLVMArrayType(size_t_type, params.count + 1);
+    LLVMValueRef arg_sizes_global = LLVMAddGlobal(dst, arg_sizes_t, shd_fmt_string_irarena(emitter->arena, "__shady_arg_sizes_%s", name));
+    LLVMSetInitializer(arg_sizes_global, LLVMConstArray(size_t_type, arg_sizes, params.count + 1));
+    LLVMSetGlobalConstant(arg_sizes_global, true);
+
+    LLVMTypeRef run_params[] = { LLVMPointerType(i8p, 0), LLVMPointerType(i32, 0), i64, i64 };
+    LLVMValueRef run = LLVMAddFunction(dst, shd_fmt_string_irarena(emitter->arena, "__shady_run_%s", name), LLVMFunctionType(LLVMVoidTypeInContext(ctx), run_params, 4, false));
+    LLVMBasicBlockRef entry = LLVMAppendBasicBlockInContext(ctx, run, "entry");
+    LLVMBasicBlockRef wg_header = LLVMAppendBasicBlockInContext(ctx, run, "workgroups");
+    LLVMBasicBlockRef wg_body = LLVMAppendBasicBlockInContext(ctx, run, "workgroup");
+    LLVMBasicBlockRef inv_header = LLVMAppendBasicBlockInContext(ctx, run, "invocations");
+    LLVMBasicBlockRef inv_body = LLVMAppendBasicBlockInContext(ctx, run, "invocation");
+    LLVMBasicBlockRef wg_latch = LLVMAppendBasicBlockInContext(ctx, run, "next_workgroup");
+    LLVMBasicBlockRef exit = LLVMAppendBasicBlockInContext(ctx, run, "exit");
+    LLVMBuilderRef b = LLVMCreateBuilderInContext(ctx);
+
+    // the arguments are the same for all invocations, no need to fetch them again for each one
+    LLVMPositionBuilderAtEnd(b, entry);
+    LARRAY(LLVMValueRef, args, params.count);
+    for (size_t i = 0; i < params.count; i++) {
+        LLVMTypeRef t = llvm_emit_type(emitter, params.nodes[i]->type);
+        LLVMValueRef index = LLVMConstInt(i64, i, false);
+        LLVMValueRef arg_ptr = LLVMBuildLoad2(b, i8p, LLVMBuildGEP2(b, i8p, LLVMGetParam(run, 0), &index, 1, ""), "");
+        args[i] = LLVMBuildLoad2(b, t, LLVMBuildPointerCast(b, arg_ptr, LLVMPointerType(t, 0), ""), "");
+    }
+    LLVMValueRef num_workgroups[3];
+    for (size_t i = 0; i < 3; i++) {
+        LLVMValueRef index = LLVMConstInt(i64, i, false);
+        num_workgroups[i] = LLVMBuildLoad2(b, i32, LLVMBuildGEP2(b, i32, LLVMGetParam(run, 1), &index, 1, ""), "");
+    }
+    LLVMValueRef wg_size[3];
+    for (size_t i = 0; i < 3; i++)
+        wg_size[i] = LLVMConstInt(i32, size[i], false);
+    LLVMValueRef invocations_count = LLVMConstInt(i32, size[0] * size[1] * size[2], false);
+    store_host_builtin(emitter, b, BuiltinNumWorkgroups, num_workgroups);
+    store_host_builtin(emitter, b, BuiltinWorkgroupSize, wg_size);
+    store_host_builtin(emitter, b, BuiltinNumSubgroups, (LLVMValueRef[]) { invocations_count });
+    store_host_builtin(emitter, b, BuiltinSubgroupSize, (LLVMValueRef[]) { LLVMConstInt(i32, 1, false) });
+    store_host_builtin(emitter, b, BuiltinSubgroupLocalInvocationId, (LLVMValueRef[]) { LLVMConstInt(i32, 0, false) });
+    LLVMValueRef first_workgroup = LLVMGetParam(run, 2);
+    LLVMValueRef end_workgroup = LLVMBuildAdd(b, first_workgroup, LLVMGetParam(run, 3), "");
+    LLVMBuildBr(b, wg_header);
+
+    LLVMPositionBuilderAtEnd(b, wg_header);
+    LLVMValueRef w = LLVMBuildPhi(b, i64, "w");
+    LLVMAddIncoming(w, &first_workgroup, &entry, 1);
+    LLVMBuildCondBr(b, LLVMBuildICmp(b, LLVMIntULT, w, end_workgroup, ""), wg_body, exit);
+
+    LLVMPositionBuilderAtEnd(b, wg_body);
+    LLVMValueRef nx = LLVMBuildZExt(b, num_workgroups[0], i64, "");
+    LLVMValueRef ny = LLVMBuildZExt(b, num_workgroups[1], i64, "");
+    LLVMValueRef w_yz = LLVMBuildUDiv(b, w, nx, "");
+    LLVMValueRef wid[3] = {
+        LLVMBuildTrunc(b, LLVMBuildURem(b, w, nx, ""), i32, ""),
+        LLVMBuildTrunc(b, LLVMBuildURem(b, w_yz, ny, ""), i32, ""),
+        LLVMBuildTrunc(b, LLVMBuildUDiv(b, w_yz, ny, ""), i32, ""),
+    };
+    store_host_builtin(emitter, b, BuiltinWorkgroupId, wid);
+    reset_host_globals(emitter, b, AsShared);
+    LLVMBuildBr(b, inv_header);
+
+    LLVMPositionBuilderAtEnd(b, inv_header);
+    LLVMValueRef index = LLVMBuildPhi(b, i32, "index");
+    LLVMValueRef zero = LLVMConstInt(i32, 0, false);
+    LLVMAddIncoming(index, &zero, &wg_body, 1);
+    LLVMBuildCondBr(b, LLVMBuildICmp(b, LLVMIntULT, index, invocations_count, ""), inv_body, wg_latch);
+
+    LLVMPositionBuilderAtEnd(b, inv_body);
+    LLVMValueRef local_id[3] = {
+        LLVMBuildURem(b, index, wg_size[0], ""),
+        LLVMBuildURem(b, LLVMBuildUDiv(b, index, wg_size[0], ""), wg_size[1], ""),
+        LLVMBuildUDiv(b, index, LLVMConstInt(i32, size[0] * size[1], false), ""),
+    };
+    LLVMValueRef global_id[3];
+    for (size_t i = 0; i < 3; i++)
+        global_id[i] = LLVMBuildAdd(b, LLVMBuildMul(b, wid[i], wg_size[i], ""), local_id[i], "");
+    store_host_builtin(emitter, b, BuiltinLocalInvocationId, local_id);
+    store_host_builtin(emitter, b, BuiltinLocalInvocationIndex, (LLVMValueRef[]) { index });
+    store_host_builtin(emitter, b, BuiltinSubgroupId, (LLVMValueRef[]) { index });
+    store_host_builtin(emitter, b, BuiltinGlobalInvocationId, global_id);
+    reset_host_globals(emitter, b, AsPrivate);
+    LLVMBuildCall2(b, llvm_emit_type(emitter, fn->type), llvm_emit_decl(emitter, fn), args, params.count, "");
+    LLVMValueRef next_index = LLVMBuildAdd(b, index, LLVMConstInt(i32, 1, false), "");
+    LLVMAddIncoming(index, &next_index, &inv_body, 1);
+    LLVMBuildBr(b, inv_header);
+
+    LLVMPositionBuilderAtEnd(b, wg_latch);
+    LLVMValueRef next_w = LLVMBuildAdd(b, w, LLVMConstInt(i64, 1, false), "");
+    LLVMAddIncoming(w, &next_w, &wg_latch, 1);
+    LLVMBuildBr(b, wg_header);
+
+    LLVMPositionBuilderAtEnd(b, exit);
+    LLVMBuildRetVoid(b);
+    LLVMDisposeBuilder(b);
+}
+
+static void emit_llvm(const CompilerConfig* compiler_config, LLVMEmitterConfig config, Module* mod, LLVMModuleRef dst, Module** new_mod) {
+    IrArena* initial_arena = shd_module_get_arena(mod);
+    mod = run_backend_specific_passes(compiler_config, mod);
+    IrArena* arena = shd_module_get_arena(mod);
+
+    Emitter emitter = {
+        .module = mod,
+        .arena = arena,
+        .compiler_config = compiler_config,
+        .config = config,
+        .context = LLVMGetModuleContext(dst),
+        .dst = dst,
+        .emitted_types = shd_new_dict(Node*, LLVMTypeRef, (HashFn) shd_hash_node, (CmpFn) shd_compare_node),
+        .emitted_values = shd_new_dict(Node*, LLVMValueRef, (HashFn) shd_hash_node, (CmpFn) shd_compare_node),
+    };
+
+    Nodes decls = shd_module_get_declarations(mod);
+    for (size_t i = 0; i < decls.count; i++)
+        llvm_emit_decl(&emitter, decls.nodes[i]);
+
+    for (size_t i = 0; i < decls.count; i++) {
+        const Node* decl = decls.nodes[i];
+        if (decl->tag == Function_TAG && decl->payload.fun.body && shd_lookup_annotation_with_string_payload(decl, "EntryPoint", "Compute"))
+            emit_host_entry_point(&emitter, decl);
+    }
+
+    shd_destroy_dict(emitter.emitted_types);
+    shd_destroy_dict(emitter.emitted_values);
+
+    if (new_mod)
+        *new_mod = mod;
+    else if (initial_arena != arena)
+        shd_destroy_ir_arena(arena);
+}
+
+LLVMEmitterConfig shd_default_llvm_emitter_config(void) {
+    return (LLVMEmitterConfig) {
+        .explicit_address_spaces = false,
+    };
+}
+
+void shd_emit_llvm_module(const CompilerConfig* compiler_config, LLVMEmitterConfig config, Module* mod, LLVMModuleRef dst, Module** new_mod) {
+    emit_llvm(compiler_config, config, mod, dst, new_mod);
+}
+
+void shd_emit_llvm(const CompilerConfig* compiler_config, LLVMEmitterConfig config, Module* mod, size_t* output_size, char** output, Module** new_mod) {
+    LLVMContextRef context = LLVMContextCreate();
+    LLVMModuleRef dst = LLVMModuleCreateWithNameInContext(shd_module_get_name(mod), context);
+    emit_llvm(compiler_config, config, mod, dst, new_mod);
+
+    char* printed = LLVMPrintModuleToString(dst);
+    *output_size = strlen(printed);
+    *output = malloc(*output_size + 1);
+    memcpy(*output, printed, *output_size + 1);
+    LLVMDisposeMessage(printed);
+
+    LLVMDisposeModule(dst);
+    LLVMContextDispose(context);
+}
@@ -0,0 +1,55 @@
+#ifndef SHADY_EMIT_LLVM_H
+#define SHADY_EMIT_LLVM_H
+
+#include "shady/ir.h"
+#include "shady/ir/builtin.h"
+#include "shady/be/llvm.h"
+
+#include "llvm-c/Core.h"
+
+typedef struct CFG_ CFG;
+typedef struct Scheduler_ Scheduler;
+
+typedef struct {
+    LLVMValueRef fn;
+    CFG* cfg;
+    Scheduler* scheduler;
+    struct Dict* emitted;
+    /// indexed like the reverse post-order of the CFG
+    LLVMBasicBlockRef* blocks;
+} FnEmitter;
+
+typedef struct Emitter_ {
+    Module* module;
+    IrArena* arena;
+    const CompilerConfig* compiler_config;
+    LLVMEmitterConfig config;
+    LLVMContextRef context;
+    LLVMModuleRef dst;
+    struct Dict* emitted_types;
+    /// declarations and the values that may appear at the top level
+    struct Dict* emitted_values;
+    /// the thread-local variables the entry point runners fill in, see emit_host_entry_point
+    LLVMValueRef builtins[BuiltinsCount];
+} Emitter;
+
+LLVMValueRef llvm_emit_decl(Emitter*, const Node*);
+LLVMTypeRef llvm_emit_type(Emitter*, const Type*);
+LLVMValueRef llvm_emit_value(Emitter*, FnEmitter*, const Node*);
+void llvm_emit_mem(Emitter*, FnEmitter*, const Node*);
+void llvm_emit_terminator(Emitter*, FnEmitter*, LLVMBuilderRef, const Node* abs, const Node* terminator);
+
+void llvm_register_emitted(Emitter*, FnEmitter*, const Node*, LLVMValueRef);
+LLVMValueRef* llvm_search_emitted(Emitter*, FnEmitter*, const Node*);
+
+LLVMBasicBlockRef llvm_find_basic_block(FnEmitter*, const Node* abs);
+/// A builder that appends to the block, or inserts before its terminator when it already has one
+LLVMBuilderRef llvm_new_builder_in_block(Emitter*, LLVMBasicBlockRef);
+
+unsigned llvm_emit_addr_space(Emitter*, AddressSpace);
+// LLVM doesn't have multiple return types, they become literal structs
+LLVMTypeRef llvm_types_to_codom(Emitter*, Nodes return_types);
+/// Declares an overload of an intrinsic, such as `llvm.sqrt` for a float type
+LLVMValueRef llvm_get_intrinsic(Emitter*, String name, size_t overloads_count, LLVMTypeRef overloads[], LLVMTypeRef* fn_type);
+
+#endif
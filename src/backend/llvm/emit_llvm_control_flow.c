@@ -0,0 +1,186 @@
+#include "emit_llvm.h"
+
+#include "../shady/analysis/cfg.h"
+
+#include "log.h"
+#include "portability.h"
+
+#include <assert.h>
+
+LLVMBasicBlockRef llvm_find_basic_block(FnEmitter* fn, const Node* abs) {
+    CFNode* cf_node = shd_cfg_lookup(fn->cfg, abs);
+    assert(cf_node);
+    return fn->blocks[cf_node->rpo_index];
+}
+
+LLVMBuilderRef llvm_new_builder_in_block(Emitter* emitter, LLVMBasicBlockRef bb) {
+    LLVMBuilderRef b = LLVMCreateBuilderInContext(emitter->context);
+    LLVMValueRef terminator = LLVMGetBasicBlockTerminator(bb);
+    if (terminator)
+        LLVMPositionBuilderBefore(b, terminator);
+    else
+        LLVMPositionBuilderAtEnd(b, bb);
+    return b;
+}
+
+static void add_phis(Emitter* emitter, FnEmitter* fn, LLVMBasicBlockRef src, const Node* dst, Nodes args) {
+    // because it's forbidden to jump back into the entry block of a function
+    // (which is actually a Function in this IR, not a BasicBlock)
+    // we assert that the destination must be an actual BasicBlock
+    assert(is_basic_block(dst));
+    Nodes params = get_abstraction_params(dst);
+    assert(params.count == args.count);
+    for (size_t i = 0; i < args.count; i++) {
+        LLVMValueRef phi = *llvm_search_emitted(emitter, fn, params.nodes[i]);
+        LLVMValueRef value = llvm_emit_value(emitter, fn, args.nodes[i]);
+        LLVMAddIncoming(phi, &value, &src, 1);
+    }
+}
+
+/// Emits the arguments of a jump and feeds them to the phis of its target
+static LLVMBasicBlockRef emit_jump_edge(Emitter* emitter, FnEmitter* fn, LLVMBuilderRef b, const Node* dst, Nodes args) {
+    add_phis(emitter, fn, LLVMGetInsertBlock(b), dst, args);
+    return llvm_find_basic_block(fn, dst);
+}
+
+static LLVMBasicBlockRef emit_jump(Emitter* emitter, FnEmitter* fn, LLVMBuilderRef b, const Node* jump) {
+    assert(jump->tag == Jump_TAG);
+    return emit_jump_edge(emitter, fn, b, jump->payload.jump.target, jump->payload.jump.args);
+}
+
+typedef enum {
+    SelectionConstruct,
+    LoopConstruct,
+} Construct;
+
+static const Node* find_construct(FnEmitter* fn, const Node* abs, Construct construct) {
+    const Node* oabs = abs;
+    for (CFNode* n = shd_cfg_lookup(fn->cfg, abs); n; oabs = n->node, n = n->idom) {
+        const Node* terminator = get_abstraction_body(n->node);
+        assert(terminator);
+        if (is_structured_construct(terminator) && get_structured_construct_tail(terminator) == oabs)
+            continue;
+        if (construct == LoopConstruct && terminator->tag == Loop_TAG)
+            return terminator;
+        if (construct == SelectionConstruct && (terminator->tag == If_TAG || terminator->tag == Match_TAG))
+            return terminator;
+    }
+    return NULL;
+}
+
+static void emit_match(Emitter* emitter, FnEmitter* fn, LLVMBuilderRef b, Match match) {
+    LLVMValueRef inspectee = llvm_emit_value(emitter, fn, match.inspect);
+    LLVMValueRef br_switch = LLVMBuildSwitch(b, inspectee, llvm_find_basic_block(fn, match.default_case), match.cases.count);
+    for (size_t i = 0; i < match.cases.count; i++)
+        LLVMAddCase(br_switch, llvm_emit_value(emitter, fn, match.literals.nodes[i]), llvm_find_basic_block(fn, match.cases.nodes[i]));
+}
+
+// Structured constructs don't need to be preserved: LLVM is happy with plain branches and recovers loops on its own.
+void llvm_emit_terminator(Emitter* emitter, FnEmitter* fn, LLVMBuilderRef b, const Node* abs, const Node* terminator) {
+    switch (is_terminator(terminator)) {
+        case Return_TAG: {
+            Return payload = terminator->payload.fn_ret;
+            llvm_emit_mem(emitter, fn, payload.mem);
+            switch (payload.args.count) {
+                case 0: LLVMBuildRetVoid(b); return;
+                case 1: LLVMBuildRet(b, llvm_emit_value(emitter, fn, payload.args.nodes[0])); return;
+                default: {
+                    LLVMValueRef acc = LLVMGetUndef(LLVMGetReturnType(LLVMGlobalGetValueType(fn->fn)));
+                    for (size_t i = 0; i < payload.args.count; i++)
+                        acc = LLVMBuildInsertValue(b, acc, llvm_emit_value(emitter, fn, payload.args.nodes[i]), i, "");
+                    LLVMBuildRet(b, acc);
+                    return;
+                }
+            }
+        }
+        case Unreachable_TAG: {
+            Unreachable payload = terminator->payload.unreachable;
+            llvm_emit_mem(emitter, fn, payload.mem);
+            LLVMBuildUnreachable(b);
+            return;
+        }
+        case Jump_TAG: {
+            Jump payload = terminator->payload.jump;
+            llvm_emit_mem(emitter, fn, payload.mem);
+            LLVMBuildBr(b, emit_jump(emitter, fn, b, terminator));
+            return;
+        }
+        case Branch_TAG: {
+            Branch payload = terminator->payload.branch;
+            llvm_emit_mem(emitter, fn, payload.mem);
+            LLVMValueRef condition = llvm_emit_value(emitter, fn, payload.condition);
+            LLVMBasicBlockRef true_target = emit_jump(emitter, fn, b, payload.true_jump);
+            LLVMBasicBlockRef false_target = emit_jump(emitter, fn, b, payload.false_jump);
+            LLVMBuildCondBr(b, condition, true_target, false_target);
+            return;
+        }
+        case Switch_TAG: {
+            Switch payload = terminator->payload.br_switch;
+            llvm_emit_mem(emitter, fn, payload.mem);
+            LLVMValueRef inspectee = llvm_emit_value(emitter, fn, payload.switch_value);
+            LARRAY(LLVMValueRef, case_values, payload.case_jumps.count);
+            LARRAY(LLVMBasicBlockRef, case_targets, payload.case_jumps.count);
+            for (size_t i = 0; i < payload.case_jumps.count; i++) {
+                case_values[i] = llvm_emit_value(emitter, fn, payload.case_values.nodes[i]);
+                case_targets[i] = emit_jump(emitter, fn, b, payload.case_jumps.nodes[i]);
+            }
+            LLVMBasicBlockRef default_target = emit_jump(emitter, fn, b, payload.default_jump);
+            LLVMValueRef br_switch = LLVMBuildSwitch(b, inspectee, default_target, payload.case_jumps.count);
+            for (size_t i = 0; i < payload.case_jumps.count; i++)
+                LLVMAddCase(br_switch, case_values[i], case_targets[i]);
+            return;
+        }
+        case If_TAG: {
+            If payload = terminator->payload.if_instr;
+            llvm_emit_mem(emitter, fn, payload.mem);
+            LLVMValueRef condition = llvm_emit_value(emitter, fn, payload.condition);
+            LLVMBasicBlockRef true_target = llvm_find_basic_block(fn, payload.if_true);
+            LLVMBasicBlockRef false_target = payload.if_false ? llvm_find_basic_block(fn, payload.if_false) : emit_jump_edge(emitter, fn, b, payload.tail, shd_empty(emitter->arena));
+            LLVMBuildCondBr(b, condition, true_target, false_target);
+            return;
+        }
+        case Match_TAG: {
+            Match payload = terminator->payload.match_instr;
+            llvm_emit_mem(emitter, fn, payload.mem);
+            emit_match(emitter, fn, b, payload);
+            return;
+        }
+        case Loop_TAG: {
+            Loop payload = terminator->payload.loop_instr;
+            llvm_emit_mem(emitter, fn, payload.mem);
+            LLVMBuildBr(b, emit_jump_edge(emitter, fn, b, payload.body, payload.initial_args));
+            return;
+        }
+        case MergeSelection_TAG: {
+            MergeSelection payload = terminator->payload.merge_selection;
+            llvm_emit_mem(emitter, fn, payload.mem);
+            const Node* construct = find_construct(fn, abs, SelectionConstruct);
+            assert(construct);
+            const Node* tail = get_structured_construct_tail(construct);
+            assert(tail != abs);
+            LLVMBuildBr(b, emit_jump_edge(emitter, fn, b, tail, payload.args));
+            return;
+        }
+        case MergeContinue_TAG: {
+            MergeContinue payload = terminator->payload.merge_continue;
+            llvm_emit_mem(emitter, fn, payload.mem);
+            const Node* construct = find_construct(fn, abs, LoopConstruct);
+            assert(construct);
+            LLVMBuildBr(b, emit_jump_edge(emitter, fn, b, construct->payload.loop_instr.body, payload.args));
+            return;
+        }
+        case MergeBreak_TAG: {
+            MergeBreak payload = terminator->payload.merge_break;
+            llvm_emit_mem(emitter, fn, payload.mem);
+            const Node* construct = find_construct(fn, abs, LoopConstruct);
+            assert(construct);
+            LLVMBuildBr(b, emit_jump_edge(emitter, fn, b, construct->payload.loop_instr.tail, payload.args));
+            return;
+        }
+        case Terminator_Control_TAG:
+        case TailCall_TAG:
+        case Join_TAG: shd_error("Lower me");
+        case NotATerminator: shd_error("TODO: emit terminator %s", shd_get_node_tag_string(terminator->tag));
+    }
+    SHADY_UNREACHABLE;
+}
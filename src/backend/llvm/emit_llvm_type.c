@@ -0,0 +1,154 @@
+#include "emit_llvm.h"
+
+#include "portability.h"
+#include "log.h"
+#include "dict.h"
+
+#include <assert.h>
+#include <string.h>
+
+#pragma GCC diagnostic error "-Wswitch"
+
+unsigned llvm_emit_addr_space(Emitter* emitter, AddressSpace as) {
+    if (!emitter->config.explicit_address_spaces)
+        return 0;
+    switch (as) {
+        case AsGlobal:
+        case AsShaderStorageBufferObject: return 1;
+        case AsShared: return 3;
+        case AsUniform:
+        case AsUniformConstant:
+        case AsPushConstant: return 4;
+        // allocas live in the default address space as long as the data layout does not say otherwise
+        default: return 0;
+    }
+}
+
+LLVMTypeRef llvm_types_to_codom(Emitter* emitter, Nodes return_types) {
+    switch (return_types.count) {
+        case 0: return LLVMVoidTypeInContext(emitter->context);
+        case 1: return llvm_emit_type(emitter, return_types.nodes[0]);
+        default: {
+            LARRAY(LLVMTypeRef, members, return_types.count);
+            for (size_t i = 0; i < return_types.count; i++)
+                members[i] = llvm_emit_type(emitter, return_types.nodes[i]);
+            return LLVMStructTypeInContext(emitter->context, members, return_types.count, false);
+        }
+    }
+}
+
+static LLVMTypeRef emit_record_body(Emitter* emitter, const Type* type, LLVMTypeRef named) {
+    assert(type->tag == RecordType_TAG);
+    Nodes member_types = type->payload.record_type.members;
+    LARRAY(LLVMTypeRef, members, member_types.count);
+    for (size_t i = 0; i < member_types.count; i++)
+        members[i] = llvm_emit_type(emitter, member_types.nodes[i]);
+    if (named) {
+        LLVMStructSetBody(named, members, member_types.count, false);
+        return named;
+    }
+    return LLVMStructTypeInContext(emitter->context, members, member_types.count, false);
+}
+
+static LLVMTypeRef emit_nominal_type(Emitter* emitter, const Node* decl) {
+    assert(decl->tag == NominalType_TAG);
+    LLVMTypeRef* found = shd_dict_find_value(const Node*, LLVMTypeRef, emitter->emitted_types, decl);
+    if (found)
+        return *found;
+    // registered before its body is emitted, since it may point to itself
+    LLVMTypeRef named = LLVMStructCreateNamed(emitter->context, decl->payload.nom_type.name);
+    shd_dict_insert(const Node*, LLVMTypeRef, emitter->emitted_types, decl, named);
+    const Type* body = decl->payload.nom_type.body;
+    if (body->tag != RecordType_TAG)
+        shd_error("not a suitable nominal type body (tag=%s)", shd_get_node_tag_string(body->tag));
+    return emit_record_body(emitter, body, named);
+}
+
+LLVMTypeRef llvm_emit_type(Emitter* emitter, const Type* type) {
+    LLVMTypeRef* found = shd_dict_find_value(const Node*, LLVMTypeRef, emitter->emitted_types, type);
+    if (found)
+        return *found;
+
+    LLVMContextRef ctx = emitter->context;
+    LLVMTypeRef new;
+    switch (is_type(type)) {
+        case NotAType: shd_error("Not a type");
+        case Int_TAG: {
+            switch (type->payload.int_type.width) {
+                case IntTy8:  new = LLVMInt8TypeInContext(ctx); break;
+                case IntTy16: new = LLVMInt16TypeInContext(ctx); break;
+                case IntTy32: new = LLVMInt32TypeInContext(ctx); break;
+                case IntTy64: new = LLVMInt64TypeInContext(ctx); break;
+                default: assert(false);
+            }
+            break;
+        }
+        case Bool_TAG: new = LLVMInt1TypeInContext(ctx); break;
+        case Float_TAG: {
+            switch (type->payload.float_type.width) {
+                case FloatTy16: new = LLVMHalfTypeInContext(ctx); break;
+                case FloatTy32: new = LLVMFloatTypeInContext(ctx); break;
+                case FloatTy64: new = LLVMDoubleTypeInContext(ctx); break;
+            }
+            break;
+        }
+        case PtrType_TAG: {
+            LLVMTypeRef pointee = llvm_emit_type(emitter, type->payload.ptr_type.pointed_type);
+            // typed pointers cannot point to void
+            if (LLVMGetTypeKind(pointee) == LLVMVoidTypeKind)
+                pointee = LLVMInt8TypeInContext(ctx);
+            new = LLVMPointerType(pointee, llvm_emit_addr_space(emitter, type->payload.ptr_type.address_space));
+            break;
+        }
+        case NoRet_TAG:
+        case LamType_TAG:
+        case BBType_TAG: shd_error("we can't emit arrow types that aren't those of first-class functions")
+        case FnType_TAG: {
+            const FnType* fnt = &type->payload.fn_type;
+            LARRAY(LLVMTypeRef, params, fnt->param_types.count);
+            for (size_t i = 0; i < fnt->param_types.count; i++)
+                params[i] = llvm_emit_type(emitter, fnt->param_types.nodes[i]);
+            new = LLVMFunctionType(llvm_types_to_codom(emitter, fnt->return_types), params, fnt->param_types.count, false);
+            break;
+        }
+        case QualifiedType_TAG: {
+            // LLVM does not care about our type qualifiers.
+            new = llvm_emit_type(emitter, type->payload.qualified_type.type);
+            break;
+        }
+        case ArrType_TAG: {
+            LLVMTypeRef element_type = llvm_emit_type(emitter, type->payload.arr_type.element_type);
+            // unsized arrays are only ever accessed through pointers, which are free to index past the end
+            unsigned size = 0;
+            if (type->payload.arr_type.size)
+                size = (unsigned) shd_get_int_literal_value(*shd_resolve_to_int_literal(type->payload.arr_type.size), false);
+            new = LLVMArrayType(element_type, size);
+            break;
+        }
+        case PackType_TAG: {
+            assert(type->payload.pack_type.width >= 2);
+            new = LLVMVectorType(llvm_emit_type(emitter, type->payload.pack_type.element_type), type->payload.pack_type.width);
+            break;
+        }
+        case RecordType_TAG: {
+            if (type->payload.record_type.members.count == 0) {
+                new = LLVMVoidTypeInContext(ctx);
+                break;
+            }
+            new = emit_record_body(emitter, type, NULL);
+            break;
+        }
+        case Type_TypeDeclRef_TAG: {
+            new = emit_nominal_type(emitter, type->payload.type_decl_ref.decl);
+            break;
+        }
+        case Type_SampledImageType_TAG:
+        case Type_SamplerType_TAG:
+        case Type_ImageType_TAG: shd_error("Images and samplers are not supported by the LLVM backend")
+        case Type_MaskType_TAG:
+        case Type_JoinPointType_TAG: shd_error("These must be lowered beforehand")
+    }
+
+    shd_dict_insert(const Node*, LLVMTypeRef, emitter->emitted_types, type, new);
+    return new;
+}
@@ -0,0 +1,732 @@
+#include "emit_llvm.h"
+
+#include "../shady/analysis/cfg.h"
+#include "../shady/analysis/scheduler.h"
+
+#include "log.h"
+#include "dict.h"
+#include "portability.h"
+
+#include <spirv/unified1/spirv.h>
+
+#include <assert.h>
+#include <string.h>
+
+typedef enum {
+    Custom, BinOp, Compare, Intrinsic
+} InstrClass;
+
+typedef enum {
+    Signed, Unsigned, FP, Logical, Ptr, OperandClassCount
+} OperandClass;
+
+static OperandClass classify_operand_type(const Type* type) {
+    assert(is_type(type) && shd_is_data_type(type));
+
+    if (type->tag == PackType_TAG)
+        return classify_operand_type(type->payload.pack_type.element_type);
+
+    switch (type->tag) {
+        case Int_TAG:     return type->payload.int_type.is_signed ? Signed : Unsigned;
+        case Bool_TAG:    return Logical;
+        case PtrType_TAG: return Ptr;
+        case Float_TAG:   return FP;
+        default: shd_error("we don't know what to do with this")
+    }
+}
+
+static OperandClass classify_operand(const Node* operand) {
+    return classify_operand_type(shd_get_unqualified_type(operand->type));
+}
+
+typedef struct {
+    InstrClass class;
+    union {
+        /// 0 where the operation makes no sense for that class of operands
+        LLVMOpcode op[OperandClassCount];
+        struct {
+            LLVMIntPredicate ipred[2];
+            LLVMRealPredicate fpred;
+            /// logical and pointer operands get compared as unsigned integers
+            bool also_logical_and_ptr;
+        } cmp;
+        String intrinsic[OperandClassCount];
+    };
+} ISelTableEntry;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmissing-field-initializers"
+
+static const ISelTableEntry isel_table[] = {
+    [add_op] = { BinOp, .op = { LLVMAdd,  LLVMAdd,  LLVMFAdd } },
+    [sub_op] = { BinOp, .op = { LLVMSub,  LLVMSub,  LLVMFSub } },
+    [mul_op] = { BinOp, .op = { LLVMMul,  LLVMMul,  LLVMFMul } },
+    [div_op] = { BinOp, .op = { LLVMSDiv, LLVMUDiv, LLVMFDiv } },
+    [mod_op] = { BinOp, .op = { LLVMSRem, LLVMURem, LLVMFRem } },
+
+    [and_op] = { BinOp, .op = { LLVMAnd, LLVMAnd, 0, LLVMAnd } },
+    [or_op]  = { BinOp, .op = { LLVMOr,  LLVMOr,  0, LLVMOr  } },
+    [xor_op] = { BinOp, .op = { LLVMXor, LLVMXor, 0, LLVMXor } },
+
+    [eq_op]  = { Compare, .cmp = { { LLVMIntEQ,  LLVMIntEQ  }, LLVMRealOEQ, true } },
+    [neq_op] = { Compare, .cmp = { { LLVMIntNE,  LLVMIntNE  }, LLVMRealONE, true } },
+    [lt_op]  = { Compare, .cmp = { { LLVMIntSLT, LLVMIntULT }, LLVMRealOLT } },
+    [lte_op] = { Compare, .cmp = { { LLVMIntSLE, LLVMIntULE }, LLVMRealOLE } },
+    [gt_op]  = { Compare, .cmp = { { LLVMIntSGT, LLVMIntUGT }, LLVMRealOGT } },
+    [gte_op] = { Compare, .cmp = { { LLVMIntSGE, LLVMIntUGE }, LLVMRealOGE } },
+
+    [sqrt_op]  = { Intrinsic, .intrinsic = { [FP] = "llvm.sqrt" } },
+    [floor_op] = { Intrinsic, .intrinsic = { [FP] = "llvm.floor" } },
+    [ceil_op]  = { Intrinsic, .intrinsic = { [FP] = "llvm.ceil" } },
+    [round_op] = { Intrinsic, .intrinsic = { [FP] = "llvm.round" } },
+    [sin_op]   = { Intrinsic, .intrinsic = { [FP] = "llvm.sin" } },
+    [cos_op]   = { Intrinsic, .intrinsic = { [FP] = "llvm.cos" } },
+    [exp_op]   = { Intrinsic, .intrinsic = { [FP] = "llvm.exp" } },
+    [pow_op]   = { Intrinsic, .intrinsic = { [FP] = "llvm.pow" } },
+    [fma_op]   = { Intrinsic, .intrinsic = { [FP] = "llvm.fma" } },
+    [min_op]   = { Intrinsic, .intrinsic = { "llvm.smin", "llvm.umin", "llvm.minnum" } },
+    [max_op]   = { Intrinsic, .intrinsic = { "llvm.smax", "llvm.umax", "llvm.maxnum" } },
+};
+
+#pragma GCC diagnostic pop
+
+static const ISelTableEntry* lookup_entry(Op op) {
+    if (op < sizeof(isel_table) / sizeof(isel_table[0]))
+        return &isel_table[op];
+    return NULL;
+}
+
+LLVMValueRef llvm_get_intrinsic(Emitter* emitter, String name, size_t overloads_count, LLVMTypeRef overloads[], LLVMTypeRef* fn_type) {
+    unsigned id = LLVMLookupIntrinsicID(name, strlen(name));
+    if (!id)
+        shd_error("Unknown LLVM intrinsic %s", name);
+    *fn_type = LLVMIntrinsicGetType(emitter->context, id, overloads, overloads_count);
+    return LLVMGetIntrinsicDeclaration(emitter->dst, id, overloads, overloads_count);
+}
+
+static LLVMValueRef call_intrinsic(Emitter* emitter, LLVMBuilderRef b, String name, LLVMTypeRef overload, size_t args_count, LLVMValueRef args[]) {
+    LLVMTypeRef fn_type;
+    LLVMValueRef intrinsic = llvm_get_intrinsic(emitter, name, 1, &overload, &fn_type);
+    return LLVMBuildCall2(b, fn_type, intrinsic, args, args_count, "");
+}
+
+static LLVMValueRef emit_alloca(Emitter* emitter, FnEmitter* fn, LLVMTypeRef type) {
+    // allocas go at the top of the entry block, where LLVM expects them to be promoted to registers
+    LLVMBuilderRef b = LLVMCreateBuilderInContext(emitter->context);
+    LLVMBasicBlockRef entry = fn->blocks[0];
+    LLVMValueRef first = LLVMGetFirstInstruction(entry);
+    if (first)
+        LLVMPositionBuilderBefore(b, first);
+    else
+        LLVMPositionBuilderAtEnd(b, entry);
+    LLVMValueRef alloca = LLVMBuildAlloca(b, type, "");
+    LLVMDisposeBuilder(b);
+    return alloca;
+}
+
+static LLVMValueRef make_tuple(Emitter* emitter, LLVMBuilderRef b, const Type* t, LLVMValueRef first, LLVMValueRef second) {
+    LLVMValueRef tuple = LLVMGetUndef(llvm_emit_type(emitter, t));
+    tuple = LLVMBuildInsertValue(b, tuple, first, 0, "");
+    return LLVMBuildInsertValue(b, tuple, second, 1, "");
+}
+
+static LLVMValueRef emit_convert(LLVMBuilderRef b, LLVMValueRef src, const Type* src_type, LLVMTypeRef dst_t, const Type* dst_type) {
+    OperandClass from = classify_operand_type(src_type);
+    OperandClass to = classify_operand_type(dst_type);
+    bool from_int = from == Signed || from == Unsigned;
+    bool to_int = to == Signed || to == Unsigned;
+    if (from_int && to_int)
+        return LLVMBuildIntCast2(b, src, dst_t, from == Signed, "");
+    if (from_int && to == FP)
+        return from == Signed ? LLVMBuildSIToFP(b, src, dst_t, "") : LLVMBuildUIToFP(b, src, dst_t, "");
+    if (from == FP && to_int)
+        return to == Signed ? LLVMBuildFPToSI(b, src, dst_t, "") : LLVMBuildFPToUI(b, src, dst_t, "");
+    if (from == FP && to == FP)
+        return LLVMBuildFPCast(b, src, dst_t, "");
+    if (from == Logical && to_int)
+        return LLVMBuildZExt(b, src, dst_t, "");
+    if (from == Logical && to == FP)
+        return LLVMBuildUIToFP(b, src, dst_t, "");
+    if (from_int && to == Logical)
+        return LLVMBuildICmp(b, LLVMIntNE, src, LLVMConstNull(LLVMTypeOf(src)), "");
+    if (from == FP && to == Logical)
+        return LLVMBuildFCmp(b, LLVMRealONE, src, LLVMConstNull(LLVMTypeOf(src)), "");
+    if (from == to)
+        return from == Ptr ? LLVMBuildPointerCast(b, src, dst_t, "") : src;
+    if (from == Ptr && to_int)
+        return LLVMBuildPtrToInt(b, src, dst_t, "");
+    if (from_int && to == Ptr)
+        return LLVMBuildIntToPtr(b, src, dst_t, "");
+    shd_error("Unsupported conversion");
+}
+
+static LLVMValueRef emit_reinterpret(LLVMBuilderRef b, LLVMValueRef src, const Type* src_type, LLVMTypeRef dst_t, const Type* dst_type) {
+    OperandClass from = classify_operand_type(src_type);
+    OperandClass to = classify_operand_type(dst_type);
+    if (from == Ptr && to == Ptr)
+        return LLVMBuildPointerCast(b, src, dst_t, "");
+    if (from == Ptr)
+        return LLVMBuildPtrToInt(b, src, dst_t, "");
+    if (to == Ptr)
+        return LLVMBuildIntToPtr(b, src, dst_t, "");
+    return LLVMBuildBitCast(b, src, dst_t, "");
+}
+
+static LLVMValueRef i32_constant(Emitter* emitter, uint64_t value) {
+    return LLVMConstInt(LLVMInt32TypeInContext(emitter->context), value, false);
+}
+
+static LLVMValueRef extract_one(Emitter* emitter, LLVMBuilderRef b, LLVMValueRef from, unsigned index) {
+    if (LLVMGetTypeKind(LLVMTypeOf(from)) == LLVMVectorTypeKind)
+        return LLVMBuildExtractElement(b, from, i32_constant(emitter, index), "");
+    return LLVMBuildExtractValue(b, from, index, "");
+}
+
+static LLVMValueRef insert_at(Emitter* emitter, LLVMBuilderRef b, LLVMValueRef into, LLVMValueRef value, size_t indices_count, const unsigned indices[]) {
+    if (indices_count == 0)
+        return value;
+    LLVMValueRef inner = insert_at(emitter, b, extract_one(emitter, b, into, indices[0]), value, indices_count - 1, indices + 1);
+    if (LLVMGetTypeKind(LLVMTypeOf(into)) == LLVMVectorTypeKind)
+        return LLVMBuildInsertElement(b, into, inner, i32_constant(emitter, indices[0]), "");
+    return LLVMBuildInsertValue(b, into, inner, indices[0], "");
+}
+
+static LLVMValueRef emit_primop(Emitter* emitter, FnEmitter* fn, LLVMBuilderRef b, const Node* instr) {
+    PrimOp the_op = instr->payload.prim_op;
+    Nodes args = the_op.operands;
+    Nodes type_arguments = the_op.type_arguments;
+
+    const ISelTableEntry* entry = lookup_entry(the_op.op);
+    if (entry && entry->class != Custom) {
+        LARRAY(LLVMValueRef, emitted_args, args.count);
+        for (size_t i = 0; i < args.count; i++)
+            emitted_args[i] = llvm_emit_value(emitter, fn, args.nodes[i]);
+        OperandClass class = classify_operand(shd_first(args));
+
+        switch (entry->class) {
+            case BinOp: {
+                assert(args.count == 2);
+                LLVMOpcode opcode = entry->op[class];
+                if (!opcode)
+                    shd_error("%s is not defined for these operands", shd_get_primop_name(the_op.op));
+                return LLVMBuildBinOp(b, opcode, emitted_args[0], emitted_args[1], "");
+            }
+            case Compare: {
+                assert(args.count == 2);
+                switch (class) {
+                    case FP: return LLVMBuildFCmp(b, entry->cmp.fpred, emitted_args[0], emitted_args[1], "");
+                    case Signed:
+                    case Unsigned: return LLVMBuildICmp(b, entry->cmp.ipred[class], emitted_args[0], emitted_args[1], "");
+                    case Logical:
+                    case Ptr: {
+                        if (!entry->cmp.also_logical_and_ptr)
+                            shd_error("%s is not defined for these operands", shd_get_primop_name(the_op.op));
+                        return LLVMBuildICmp(b, entry->cmp.ipred[Unsigned], emitted_args[0], emitted_args[1], "");
+                    }
+                    default: SHADY_UNREACHABLE;
+                }
+            }
+            case Intrinsic: {
+                String name = entry->intrinsic[class];
+                if (!name)
+                    shd_error("%s is not defined for these operands", shd_get_primop_name(the_op.op));
+                return call_intrinsic(emitter, b, name, LLVMTypeOf(emitted_args[0]), args.count, emitted_args);
+            }
+            case Custom: SHADY_UNREACHABLE;
+        }
+        SHADY_UNREACHABLE;
+    }
+
+    LLVMTypeRef result_t = llvm_emit_type(emitter, instr->type);
+    switch (the_op.op) {
+        case neg_op: {
+            LLVMValueRef x = llvm_emit_value(emitter, fn, shd_first(args));
+            return classify_operand(shd_first(args)) == FP ? LLVMBuildFNeg(b, x, "") : LLVMBuildNeg(b, x, "");
+        }
+        case not_op: return LLVMBuildNot(b, llvm_emit_value(emitter, fn, shd_first(args)), "");
+        case lshift_op:
+        case rshift_logical_op:
+        case rshift_arithm_op: {
+            LLVMValueRef x = llvm_emit_value(emitter, fn, args.nodes[0]);
+            // LLVM wants both sides of a shift to have the same type, unlike us
+            LLVMValueRef amount = LLVMBuildIntCast2(b, llvm_emit_value(emitter, fn, args.nodes[1]), LLVMTypeOf(x), false, "");
+            LLVMOpcode opcode = the_op.op == lshift_op ? LLVMShl : the_op.op == rshift_logical_op ? LLVMLShr : LLVMAShr;
+            return LLVMBuildBinOp(b, opcode, x, amount, "");
+        }
+        case add_carry_op: {
+            LLVMValueRef x = llvm_emit_value(emitter, fn, args.nodes[0]);
+            LLVMValueRef y = llvm_emit_value(emitter, fn, args.nodes[1]);
+            LLVMValueRef sum = LLVMBuildAdd(b, x, y, "");
+            LLVMValueRef carry = LLVMBuildZExt(b, LLVMBuildICmp(b, LLVMIntULT, sum, x, ""), LLVMTypeOf(x), "");
+            return make_tuple(emitter, b, instr->type, sum, carry);
+        }
+        case sub_borrow_op: {
+            LLVMValueRef x = llvm_emit_value(emitter, fn, args.nodes[0]);
+            LLVMValueRef y = llvm_emit_value(emitter, fn, args.nodes[1]);
+            LLVMValueRef difference = LLVMBuildSub(b, x, y, "");
+            LLVMValueRef borrow = LLVMBuildZExt(b, LLVMBuildICmp(b, LLVMIntULT, x, y, ""), LLVMTypeOf(x), "");
+            return make_tuple(emitter, b, instr->type, difference, borrow);
+        }
+        case mul_extended_op: {
+            bool is_signed = classify_operand(shd_first(args)) == Signed;
+            LLVMValueRef x = llvm_emit_value(emitter, fn, args.nodes[0]);
+            LLVMValueRef y = llvm_emit_value(emitter, fn, args.nodes[1]);
+            LLVMTypeRef t = LLVMTypeOf(x);
+            unsigned width = LLVMGetIntTypeWidth(t);
+            LLVMTypeRef wide_t = LLVMIntTypeInContext(emitter->context, width * 2);
+            LLVMValueRef product = LLVMBuildMul(b, LLVMBuildIntCast2(b, x, wide_t, is_signed, ""), LLVMBuildIntCast2(b, y, wide_t, is_signed, ""), "");
+            LLVMValueRef lo = LLVMBuildTrunc(b, product, t, "");
+            LLVMValueRef hi = LLVMBuildTrunc(b, LLVMBuildLShr(b, product, LLVMConstInt(wide_t, width, false), ""), t, "");
+            return make_tuple(emitter, b, instr->type, lo, hi);
+        }
+        case fract_op: {
+            LLVMValueRef x = llvm_emit_value(emitter, fn, shd_first(args));
+            LLVMValueRef floored = call_intrinsic(emitter, b, "llvm.floor", LLVMTypeOf(x), 1, &x);
+            return LLVMBuildFSub(b, x, floored, "");
+        }
+        case inv_sqrt_op: {
+            LLVMValueRef x = llvm_emit_value(emitter, fn, shd_first(args));
+            LLVMValueRef root = call_intrinsic(emitter, b, "llvm.sqrt", LLVMTypeOf(x), 1, &x);
+            return LLVMBuildFDiv(b, LLVMConstReal(LLVMTypeOf(x), 1.0), root, "");
+        }
+        case abs_op: {
+            LLVMValueRef x = llvm_emit_value(emitter, fn, shd_first(args));
+            if (classify_operand(shd_first(args)) == FP)
+                return call_intrinsic(emitter, b, "llvm.fabs", LLVMTypeOf(x), 1, &x);
+            LLVMValueRef abs_args[] = { x, LLVMConstInt(LLVMInt1TypeInContext(emitter->context), 0, false) };
+            return call_intrinsic(emitter, b, "llvm.abs", LLVMTypeOf(x), 2, abs_args);
+        }
+        case sign_op: {
+            LLVMValueRef x = llvm_emit_value(emitter, fn, shd_first(args));
+            LLVMTypeRef t = LLVMTypeOf(x);
+            LLVMValueRef zero = LLVMConstNull(t);
+            if (classify_operand(shd_first(args)) == FP) {
+                LLVMValueRef positive = LLVMBuildSelect(b, LLVMBuildFCmp(b, LLVMRealOGT, x, zero, ""), LLVMConstReal(t, 1.0), zero, "");
+                return LLVMBuildSelect(b, LLVMBuildFCmp(b, LLVMRealOLT, x, zero, ""), LLVMConstReal(t, -1.0), positive, "");
+            }
+            LLVMValueRef positive = LLVMBuildSelect(b, LLVMBuildICmp(b, LLVMIntSGT, x, zero, ""), LLVMConstInt(t, 1, false), zero, "");
+            return LLVMBuildSelect(b, LLVMBuildICmp(b, LLVMIntSLT, x, zero, ""), LLVMConstAllOnes(t), positive, "");
+        }
+        case size_of_op: return LLVMBuildIntCast2(b, LLVMSizeOf(llvm_emit_type(emitter, shd_first(type_arguments))), result_t, false, "");
+        case align_of_op: return LLVMBuildIntCast2(b, LLVMAlignOf(llvm_emit_type(emitter, shd_first(type_arguments))), result_t, false, "");
+        case offset_of_op: {
+            LLVMTypeRef t = llvm_emit_type(emitter, shd_first(type_arguments));
+            uint64_t index = shd_get_int_literal_value(*shd_resolve_to_int_literal(shd_first(args)), false);
+            LLVMValueRef indices[] = { i32_constant(emitter, 0), i32_constant(emitter, index) };
+            LLVMValueRef member = LLVMBuildGEP2(b, t, LLVMConstNull(LLVMPointerType(t, 0)), indices, 2, "");
+            return LLVMBuildPtrToInt(b, member, result_t, "");
+        }
+        case select_op: {
+            assert(args.count == 3);
+            LLVMValueRef condition = llvm_emit_value(emitter, fn, args.nodes[0]);
+            LLVMValueRef l = llvm_emit_value(emitter, fn, args.nodes[1]);
+            LLVMValueRef r = llvm_emit_value(emitter, fn, args.nodes[2]);
+            return LLVMBuildSelect(b, condition, l, r, "");
+        }
+        case convert_op: {
+            const Type* src_type = shd_get_unqualified_type(shd_first(args)->type);
+            LLVMValueRef src = llvm_emit_value(emitter, fn, shd_first(args));
+            return emit_convert(b, src, src_type, result_t, shd_first(type_arguments));
+        }
+        case reinterpret_op: {
+            const Type* src_type = shd_get_unqualified_type(shd_first(args)->type);
+            LLVMValueRef src = llvm_emit_value(emitter, fn, shd_first(args));
+            return emit_reinterpret(b, src, src_type, result_t, shd_first(type_arguments));
+        }
+        case insert_op:
+        case extract_dynamic_op:
+        case extract_op: {
+            bool insert = the_op.op == insert_op;
+            size_t indices_start = insert ? 2 : 1;
+            size_t indices_count = args.count - indices_start;
+            assert(args.count > indices_start);
+            LLVMValueRef acc = llvm_emit_value(emitter, fn, shd_first(args));
+
+            if (insert) {
+                LARRAY(unsigned, indices, indices_count);
+                for (size_t i = 0; i < indices_count; i++)
+                    indices[i] = (unsigned) shd_get_int_literal_value(*shd_resolve_to_int_literal(args.nodes[indices_start + i]), false);
+                return insert_at(emitter, b, acc, llvm_emit_value(emitter, fn, args.nodes[1]), indices_count, indices);
+            }
+
+            for (size_t i = indices_start; i < args.count; i++) {
+                const Node* index = args.nodes[i];
+                const IntLiteral* static_index = shd_resolve_to_int_literal(index);
+                if (static_index) {
+                    acc = extract_one(emitter, b, acc, (unsigned) shd_get_int_literal_value(*static_index, false));
+                    continue;
+                }
+                LLVMValueRef dynamic_index = llvm_emit_value(emitter, fn, index);
+                LLVMTypeRef t = LLVMTypeOf(acc);
+                switch (LLVMGetTypeKind(t)) {
+                    case LLVMVectorTypeKind: acc = LLVMBuildExtractElement(b, acc, dynamic_index, ""); break;
+                    case LLVMArrayTypeKind: {
+                        // aggregates can only be indexed dynamically in memory
+                        LLVMValueRef spilled = emit_alloca(emitter, fn, t);
+                        LLVMBuildStore(b, acc, spilled);
+                        LLVMValueRef indices[] = { i32_constant(emitter, 0), dynamic_index };
+                        acc = LLVMBuildLoad2(b, LLVMGetElementType(t), LLVMBuildGEP2(b, t, spilled, indices, 2, ""), "");
+                        break;
+                    }
+                    default: shd_error("Records can only be indexed by constants");
+                }
+            }
+            return acc;
+        }
+        case shuffle_op: {
+            LLVMValueRef lhs = llvm_emit_value(emitter, fn, args.nodes[0]);
+            LLVMValueRef rhs = llvm_emit_value(emitter, fn, args.nodes[1]);
+            LARRAY(LLVMValueRef, mask, args.count - 2);
+            for (size_t i = 2; i < args.count; i++) {
+                int64_t lane = shd_get_int_literal_value(*shd_resolve_to_int_literal(args.nodes[i]), true);
+                mask[i - 2] = lane < 0 ? LLVMGetUndef(LLVMInt32TypeInContext(emitter->context)) : i32_constant(emitter, lane);
+            }
+            return LLVMBuildShuffleVector(b, lhs, rhs, LLVMConstVector(mask, args.count - 2), "");
+        }
+        case subgroup_assume_uniform_op: return llvm_emit_value(emitter, fn, shd_first(args));
+        case sample_texture_op: shd_error("Images and samplers are not supported by the LLVM backend")
+        case empty_mask_op:
+        case mask_is_thread_active_op: shd_error("lower_mask should have taken care of those")
+        default: break;
+    }
+    shd_error("TODO: implement %s in the LLVM backend", shd_get_primop_name(the_op.op));
+}
+
+/// With one invocation per subgroup, which is how the CPU runs them, every subgroup operation is trivial.
+static LLVMValueRef emit_ext_instr(Emitter* emitter, FnEmitter* fn, LLVMBuilderRef b, const Node* instr) {
+    ExtInstr payload = instr->payload.ext_instr;
+    llvm_emit_mem(emitter, fn, payload.mem);
+    if (strcmp(payload.set, "spirv.core") != 0 || emitter->compiler_config->specialization.subgroup_size != 1)
+        shd_error("Unsupported extended instruction: (set = %s, opcode = %d )", payload.set, payload.opcode);
+
+    Nodes operands = payload.operands;
+    LLVMTypeRef result_t = llvm_emit_type(emitter, payload.result_t);
+    switch (payload.opcode) {
+        case SpvOpGroupNonUniformBroadcastFirst: {
+            assert(operands.count == 2);
+            return llvm_emit_value(emitter, fn, operands.nodes[1]);
+        }
+        case SpvOpGroupNonUniformElect:
+        case SpvOpGroupNonUniformAllEqual: return LLVMConstInt(result_t, 1, false);
+        case SpvOpGroupNonUniformAll:
+        case SpvOpGroupNonUniformAny: return llvm_emit_value(emitter, fn, operands.nodes[1]);
+        case SpvOpGroupNonUniformBallot: {
+            LLVMValueRef predicate = llvm_emit_value(emitter, fn, operands.nodes[1]);
+            if (LLVMGetTypeKind(result_t) != LLVMVectorTypeKind)
+                return LLVMBuildZExt(b, predicate, result_t, "");
+            LLVMValueRef word = LLVMBuildZExt(b, predicate, LLVMGetElementType(result_t), "");
+            return LLVMBuildInsertElement(b, LLVMConstNull(result_t), word, i32_constant(emitter, 0), "");
+        }
+        case SpvOpGroupIAdd: case SpvOpGroupNonUniformIAdd:
+        case SpvOpGroupFAdd: case SpvOpGroupNonUniformFAdd:
+        case SpvOpGroupSMin: case SpvOpGroupNonUniformSMin:
+        case SpvOpGroupUMin: case SpvOpGroupNonUniformUMin:
+        case SpvOpGroupFMin: case SpvOpGroupNonUniformFMin:
+        case SpvOpGroupSMax: case SpvOpGroupNonUniformSMax:
+        case SpvOpGroupUMax: case SpvOpGroupNonUniformUMax:
+        case SpvOpGroupFMax: case SpvOpGroupNonUniformFMax:
+        case SpvOpGroupNonUniformIMul: case SpvOpGroupNonUniformFMul:
+        case SpvOpGroupNonUniformBitwiseAnd: case SpvOpGroupNonUniformBitwiseOr: case SpvOpGroupNonUniformBitwiseXor:
+        case SpvOpGroupNonUniformLogicalAnd: case SpvOpGroupNonUniformLogicalOr: case SpvOpGroupNonUniformLogicalXor: {
+            assert(operands.count == 3);
+            SpvGroupOperation group_op = (SpvGroupOperation) shd_get_int_literal_value(*shd_resolve_to_int_literal(operands.nodes[1]), false);
+            switch (group_op) {
+                case SpvGroupOperationReduce:
+                case SpvGroupOperationInclusiveScan: return llvm_emit_value(emitter, fn, operands.nodes[2]);
+                case SpvGroupOperationExclusiveScan: {
+                    switch (payload.opcode) {
+                        case SpvOpGroupIAdd: case SpvOpGroupNonUniformIAdd:
+                        case SpvOpGroupFAdd: case SpvOpGroupNonUniformFAdd: return LLVMConstNull(result_t);
+                        default: break;
+                    }
+                    break;
+                }
+                default: break;
+            }
+            break;
+        }
+        default: break;
+    }
+    shd_error("Unsupported extended instruction: (set = %s, opcode = %d )", payload.set, payload.opcode);
+}
+
+static LLVMValueRef emit_call(Emitter* emitter, FnEmitter* fn, LLVMBuilderRef b, const Node* instr) {
+    Call payload = instr->payload.call;
+    llvm_emit_mem(emitter, fn, payload.mem);
+    LARRAY(LLVMValueRef, args, payload.args.count);
+    for (size_t i = 0; i < payload.args.count; i++)
+        args[i] = llvm_emit_value(emitter, fn, payload.args.nodes[i]);
+
+    LLVMValueRef callee;
+    LLVMTypeRef fn_type;
+    if (payload.callee->tag == FnAddr_TAG) {
+        const Node* decl = payload.callee->payload.fn_addr.fn;
+        callee = llvm_emit_decl(emitter, decl);
+        fn_type = llvm_emit_type(emitter, decl->type);
+    } else {
+        callee = llvm_emit_value(emitter, fn, payload.callee);
+        const Type* callee_type = shd_get_unqualified_type(payload.callee->type);
+        assert(callee_type->tag == PtrType_TAG);
+        fn_type = llvm_emit_type(emitter, callee_type->payload.ptr_type.pointed_type);
+    }
+    return LLVMBuildCall2(b, fn_type, callee, args, payload.args.count, "");
+}
+
+static LLVMValueRef emit_debug_printf(Emitter* emitter, FnEmitter* fn, LLVMBuilderRef b, const Node* instr) {
+    DebugPrintf payload = instr->payload.debug_printf;
+    llvm_emit_mem(emitter, fn, payload.mem);
+    LLVMContextRef ctx = emitter->context;
+    LLVMTypeRef i32 = LLVMInt32TypeInContext(ctx);
+    LLVMTypeRef i8p = LLVMPointerType(LLVMInt8TypeInContext(ctx), 0);
+    LLVMTypeRef printf_t = LLVMFunctionType(i32, &i8p, 1, true);
+    LLVMValueRef printf_fn = LLVMGetNamedFunction(emitter->dst, "printf");
+    if (!printf_fn)
+        printf_fn = LLVMAddFunction(emitter->dst, "printf", printf_t);
+
+    LARRAY(LLVMValueRef, args, payload.args.count + 1);
+    args[0] = LLVMBuildGlobalStringPtr(b, payload.string, "");
+    for (size_t i = 0; i < payload.args.count; i++) {
+        const Node* arg = payload.args.nodes[i];
+        LLVMValueRef value = llvm_emit_value(emitter, fn, arg);
+        // default argument promotions, as a C caller would do them
+        LLVMTypeRef t = LLVMTypeOf(value);
+        switch (LLVMGetTypeKind(t)) {
+            case LLVMHalfTypeKind:
+            case LLVMFloatTypeKind: value = LLVMBuildFPExt(b, value, LLVMDoubleTypeInContext(ctx), ""); break;
+            case LLVMIntegerTypeKind: {
+                if (LLVMGetIntTypeWidth(t) < 32)
+                    value = LLVMBuildIntCast2(b, value, i32, classify_operand(arg) == Signed, "");
+                break;
+            }
+            default: break;
+        }
+        args[i + 1] = value;
+    }
+    LLVMBuildCall2(b, printf_t, printf_fn, args, payload.args.count + 1, "");
+    return NULL;
+}
+
+/// Taken from our own types, so this keeps working once LLVM pointers stop knowing what they point to
+static LLVMTypeRef emit_pointee_type(Emitter* emitter, const Type* ptr_type) {
+    assert(ptr_type->tag == PtrType_TAG);
+    LLVMTypeRef pointee = llvm_emit_type(emitter, ptr_type->payload.ptr_type.pointed_type);
+    if (LLVMGetTypeKind(pointee) == LLVMVoidTypeKind)
+        return LLVMInt8TypeInContext(emitter->context);
+    return pointee;
+}
+
+static LLVMValueRef emit_instruction(Emitter* emitter, FnEmitter* fn, LLVMBuilderRef b, const Node* instruction) {
+    switch (is_instruction(instruction)) {
+        case NotAnInstruction: shd_error("");
+        case Instruction_PushStack_TAG:
+        case Instruction_PopStack_TAG:
+        case Instruction_GetStackSize_TAG:
+        case Instruction_SetStackSize_TAG:
+        case Instruction_GetStackBaseAddr_TAG: shd_error("Stack operations need to be lowered.");
+        case Instruction_ExtInstr_TAG: return emit_ext_instr(emitter, fn, b, instruction);
+        case Instruction_Call_TAG: return emit_call(emitter, fn, b, instruction);
+        case Instruction_DebugPrintf_TAG: return emit_debug_printf(emitter, fn, b, instruction);
+        case PrimOp_TAG: return emit_primop(emitter, fn, b, instruction);
+        case Comment_TAG: {
+            llvm_emit_mem(emitter, fn, instruction->payload.comment.mem);
+            return NULL;
+        }
+        case Instruction_StackAlloc_TAG: {
+            StackAlloc payload = instruction->payload.stack_alloc;
+            llvm_emit_mem(emitter, fn, payload.mem);
+            return emit_alloca(emitter, fn, llvm_emit_type(emitter, payload.type));
+        }
+        case Instruction_LocalAlloc_TAG: {
+            LocalAlloc payload = instruction->payload.local_alloc;
+            llvm_emit_mem(emitter, fn, payload.mem);
+            return emit_alloca(emitter, fn, llvm_emit_type(emitter, payload.type));
+        }
+        case Instruction_Load_TAG: {
+            Load payload = instruction->payload.load;
+            llvm_emit_mem(emitter, fn, payload.mem);
+            LLVMValueRef ptr = llvm_emit_value(emitter, fn, payload.ptr);
+            return LLVMBuildLoad2(b, llvm_emit_type(emitter, instruction->type), ptr, "");
+        }
+        case Instruction_Store_TAG: {
+            Store payload = instruction->payload.store;
+            llvm_emit_mem(emitter, fn, payload.mem);
+            LLVMValueRef ptr = llvm_emit_value(emitter, fn, payload.ptr);
+            LLVMBuildStore(b, llvm_emit_value(emitter, fn, payload.value), ptr);
+            return NULL;
+        }
+        case Instruction_PtrCompositeElement_TAG: {
+            PtrCompositeElement payload = instruction->payload.ptr_composite_element;
+            const Type* ptr_type = shd_get_unqualified_type(payload.ptr->type);
+            assert(ptr_type->tag == PtrType_TAG);
+            LLVMTypeRef pointee = emit_pointee_type(emitter, ptr_type);
+            LLVMValueRef index;
+            // struct members can only be picked with i32 constants
+            if (LLVMGetTypeKind(pointee) == LLVMStructTypeKind)
+                index = i32_constant(emitter, shd_get_int_literal_value(*shd_resolve_to_int_literal(payload.index), false));
+            else
+                index = llvm_emit_value(emitter, fn, payload.index);
+            LLVMValueRef indices[] = { i32_constant(emitter, 0), index };
+            return LLVMBuildGEP2(b, pointee, llvm_emit_value(emitter, fn, payload.ptr), indices, 2, "");
+        }
+        case Instruction_PtrArrayElementOffset_TAG: {
+            PtrArrayElementOffset payload = instruction->payload.ptr_array_element_offset;
+            const Type* ptr_type = shd_get_unqualified_type(payload.ptr->type);
+            assert(ptr_type->tag == PtrType_TAG);
+            LLVMTypeRef pointee = emit_pointee_type(emitter, ptr_type);
+            LLVMValueRef offset = llvm_emit_value(emitter, fn, payload.offset);
+            return LLVMBuildGEP2(b, pointee, llvm_emit_value(emitter, fn, payload.ptr), &offset, 1, "");
+        }
+        case Instruction_CopyBytes_TAG: {
+            CopyBytes payload = instruction->payload.copy_bytes;
+            llvm_emit_mem(emitter, fn, payload.mem);
+            LLVMValueRef dst = llvm_emit_value(emitter, fn, payload.dst);
+            LLVMValueRef src = llvm_emit_value(emitter, fn, payload.src);
+            LLVMBuildMemCpy(b, dst, 1, src, 1, llvm_emit_value(emitter, fn, payload.count));
+            return NULL;
+        }
+        case Instruction_FillBytes_TAG: {
+            FillBytes payload = instruction->payload.fill_bytes;
+            llvm_emit_mem(emitter, fn, payload.mem);
+            LLVMValueRef dst = llvm_emit_value(emitter, fn, payload.dst);
+            LLVMValueRef byte = LLVMBuildIntCast2(b, llvm_emit_value(emitter, fn, payload.src), LLVMInt8TypeInContext(emitter->context), false, "");
+            LLVMBuildMemSet(b, dst, byte, llvm_emit_value(emitter, fn, payload.count), 1);
+            return NULL;
+        }
+    }
+    SHADY_UNREACHABLE;
+}
+
+static LLVMValueRef emit_value_(Emitter* emitter, FnEmitter* fn, LLVMBuilderRef b, const Node* node) {
+    if (is_instruction(node)) {
+        assert(b);
+        return emit_instruction(emitter, fn, b, node);
+    }
+
+    LLVMContextRef ctx = emitter->context;
+    switch (is_value(node)) {
+        case NotAValue: shd_error("");
+        case Param_TAG: shd_error("tried to emit a param: all params should be emitted by their binding abstraction !");
+        case IntLiteral_TAG: return LLVMConstInt(llvm_emit_type(emitter, node->type), shd_get_int_literal_value(node->payload.int_literal, false), false);
+        case FloatLiteral_TAG: {
+            FloatLiteral lit = node->payload.float_literal;
+            LLVMTypeRef bits_t;
+            switch (lit.width) {
+                case FloatTy16: bits_t = LLVMInt16TypeInContext(ctx); break;
+                case FloatTy32: bits_t = LLVMInt32TypeInContext(ctx); break;
+                case FloatTy64: bits_t = LLVMInt64TypeInContext(ctx); break;
+            }
+            return LLVMConstBitCast(LLVMConstInt(bits_t, lit.value, false), llvm_emit_type(emitter, node->type));
+        }
+        case True_TAG: return LLVMConstInt(LLVMInt1TypeInContext(ctx), 1, false);
+        case False_TAG: return LLVMConstInt(LLVMInt1TypeInContext(ctx), 0, false);
+        case Value_StringLiteral_TAG: {
+            String string = node->payload.string_lit.string;
+            return LLVMConstStringInContext(ctx, string, strlen(string), true);
+        }
+        case Value_NullPtr_TAG: return LLVMConstNull(llvm_emit_type(emitter, node->payload.null_ptr.ptr_type));
+        case Value_Undef_TAG: return LLVMGetUndef(llvm_emit_type(emitter, node->payload.undef.type));
+        case Composite_TAG: {
+            Nodes contents = node->payload.composite.contents;
+            LARRAY(LLVMValueRef, members, contents.count);
+            for (size_t i = 0; i < contents.count; i++)
+                members[i] = llvm_emit_value(emitter, fn, contents.nodes[i]);
+            LLVMTypeRef t = llvm_emit_type(emitter, node->type);
+            if (b) {
+                LLVMValueRef acc = LLVMGetUndef(t);
+                for (size_t i = 0; i < contents.count; i++)
+                    acc = insert_at(emitter, b, acc, members[i], 1, (unsigned[]) { i });
+                return acc;
+            }
+            switch (LLVMGetTypeKind(t)) {
+                case LLVMVectorTypeKind: return LLVMConstVector(members, contents.count);
+                case LLVMArrayTypeKind: return LLVMConstArray(LLVMGetElementType(t), members, contents.count);
+                case LLVMStructTypeKind: return LLVMConstNamedStruct(t, members, contents.count);
+                default: shd_error("not a composite type");
+            }
+        }
+        case Value_Fill_TAG: {
+            LLVMTypeRef t = llvm_emit_type(emitter, node->payload.fill.type);
+            LLVMValueRef value = llvm_emit_value(emitter, fn, node->payload.fill.value);
+            unsigned count = LLVMGetTypeKind(t) == LLVMVectorTypeKind ? LLVMGetVectorSize(t) : LLVMGetArrayLength(t);
+            if (b) {
+                LLVMValueRef acc = LLVMGetUndef(t);
+                for (unsigned i = 0; i < count; i++)
+                    acc = insert_at(emitter, b, acc, value, 1, &i);
+                return acc;
+            }
+            LARRAY(LLVMValueRef, members, count);
+            for (unsigned i = 0; i < count; i++)
+                members[i] = value;
+            return LLVMGetTypeKind(t) == LLVMVectorTypeKind ? LLVMConstVector(members, count) : LLVMConstArray(LLVMGetElementType(t), members, count);
+        }
+        case RefDecl_TAG: {
+            const Node* decl = node->payload.ref_decl.decl;
+            switch (decl->tag) {
+                case GlobalVariable_TAG: return llvm_emit_decl(emitter, decl);
+                case Constant_TAG: return llvm_emit_value(emitter, fn, decl->payload.constant.value);
+                default: shd_error("RefDecl must reference a constant or global");
+            }
+        }
+        case FnAddr_TAG: return llvm_emit_decl(emitter, node->payload.fn_addr.fn);
+        case Value_MemAndValue_TAG: {
+            llvm_emit_mem(emitter, fn, node->payload.mem_and_value.mem);
+            return llvm_emit_value(emitter, fn, node->payload.mem_and_value.value);
+        }
+        default: shd_error("Unhandled value for code generation: %s", shd_get_node_tag_string(node->tag));
+    }
+}
+
+static bool can_appear_at_top_level(const Node* node) {
+    switch (node->tag) {
+        case Undef_TAG:
+        case Composite_TAG:
+        case Fill_TAG:
+        case FloatLiteral_TAG:
+        case IntLiteral_TAG:
+        case True_TAG:
+        case False_TAG:
+        case StringLiteral_TAG:
+        case NullPtr_TAG:
+        case RefDecl_TAG:
+        case FnAddr_TAG:
+            return true;
+        default: break;
+    }
+    return false;
+}
+
+LLVMValueRef llvm_emit_value(Emitter* emitter, FnEmitter* fn, const Node* node) {
+    LLVMValueRef* existing = llvm_search_emitted(emitter, fn, node);
+    if (existing)
+        return *existing;
+
+    CFNode* where = fn ? shd_schedule_instruction(fn->scheduler, node) : NULL;
+    if (where || !can_appear_at_top_level(node)) {
+        if (!fn) {
+            shd_log_node(ERROR, node);
+            shd_log_fmt(ERROR, "cannot appear at top-level");
+            exit(-1);
+        }
+        // Unscheduled values go in the entry block of the current fn
+        LLVMBuilderRef b = llvm_new_builder_in_block(emitter, fn->blocks[where ? where->rpo_index : 0]);
+        LLVMValueRef emitted = emit_value_(emitter, fn, b, node);
+        LLVMDisposeBuilder(b);
+        llvm_register_emitted(emitter, fn, node, emitted);
+        return emitted;
+    }
+    assert(!is_mem(node));
+    LLVMValueRef emitted = emit_value_(emitter, NULL, NULL, node);
+    llvm_register_emitted(emitter, NULL, node, emitted);
+    return emitted;
+}
+
+void llvm_emit_mem(Emitter* emitter, FnEmitter* fn, const Node* mem) {
+    assert(is_mem(mem));
+    if (mem->tag == AbsMem_TAG)
+        return;
+    if (is_instruction(mem) || mem->tag == MemAndValue_TAG) {
+        llvm_emit_value(emitter, fn, mem);
+        return;
+    }
+    shd_error("What sort of mem is this ?");
+}
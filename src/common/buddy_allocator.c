@@ -0,0 +1,116 @@
+#include "buddy_allocator.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+
+/// Implicit binary tree over the units: each node stores 1 + the order of the largest free range in its subtree, or 0 if it has none.
+/// An allocated node is marked with 0 while its descendants keep their (fully free) state, which is how free() finds it again.
+struct BuddyAllocator_ {
+    size_t unit_size;
+    size_t units_count;
+    uint8_t root_order;
+    size_t used;
+    uint8_t* tree;
+};
+
+static uint8_t ceil_log2(size_t n) {
+    uint8_t order = 0;
+    while (((size_t) 1 << order) < n)
+        order++;
+    return order;
+}
+
+static uint8_t max_u8(uint8_t a, uint8_t b) { return a > b ? a : b; }
+
+BuddyAllocator* shd_new_buddy_allocator(size_t unit_size, size_t units_count) {
+    assert(units_count > 0 && (units_count & (units_count - 1)) == 0 && "units_count must be a power of two");
+    BuddyAllocator* allocator = calloc(1, sizeof(BuddyAllocator));
+    *allocator = (BuddyAllocator) {
+        .unit_size = unit_size,
+        .units_count = units_count,
+        .root_order = ceil_log2(units_count),
+        .tree = malloc(2 * units_count - 1),
+    };
+    size_t first = 0;
+    for (uint8_t depth = 0; depth <= allocator->root_order; depth++) {
+        size_t count = (size_t) 1 << depth;
+        for (size_t i = 0; i < count; i++)
+            allocator->tree[first + i] = allocator->root_order - depth + 1;
+        first += count;
+    }
+    return allocator;
+}
+
+void shd_destroy_buddy_allocator(BuddyAllocator* allocator) {
+    free(allocator->tree);
+    free(allocator);
+}
+
+bool shd_buddy_alloc(BuddyAllocator* allocator, size_t size, size_t alignment, size_t* offset) {
+    assert((alignment & (alignment - 1)) == 0);
+    if (alignment > size)
+        size = alignment;
+    size_t units = (size + allocator->unit_size - 1) / allocator->unit_size;
+    if (units == 0)
+        units = 1;
+    uint8_t order = ceil_log2(units);
+    if (order > allocator->root_order || allocator->tree[0] < order + 1)
+        return false;
+
+    size_t index = 0;
+    for (uint8_t node_order = allocator->root_order; node_order != order; node_order--) {
+        size_t left = index * 2 + 1;
+        index = allocator->tree[left] >= order + 1 ? left : left + 1;
+    }
+    allocator->tree[index] = 0;
+
+    size_t node_units = (size_t) 1 << order;
+    *offset = ((index + 1) * node_units - allocator->units_count) * allocator->unit_size;
+
+    while (index > 0) {
+        index = (index - 1) / 2;
+        allocator->tree[index] = max_u8(allocator->tree[index * 2 + 1], allocator->tree[index * 2 + 2]);
+    }
+
+    allocator->used += node_units * allocator->unit_size;
+    return true;
+}
+
+size_t shd_buddy_free(BuddyAllocator* allocator, size_t offset) {
+    assert(offset % allocator->unit_size == 0);
+    size_t index = offset / allocator->unit_size + allocator->units_count - 1;
+    uint8_t order = 0;
+    while (allocator->tree[index] != 0) {
+        assert(index > 0 && "double free or bogus offset");
+        index = (index - 1) / 2;
+        order++;
+    }
+    allocator->tree[index] = order + 1;
+    size_t freed = ((size_t) 1 << order) * allocator->unit_size;
+
+    // coalesce with free buddies on the way up
+    while (index > 0) {
+        index = (index - 1) / 2;
+        order++;
+        uint8_t left = allocator->tree[index * 2 + 1];
+        uint8_t right = allocator->tree[index * 2 + 2];
+        if (left == order && right == order)
+            allocator->tree[index] = order + 1;
+        else
+            allocator->tree[index] = max_u8(left, right);
+    }
+
+    allocator->used -= freed;
+    return freed;
+}
+
+size_t shd_buddy_capacity(BuddyAllocator* allocator) { return allocator->units_count * allocator->unit_size; }
+
+size_t shd_buddy_used(BuddyAllocator* allocator) { return allocator->used; }
+
+size_t shd_buddy_largest_free_range(BuddyAllocator* allocator) {
+    if (allocator->tree[0] == 0)
+        return 0;
+    return ((size_t) 1 << (allocator->tree[0] - 1)) * allocator->unit_size;
+}
@@ -0,0 +1,25 @@
+#ifndef SHADY_BUDDY_ALLOCATOR_H
+#define SHADY_BUDDY_ALLOCATOR_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/// Hands out ranges of an abstract address space (typically a block of device memory).
+/// Ranges are power-of-two multiples of the unit size and are aligned to their own size.
+/// The bookkeeping lives entirely on the host, the managed memory is never touched.
+typedef struct BuddyAllocator_ BuddyAllocator;
+
+/// units_count must be a power of two
+BuddyAllocator* shd_new_buddy_allocator(size_t unit_size, size_t units_count);
+void shd_destroy_buddy_allocator(BuddyAllocator*);
+
+/// Alignment must be a power of two, returns false if no suitably sized range is free
+bool shd_buddy_alloc(BuddyAllocator*, size_t size, size_t alignment, size_t* offset);
+/// Returns the size of the range that was released
+size_t shd_buddy_free(BuddyAllocator*, size_t offset);
+
+size_t shd_buddy_capacity(BuddyAllocator*);
+size_t shd_buddy_used(BuddyAllocator*);
+size_t shd_buddy_largest_free_range(BuddyAllocator*);
+
+#endif
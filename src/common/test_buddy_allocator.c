@@ -0,0 +1,85 @@
+#include "buddy_allocator.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define UNIT_SIZE 256
+#define UNITS_COUNT 4096
+#define TEST_ITERATIONS 100000
+#define MAX_LIVE 512
+
+typedef struct {
+    bool live;
+    size_t offset;
+    size_t size;
+} Allocation;
+
+// which allocation owns each unit, to detect overlaps
+static int owner[UNITS_COUNT];
+
+// fixed so that runs are reproducible, another one can be passed as the first argument
+static unsigned seed = 42;
+
+static void check(bool condition, const char* what) {
+    if (!condition) {
+        shd_error_print("buddy allocator test failed with seed %u: %s\n", seed, what);
+        exit(-1);
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1)
+        seed = (unsigned) strtoul(argv[1], NULL, 10);
+    srand(seed);
+    BuddyAllocator* allocator = shd_new_buddy_allocator(UNIT_SIZE, UNITS_COUNT);
+    check(shd_buddy_largest_free_range(allocator) == UNIT_SIZE * UNITS_COUNT, "initially everything is free");
+
+    // the whole range can be taken in one go, and nothing else fits afterwards
+    size_t offset;
+    check(shd_buddy_alloc(allocator, UNIT_SIZE * UNITS_COUNT, 1, &offset) && offset == 0, "allocate everything");
+    check(!shd_buddy_alloc(allocator, 1, 1, &offset), "allocating from a full allocator fails");
+    check(shd_buddy_free(allocator, 0) == UNIT_SIZE * UNITS_COUNT, "free everything");
+
+    Allocation live[MAX_LIVE] = { 0 };
+    memset(owner, -1, sizeof(owner));
+    size_t failures = 0;
+    for (size_t it = 0; it < TEST_ITERATIONS; it++) {
+        int slot = rand() % MAX_LIVE;
+        Allocation* a = &live[slot];
+        if (a->live) {
+            size_t freed = shd_buddy_free(allocator, a->offset);
+            check(freed >= a->size, "freed range covers the allocation");
+            for (size_t u = a->offset / UNIT_SIZE; u < (a->offset + a->size + UNIT_SIZE - 1) / UNIT_SIZE; u++)
+                owner[u] = -1;
+            a->live = false;
+        } else {
+            size_t size = 1 + rand() % (UNIT_SIZE * 32);
+            size_t alignment = (size_t) 1 << (rand() % 12);
+            if (!shd_buddy_alloc(allocator, size, alignment, &a->offset)) {
+                failures++;
+                continue;
+            }
+            check(a->offset % alignment == 0, "allocation is aligned");
+            check(a->offset + size <= UNIT_SIZE * UNITS_COUNT, "allocation is in bounds");
+            for (size_t u = a->offset / UNIT_SIZE; u < (a->offset + size + UNIT_SIZE - 1) / UNIT_SIZE; u++) {
+                check(owner[u] == -1, "allocations do not overlap");
+                owner[u] = slot;
+            }
+            a->size = size;
+            a->live = true;
+        }
+    }
+
+    for (size_t i = 0; i < MAX_LIVE; i++) {
+        if (live[i].live)
+            shd_buddy_free(allocator, live[i].offset);
+    }
+    check(shd_buddy_used(allocator) == 0, "everything was returned");
+    check(shd_buddy_largest_free_range(allocator) == UNIT_SIZE * UNITS_COUNT, "free ranges coalesce back");
+    printf("%zu allocations could not be satisfied out of %d iterations\n", failures, TEST_ITERATIONS);
+
+    shd_destroy_buddy_allocator(allocator);
+    return 0;
+}
@@ -0,0 +1,58 @@
+#include "thread_pool.h"
+#include "threads.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#define TEST_JOBS 10000
+
+typedef struct {
+    Mutex* mutex;
+    size_t sum;
+} Counter;
+
+typedef struct {
+    Counter* counter;
+    size_t value;
+} Job;
+
+static void add_to_counter(Job* job) {
+    shd_mutex_lock(job->counter->mutex);
+    job->counter->sum += job->value;
+    shd_mutex_unlock(job->counter->mutex);
+}
+
+int main(int argc, char** argv) {
+    Counter counter = { .mutex = shd_new_mutex() };
+    Job* jobs = calloc(TEST_JOBS, sizeof(Job));
+
+    ThreadPool* pool = shd_new_thread_pool(0);
+    printf("thread pool has %zu workers\n", shd_thread_pool_size(pool));
+
+    for (size_t i = 0; i < TEST_JOBS; i++) {
+        jobs[i] = (Job) { .counter = &counter, .value = i };
+        shd_thread_pool_submit(pool, (void (*)(void*)) add_to_counter, &jobs[i]);
+    }
+    shd_thread_pool_wait_idle(pool);
+
+    size_t expected = (size_t) TEST_JOBS * (TEST_JOBS - 1) / 2;
+    if (counter.sum != expected) {
+        shd_error_print("Expected sum %zu but got %zu\n", expected, counter.sum);
+        exit(-1);
+    }
+
+    // jobs still queued on destruction must run to completion
+    counter.sum = 0;
+    for (size_t i = 0; i < TEST_JOBS; i++)
+        shd_thread_pool_submit(pool, (void (*)(void*)) add_to_counter, &jobs[i]);
+    shd_destroy_thread_pool(pool);
+    if (counter.sum != expected) {
+        shd_error_print("Expected sum %zu after shutdown but got %zu\n", expected, counter.sum);
+        exit(-1);
+    }
+
+    free(jobs);
+    shd_destroy_mutex(counter.mutex);
+    return 0;
+}
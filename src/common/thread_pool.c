@@ -0,0 +1,111 @@
+#include "thread_pool.h"
+#include "threads.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <assert.h>
+
+typedef struct Job_ Job;
+struct Job_ {
+    void (*fn)(void*);
+    void* uptr;
+    Job* next;
+};
+
+struct ThreadPool_ {
+    Mutex* mutex;
+    /// signalled when a job is queued or the pool shuts down
+    CondVar* job_available;
+    /// signalled when the pool becomes idle
+    CondVar* idle;
+
+    Job* head;
+    Job* tail;
+    size_t running;
+    bool shutting_down;
+
+    size_t threads_count;
+    Thread** threads;
+};
+
+static void worker_loop(ThreadPool* pool) {
+    shd_mutex_lock(pool->mutex);
+    while (true) {
+        while (!pool->head && !pool->shutting_down)
+            shd_cond_var_wait(pool->job_available, pool->mutex);
+        Job* job = pool->head;
+        if (!job)
+            break;
+        pool->head = job->next;
+        if (!pool->head)
+            pool->tail = NULL;
+        pool->running++;
+        shd_mutex_unlock(pool->mutex);
+
+        job->fn(job->uptr);
+        free(job);
+
+        shd_mutex_lock(pool->mutex);
+        pool->running--;
+        if (!pool->head && pool->running == 0)
+            shd_cond_var_broadcast(pool->idle);
+    }
+    shd_mutex_unlock(pool->mutex);
+}
+
+ThreadPool* shd_new_thread_pool(size_t threads_count) {
+    if (threads_count == 0)
+        threads_count = shd_get_cpu_count();
+    ThreadPool* pool = calloc(1, sizeof(ThreadPool));
+    *pool = (ThreadPool) {
+        .mutex = shd_new_mutex(),
+        .job_available = shd_new_cond_var(),
+        .idle = shd_new_cond_var(),
+        .threads_count = threads_count,
+        .threads = calloc(threads_count, sizeof(Thread*)),
+    };
+    for (size_t i = 0; i < threads_count; i++)
+        pool->threads[i] = shd_spawn_thread((void (*)(void*)) worker_loop, pool);
+    return pool;
+}
+
+void shd_destroy_thread_pool(ThreadPool* pool) {
+    shd_mutex_lock(pool->mutex);
+    pool->shutting_down = true;
+    shd_cond_var_broadcast(pool->job_available);
+    shd_mutex_unlock(pool->mutex);
+
+    for (size_t i = 0; i < pool->threads_count; i++)
+        shd_join_thread(pool->threads[i]);
+    assert(!pool->head);
+
+    free(pool->threads);
+    shd_destroy_cond_var(pool->idle);
+    shd_destroy_cond_var(pool->job_available);
+    shd_destroy_mutex(pool->mutex);
+    free(pool);
+}
+
+size_t shd_thread_pool_size(ThreadPool* pool) { return pool->threads_count; }
+
+void shd_thread_pool_submit(ThreadPool* pool, void (*fn)(void*), void* uptr) {
+    Job* job = calloc(1, sizeof(Job));
+    *job = (Job) { .fn = fn, .uptr = uptr };
+
+    shd_mutex_lock(pool->mutex);
+    assert(!pool->shutting_down);
+    if (pool->tail)
+        pool->tail->next = job;
+    else
+        pool->head = job;
+    pool->tail = job;
+    shd_cond_var_signal(pool->job_available);
+    shd_mutex_unlock(pool->mutex);
+}
+
+void shd_thread_pool_wait_idle(ThreadPool* pool) {
+    shd_mutex_lock(pool->mutex);
+    while (pool->head || pool->running > 0)
+        shd_cond_var_wait(pool->idle, pool->mutex);
+    shd_mutex_unlock(pool->mutex);
+}
@@ -0,0 +1,20 @@
+#ifndef SHADY_THREAD_POOL_H
+#define SHADY_THREAD_POOL_H
+
+#include <stddef.h>
+
+/// Fixed-size pool of worker threads consuming jobs in FIFO order.
+typedef struct ThreadPool_ ThreadPool;
+
+/// A thread count of zero picks one worker per CPU.
+ThreadPool* shd_new_thread_pool(size_t threads_count);
+/// Runs all the jobs still queued before tearing the workers down.
+void shd_destroy_thread_pool(ThreadPool*);
+
+size_t shd_thread_pool_size(ThreadPool*);
+
+void shd_thread_pool_submit(ThreadPool*, void (*fn)(void*), void* uptr);
+/// Blocks until the queue is empty and no job is running.
+void shd_thread_pool_wait_idle(ThreadPool*);
+
+#endif
@@ -0,0 +1,140 @@
+#include "threads.h"
+
+#include <stdlib.h>
+#include <assert.h>
+
+#ifdef _WIN32
+#include <windows.h>
+
+struct Mutex_ { SRWLOCK lock; };
+struct CondVar_ { CONDITION_VARIABLE cv; };
+struct Thread_ {
+    HANDLE handle;
+    void (*fn)(void*);
+    void* uptr;
+};
+
+Mutex* shd_new_mutex(void) {
+    Mutex* m = calloc(1, sizeof(Mutex));
+    InitializeSRWLock(&m->lock);
+    return m;
+}
+
+void shd_destroy_mutex(Mutex* m) { free(m); }
+void shd_mutex_lock(Mutex* m) { AcquireSRWLockExclusive(&m->lock); }
+void shd_mutex_unlock(Mutex* m) { ReleaseSRWLockExclusive(&m->lock); }
+
+CondVar* shd_new_cond_var(void) {
+    CondVar* c = calloc(1, sizeof(CondVar));
+    InitializeConditionVariable(&c->cv);
+    return c;
+}
+
+void shd_destroy_cond_var(CondVar* c) { free(c); }
+void shd_cond_var_wait(CondVar* c, Mutex* m) { SleepConditionVariableSRW(&c->cv, &m->lock, INFINITE, 0); }
+void shd_cond_var_signal(CondVar* c) { WakeConditionVariable(&c->cv); }
+void shd_cond_var_broadcast(CondVar* c) { WakeAllConditionVariable(&c->cv); }
+
+static DWORD WINAPI thread_trampoline(LPVOID uptr) {
+    Thread* t = uptr;
+    t->fn(t->uptr);
+    return 0;
+}
+
+Thread* shd_spawn_thread(void (*fn)(void*), void* uptr) {
+    Thread* t = calloc(1, sizeof(Thread));
+    t->fn = fn;
+    t->uptr = uptr;
+    t->handle = CreateThread(NULL, 0, thread_trampoline, t, 0, NULL);
+    assert(t->handle);
+    return t;
+}
+
+void shd_join_thread(Thread* t) {
+    WaitForSingleObject(t->handle, INFINITE);
+    CloseHandle(t->handle);
+    free(t);
+}
+
+size_t shd_get_cpu_count(void) {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+}
+
+uint64_t shd_atomic_fetch_add(volatile uint64_t* target, uint64_t value) {
+    return (uint64_t) InterlockedExchangeAdd64((volatile LONG64*) target, (LONG64) value);
+}
+
+#else
+#include <pthread.h>
+#include <unistd.h>
+
+struct Mutex_ { pthread_mutex_t mutex; };
+struct CondVar_ { pthread_cond_t cond; };
+struct Thread_ {
+    pthread_t handle;
+    void (*fn)(void*);
+    void* uptr;
+};
+
+Mutex* shd_new_mutex(void) {
+    Mutex* m = calloc(1, sizeof(Mutex));
+    pthread_mutex_init(&m->mutex, NULL);
+    return m;
+}
+
+void shd_destroy_mutex(Mutex* m) {
+    pthread_mutex_destroy(&m->mutex);
+    free(m);
+}
+
+void shd_mutex_lock(Mutex* m) { pthread_mutex_lock(&m->mutex); }
+void shd_mutex_unlock(Mutex* m) { pthread_mutex_unlock(&m->mutex); }
+
+CondVar* shd_new_cond_var(void) {
+    CondVar* c = calloc(1, sizeof(CondVar));
+    pthread_cond_init(&c->cond, NULL);
+    return c;
+}
+
+void shd_destroy_cond_var(CondVar* c) {
+    pthread_cond_destroy(&c->cond);
+    free(c);
+}
+
+void shd_cond_var_wait(CondVar* c, Mutex* m) { pthread_cond_wait(&c->cond, &m->mutex); }
+void shd_cond_var_signal(CondVar* c) { pthread_cond_signal(&c->cond); }
+void shd_cond_var_broadcast(CondVar* c) { pthread_cond_broadcast(&c->cond); }
+
+static void* thread_trampoline(void* uptr) {
+    Thread* t = uptr;
+    t->fn(t->uptr);
+    return NULL;
+}
+
+Thread* shd_spawn_thread(void (*fn)(void*), void* uptr) {
+    Thread* t = calloc(1, sizeof(Thread));
+    t->fn = fn;
+    t->uptr = uptr;
+    int err = pthread_create(&t->handle, NULL, thread_trampoline, t);
+    assert(err == 0);
+    (void) err;
+    return t;
+}
+
+void shd_join_thread(Thread* t) {
+    pthread_join(t->handle, NULL);
+    free(t);
+}
+
+size_t shd_get_cpu_count(void) {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (size_t) count : 1;
+}
+
+uint64_t shd_atomic_fetch_add(volatile uint64_t* target, uint64_t value) {
+    return __atomic_fetch_add(target, value, __ATOMIC_SEQ_CST);
+}
+
+#endif
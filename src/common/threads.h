@@ -0,0 +1,31 @@
+#ifndef SHADY_THREADS_H
+#define SHADY_THREADS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// Thin portable layer over pthreads/Win32, since C11 <threads.h> is missing on MacOS and older MSVC.
+typedef struct Mutex_ Mutex;
+typedef struct CondVar_ CondVar;
+typedef struct Thread_ Thread;
+
+Mutex* shd_new_mutex(void);
+void shd_destroy_mutex(Mutex*);
+void shd_mutex_lock(Mutex*);
+void shd_mutex_unlock(Mutex*);
+
+CondVar* shd_new_cond_var(void);
+void shd_destroy_cond_var(CondVar*);
+void shd_cond_var_wait(CondVar*, Mutex*);
+void shd_cond_var_signal(CondVar*);
+void shd_cond_var_broadcast(CondVar*);
+
+Thread* shd_spawn_thread(void (*fn)(void*), void* uptr);
+void shd_join_thread(Thread*);
+
+size_t shd_get_cpu_count(void);
+
+/// Returns the value `target` held before adding `value` to it.
+uint64_t shd_atomic_fetch_add(volatile uint64_t* target, uint64_t value);
+
+#endif
@@ -1,6 +1,7 @@
 #include "util.h"
 #include "printer.h"
 #include "arena.h"
+#include "portability.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -164,7 +165,7 @@ enum {
     ThreadLocalStaticBufferSize = 256
 };
 
-static char static_buffer[ThreadLocalStaticBufferSize];
+static SHADY_THREAD_LOCAL char static_buffer[ThreadLocalStaticBufferSize];
 
 void shd_format_string_internal(const char* str, va_list args, void* uptr, void callback(void*, size_t, char*)) {
     size_t buffer_size = ThreadLocalStaticBufferSize;
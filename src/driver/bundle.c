@@ -0,0 +1,503 @@
+#include "shady/driver.h"
+#include "shady/ir.h"
+#include "shady/ir/memory_layout.h"
+
+#include "log.h"
+#include "list.h"
+#include "arena.h"
+#include "growy.h"
+#include "util.h"
+#include "portability.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+struct KernelBundle_ {
+    Arena* arena;
+    uint64_t config_fingerprint;
+    struct List* kernels;
+};
+
+/// FNV-1a, the fingerprint ends up in files so it has to be stable across runs and platforms
+static uint64_t hash_bytes(uint64_t hash, size_t size, const void* data) {
+    const unsigned char* bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= UINT64_C(0x100000001b3);
+    }
+    return hash;
+}
+
+#define HASH_FIELD(field) hash = hash_bytes(hash, sizeof(uint64_t), &(uint64_t) { (uint64_t) (field) });
+
+uint64_t shd_driver_config_fingerprint(const CompilerConfig* config) {
+    uint64_t hash = UINT64_C(0xcbf29ce484222325);
+    HASH_FIELD(config->dynamic_scheduling)
+    HASH_FIELD(config->per_thread_stack_size)
+    HASH_FIELD(config->target_spirv_version.major)
+    HASH_FIELD(config->target_spirv_version.minor)
+    HASH_FIELD(config->input_cf.restructure_with_heuristics)
+    HASH_FIELD(config->input_cf.add_scope_annotations)
+    HASH_FIELD(config->input_cf.has_scope_annotations)
+    HASH_FIELD(config->lower.emulate_generic_ptrs)
+    HASH_FIELD(config->lower.emulate_physical_memory)
+    HASH_FIELD(config->lower.emulate_subgroup_ops)
+    HASH_FIELD(config->lower.emulate_subgroup_ops_extended_types)
+    HASH_FIELD(config->lower.int64)
+    HASH_FIELD(config->lower.decay_ptrs)
+    HASH_FIELD(config->hacks.spv_shuffle_instead_of_broadcast_first)
+    HASH_FIELD(config->hacks.force_join_point_lifting)
+    HASH_FIELD(config->optimisations.cleanup.after_every_pass)
+    HASH_FIELD(config->optimisations.cleanup.delete_unused_instructions)
+    HASH_FIELD(config->optimisations.inline_everything)
+    HASH_FIELD(config->printf_trace.memory_accesses)
+    HASH_FIELD(config->printf_trace.stack_accesses)
+    HASH_FIELD(config->printf_trace.god_function)
+    HASH_FIELD(config->printf_trace.stack_size)
+    HASH_FIELD(config->printf_trace.subgroup_ops)
+    HASH_FIELD(config->specialization.execution_model)
+    HASH_FIELD(config->specialization.subgroup_size)
+    HASH_FIELD(config->target.memory.ptr_size)
+    HASH_FIELD(config->target.memory.word_size)
+    return hash;
+}
+
+#undef HASH_FIELD
+
+KernelBundle* shd_new_kernel_bundle(uint64_t config_fingerprint) {
+    KernelBundle* bundle = calloc(1, sizeof(KernelBundle));
+    bundle->arena = shd_new_arena();
+    bundle->config_fingerprint = config_fingerprint;
+    bundle->kernels = shd_new_list(CompiledKernel*);
+    return bundle;
+}
+
+void shd_destroy_kernel_bundle(KernelBundle* bundle) {
+    shd_destroy_list(bundle->kernels);
+    shd_destroy_arena(bundle->arena);
+    free(bundle);
+}
+
+uint64_t shd_kernel_bundle_fingerprint(const KernelBundle* bundle) {
+    return bundle->config_fingerprint;
+}
+
+size_t shd_kernel_bundle_count(const KernelBundle* bundle) {
+    return shd_list_count(bundle->kernels);
+}
+
+const CompiledKernel* shd_kernel_bundle_get(const KernelBundle* bundle, size_t i) {
+    assert(i < shd_list_count(bundle->kernels));
+    return shd_read_list(CompiledKernel*, bundle->kernels)[i];
+}
+
+const CompiledKernel* shd_kernel_bundle_find(const KernelBundle* bundle, String entry_point) {
+    for (size_t i = 0; i < shd_list_count(bundle->kernels); i++) {
+        CompiledKernel* kernel = shd_read_list(CompiledKernel*, bundle->kernels)[i];
+        if (strcmp(kernel->entry_point, entry_point) == 0)
+            return kernel;
+    }
+    return NULL;
+}
+
+static void* copy_into_arena(Arena* arena, size_t size, const void* data) {
+    void* copy = shd_arena_alloc(arena, size > 0 ? size : 1);
+    if (size > 0)
+        memcpy(copy, data, size);
+    return copy;
+}
+
+static void write_value(unsigned char* tgt, const Node* value) {
+    IrArena* a = value->arena;
+    switch (value->tag) {
+        case IntLiteral_TAG: {
+            switch (value->payload.int_literal.width) {
+                case IntTy8: *((uint8_t*) tgt) = (uint8_t) (value->payload.int_literal.value & 0xFF); break;
+                case IntTy16: *((uint16_t*) tgt) = (uint16_t) (value->payload.int_literal.value & 0xFFFF); break;
+                case IntTy32: *((uint32_t*) tgt) = (uint32_t) (value->payload.int_literal.value & 0xFFFFFFFF); break;
+                case IntTy64: *((uint64_t*) tgt) = (uint64_t) (value->payload.int_literal.value); break;
+            }
+            break;
+        }
+        case Composite_TAG: {
+            Nodes values = value->payload.composite.contents;
+            const Type* struct_t = value->payload.composite.type;
+            struct_t = shd_get_maybe_nominal_type_body(struct_t);
+
+            if (struct_t->tag == RecordType_TAG) {
+                LARRAY(FieldLayout, fields, values.count);
+                shd_get_record_layout(a, struct_t, fields);
+                for (size_t i = 0; i < values.count; i++) {
+                    // TypeMemLayout layout = get_mem_layout(value->arena, get_unqualified_type(element->type));
+                    write_value(tgt + fields->offset_in_bytes, values.nodes[i]);
+                }
+            } else if (struct_t->tag == ArrType_TAG) {
+                for (size_t i = 0; i < values.count; i++) {
+                    TypeMemLayout layout = shd_get_mem_layout(value->arena, shd_get_unqualified_type(values.nodes[i]->type));
+                    write_value(tgt, values.nodes[i]);
+                    tgt += layout.size_in_bytes;
+                }
+            } else {
+                assert(false);
+            }
+            break;
+        }
+        default:
+            assert(false);
+    }
+}
+
+static void extract_resources_layout(Arena* arena, Module* mod, CompiledKernel* kernel) {
+    struct List* resources = shd_new_list(KernelResourceLayout);
+
+    Nodes decls = shd_module_get_declarations(mod);
+    for (size_t i = 0; i < decls.count; i++) {
+        const Node* decl = decls.nodes[i];
+        if (decl->tag != GlobalVariable_TAG) continue;
+
+        if (shd_lookup_annotation(decl, "Constants")) {
+            AddressSpace as = decl->payload.global_variable.address_space;
+            switch (as) {
+                case AsShaderStorageBufferObject:
+                case AsUniform: break;
+                default: continue;
+            }
+
+            int set = shd_get_int_literal_value(*shd_resolve_to_int_literal(shd_get_annotation_value(shd_lookup_annotation(decl, "DescriptorSet"))), false);
+            int binding = shd_get_int_literal_value(*shd_resolve_to_int_literal(shd_get_annotation_value(shd_lookup_annotation(decl, "DescriptorBinding"))), false);
+
+            int block_index = (int) shd_list_count(resources);
+            KernelResourceLayout block = {
+                .parent = -1,
+                .set = set,
+                .binding = binding,
+                .as = as,
+            };
+            shd_list_append(KernelResourceLayout, resources, block);
+
+            const Type* struct_t = decl->payload.global_variable.type;
+            assert(struct_t->tag == RecordType_TAG && struct_t->payload.record_type.special == DecorateBlock);
+
+            for (size_t j = 0; j < struct_t->payload.record_type.members.count; j++) {
+                const Type* member_t = struct_t->payload.record_type.members.nodes[j];
+                assert(member_t->tag == PtrType_TAG);
+                member_t = shd_get_pointee_type(member_t->arena, member_t);
+                TypeMemLayout layout = shd_get_mem_layout(shd_module_get_arena(mod), member_t);
+
+                KernelResourceLayout* parent = &shd_read_list(KernelResourceLayout, resources)[block_index];
+                KernelResourceLayout constant = {
+                    .parent = block_index,
+                    .set = -1,
+                    .binding = -1,
+                    .as = as,
+                    .offset = parent->size,
+                    .size = layout.size_in_bytes,
+                };
+                parent->size += sizeof(uint64_t);
+
+                Nodes annotations = get_declaration_annotations(decl);
+                for (size_t k = 0; k < annotations.count; k++) {
+                    const Node* a = annotations.nodes[k];
+                    if ((strcmp(get_annotation_name(a), "InitialValue") == 0) && shd_resolve_to_int_literal(shd_first(shd_get_annotation_values(a)))->value == j) {
+                        unsigned char* default_data = shd_arena_alloc(arena, layout.size_in_bytes);
+                        write_value(default_data, shd_get_annotation_values(a).nodes[1]);
+                        constant.default_data = default_data;
+                    }
+                }
+                shd_list_append(KernelResourceLayout, resources, constant);
+            }
+        }
+    }
+
+    kernel->resources_count = shd_list_count(resources);
+    kernel->resources = copy_into_arena(arena, kernel->resources_count * sizeof(KernelResourceLayout), shd_read_list(KernelResourceLayout, resources));
+    shd_destroy_list(resources);
+}
+
+static bool extract_parameters_info(Arena* arena, Module* mod, CompiledKernel* kernel) {
+    Nodes decls = shd_module_get_declarations(mod);
+
+    const Node* args_struct_annotation;
+    const Node* args_struct_type = NULL;
+    const Node* entry_point_function = NULL;
+
+    for (int i = 0; i < decls.count; ++i) {
+        const Node* node = decls.nodes[i];
+
+        switch (node->tag) {
+            case GlobalVariable_TAG: {
+                const Node* entry_point_args_annotation = shd_lookup_annotation(node, "EntryPointArgs");
+                if (entry_point_args_annotation) {
+                    if (node->payload.global_variable.type->tag != RecordType_TAG) {
+                        shd_error_print("EntryPointArgs must be a struct\n");
+                        return false;
+                    }
+
+                    if (args_struct_type) {
+                        shd_error_print("there cannot be more than one EntryPointArgs\n");
+                        return false;
+                    }
+
+                    args_struct_annotation = entry_point_args_annotation;
+                    args_struct_type = node->payload.global_variable.type;
+                }
+                break;
+            }
+            case Function_TAG: {
+                if (shd_lookup_annotation(node, "EntryPoint")) {
+                    if (node->payload.fun.params.count != 0) {
+                        shd_error_print("EntryPoint cannot have parameters\n");
+                        return false;
+                    }
+
+                    if (entry_point_function) {
+                        shd_error_print("there cannot be more than one EntryPoint\n");
+                        return false;
+                    }
+
+                    entry_point_function = node;
+                }
+                break;
+            }
+            default: break;
+        }
+    }
+
+    if (!entry_point_function) {
+        shd_error_print("could not find EntryPoint\n");
+        return false;
+    }
+
+    if (!args_struct_type) {
+        kernel->args_count = 0;
+        kernel->args_size = 0;
+        return true;
+    }
+
+    if (args_struct_annotation->tag != AnnotationValue_TAG) {
+        shd_error_print("EntryPointArgs annotation must contain exactly one value\n");
+        return false;
+    }
+
+    const Node* annotation_fn = args_struct_annotation->payload.annotation_value.value;
+    assert(annotation_fn->tag == FnAddr_TAG);
+    if (annotation_fn->payload.fn_addr.fn != entry_point_function) {
+        shd_error_print("EntryPointArgs annotation refers to different EntryPoint\n");
+        return false;
+    }
+
+    size_t num_args = args_struct_type->payload.record_type.members.count;
+
+    if (num_args == 0) {
+        shd_error_print("EntryPointArgs cannot be shd_empty\n");
+        return false;
+    }
+
+    IrArena* a = shd_module_get_arena(mod);
+
+    LARRAY(FieldLayout, fields, num_args);
+    shd_get_record_layout(a, args_struct_type, fields);
+
+    size_t* offsets = shd_arena_alloc(arena, num_args * sizeof(size_t));
+    size_t* sizes = shd_arena_alloc(arena, num_args * sizeof(size_t));
+    for (int i = 0; i < num_args; ++i) {
+        offsets[i] = fields[i].offset_in_bytes;
+        sizes[i] = fields[i].mem_layout.size_in_bytes;
+    }
+
+    kernel->args_count = num_args;
+    kernel->arg_offsets = offsets;
+    kernel->arg_sizes = sizes;
+    kernel->args_size = offsets[num_args - 1] + sizes[num_args - 1];
+    return true;
+}
+
+const CompiledKernel* shd_kernel_bundle_add(KernelBundle* bundle, String entry_point, Module* final_mod, size_t spirv_size, const char* spirv) {
+    CompiledKernel* kernel = shd_arena_alloc(bundle->arena, sizeof(CompiledKernel));
+    kernel->entry_point = copy_into_arena(bundle->arena, strlen(entry_point) + 1, entry_point);
+    kernel->spirv_size = spirv_size;
+    kernel->spirv = copy_into_arena(bundle->arena, spirv_size, spirv);
+    if (!extract_parameters_info(bundle->arena, final_mod, kernel))
+        return NULL;
+    extract_resources_layout(bundle->arena, final_mod, kernel);
+    shd_list_append(CompiledKernel*, bundle->kernels, kernel);
+    return kernel;
+}
+
+/// Bumped whenever the layout below changes, there is no attempt at reading older bundles
+#define BUNDLE_FORMAT_VERSION 1
+static const char bundle_magic[8] = { 'S', 'H', 'D', 'B', 'N', 'D', 'L', '\0' };
+
+// Everything is written in the host's byte order, with fixed-size integers
+
+static void write_u64(Growy* g, uint64_t value) {
+    shd_growy_append_object(g, value);
+}
+
+static void write_blob(Growy* g, size_t size, const void* data) {
+    write_u64(g, size);
+    shd_growy_append_bytes(g, size, data);
+}
+
+bool shd_write_kernel_bundle(const KernelBundle* bundle, const char* filename) {
+    Growy* g = shd_new_growy();
+    shd_growy_append_bytes(g, sizeof(bundle_magic), bundle_magic);
+    write_u64(g, BUNDLE_FORMAT_VERSION);
+    write_u64(g, bundle->config_fingerprint);
+    write_u64(g, shd_list_count(bundle->kernels));
+    for (size_t i = 0; i < shd_list_count(bundle->kernels); i++) {
+        const CompiledKernel* kernel = shd_read_list(CompiledKernel*, bundle->kernels)[i];
+        write_blob(g, strlen(kernel->entry_point), kernel->entry_point);
+        write_blob(g, kernel->spirv_size, kernel->spirv);
+        write_u64(g, kernel->args_size);
+        write_u64(g, kernel->args_count);
+        for (size_t j = 0; j < kernel->args_count; j++) {
+            write_u64(g, kernel->arg_offsets[j]);
+            write_u64(g, kernel->arg_sizes[j]);
+        }
+        write_u64(g, kernel->resources_count);
+        for (size_t j = 0; j < kernel->resources_count; j++) {
+            const KernelResourceLayout* resource = &kernel->resources[j];
+            write_u64(g, (uint64_t) (int64_t) resource->parent);
+            write_u64(g, (uint64_t) (int64_t) resource->set);
+            write_u64(g, (uint64_t) (int64_t) resource->binding);
+            write_u64(g, resource->as);
+            write_u64(g, resource->offset);
+            write_u64(g, resource->size);
+            write_blob(g, resource->default_data ? resource->size : 0, resource->default_data);
+        }
+    }
+
+    bool ok = shd_write_file(filename, shd_growy_size(g), shd_growy_data(g));
+    shd_destroy_growy(g);
+    return ok;
+}
+
+typedef struct {
+    const char* data;
+    size_t size;
+    size_t cursor;
+    /// set on the first read going past the end, after which everything reads as zero
+    bool overrun;
+} BundleReader;
+
+static const void* read_bytes(BundleReader* r, size_t size) {
+    if (r->overrun || size > r->size - r->cursor) {
+        r->overrun = true;
+        return NULL;
+    }
+    const void* bytes = r->data + r->cursor;
+    r->cursor += size;
+    return bytes;
+}
+
+static uint64_t read_u64(BundleReader* r) {
+    const void* bytes = read_bytes(r, sizeof(uint64_t));
+    uint64_t value = 0;
+    if (bytes)
+        memcpy(&value, bytes, sizeof(uint64_t));
+    return value;
+}
+
+/// Copies a blob into the bundle's arena, NULL-terminated so that names can be read as such
+static const char* read_blob(BundleReader* r, Arena* arena, size_t* size) {
+    size_t blob_size = read_u64(r);
+    const void* bytes = read_bytes(r, blob_size);
+    if (!bytes)
+        return NULL;
+    char* copy = shd_arena_alloc(arena, blob_size + 1);
+    memcpy(copy, bytes, blob_size);
+    copy[blob_size] = '\0';
+    if (size)
+        *size = blob_size;
+    return copy;
+}
+
+static bool read_kernel(BundleReader* r, Arena* arena, CompiledKernel* kernel) {
+    kernel->entry_point = read_blob(r, arena, NULL);
+    kernel->spirv = read_blob(r, arena, &kernel->spirv_size);
+    kernel->args_size = read_u64(r);
+    kernel->args_count = read_u64(r);
+    // counts are checked against what is left of the file before allocating anything for them
+    if (r->overrun || kernel->args_count > (r->size - r->cursor) / (2 * sizeof(uint64_t)))
+        return false;
+    size_t* offsets = shd_arena_alloc(arena, (kernel->args_count + 1) * sizeof(size_t));
+    size_t* sizes = shd_arena_alloc(arena, (kernel->args_count + 1) * sizeof(size_t));
+    for (size_t j = 0; j < kernel->args_count; j++) {
+        offsets[j] = read_u64(r);
+        sizes[j] = read_u64(r);
+        // arguments get marshalled into a buffer of args_size bytes
+        if (offsets[j] > kernel->args_size || sizes[j] > kernel->args_size - offsets[j])
+            return false;
+    }
+    kernel->arg_offsets = offsets;
+    kernel->arg_sizes = sizes;
+
+    kernel->resources_count = read_u64(r);
+    if (r->overrun || kernel->resources_count > (r->size - r->cursor) / (7 * sizeof(uint64_t)))
+        return false;
+    KernelResourceLayout* resources = shd_arena_alloc(arena, (kernel->resources_count + 1) * sizeof(KernelResourceLayout));
+    for (size_t j = 0; j < kernel->resources_count; j++) {
+        KernelResourceLayout* resource = &resources[j];
+        resource->parent = (int) (int64_t) read_u64(r);
+        resource->set = (int) (int64_t) read_u64(r);
+        resource->binding = (int) (int64_t) read_u64(r);
+        resource->as = (AddressSpace) read_u64(r);
+        resource->offset = read_u64(r);
+        resource->size = read_u64(r);
+        size_t default_data_size;
+        const char* default_data = read_blob(r, arena, &default_data_size);
+        if (r->overrun)
+            return false;
+        if (default_data_size > 0) {
+            if (default_data_size != resource->size)
+                return false;
+            resource->default_data = (const unsigned char*) default_data;
+        }
+        // -1 means no parent, otherwise it has to be an earlier top-level resource
+        if (resource->parent < -1 || resource->parent >= (int) j || (resource->parent >= 0 && resources[resource->parent].parent >= 0))
+            return false;
+        // and the pointer to it gets written at its offset in the parent
+        if (resource->parent >= 0 && (resource->offset > resources[resource->parent].size || resources[resource->parent].size - resource->offset < sizeof(uint64_t)))
+            return false;
+    }
+    kernel->resources = resources;
+    return !r->overrun;
+}
+
+KernelBundle* shd_read_kernel_bundle(const char* filename) {
+    size_t size;
+    char* data;
+    if (!shd_read_file(filename, &size, &data) || !data) {
+        shd_error_print("Failed to read kernel bundle '%s'\n", filename);
+        return NULL;
+    }
+
+    BundleReader r = { .data = data, .size = size };
+    const void* magic = read_bytes(&r, sizeof(bundle_magic));
+    if (!magic || memcmp(magic, bundle_magic, sizeof(bundle_magic)) != 0 || read_u64(&r) != BUNDLE_FORMAT_VERSION) {
+        shd_error_print("'%s' is not a kernel bundle, or was written by another version of shady\n", filename);
+        free(data);
+        return NULL;
+    }
+
+    KernelBundle* bundle = shd_new_kernel_bundle(read_u64(&r));
+    size_t kernels_count = read_u64(&r);
+    for (size_t i = 0; i < kernels_count && !r.overrun; i++) {
+        CompiledKernel* kernel = shd_arena_alloc(bundle->arena, sizeof(CompiledKernel));
+        if (!read_kernel(&r, bundle->arena, kernel)) {
+            r.overrun = true;
+            break;
+        }
+        shd_list_append(CompiledKernel*, bundle->kernels, kernel);
+    }
+    free(data);
+
+    if (r.overrun) {
+        shd_error_print("Kernel bundle '%s' is corrupted\n", filename);
+        shd_destroy_kernel_bundle(bundle);
+        return NULL;
+    }
+    return bundle;
+}
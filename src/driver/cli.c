@@ -5,6 +5,7 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdio.h>
 
 #include "log.h"
 #include "portability.h"
@@ -20,6 +21,10 @@ CodegenTarget shd_guess_target(const char* filename) {
         return TgtSPV;
     else if (shd_string_ends_with(filename, "ispc"))
         return TgtISPC;
+    else if (shd_string_ends_with(filename, ".ll"))
+        return TgtLLVM;
+    else if (shd_string_ends_with(filename, ".bundle"))
+        return TgtBundle;
     shd_error_print("No target has been specified, and output filename '%s' did not allow guessing the right one\n");
     exit(InvalidTarget);
 }
@@ -129,6 +134,14 @@ void shd_parse_compiler_config_args(CompilerConfig* config, int* pargc, char** a
             if (i == argc)
                 shd_error("Missing subgroup size");
             config->specialization.subgroup_size = atoi(argv[i]);
+        } else if (strcmp(argv[i], "--spirv-version") == 0) {
+            argv[i] = NULL;
+            i++;
+            unsigned major, minor;
+            if (i == argc || sscanf(argv[i], "%u.%u", &major, &minor) != 2)
+                shd_error("--spirv-version must be followed with a version such as 1.3");
+            config->target_spirv_version.major = (uint8_t) major;
+            config->target_spirv_version.minor = (uint8_t) minor;
         } else if (strcmp(argv[i], "--stack-size") == 0) {
             argv[i] = NULL;
             i++;
@@ -183,6 +196,7 @@ void shd_parse_compiler_config_args(CompilerConfig* config, int* pargc, char** a
         shd_error_print("  --execution-model <em>                   Selects an entry point for the program to be specialized on.\nPossible values: " EXECUTION_MODELS(EM));
 #undef EM
         shd_error_print("  --subgroup-size N                         Sets the subgroup size the program will be specialized for.\n");
+        shd_error_print("  --spirv-version <major.minor>             Sets the SPIR-V version to target.\n");
         shd_error_print("  --lift-join-points                        Forcefully lambda-lifts all join points. Can help with reconvergence issues.\n");
     }
 
@@ -212,6 +226,9 @@ DriverConfig shd_default_driver_config(void) {
         .cfg_output_filename = NULL,
         .shd_output_filename = NULL,
         .c_emitter_config = shd_default_c_emitter_config(),
+#ifdef LLVM_BACKEND_PRESENT
+        .llvm_emitter_config = shd_default_llvm_emitter_config(),
+#endif
     };
 }
 
@@ -256,6 +273,16 @@ void shd_parse_driver_args(DriverConfig* args, int* pargc, char** argv) {
                 exit(MissingDumpIrArg);
             }
             args->shd_output_filename = argv[i];
+        } else if (strcmp(argv[i], "--c-native-vectors") == 0) {
+            args->c_emitter_config.native_vectors = true;
+        } else if (strcmp(argv[i], "--c-simd-workgroups") == 0) {
+            args->c_emitter_config.simd_workgroups = true;
+        } else if (strcmp(argv[i], "--c-restrict-kernel-args") == 0) {
+            args->c_emitter_config.restrict_kernel_args = true;
+        } else if (strcmp(argv[i], "--c-dispatch-harness") == 0) {
+            args->c_emitter_config.dispatch_harness = true;
+        } else if (strcmp(argv[i], "--llvm-explicit-address-spaces") == 0) {
+            args->llvm_emitter_config.explicit_address_spaces = true;
         } else if (strcmp(argv[i], "--glsl-version") == 0) {
             argv[i] = NULL;
             i++;
@@ -273,6 +300,10 @@ void shd_parse_driver_args(DriverConfig* args, int* pargc, char** argv) {
                 args->target = TgtGLSL;
             else if (strcmp(argv[i], "ispc") == 0)
                 args->target = TgtISPC;
+            else if (strcmp(argv[i], "llvm") == 0)
+                args->target = TgtLLVM;
+            else if (strcmp(argv[i], "bundle") == 0)
+                args->target = TgtBundle;
             else
                 goto invalid_target;
             argv[i] = NULL;
@@ -292,11 +323,16 @@ void shd_parse_driver_args(DriverConfig* args, int* pargc, char** argv) {
     if (help) {
         // shd_error_print("Usage: slim source.slim\n");
         // shd_error_print("Available arguments: \n");
-        shd_error_print("  --target <c, glsl, ispc, spirv>           \n");
+        shd_error_print("  --target <c, glsl, ispc, llvm, spirv, bundle> A bundle holds SPIR-V and layouts for each entry point, for shd_rt_load_program_bundle\n");
         shd_error_print("  --output <filename>, -o <filename>        \n");
         shd_error_print("  --dump-cfg <filename>                     Dumps the control flow graph of the final IR\n");
         shd_error_print("  --dump-loop-tree <filename>\n");
         shd_error_print("  --dump-ir <filename>                      Dumps the final IR\n");
+        shd_error_print("  --c-native-vectors                        Emits packed types as GCC/Clang vector types in C\n");
+        shd_error_print("  --c-simd-workgroups                       Runs the invocations of a workgroup as a vectorisable loop in C\n");
+        shd_error_print("  --c-restrict-kernel-args                  Declares entry point pointers restrict in C and CUDA, they must not alias\n");
+        shd_error_print("  --c-dispatch-harness                      Emits __shady_dispatch_<entry point> functions running a dispatch over pthreads\n");
+        shd_error_print("  --llvm-explicit-address-spaces            Numbers LLVM address spaces the way GPU targets do, instead of flat\n");
     }
 
     shd_pack_remaining_args(pargc, argv);
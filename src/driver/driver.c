@@ -4,6 +4,7 @@
 #include "shady/be/c.h"
 #include "shady/be/spirv.h"
 #include "shady/be/dump.h"
+#include "shady/be/llvm.h"
 
 #include "../frontend/slim/parser.h"
 
@@ -114,7 +115,64 @@ ShadyErrorCodes shd_driver_load_source_files(DriverConfig* args, Module* mod) {
     return NoError;
 }
 
+/// Every entry point gets specialised on its own, like the runtime would do it on the first launch
+static ShadyErrorCodes compile_bundle(DriverConfig* args, Module* mod) {
+    if (!args->output_filename) {
+        shd_error_print("Bundles must be written to an output file\n");
+        return MissingOutputArg;
+    }
+
+    KernelBundle* bundle = shd_new_kernel_bundle(shd_driver_config_fingerprint(&args->config));
+    Nodes decls = shd_module_get_declarations(mod);
+    for (size_t i = 0; i < decls.count; i++) {
+        const Node* decl = decls.nodes[i];
+        if (decl->tag != Function_TAG || !shd_lookup_annotation(decl, "EntryPoint"))
+            continue;
+        String entry_point = shd_get_abstraction_name(decl);
+        if (args->config.specialization.entry_point && strcmp(args->config.specialization.entry_point, entry_point) != 0)
+            continue;
+
+        CompilerConfig config = args->config;
+        config.specialization.entry_point = entry_point;
+        Module* specialized = mod;
+        CompilationResult result = shd_run_compiler_passes(&config, &specialized);
+        if (result != CompilationNoError) {
+            shd_error_print("Compilation pipeline failed for entry point '%s', errcode=%d\n", entry_point, (int) result);
+            exit(result);
+        }
+
+        size_t spirv_size;
+        char* spirv;
+        Module* final_mod;
+        shd_emit_spirv(&config, specialized, &spirv_size, &spirv, &final_mod);
+        const CompiledKernel* kernel = shd_kernel_bundle_add(bundle, entry_point, final_mod, spirv_size, spirv);
+        free(spirv);
+        if (shd_module_get_arena(final_mod) != shd_module_get_arena(specialized))
+            shd_destroy_ir_arena(shd_module_get_arena(final_mod));
+        if (shd_module_get_arena(specialized) != shd_module_get_arena(mod))
+            shd_destroy_ir_arena(shd_module_get_arena(specialized));
+        if (!kernel)
+            shd_error("Could not recover the layout of entry point '%s'", entry_point);
+        shd_debug_print("Bundled entry point '%s' (%zu bytes of SPIR-V)\n", entry_point, spirv_size);
+    }
+
+    if (shd_kernel_bundle_count(bundle) == 0)
+        shd_warn_print("The bundle has no entry points\n");
+    bool ok = shd_write_kernel_bundle(bundle, args->output_filename);
+    if (ok)
+        shd_debug_print("Wrote bundle to %s\n", args->output_filename);
+    else
+        shd_error_print("Failed to write bundle to %s\n", args->output_filename);
+    shd_destroy_kernel_bundle(bundle);
+    return ok ? NoError : OutputFileIOError;
+}
+
 ShadyErrorCodes shd_driver_compile(DriverConfig* args, Module* mod) {
+    if (args->output_filename && args->target == TgtAuto)
+        args->target = shd_guess_target(args->output_filename);
+    if (args->target == TgtBundle)
+        return compile_bundle(args, mod);
+
     shd_debugv_print("Parsed program successfully: \n");
     shd_log_module(DEBUGV, &args->config, mod);
 
@@ -161,7 +219,8 @@ ShadyErrorCodes shd_driver_compile(DriverConfig* args, Module* mod) {
         size_t output_size;
         char* output_buffer;
         switch (args->target) {
-            case TgtAuto: SHADY_UNREACHABLE;
+            case TgtAuto:
+            case TgtBundle: SHADY_UNREACHABLE;
             case TgtSPV: shd_emit_spirv(&args->config, mod, &output_size, &output_buffer, NULL); break;
             case TgtC:
                 args->c_emitter_config.dialect = CDialect_C11;
@@ -175,6 +234,14 @@ ShadyErrorCodes shd_driver_compile(DriverConfig* args, Module* mod) {
                 args->c_emitter_config.dialect = CDialect_ISPC;
                 shd_emit_c(&args->config, args->c_emitter_config, mod, &output_size, &output_buffer, NULL);
                 break;
+            case TgtLLVM:
+#ifdef LLVM_BACKEND_PRESENT
+                shd_emit_llvm(&args->config, args->llvm_emitter_config, mod, &output_size, &output_buffer, NULL);
+                break;
+#else
+                shd_error_print("This build of shady does not include the LLVM backend\n");
+                exit(InvalidTarget);
+#endif
         }
         shd_debug_print("Wrote result to %s\n", args->output_filename);
         fwrite(output_buffer, output_size, 1, f);
@@ -0,0 +1,116 @@
+#include "cpu_runtime_private.h"
+
+#include "log.h"
+#include "portability.h"
+#include "list.h"
+#include "dict.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void shutdown_cpu_runtime(CpuBackend* backend) {
+    free(backend);
+}
+
+static String cpu_device_get_name(CpuDevice* device) { return device->name; }
+
+static void cpu_device_cleanup(CpuDevice* device) {
+    // runs whatever launches are still queued
+    shd_destroy_thread_pool(device->pool);
+    size_t i = 0;
+    CpuKernel* kernel;
+    while (shd_dict_iter(device->specialized_programs, &i, NULL, &kernel))
+        shd_rt_cpu_destroy_specialized_program(kernel);
+    shd_destroy_dict(device->specialized_programs);
+    if (device->jit)
+        shd_rt_cpu_destroy_jit(device->jit);
+    shd_destroy_cond_var(device->specialized_programs_cond);
+    shd_destroy_mutex(device->specialized_programs_mutex);
+    shd_destroy_cond_var(device->commands_cond);
+    shd_destroy_mutex(device->commands_mutex);
+    free(device);
+}
+
+static void cpu_device_unload_program(CpuDevice* device, Program* program) {
+    // launches still queued might run the program's kernels
+    shd_thread_pool_wait_idle(device->pool);
+
+    shd_mutex_lock(device->specialized_programs_mutex);
+    struct List* unloaded = shd_new_list(CpuKernel*);
+    size_t i = 0;
+    SpecProgramKey key;
+    CpuKernel* kernel;
+    while (shd_dict_iter(device->specialized_programs, &i, &key, &kernel)) {
+        if (key.base != program)
+            continue;
+        while (kernel->state == CpuKernelCompiling)
+            shd_cond_var_wait(device->specialized_programs_cond, device->specialized_programs_mutex);
+        shd_list_append(CpuKernel*, unloaded, kernel);
+    }
+    for (size_t j = 0; j < shd_list_count(unloaded); j++) {
+        kernel = shd_read_list(CpuKernel*, unloaded)[j];
+        shd_dict_remove(SpecProgramKey, device->specialized_programs, kernel->key);
+        shd_rt_cpu_destroy_specialized_program(kernel);
+    }
+    shd_mutex_unlock(device->specialized_programs_mutex);
+    shd_destroy_list(unloaded);
+}
+
+KeyHash shd_hash_string(const char** string);
+
+static KeyHash hash_spec_program_key(SpecProgramKey* ptr) {
+    return shd_hash(&ptr->base, sizeof(Program*)) ^ shd_hash_string(&ptr->entry_point);
+}
+
+static bool cmp_spec_program_keys(SpecProgramKey* a, SpecProgramKey* b) {
+    return a->base == b->base && strcmp(a->entry_point, b->entry_point) == 0;
+}
+
+static CpuDevice* create_cpu_device(SHADY_UNUSED CpuBackend* backend) {
+    CpuDevice* device = calloc(1, sizeof(CpuDevice));
+    CHECK(device, return NULL);
+    *device = (CpuDevice) {
+        .base = {
+            .get_name = (String (*)(Device*)) cpu_device_get_name,
+            .cleanup = (void (*)(Device*)) cpu_device_cleanup,
+            .allocate_buffer = (Buffer* (*)(Device*, size_t)) shd_rt_cpu_allocate_buffer,
+            .can_import_host_memory = (bool (*)(Device*)) shd_rt_cpu_can_import_host_memory,
+            .import_host_memory_as_buffer = (Buffer* (*)(Device*, void*, size_t)) shd_rt_cpu_import_host_memory,
+            .launch_kernel = (Command* (*)(Device*, Program*, String, int, int, int, int, void**, ExtraKernelOptions*)) shd_rt_cpu_launch_kernel,
+            .launch_kernel_indirect = (Command* (*)(Device*, Program*, String, Buffer*, size_t, int, void**, ExtraKernelOptions*)) shd_rt_cpu_launch_kernel_indirect,
+            .begin_batch = (Batch* (*)(Device*)) shd_rt_cpu_begin_batch,
+            .prepare_kernel = (KernelFuture* (*)(Device*, Program*, String)) shd_rt_cpu_prepare_kernel,
+            .unload_program = (void (*)(Device*, Program*)) cpu_device_unload_program,
+        },
+        .pool = shd_new_thread_pool(0),
+        .specialized_programs_mutex = shd_new_mutex(),
+        .specialized_programs_cond = shd_new_cond_var(),
+        .specialized_programs = shd_new_dict(SpecProgramKey, CpuKernel*, (HashFn) hash_spec_program_key, (CmpFn) cmp_spec_program_keys),
+        .commands_mutex = shd_new_mutex(),
+        .commands_cond = shd_new_cond_var(),
+        .jit = shd_rt_cpu_create_jit(),
+    };
+    snprintf(device->name, sizeof(device->name), "Host CPU (%zu threads)", shd_thread_pool_size(device->pool));
+    return device;
+}
+
+Backend* shd_rt_initialize_cpu_backend(Runtime* base) {
+    CpuBackend* backend = calloc(1, sizeof(CpuBackend));
+    CHECK(backend, return NULL);
+    backend->base = (Backend) {
+        .runtime = base,
+        .cleanup = (void (*)(Backend*)) shutdown_cpu_runtime,
+    };
+
+    CpuDevice* device = create_cpu_device(backend);
+    CHECK(device, goto init_fail_free);
+    shd_list_append(CpuDevice*, base->devices, device);
+    shd_info_print("Shady CPU backend successfully initialized\n");
+    return &backend->base;
+
+    init_fail_free:
+    shd_error_print("Failed to initialise the CPU back-end.\n");
+    free(backend);
+    return NULL;
+}
@@ -0,0 +1,85 @@
+#include "cpu_runtime_private.h"
+
+#include "log.h"
+#include "portability.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/// generous enough for any vector type the C compiler might pick
+#define CPU_BUFFER_ALIGNMENT 64
+
+static void cpu_destroy_buffer(CpuBuffer* buffer) {
+    if (!buffer->is_imported)
+        shd_free_aligned(buffer->ptr);
+    free(buffer);
+}
+
+static void* cpu_get_host_ptr(CpuBuffer* buffer) { return buffer->ptr; }
+
+static uint64_t cpu_get_device_ptr(CpuBuffer* buffer) { return (uint64_t) (uintptr_t) buffer->ptr; }
+
+static bool cpu_copy_to_buffer(CpuBuffer* dst, size_t buffer_offset, void* src, size_t size) {
+    CHECK(buffer_offset + size <= dst->size, return false);
+    memcpy((char*) dst->ptr + buffer_offset, src, size);
+    return true;
+}
+
+static bool cpu_copy_from_buffer(CpuBuffer* src, size_t buffer_offset, void* dst, size_t size) {
+    CHECK(buffer_offset + size <= src->size, return false);
+    memcpy(dst, (char*) src->ptr + buffer_offset, size);
+    return true;
+}
+
+/// There is no queue to hand copies over to, they happen right away once their dependencies completed
+static Command* cpu_copy_to_buffer_async(CpuBuffer* dst, size_t buffer_offset, void* src, size_t size, size_t dependencies_count, Command** dependencies) {
+    shd_rt_cpu_wait_dependencies(dependencies_count, dependencies);
+    CHECK(cpu_copy_to_buffer(dst, buffer_offset, src, size), return NULL);
+    return (Command*) shd_rt_cpu_new_completed_command(dst->device);
+}
+
+static Command* cpu_copy_from_buffer_async(CpuBuffer* src, size_t buffer_offset, void* dst, size_t size, size_t dependencies_count, Command** dependencies) {
+    shd_rt_cpu_wait_dependencies(dependencies_count, dependencies);
+    CHECK(cpu_copy_from_buffer(src, buffer_offset, dst, size), return NULL);
+    return (Command*) shd_rt_cpu_new_completed_command(src->device);
+}
+
+static CpuBuffer* new_buffer(CpuDevice* device, void* ptr, size_t size, bool is_imported) {
+    CpuBuffer* buffer = calloc(1, sizeof(CpuBuffer));
+    if (!buffer)
+        return NULL;
+    *buffer = (CpuBuffer) {
+        .base = {
+            .backend_tag = CPURuntimeBackend,
+            .destroy = (void (*)(Buffer*)) cpu_destroy_buffer,
+            .get_host_ptr = (void* (*)(Buffer*)) cpu_get_host_ptr,
+            .get_device_ptr = (uint64_t (*)(Buffer*)) cpu_get_device_ptr,
+            .copy_into = (bool (*)(Buffer*, size_t, void*, size_t)) cpu_copy_to_buffer,
+            .copy_from = (bool (*)(Buffer*, size_t, void*, size_t)) cpu_copy_from_buffer,
+            .copy_into_async = (Command* (*)(Buffer*, size_t, void*, size_t, size_t, Command**)) cpu_copy_to_buffer_async,
+            .copy_from_async = (Command* (*)(Buffer*, size_t, void*, size_t, size_t, Command**)) cpu_copy_from_buffer_async,
+        },
+        .device = device,
+        .size = size,
+        .ptr = ptr,
+        .is_imported = is_imported,
+    };
+    return buffer;
+}
+
+CpuBuffer* shd_rt_cpu_allocate_buffer(CpuDevice* device, size_t size) {
+    // aligned_alloc wants a multiple of the alignment, and zero-sized buffers still get an address of their own
+    size_t rounded = (size + CPU_BUFFER_ALIGNMENT - 1) & ~(size_t) (CPU_BUFFER_ALIGNMENT - 1);
+    void* ptr = shd_alloc_aligned(rounded > 0 ? rounded : CPU_BUFFER_ALIGNMENT, CPU_BUFFER_ALIGNMENT);
+    CHECK(ptr, return NULL);
+    CpuBuffer* buffer = new_buffer(device, ptr, size, false);
+    if (!buffer)
+        shd_free_aligned(ptr);
+    return buffer;
+}
+
+CpuBuffer* shd_rt_cpu_import_host_memory(CpuDevice* device, void* host_ptr, size_t size) {
+    return new_buffer(device, host_ptr, size, true);
+}
+
+bool shd_rt_cpu_can_import_host_memory(SHADY_UNUSED CpuDevice* device) { return true; }
@@ -0,0 +1,260 @@
+#include "cpu_runtime_private.h"
+
+#include "log.h"
+#include "portability.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    Batch base;
+    CpuDevice* device;
+    CpuCommand* first;
+    CpuCommand* last;
+} CpuBatch;
+
+/// Blocks until the command completed, but leaves it to its owner to free
+static void wait_command(CpuCommand* cmd) {
+    CpuDevice* device = cmd->device;
+    shd_mutex_lock(device->commands_mutex);
+    while (!cmd->done)
+        shd_cond_var_wait(device->commands_cond, device->commands_mutex);
+    shd_mutex_unlock(device->commands_mutex);
+}
+
+static bool cpu_command_wait(CpuCommand* cmd) {
+    Profiler* profiler = cmd->device->base.profiler;
+    uint64_t start = shd_get_time_nano();
+    wait_command(cmd);
+    // batches hand out their last command, which completes after all the others
+    CpuCommand* c = cmd->first ? cmd->first : cmd;
+    while (c) {
+        CpuCommand* next = c->next;
+        if (c->kernel) {
+            if (c->profiled_gpu_time)
+                *c->profiled_gpu_time = c->end_ns - c->start_ns;
+            if (profiler)
+                shd_rt_profile_device_event(profiler, c->kernel->key.entry_point, "kernel", c->submitted_ns, c->start_ns, c->end_ns);
+        }
+        free(c->args);
+        free(c);
+        c = next;
+    }
+    if (profiler)
+        shd_rt_profile_host_event(profiler, "wait", "wait", start);
+    return true;
+}
+
+CpuCommand* shd_rt_cpu_new_completed_command(CpuDevice* device) {
+    CpuCommand* cmd = calloc(1, sizeof(CpuCommand));
+    CHECK(cmd, return NULL);
+    *cmd = (CpuCommand) {
+        .base = {
+            .wait_for_completion = (bool (*)(Command*)) cpu_command_wait,
+        },
+        .device = device,
+        .done = true,
+    };
+    cmd->submitted_ns = cmd->start_ns = cmd->end_ns = shd_get_time_nano();
+    return cmd;
+}
+
+void shd_rt_cpu_wait_dependencies(size_t dependencies_count, Command** dependencies) {
+    for (size_t i = 0; i < dependencies_count; i++)
+        wait_command((CpuCommand*) dependencies[i]);
+}
+
+static void start_command(CpuCommand* cmd);
+
+static void complete_command(CpuCommand* cmd) {
+    CpuDevice* device = cmd->device;
+    cmd->end_ns = shd_get_time_nano();
+    // the chain belongs to whoever waits on its last command, so it must not be touched once that one is done
+    CpuCommand* next = cmd->next;
+    shd_mutex_lock(device->commands_mutex);
+    cmd->done = true;
+    shd_cond_var_broadcast(device->commands_cond);
+    shd_mutex_unlock(device->commands_mutex);
+    if (next)
+        start_command(next);
+}
+
+/// Jobs take chunks of workgroups until there are none left, so the threads that run ahead pick up the slack of the others.
+static void run_launch_job(CpuCommand* cmd) {
+    CpuDevice* device = cmd->device;
+    while (true) {
+        uint64_t first = shd_atomic_fetch_add(&cmd->next_workgroup, cmd->chunk_size);
+        if (first >= cmd->workgroups_count)
+            break;
+        uint64_t count = cmd->workgroups_count - first;
+        if (count > cmd->chunk_size)
+            count = cmd->chunk_size;
+        cmd->kernel->run(cmd->args, cmd->num_workgroups, first, count);
+    }
+
+    shd_mutex_lock(device->commands_mutex);
+    bool last = --cmd->running_jobs == 0;
+    shd_mutex_unlock(device->commands_mutex);
+    if (last)
+        complete_command(cmd);
+}
+
+static void start_command(CpuCommand* cmd) {
+    CpuDevice* device = cmd->device;
+    cmd->start_ns = shd_get_time_nano();
+    // indirect launches may have had their size written by the launch before them
+    if (cmd->dimensions)
+        memcpy(cmd->num_workgroups, (char*) cmd->dimensions->ptr + cmd->dimensions_offset, sizeof(cmd->num_workgroups));
+    cmd->workgroups_count = (uint64_t) cmd->num_workgroups[0] * cmd->num_workgroups[1] * cmd->num_workgroups[2];
+    if (cmd->workgroups_count == 0) {
+        complete_command(cmd);
+        return;
+    }
+
+    size_t jobs = shd_thread_pool_size(device->pool);
+    if (jobs > cmd->workgroups_count)
+        jobs = cmd->workgroups_count;
+    // several chunks per job, so that uneven workgroups balance out
+    cmd->chunk_size = cmd->workgroups_count / (jobs * 8);
+    if (cmd->chunk_size == 0)
+        cmd->chunk_size = 1;
+    cmd->running_jobs = jobs;
+    for (size_t i = 0; i < jobs; i++)
+        shd_thread_pool_submit(device->pool, (void (*)(void*)) run_launch_job, cmd);
+}
+
+static size_t align_arg(size_t size) { return (size + 15) & ~(size_t) 15; }
+
+/// Looks up the kernel and copies the arguments, the caller fills in the launch size
+static CpuCommand* new_launch(CpuDevice* device, Program* program, String entry_point, int args_count, void** args) {
+    CpuKernel* kernel = shd_rt_cpu_get_specialized_program(device, program, entry_point);
+    CHECK(kernel, return NULL);
+    CHECK(args_count >= 0 && (size_t) args_count == kernel->args_count, return NULL);
+
+    size_t storage_size = align_arg(sizeof(void*) * args_count);
+    for (int i = 0; i < args_count; i++)
+        storage_size += align_arg(kernel->arg_sizes[i]);
+    char* storage = malloc(storage_size > 0 ? storage_size : 1);
+    CHECK(storage, return NULL);
+    void** copied_args = (void**) storage;
+    size_t offset = align_arg(sizeof(void*) * args_count);
+    for (int i = 0; i < args_count; i++) {
+        copied_args[i] = storage + offset;
+        memcpy(copied_args[i], args[i], kernel->arg_sizes[i]);
+        offset += align_arg(kernel->arg_sizes[i]);
+    }
+
+    CpuCommand* cmd = calloc(1, sizeof(CpuCommand));
+    if (!cmd) {
+        free(storage);
+        return NULL;
+    }
+    *cmd = (CpuCommand) {
+        .base = {
+            .wait_for_completion = (bool (*)(Command*)) cpu_command_wait,
+        },
+        .device = device,
+        .kernel = kernel,
+        .args = copied_args,
+    };
+    return cmd;
+}
+
+static bool check_dimensions_buffer(CpuBuffer* dimensions, size_t offset) {
+    CHECK(dimensions->base.backend_tag == CPURuntimeBackend, return false);
+    CHECK(offset % 4 == 0 && offset + sizeof(uint32_t) * 3 <= dimensions->size, return false);
+    return true;
+}
+
+static CpuCommand* launch_kernel(CpuDevice* device, Program* program, String entry_point, const uint32_t dims[3], CpuBuffer* dimensions, size_t offset, int args_count, void** args, ExtraKernelOptions* options) {
+    uint64_t start = shd_get_time_nano();
+    CpuCommand* cmd = new_launch(device, program, entry_point, args_count, args);
+    CHECK(cmd, return NULL);
+    if (dims)
+        memcpy(cmd->num_workgroups, dims, sizeof(cmd->num_workgroups));
+    cmd->dimensions = dimensions;
+    cmd->dimensions_offset = offset;
+
+    if (options) {
+        cmd->profiled_gpu_time = options->profiled_gpu_time;
+        // there is no queue to track the dependencies for us, this thread has to wait them out
+        shd_rt_cpu_wait_dependencies(options->dependencies_count, options->dependencies);
+    }
+
+    cmd->submitted_ns = shd_get_time_nano();
+    start_command(cmd);
+    if (device->base.profiler)
+        shd_rt_profile_host_event(device->base.profiler, entry_point, "launch", start);
+    return cmd;
+}
+
+CpuCommand* shd_rt_cpu_launch_kernel(CpuDevice* device, Program* program, String entry_point, int dimx, int dimy, int dimz, int args_count, void** args, ExtraKernelOptions* options) {
+    CHECK(dimx >= 0 && dimy >= 0 && dimz >= 0, return NULL);
+    uint32_t dims[3] = { dimx, dimy, dimz };
+    return launch_kernel(device, program, entry_point, dims, NULL, 0, args_count, args, options);
+}
+
+CpuCommand* shd_rt_cpu_launch_kernel_indirect(CpuDevice* device, Program* program, String entry_point, CpuBuffer* dimensions, size_t offset, int args_count, void** args, ExtraKernelOptions* options) {
+    CHECK(check_dimensions_buffer(dimensions, offset), return NULL);
+    return launch_kernel(device, program, entry_point, NULL, dimensions, offset, args_count, args, options);
+}
+
+static bool launch_kernel_in_batch(CpuBatch* batch, Program* program, String entry_point, const uint32_t dims[3], CpuBuffer* dimensions, size_t offset, int args_count, void** args) {
+    uint64_t start = shd_get_time_nano();
+    CpuCommand* cmd = new_launch(batch->device, program, entry_point, args_count, args);
+    CHECK(cmd, return false);
+    if (dims)
+        memcpy(cmd->num_workgroups, dims, sizeof(cmd->num_workgroups));
+    cmd->dimensions = dimensions;
+    cmd->dimensions_offset = offset;
+
+    if (batch->last)
+        batch->last->next = cmd;
+    else
+        batch->first = cmd;
+    batch->last = cmd;
+    if (batch->device->base.profiler)
+        shd_rt_profile_host_event(batch->device->base.profiler, entry_point, "launch", start);
+    return true;
+}
+
+static bool cpu_launch_kernel_in_batch(CpuBatch* batch, Program* program, String entry_point, int dimx, int dimy, int dimz, int args_count, void** args) {
+    CHECK(dimx >= 0 && dimy >= 0 && dimz >= 0, return false);
+    uint32_t dims[3] = { dimx, dimy, dimz };
+    return launch_kernel_in_batch(batch, program, entry_point, dims, NULL, 0, args_count, args);
+}
+
+static bool cpu_launch_kernel_indirect_in_batch(CpuBatch* batch, Program* program, String entry_point, CpuBuffer* dimensions, size_t offset, int args_count, void** args) {
+    CHECK(check_dimensions_buffer(dimensions, offset), return false);
+    return launch_kernel_in_batch(batch, program, entry_point, NULL, dimensions, offset, args_count, args);
+}
+
+static Command* cpu_submit_batch(CpuBatch* batch) {
+    CpuCommand* first = batch->first;
+    CpuCommand* last = batch->last;
+    CpuDevice* device = batch->device;
+    free(batch);
+    if (!first)
+        return (Command*) shd_rt_cpu_new_completed_command(device);
+
+    uint64_t now = shd_get_time_nano();
+    for (CpuCommand* c = first; c; c = c->next)
+        c->submitted_ns = now;
+    last->first = first;
+    start_command(first);
+    return (Command*) last;
+}
+
+Batch* shd_rt_cpu_begin_batch(CpuDevice* device) {
+    CpuBatch* batch = calloc(1, sizeof(CpuBatch));
+    CHECK(batch, return NULL);
+    *batch = (CpuBatch) {
+        .base = {
+            .launch_kernel = (bool (*)(Batch*, Program*, String, int, int, int, int, void**)) cpu_launch_kernel_in_batch,
+            .launch_kernel_indirect = (bool (*)(Batch*, Program*, String, Buffer*, size_t, int, void**)) cpu_launch_kernel_indirect_in_batch,
+            .submit = (Command* (*)(Batch*)) cpu_submit_batch,
+        },
+        .device = device,
+    };
+    return &batch->base;
+}
@@ -0,0 +1,224 @@
+#include "cpu_runtime_private.h"
+
+#include "log.h"
+#include "portability.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+
+#ifdef LLVM_BACKEND_PRESENT
+
+#include "shady/be/llvm.h"
+
+#include "llvm-c/Core.h"
+#include "llvm-c/Analysis.h"
+#include "llvm-c/Target.h"
+#include "llvm-c/TargetMachine.h"
+#include "llvm-c/Error.h"
+#include "llvm-c/Orc.h"
+#include "llvm-c/LLJIT.h"
+#include "llvm-c/Transforms/PassBuilder.h"
+
+/// Kernels are emitted straight to LLVM IR and compiled in-process, which saves writing out C, running the C compiler and
+/// loading its output back. They all go into the main JITDylib, each under its own resource tracker so it can be unloaded.
+struct CpuJit_ {
+    LLVMOrcLLJITRef lljit;
+    LLVMTargetRef target;
+    char* cpu;
+    char* cpu_features;
+    /// keeps the exported symbols of the kernels apart, guarded by mutex
+    size_t next_kernel_id;
+    Mutex* mutex;
+};
+
+static bool check_llvm_error(LLVMErrorRef err, String what) {
+    if (!err)
+        return true;
+    char* message = LLVMGetErrorMessage(err);
+    shd_error_print("%s: %s\n", what, message);
+    LLVMDisposeErrorMessage(message);
+    return false;
+}
+
+CpuJit* shd_rt_cpu_create_jit(void) {
+    String compiler = getenv("SHADY_CPU_COMPILER");
+    if (compiler && strcmp(compiler, "cc") == 0)
+        return NULL;
+
+    LLVMInitializeNativeTarget();
+    LLVMInitializeNativeAsmPrinter();
+
+    CpuJit* jit = calloc(1, sizeof(CpuJit));
+    CHECK(jit, return NULL);
+    jit->mutex = shd_new_mutex();
+
+    LLVMOrcJITTargetMachineBuilderRef jtmb;
+    CHECK(check_llvm_error(LLVMOrcJITTargetMachineBuilderDetectHost(&jtmb), "Failed to detect the host"), goto fail);
+    LLVMOrcLLJITBuilderRef builder = LLVMOrcCreateLLJITBuilder();
+    LLVMOrcLLJITBuilderSetJITTargetMachineBuilder(builder, jtmb);
+    CHECK(check_llvm_error(LLVMOrcCreateLLJIT(&jit->lljit, builder), "Failed to create the JIT"), goto fail);
+
+    // kernels call into the C library, and the JIT emulates thread-locals with __emutls_get_address from libgcc
+    LLVMOrcDefinitionGeneratorRef process_symbols;
+    CHECK(check_llvm_error(LLVMOrcCreateDynamicLibrarySearchGeneratorForProcess(&process_symbols, LLVMOrcLLJITGetGlobalPrefix(jit->lljit), NULL, NULL), "Failed to expose the process' symbols to the JIT"), goto fail);
+    LLVMOrcJITDylibAddGenerator(LLVMOrcLLJITGetMainJITDylib(jit->lljit), process_symbols);
+
+    char* error;
+    if (LLVMGetTargetFromTriple(LLVMOrcLLJITGetTripleString(jit->lljit), &jit->target, &error)) {
+        shd_error_print("Failed to find the host target: %s\n", error);
+        LLVMDisposeMessage(error);
+        goto fail;
+    }
+    jit->cpu = LLVMGetHostCPUName();
+    jit->cpu_features = LLVMGetHostCPUFeatures();
+    return jit;
+
+fail:
+    shd_warn_print("Kernels will be built with the C compiler instead of LLVM.\n");
+    shd_rt_cpu_destroy_jit(jit);
+    return NULL;
+}
+
+void shd_rt_cpu_destroy_jit(CpuJit* jit) {
+    if (jit->lljit)
+        check_llvm_error(LLVMOrcDisposeLLJIT(jit->lljit), "Failed to tear down the JIT");
+    if (jit->cpu)
+        LLVMDisposeMessage(jit->cpu);
+    if (jit->cpu_features)
+        LLVMDisposeMessage(jit->cpu_features);
+    shd_destroy_mutex(jit->mutex);
+    free(jit);
+}
+
+static bool has_name(LLVMValueRef value, String name) {
+    size_t length;
+    const char* value_name = LLVMGetValueName2(value, &length);
+    return length == strlen(name) && memcmp(value_name, name, length) == 0;
+}
+
+/// Everything but the exports of the entry point becomes private to the module, which lets the optimiser inline the entry point into
+/// its runner and drop whatever it does not use. The exports get a suffix, as other kernels may have entry points of the same name.
+static void make_exports_unique(LLVMModuleRef mod, String entry_point, size_t id, String names[3]) {
+    names[0] = shd_format_string_new("__shady_run_%s", entry_point);
+    names[1] = shd_format_string_new("__shady_args_count_%s", entry_point);
+    names[2] = shd_format_string_new("__shady_arg_sizes_%s", entry_point);
+    for (LLVMValueRef fn = LLVMGetFirstFunction(mod); fn; fn = LLVMGetNextFunction(fn))
+        if (!LLVMIsDeclaration(fn) && !has_name(fn, names[0]))
+            LLVMSetLinkage(fn, LLVMInternalLinkage);
+    for (LLVMValueRef global = LLVMGetFirstGlobal(mod); global; global = LLVMGetNextGlobal(global))
+        if (!LLVMIsDeclaration(global) && !has_name(global, names[1]) && !has_name(global, names[2]))
+            LLVMSetLinkage(global, LLVMInternalLinkage);
+
+    for (size_t i = 0; i < 3; i++) {
+        String unique = shd_format_string_new("%s.%zu", names[i], id);
+        LLVMValueRef value = LLVMGetNamedFunction(mod, names[i]);
+        if (!value)
+            value = LLVMGetNamedGlobal(mod, names[i]);
+        if (value)
+            LLVMSetValueName2(value, unique, strlen(unique));
+        free((void*) names[i]);
+        names[i] = unique;
+    }
+}
+
+static bool optimize(CpuJit* jit, LLVMModuleRef mod) {
+    // target machines are not meant to be shared between threads, and they are cheap next to the passes themselves
+    LLVMTargetMachineRef machine = LLVMCreateTargetMachine(jit->target, LLVMGetTarget(mod), jit->cpu, jit->cpu_features, LLVMCodeGenLevelDefault, LLVMRelocDefault, LLVMCodeModelJITDefault);
+    LLVMPassBuilderOptionsRef options = LLVMCreatePassBuilderOptions();
+    bool ok = check_llvm_error(LLVMRunPasses(mod, "default<O2>", machine, options), "Failed to optimise the kernel");
+    LLVMDisposePassBuilderOptions(options);
+    LLVMDisposeTargetMachine(machine);
+    return ok;
+}
+
+bool shd_rt_cpu_jit_kernel(CpuJit* jit, CpuKernel* kernel, const CompilerConfig* config, Module* mod) {
+    LLVMOrcThreadSafeContextRef tsc = LLVMOrcCreateNewThreadSafeContext();
+    LLVMModuleRef llvm_mod = LLVMModuleCreateWithNameInContext(shd_module_get_name(mod), LLVMOrcThreadSafeContextGetContext(tsc));
+    // the sizes of the arguments the runners export depend on the data layout
+    LLVMSetTarget(llvm_mod, LLVMOrcLLJITGetTripleString(jit->lljit));
+    LLVMSetDataLayout(llvm_mod, LLVMOrcLLJITGetDataLayoutStr(jit->lljit));
+
+    Module* final_mod;
+    shd_emit_llvm_module(config, shd_default_llvm_emitter_config(), mod, llvm_mod, &final_mod);
+    if (shd_module_get_arena(final_mod) != shd_module_get_arena(mod))
+        shd_destroy_ir_arena(shd_module_get_arena(final_mod));
+
+    shd_mutex_lock(jit->mutex);
+    size_t id = jit->next_kernel_id++;
+    shd_mutex_unlock(jit->mutex);
+    String names[3];
+    make_exports_unique(llvm_mod, kernel->key.entry_point, id, names);
+
+    bool ok = false;
+    char* error = NULL;
+    if (LLVMVerifyModule(llvm_mod, LLVMReturnStatusAction, &error)) {
+        shd_error_print("The LLVM backend emitted an invalid module: %s\n", error);
+        LLVMDisposeMessage(error);
+        LLVMDisposeModule(llvm_mod);
+        goto cleanup;
+    }
+    LLVMDisposeMessage(error);
+    if (!optimize(jit, llvm_mod)) {
+        LLVMDisposeModule(llvm_mod);
+        goto cleanup;
+    }
+
+    if (kernel->key.base->runtime->config.dump_spv) {
+        String file_name = shd_format_string_new("%s.%s.ll", shd_module_get_name(mod), kernel->key.entry_point);
+        if (LLVMPrintModuleToFile(llvm_mod, file_name, &error)) {
+            shd_warn_print("Failed to dump the kernel to %s: %s\n", file_name, error);
+            LLVMDisposeMessage(error);
+        }
+        free((void*) file_name);
+    }
+
+    LLVMOrcResourceTrackerRef tracker = LLVMOrcJITDylibCreateResourceTracker(LLVMOrcLLJITGetMainJITDylib(jit->lljit));
+    kernel->jit_resources = tracker;
+    // the JIT owns the module from there on, even when adding it fails
+    CHECK(check_llvm_error(LLVMOrcLLJITAddLLVMIRModuleWithRT(jit->lljit, tracker, LLVMOrcCreateNewThreadSafeModule(llvm_mod, tsc)), "Failed to add the kernel to the JIT"), goto cleanup);
+
+    // looking the symbols up is what compiles the module
+    LLVMOrcExecutorAddress addresses[3];
+    for (size_t i = 0; i < 3; i++)
+        CHECK(check_llvm_error(LLVMOrcLLJITLookup(jit->lljit, &addresses[i], names[i]), "Failed to compile the kernel"), goto cleanup);
+    kernel->run = (CpuKernelFn) addresses[0];
+    kernel->args_count = *(const size_t*) addresses[1];
+    kernel->arg_sizes = (const size_t*) addresses[2];
+    ok = true;
+
+cleanup:
+    for (size_t i = 0; i < 3; i++)
+        free((void*) names[i]);
+    // modules share it with the JIT, which keeps it alive for as long as it needs it
+    LLVMOrcDisposeThreadSafeContext(tsc);
+    return ok;
+}
+
+void shd_rt_cpu_release_jit_kernel(CpuJit* jit, CpuKernel* kernel) {
+    LLVMOrcResourceTrackerRef tracker = kernel->jit_resources;
+    if (!tracker)
+        return;
+    check_llvm_error(LLVMOrcResourceTrackerRemove(tracker), "Failed to unload the kernel");
+    LLVMOrcReleaseResourceTracker(tracker);
+    kernel->jit_resources = NULL;
+}
+
+#else
+
+CpuJit* shd_rt_cpu_create_jit(void) {
+    return NULL;
+}
+
+void shd_rt_cpu_destroy_jit(SHADY_UNUSED CpuJit* jit) {
+    assert(false);
+}
+
+bool shd_rt_cpu_jit_kernel(SHADY_UNUSED CpuJit* jit, SHADY_UNUSED CpuKernel* kernel, SHADY_UNUSED const CompilerConfig* config, SHADY_UNUSED Module* mod) {
+    return false;
+}
+
+void shd_rt_cpu_release_jit_kernel(SHADY_UNUSED CpuJit* jit, SHADY_UNUSED CpuKernel* kernel) {}
+
+#endif
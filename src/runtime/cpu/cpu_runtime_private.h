@@ -0,0 +1,125 @@
+#ifndef SHADY_CPU_RUNTIME_PRIVATE_H
+#define SHADY_CPU_RUNTIME_PRIVATE_H
+
+#include "../runtime_private.h"
+
+#include "threads.h"
+
+typedef struct {
+    Program* base;
+    String entry_point;
+} SpecProgramKey;
+
+typedef struct {
+    Backend base;
+} CpuBackend;
+
+typedef struct CpuJit_ CpuJit;
+
+/// Runs kernels on the host: they are either compiled in-process by LLVM, see cpu_runtime_jit.c, or emitted as C11, built into a
+/// shared object by the system's C compiler and loaded back.
+typedef struct {
+    Device base;
+    char name[256];
+    /// runs the workgroups of the launches, separate from the runtime's workers which compile the kernels
+    ThreadPool* pool;
+    /// NULL when kernels go through the C compiler
+    CpuJit* jit;
+
+    /// guards specialized_programs and the state of its entries
+    Mutex* specialized_programs_mutex;
+    CondVar* specialized_programs_cond;
+    struct Dict* specialized_programs;
+
+    /// guards the completion of commands
+    Mutex* commands_mutex;
+    CondVar* commands_cond;
+} CpuDevice;
+
+typedef struct {
+    Buffer base;
+    CpuDevice* device;
+    size_t size;
+    void* ptr;
+    bool is_imported;
+} CpuBuffer;
+
+typedef enum {
+    CpuKernelCompiling,
+    CpuKernelReady,
+    CpuKernelFailed,
+} CpuKernelState;
+
+/// Signature of the `__shady_run_<entry point>` functions the C11 and LLVM emitters add for compute entry points
+typedef void (*CpuKernelFn)(void** args, const uint32_t num_workgroups[3], uint64_t first_workgroup, uint64_t workgroups_count);
+
+typedef struct {
+    KernelFuture future;
+    SpecProgramKey key;
+    CpuDevice* device;
+    /// guarded by CpuDevice::specialized_programs_mutex
+    CpuKernelState state;
+
+    void* library;
+    /// what the JIT holds on behalf of the kernel, when it compiled it
+    void* jit_resources;
+    CpuKernelFn run;
+    size_t args_count;
+    /// zero-terminated
+    const size_t* arg_sizes;
+} CpuKernel;
+
+typedef struct CpuCommand_ CpuCommand;
+struct CpuCommand_ {
+    Command base;
+    CpuDevice* device;
+    /// NULL for copies, which are done by the time they are returned
+    CpuKernel* kernel;
+    /// copies of the arguments, which the caller does not need to keep around
+    void** args;
+    uint32_t num_workgroups[3];
+    /// indirect launches read num_workgroups from there once they start
+    CpuBuffer* dimensions;
+    size_t dimensions_offset;
+
+    uint64_t workgroups_count;
+    uint64_t chunk_size;
+    volatile uint64_t next_workgroup;
+    /// guarded by CpuDevice::commands_mutex
+    size_t running_jobs;
+    bool done;
+
+    uint64_t submitted_ns;
+    uint64_t start_ns;
+    uint64_t end_ns;
+    uint64_t* profiled_gpu_time;
+
+    /// batches chain their launches, each one starting when the one before completes. The last one owns the chain.
+    CpuCommand* first;
+    CpuCommand* next;
+};
+
+CpuBuffer* shd_rt_cpu_allocate_buffer(CpuDevice*, size_t size);
+CpuBuffer* shd_rt_cpu_import_host_memory(CpuDevice*, void* host_ptr, size_t size);
+bool shd_rt_cpu_can_import_host_memory(CpuDevice*);
+
+CpuCommand* shd_rt_cpu_new_completed_command(CpuDevice*);
+/// Blocks until all the dependencies completed, without consuming them
+void shd_rt_cpu_wait_dependencies(size_t dependencies_count, Command** dependencies);
+
+CpuCommand* shd_rt_cpu_launch_kernel(CpuDevice*, Program*, String entry_point, int dimx, int dimy, int dimz, int args_count, void** args, ExtraKernelOptions*);
+CpuCommand* shd_rt_cpu_launch_kernel_indirect(CpuDevice*, Program*, String entry_point, CpuBuffer* dimensions, size_t offset, int args_count, void** args, ExtraKernelOptions*);
+Batch* shd_rt_cpu_begin_batch(CpuDevice*);
+
+KernelFuture* shd_rt_cpu_prepare_kernel(CpuDevice*, Program*, String entry_point);
+CpuKernel* shd_rt_cpu_get_specialized_program(CpuDevice*, Program*, String entry_point);
+void shd_rt_cpu_destroy_specialized_program(CpuKernel*);
+
+/// NULL when the runtime was built without the LLVM backend, or when `SHADY_CPU_COMPILER=cc` asks for the C compiler instead
+CpuJit* shd_rt_cpu_create_jit(void);
+void shd_rt_cpu_destroy_jit(CpuJit*);
+/// Emits the specialized module as LLVM IR, optimises it for the host and fills in the entry points of the kernel
+bool shd_rt_cpu_jit_kernel(CpuJit*, CpuKernel*, const CompilerConfig*, Module*);
+void shd_rt_cpu_release_jit_kernel(CpuJit*, CpuKernel*);
+
+#endif
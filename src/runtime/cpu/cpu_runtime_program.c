@@ -0,0 +1,280 @@
+#include "cpu_runtime_private.h"
+
+#include "shady/driver.h"
+#include "shady/visit.h"
+#include "shady/be/c.h"
+
+#include "log.h"
+#include "portability.h"
+#include "dict.h"
+#include "util.h"
+#include "growy.h"
+
+#include <spirv/unified1/spirv.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+static CompilerConfig get_compiler_config_for_device(SHADY_UNUSED CpuDevice* device, const CompilerConfig* base_config) {
+    CompilerConfig config = *base_config;
+    // invocations run one after the other, each in a subgroup of its own
+    config.specialization.subgroup_size = 1;
+    return config;
+}
+
+static bool emit_c11_code(CpuKernel* kernel, const CompilerConfig* config, Module* specialized, size_t* code_size, char** code) {
+    CEmitterConfig emitter_config = shd_default_c_emitter_config();
+    emitter_config.dialect = CDialect_C11;
+    emitter_config.explicitly_sized_types = true;
+    emitter_config.allow_compound_literals = true;
+    emitter_config.decay_unsized_arrays = true;
+    emitter_config.native_vectors = true;
+    emitter_config.simd_workgroups = true;
+    Module* final_mod;
+    shd_emit_c(config, emitter_config, specialized, code_size, code, &final_mod);
+
+    if (kernel->key.base->runtime->config.dump_spv) {
+        String file_name = shd_format_string_new("%s.%s.c", shd_module_get_name(final_mod), kernel->key.entry_point);
+        shd_write_file(file_name, *code_size, *code);
+        free((void*) file_name);
+    }
+
+    if (shd_module_get_arena(final_mod) != shd_module_get_arena(specialized))
+        shd_destroy_ir_arena(shd_module_get_arena(final_mod));
+    return true;
+}
+
+/// Runs the compiler, whose output only gets printed if it fails. `SHADY_CC` picks another compiler than the system's.
+static bool run_c_compiler(String source, String library) {
+    String cc = getenv("SHADY_CC");
+    if (!cc)
+        cc = "cc";
+    char* command = shd_format_string_new("%s -std=gnu11 -O2 -fopenmp-simd -shared -fPIC -o '%s' '%s' -lm 2>&1", cc, library, source);
+    shd_debug_print("Building kernel: %s\n", command);
+    FILE* f = popen(command, "r");
+    free(command);
+    CHECK(f, return false);
+
+    Growy* output = shd_new_growy();
+    char buffer[1024];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), f)) > 0)
+        shd_growy_append_bytes(output, read, buffer);
+    shd_growy_append_bytes(output, 1, "\0");
+    int status = pclose(f);
+
+    bool ok = status != -1 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    if (!ok)
+        shd_error_print("Building the kernel with '%s' failed:\n%s", cc, shd_growy_data(output));
+    else if (shd_growy_size(output) > 1)
+        shd_debug_print("C compiler output:\n%s", shd_growy_data(output));
+    shd_destroy_growy(output);
+    return ok;
+}
+
+static bool build_and_load(CpuKernel* kernel, size_t code_size, const char* code) {
+    String tmp = getenv("TMPDIR");
+    char* dir = shd_format_string_new("%s/shady_cpu_XXXXXX", tmp ? tmp : "/tmp");
+    if (!mkdtemp(dir)) {
+        shd_error_print("Failed to create a temporary directory in %s\n", tmp ? tmp : "/tmp");
+        free(dir);
+        return false;
+    }
+    char* source = shd_format_string_new("%s/kernel.c", dir);
+    char* library = shd_format_string_new("%s/kernel.so", dir);
+
+    bool ok = false;
+    CHECK(shd_write_file(source, code_size, code), goto cleanup);
+    CHECK(run_c_compiler(source, library), goto cleanup);
+
+    kernel->library = dlopen(library, RTLD_NOW | RTLD_LOCAL);
+    if (!kernel->library) {
+        shd_error_print("Failed to load the kernel: %s\n", dlerror());
+        goto cleanup;
+    }
+
+    String name = kernel->key.entry_point;
+    char* run_name = shd_format_string_new("__shady_run_%s", name);
+    char* count_name = shd_format_string_new("__shady_args_count_%s", name);
+    char* sizes_name = shd_format_string_new("__shady_arg_sizes_%s", name);
+    kernel->run = (CpuKernelFn) dlsym(kernel->library, run_name);
+    const size_t* args_count = dlsym(kernel->library, count_name);
+    kernel->arg_sizes = dlsym(kernel->library, sizes_name);
+    free(run_name);
+    free(count_name);
+    free(sizes_name);
+    if (!kernel->run || !args_count || !kernel->arg_sizes) {
+        shd_error_print("The kernel has no compute entry point named '%s'\n", name);
+        goto cleanup;
+    }
+    kernel->args_count = *args_count;
+    ok = true;
+
+cleanup:
+    // the library stays mapped after being unlinked
+    unlink(library);
+    unlink(source);
+    rmdir(dir);
+    free(library);
+    free(source);
+    free(dir);
+    return ok;
+}
+
+static bool compile_kernel_with_cc(CpuKernel* kernel, const CompilerConfig* config, Module* specialized) {
+    size_t code_size;
+    char* code;
+    CHECK(emit_c11_code(kernel, config, specialized, &code_size, &code), return false);
+    bool ok = build_and_load(kernel, code_size, code);
+    free(code);
+    return ok;
+}
+
+typedef struct {
+    Visitor visitor;
+    struct Dict* once;
+    bool found;
+} BarrierVisitor;
+
+static void visit_barriers(BarrierVisitor* visitor, const Node* node) {
+    if (shd_dict_find_key(const Node*, visitor->once, node))
+        return;
+    shd_set_insert_get_result(const Node*, visitor->once, node);
+    if (node->tag == ExtInstr_TAG && strcmp(node->payload.ext_instr.set, "spirv.core") == 0 && node->payload.ext_instr.opcode == SpvOpControlBarrier)
+        visitor->found = true;
+    shd_visit_node_operands(&visitor->visitor, 0, node);
+}
+
+/// Invocations run one after the other to completion, none of them could wait for the others at a barrier
+static bool has_control_barriers(Module* mod) {
+    BarrierVisitor visitor = {
+        .visitor = {
+            .visit_node_fn = (VisitNodeFn) visit_barriers,
+        },
+        .once = shd_new_set(const Node*, (HashFn) shd_hash_ptr, (CmpFn) shd_compare_ptrs),
+    };
+    shd_visit_module(&visitor.visitor, mod);
+    shd_destroy_dict(visitor.once);
+    return visitor.found;
+}
+
+static bool compile_kernel(CpuKernel* kernel) {
+    CompilerConfig config = get_compiler_config_for_device(kernel->device, kernel->key.base->base_config);
+    config.specialization.entry_point = kernel->key.entry_point;
+
+    // kernel bundles hold SPIR-V, which is of no use here
+    Module* mod = kernel->key.base->module;
+    CHECK(mod, return false);
+    Module* specialized = mod;
+    CHECK(shd_run_compiler_passes(&config, &specialized) == CompilationNoError, return false);
+
+    bool ok;
+    if (has_control_barriers(specialized)) {
+        shd_error_print("'%s' uses control barriers, which the CPU runtime does not support\n", kernel->key.entry_point);
+        ok = false;
+    } else if (kernel->device->jit)
+        ok = shd_rt_cpu_jit_kernel(kernel->device->jit, kernel, &config, specialized);
+    else
+        ok = compile_kernel_with_cc(kernel, &config, specialized);
+
+    if (shd_module_get_arena(specialized) != shd_module_get_arena(mod))
+        shd_destroy_ir_arena(shd_module_get_arena(specialized));
+    return ok;
+}
+
+/// Runs on the runtime's worker threads, building several kernels at once only costs more C compiler processes, or JIT sessions.
+static void compile_kernel_job(CpuKernel* kernel) {
+    uint64_t tsn = shd_get_time_nano();
+    bool ok = compile_kernel(kernel);
+    uint64_t tpn = shd_get_time_nano();
+    shd_debug_print("Compiling '%s' for the CPU took %zu us\n", kernel->key.entry_point, (size_t) ((tpn - tsn) / 1000));
+
+    CpuDevice* device = kernel->device;
+    shd_mutex_lock(device->specialized_programs_mutex);
+    kernel->state = ok ? CpuKernelReady : CpuKernelFailed;
+    shd_cond_var_broadcast(device->specialized_programs_cond);
+    shd_mutex_unlock(device->specialized_programs_mutex);
+}
+
+static bool is_kernel_ready(CpuKernel* kernel) {
+    shd_mutex_lock(kernel->device->specialized_programs_mutex);
+    bool ready = kernel->state != CpuKernelCompiling;
+    shd_mutex_unlock(kernel->device->specialized_programs_mutex);
+    return ready;
+}
+
+static bool wait_kernel(CpuKernel* kernel) {
+    CpuDevice* device = kernel->device;
+    shd_mutex_lock(device->specialized_programs_mutex);
+    while (kernel->state == CpuKernelCompiling)
+        shd_cond_var_wait(device->specialized_programs_cond, device->specialized_programs_mutex);
+    bool ok = kernel->state == CpuKernelReady;
+    shd_mutex_unlock(device->specialized_programs_mutex);
+    return ok;
+}
+
+static CpuKernel* create_kernel(SpecProgramKey key, CpuDevice* device) {
+    CpuKernel* kernel = calloc(1, sizeof(CpuKernel));
+    if (!kernel)
+        return NULL;
+    // the caller's string might not outlive the kernel
+    char* entry_point = malloc(strlen(key.entry_point) + 1);
+    if (!entry_point) {
+        free(kernel);
+        return NULL;
+    }
+    strcpy(entry_point, key.entry_point);
+    key.entry_point = entry_point;
+    *kernel = (CpuKernel) {
+        .future = {
+            .is_ready = (bool (*)(KernelFuture*)) is_kernel_ready,
+            .wait = (bool (*)(KernelFuture*)) wait_kernel,
+        },
+        .key = key,
+        .device = device,
+        .state = CpuKernelCompiling,
+    };
+    return kernel;
+}
+
+static CpuKernel* prepare_kernel(CpuDevice* device, Program* program, String entry_point) {
+    SpecProgramKey key = { .base = program, .entry_point = entry_point };
+    shd_mutex_lock(device->specialized_programs_mutex);
+    CpuKernel** found = shd_dict_find_value(SpecProgramKey, CpuKernel*, device->specialized_programs, key);
+    if (found) {
+        shd_mutex_unlock(device->specialized_programs_mutex);
+        return *found;
+    }
+    CpuKernel* kernel = create_kernel(key, device);
+    assert(kernel);
+    shd_dict_insert(SpecProgramKey, CpuKernel*, device->specialized_programs, kernel->key, kernel);
+    shd_mutex_unlock(device->specialized_programs_mutex);
+
+    shd_thread_pool_submit(program->runtime->workers, (void (*)(void*)) compile_kernel_job, kernel);
+    return kernel;
+}
+
+KernelFuture* shd_rt_cpu_prepare_kernel(CpuDevice* device, Program* program, String entry_point) {
+    return &prepare_kernel(device, program, entry_point)->future;
+}
+
+CpuKernel* shd_rt_cpu_get_specialized_program(CpuDevice* device, Program* program, String entry_point) {
+    CpuKernel* kernel = prepare_kernel(device, program, entry_point);
+    if (!wait_kernel(kernel))
+        return NULL;
+    return kernel;
+}
+
+void shd_rt_cpu_destroy_specialized_program(CpuKernel* kernel) {
+    if (kernel->jit_resources)
+        shd_rt_cpu_release_jit_kernel(kernel->device->jit, kernel);
+    if (kernel->library)
+        dlclose(kernel->library);
+    free((void*) kernel->key.entry_point);
+    free(kernel);
+}
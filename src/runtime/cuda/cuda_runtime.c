@@ -60,6 +60,15 @@ static CudaCommand* shd_cuda_launch_kernel(CudaDevice* device, Program* p, Strin
     return cmd;
 }
 
+/// CUDA has no indirect launches: the grid size is read back on the default stream, after the work that produces it
+static CudaCommand* shd_cuda_launch_kernel_indirect(CudaDevice* device, Program* p, String entry_point, CudaBuffer* dimensions, size_t offset, int args_count, void** args, ExtraKernelOptions* options) {
+    CHECK(dimensions->base.backend_tag == CUDARuntimeBackend, return NULL);
+    CHECK(offset % 4 == 0 && offset + sizeof(uint32_t) * 3 <= dimensions->size, return NULL);
+    uint32_t dims[3];
+    CHECK_CUDA(cuMemcpyDtoH(dims, dimensions->device_ptr + offset, sizeof(dims)), return NULL);
+    return shd_cuda_launch_kernel(device, p, entry_point, dims[0], dims[1], dims[2], args_count, args, options);
+}
+
 static KeyHash hash_spec_program_key(SpecProgramKey* ptr) {
     return hash_murmur(ptr, sizeof(SpecProgramKey));
 }
@@ -80,6 +89,7 @@ static CudaDevice* create_cuda_device(CudaBackend* b, int ordinal) {
             .can_import_host_memory = (bool (*)(Device*)) shd_rt_cuda_can_import_host_memory,
             .import_host_memory_as_buffer = (Buffer* (*)(Device*, void*, size_t)) shd_rt_cuda_import_host_memory,
             .launch_kernel = (Command*(*)(Device*, Program*, String, int, int, int, int, void**, ExtraKernelOptions*)) shd_cuda_launch_kernel,
+            .launch_kernel_indirect = (Command*(*)(Device*, Program*, String, Buffer*, size_t, int, void**, ExtraKernelOptions*)) shd_cuda_launch_kernel_indirect,
         },
         .handle = handle,
         .specialized_programs = new_dict(SpecProgramKey, CudaKernel*, (HashFn) hash_spec_program_key, (CmpFn) cmp_spec_program_keys),
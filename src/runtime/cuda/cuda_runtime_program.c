@@ -18,7 +18,9 @@ static bool emit_cuda_c_code(CudaKernel* spec) {
     CompilerConfig config = get_compiler_config_for_device(spec->device, spec->key.base->base_config);
     config.specialization.entry_point = spec->key.entry_point;
 
+    // kernel bundles hold SPIR-V, which is of no use here
     Module* dst_mod = spec->key.base->module;
+    CHECK(dst_mod, return false);
     CHECK(run_compiler_passes(&config, &dst_mod) == CompilationNoError, return false);
 
     CEmitterConfig emitter_config = {
@@ -2,6 +2,9 @@
 
 #include "log.h"
 #include "list.h"
+#include "growy.h"
+#include "util.h"
+
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
@@ -13,23 +16,43 @@ Runtime* shd_rt_initialize(RuntimeConfig config) {
     runtime->backends = shd_new_list(Backend*);
     runtime->devices = shd_new_list(Device*);
     runtime->programs = shd_new_list(Program*);
+    runtime->workers = shd_new_thread_pool(config.worker_threads);
 
 #if VK_BACKEND_PRESENT
     Backend* vk_backend = shd_rt_initialize_vk_backend(runtime);
+#if CPU_BACKEND_PRESENT
+    // machines without a Vulkan driver can still run everything on the CPU
+    if (!vk_backend)
+        shd_warn_print("Vulkan is unavailable, only the CPU backend will be used.\n");
+#else
     CHECK(vk_backend, goto init_fail_free);
-    shd_list_append(Backend*, runtime->backends, vk_backend);
+#endif
+    if (vk_backend)
+        shd_list_append(Backend*, runtime->backends, vk_backend);
 #endif
 #if CUDA_BACKEND_PRESENT
     Backend* cuda_backend = shd_rt_initialize_cuda_backend(runtime);
     CHECK(cuda_backend, goto init_fail_free);
     append_list(Backend*, runtime->backends, cuda_backend);
 #endif
+#if CPU_BACKEND_PRESENT
+    // comes last so that it does not shift the indices of the GPUs
+    Backend* cpu_backend = shd_rt_initialize_cpu_backend(runtime);
+    CHECK(cpu_backend, goto init_fail_free);
+    shd_list_append(Backend*, runtime->backends, cpu_backend);
+#endif
+
+    if (config.profile || config.profile_trace_path) {
+        for (size_t i = 0; i < shd_list_count(runtime->devices); i++)
+            shd_read_list(Device*, runtime->devices)[i]->profiler = shd_rt_new_profiler();
+    }
 
     shd_info_print("Shady runtime successfully initialized !\n");
     return runtime;
 
     init_fail_free:
     shd_error_print("Failed to initialise the runtime.\n");
+    shd_destroy_thread_pool(runtime->workers);
     free(runtime);
     return NULL;
 }
@@ -37,18 +60,29 @@ Runtime* shd_rt_initialize(RuntimeConfig config) {
 void shd_rt_shutdown(Runtime* runtime) {
     if (!runtime) return;
 
+    // the programs go first, while the devices holding their specialisations are still around
+    for (size_t i = 0; i < shd_list_count(runtime->programs); i++) {
+        shd_rt_unload_program(shd_read_list(Program*, runtime->programs)[i]);
+    }
+    shd_destroy_list(runtime->programs);
+
+    shd_destroy_thread_pool(runtime->workers);
+
+    if (runtime->config.profile_trace_path)
+        shd_rt_export_profile_trace(runtime, runtime->config.profile_trace_path);
+
     // TODO force wait outstanding dispatches ?
     for (size_t i = 0; i < shd_list_count(runtime->devices); i++) {
         Device* dev = shd_read_list(Device*, runtime->devices)[i];
+        if (dev->profiler) {
+            shd_rt_print_kernel_profiles(dev);
+            shd_rt_destroy_profiler(dev->profiler);
+            dev->profiler = NULL;
+        }
         dev->cleanup(dev);
     }
     shd_destroy_list(runtime->devices);
 
-    for (size_t i = 0; i < shd_list_count(runtime->programs); i++) {
-        shd_rt_unload_program(shd_read_list(Program*, runtime->programs)[i]);
-    }
-    shd_destroy_list(runtime->programs);
-
     for (size_t i = 0; i < shd_list_count(runtime->backends); i++) {
         Backend* bk = shd_read_list(Backend*, runtime->backends)[i];
         bk->cleanup(bk);
@@ -78,8 +112,132 @@ Command* shd_rt_launch_kernel(Program* p, Device* d, const char* entry_point, in
     return d->launch_kernel(d, p, entry_point, dimx, dimy, dimz, args_count, args, extra_options);
 }
 
+Command* shd_rt_launch_kernel_indirect(Program* p, Device* d, const char* entry_point, Buffer* dimensions, size_t offset, int args_count, void** args, ExtraKernelOptions* extra_options) {
+    CHECK(d->launch_kernel_indirect, return NULL);
+    return d->launch_kernel_indirect(d, p, entry_point, dimensions, offset, args_count, args, extra_options);
+}
+
 bool shd_rt_wait_completion(Command* cmd) { return cmd->wait_for_completion(cmd); }
 
+Batch* shd_rt_begin_batch(Device* d) {
+    CHECK(d->begin_batch, return NULL);
+    return d->begin_batch(d);
+}
+
+bool shd_rt_launch_kernel_in_batch(Batch* b, Program* p, const char* entry_point, int dimx, int dimy, int dimz, int args_count, void** args) {
+    return b->launch_kernel(b, p, entry_point, dimx, dimy, dimz, args_count, args);
+}
+
+bool shd_rt_launch_kernel_indirect_in_batch(Batch* b, Program* p, const char* entry_point, Buffer* dimensions, size_t offset, int args_count, void** args) {
+    CHECK(b->launch_kernel_indirect, return false);
+    return b->launch_kernel_indirect(b, p, entry_point, dimensions, offset, args_count, args);
+}
+
+Command* shd_rt_submit_batch(Batch* b) { return b->submit(b); }
+
+KernelLaunchTemplate* shd_rt_begin_launch_template(Device* d) {
+    CHECK(d->begin_launch_template, return NULL);
+    return d->begin_launch_template(d);
+}
+
+bool shd_rt_record_launch(KernelLaunchTemplate* t, Program* p, const char* entry_point, int dimx, int dimy, int dimz, int args_count, void** args) {
+    return t->record_launch(t, p, entry_point, dimx, dimy, dimz, args_count, args);
+}
+
+bool shd_rt_record_launch_indirect(KernelLaunchTemplate* t, Program* p, const char* entry_point, Buffer* dimensions, size_t offset, int args_count, void** args) {
+    return t->record_launch_indirect(t, p, entry_point, dimensions, offset, args_count, args);
+}
+
+Command* shd_rt_submit_launch_template(KernelLaunchTemplate* t, size_t patches_count, void** patches, size_t dependencies_count, Command** dependencies) {
+    return t->submit(t, patches_count, patches, dependencies_count, dependencies);
+}
+
+void shd_rt_destroy_launch_template(KernelLaunchTemplate* t) { t->destroy(t); }
+
+KernelFuture* shd_rt_prepare_kernel(Program* p, Device* d, const char* entry_point) {
+    if (!d->prepare_kernel)
+        return NULL;
+    return d->prepare_kernel(d, p, entry_point);
+}
+
+void shd_rt_prepare_all_kernels(Program* p, Device* d) {
+    if (p->bundle) {
+        for (size_t i = 0; i < shd_kernel_bundle_count(p->bundle); i++)
+            shd_rt_prepare_kernel(p, d, shd_kernel_bundle_get(p->bundle, i)->entry_point);
+        return;
+    }
+    Nodes decls = shd_module_get_declarations(p->module);
+    for (size_t i = 0; i < decls.count; i++) {
+        const Node* decl = decls.nodes[i];
+        if (decl->tag == Function_TAG && shd_lookup_annotation(decl, "EntryPoint"))
+            shd_rt_prepare_kernel(p, d, shd_get_abstraction_name(decl));
+    }
+}
+
+bool shd_rt_is_kernel_ready(KernelFuture* f) { return f->is_ready(f); }
+bool shd_rt_wait_kernel(KernelFuture* f) { return f->wait(f); }
+
+bool shd_rt_prewarm_kernel(Program* p, Device* d, const char* entry_point) {
+    KernelFuture* f = shd_rt_prepare_kernel(p, d, entry_point);
+    if (!f)
+        return true;
+    return shd_rt_wait_kernel(f);
+}
+
+bool shd_rt_flush_pipeline_cache(Device* d) {
+    if (!d->flush_pipeline_cache)
+        return true;
+    return d->flush_pipeline_cache(d);
+}
+
+bool shd_rt_get_buffer_allocator_stats(Device* d, BufferAllocatorStats* stats) {
+    if (!d->get_buffer_allocator_stats)
+        return false;
+    return d->get_buffer_allocator_stats(d, stats);
+}
+
+size_t shd_rt_get_kernel_profiles(Device* d, size_t capacity, KernelProfile* profiles) {
+    if (!d->profiler)
+        return 0;
+    return shd_rt_profiler_get_kernel_profiles(d->profiler, capacity, profiles);
+}
+
+void shd_rt_print_kernel_profiles(Device* d) {
+    size_t count = shd_rt_get_kernel_profiles(d, 0, NULL);
+    if (count == 0)
+        return;
+    LARRAY(KernelProfile, profiles, count);
+    shd_rt_get_kernel_profiles(d, count, profiles);
+    shd_info_print("Kernel timings on %s:\n", shd_rt_get_device_name(d));
+    for (size_t i = 0; i < count; i++) {
+        KernelProfile* p = &profiles[i];
+        shd_info_print("  %-32s %6zu launches, %10.3f ms total, min %9.1f us, mean %9.1f us, p50 %9.1f us, p99 %9.1f us\n", p->entry_point, p->count, (double) p->total_ns / 1000000.0, (double) p->min_ns / 1000.0, (double) p->mean_ns / 1000.0, (double) p->p50_ns / 1000.0, (double) p->p99_ns / 1000.0);
+    }
+}
+
+bool shd_rt_export_profile_trace(Runtime* r, const char* path) {
+    Growy* g = shd_new_growy();
+    shd_growy_append_string(g, "{\"traceEvents\":[\n");
+    bool first = true;
+    for (size_t i = 0; i < shd_list_count(r->devices); i++) {
+        Device* dev = shd_read_list(Device*, r->devices)[i];
+        if (!dev->profiler)
+            continue;
+        if (!first)
+            shd_growy_append_string(g, ",\n");
+        shd_rt_profiler_write_trace(dev->profiler, g, i, shd_rt_get_device_name(dev));
+        first = false;
+    }
+    shd_growy_append_string(g, "\n]}\n");
+    bool ok = shd_write_file(path, shd_growy_size(g), shd_growy_data(g));
+    shd_destroy_growy(g);
+    if (ok)
+        shd_info_print("Wrote profiling trace to '%s'\n", path);
+    else
+        shd_error_print("Failed to write profiling trace to '%s'\n", path);
+    return ok;
+}
+
 bool shd_rt_can_import_host_memory(Device* device) { return device->can_import_host_memory(device); }
 
 Buffer* shd_rt_allocate_buffer_device(Device* device, size_t bytes) { return device->allocate_buffer(device, bytes); }
@@ -92,3 +250,5 @@ uint64_t shd_rt_get_buffer_device_pointer(Buffer* buf) { return buf->get_device_
 
 bool shd_rt_copy_to_buffer(Buffer* dst, size_t buffer_offset, void* src, size_t size) { return dst->copy_into(dst, buffer_offset, src, size); }
 bool shd_rt_copy_from_buffer(Buffer* src, size_t buffer_offset, void* dst, size_t size) { return src->copy_from(src, buffer_offset, dst, size); }
+Command* shd_rt_copy_to_buffer_async(Buffer* dst, size_t buffer_offset, void* src, size_t size, size_t dependencies_count, Command** dependencies) { return dst->copy_into_async(dst, buffer_offset, src, size, dependencies_count, dependencies); }
+Command* shd_rt_copy_from_buffer_async(Buffer* src, size_t buffer_offset, void* dst, size_t size, size_t dependencies_count, Command** dependencies) { return src->copy_from_async(src, buffer_offset, dst, size, dependencies_count, dependencies); }
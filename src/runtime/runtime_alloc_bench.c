@@ -0,0 +1,91 @@
+#include "shady/runtime.h"
+
+#include "runtime_app_common.h"
+
+#include "log.h"
+#include "portability.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+
+/// Allocation churn: keeps a working set of buffers of mixed sizes alive while randomly replacing them,
+/// then reports allocator throughput and fragmentation. Works on any device, including lavapipe.
+
+#define DEFAULT_ITERATIONS 100000
+#define WORKING_SET 1024
+#define MAX_SMALL_SIZE (64 * 1024)
+#define MAX_LARGE_SIZE (32 * 1024 * 1024)
+
+typedef struct {
+    RuntimeConfig runtime_config;
+    CommonAppArgs common_app_args;
+    size_t iterations;
+} Args;
+
+static size_t random_size(void) {
+    // mostly small buffers, with the occasional big one
+    if (rand() % 64 == 0)
+        return 1 + (size_t) rand() % MAX_LARGE_SIZE;
+    return 1 + (size_t) rand() % MAX_SMALL_SIZE;
+}
+
+static void print_stats(const char* when, BufferAllocatorStats* stats) {
+    size_t free_bytes = stats->reserved_bytes - stats->used_bytes;
+    double external = free_bytes > 0 ? 1.0 - (double) stats->largest_free_range / (double) free_bytes : 0.0;
+    double internal = stats->used_bytes > 0 ? 1.0 - (double) stats->requested_bytes / (double) stats->used_bytes : 0.0;
+    shd_info_print("[%s] %zu blocks, %zu/%zu bytes used (%zu requested), largest free range %zu, %zu dedicated buffers (%zu bytes)\n", when, stats->blocks_count, stats->used_bytes, stats->reserved_bytes, stats->requested_bytes, stats->largest_free_range, stats->dedicated_count, stats->dedicated_bytes);
+    shd_info_print("[%s] internal fragmentation %.1f%%, external fragmentation %.1f%%\n", when, internal * 100.0, external * 100.0);
+}
+
+int main(int argc, char* argv[]) {
+    shd_log_set_level(INFO);
+    Args args = {
+        .runtime_config = shd_rt_default_config(),
+        .iterations = DEFAULT_ITERATIONS,
+    };
+    cli_parse_common_app_arguments(&args.common_app_args, &argc, argv);
+    shd_parse_common_args(&argc, argv);
+    shd_rt_cli_parse_runtime_config(&args.runtime_config, &argc, argv);
+    if (argc > 1)
+        args.iterations = strtoull(argv[1], NULL, 10);
+
+    Runtime* runtime = shd_rt_initialize(args.runtime_config);
+    Device* device = shd_rt_get_device(runtime, args.common_app_args.device);
+    assert(device);
+    shd_info_print("Running %zu allocation churn iterations on %s\n", args.iterations, shd_rt_get_device_name(device));
+
+    srand(0);
+    Buffer* buffers[WORKING_SET] = { 0 };
+    size_t failures = 0;
+
+    uint64_t start = shd_get_time_nano();
+    for (size_t i = 0; i < args.iterations; i++) {
+        size_t slot = (size_t) rand() % WORKING_SET;
+        if (buffers[slot])
+            shd_rt_destroy_buffer(buffers[slot]);
+        buffers[slot] = shd_rt_allocate_buffer_device(device, random_size());
+        if (!buffers[slot])
+            failures++;
+    }
+    uint64_t elapsed = shd_get_time_nano() - start;
+
+    BufferAllocatorStats stats;
+    bool has_stats = shd_rt_get_buffer_allocator_stats(device, &stats);
+    if (has_stats)
+        print_stats("steady state", &stats);
+
+    for (size_t i = 0; i < WORKING_SET; i++) {
+        if (buffers[i])
+            shd_rt_destroy_buffer(buffers[i]);
+    }
+
+    shd_info_print("%zu allocations (%zu failed) in %.3f ms, %.1f ns per allocate+free\n", args.iterations, failures, (double) elapsed / 1000000.0, (double) elapsed / (double) args.iterations);
+    if (has_stats && shd_rt_get_buffer_allocator_stats(device, &stats)) {
+        print_stats("after teardown", &stats);
+        shd_info_print("%zu allocations, %zu frees, %.3f ms spent in the allocator\n", stats.allocations_count, stats.frees_count, (double) stats.allocator_time_ns / 1000000.0);
+    }
+
+    shd_rt_shutdown(runtime);
+    return failures > 0;
+}
@@ -3,6 +3,8 @@
 
 #include "log.h"
 
+#include <stdlib.h>
+
 RuntimeConfig shd_rt_default_config() {
     return (RuntimeConfig) {
 #ifndef NDEBUG
@@ -17,16 +19,37 @@ RuntimeConfig shd_rt_default_config() {
 #define DRIVER_CONFIG_OPTIONS(F) \
 F(config->use_validation, api-validation) \
 F(config->dump_spv, dump-spv) \
+F(config->profile, profile) \
 
 void shd_rt_cli_parse_runtime_config(RuntimeConfig* config, int* pargc, char** argv) {
     int argc = *pargc;
 
     bool help = false;
     for (int i = 1; i < argc; i++) {
+        if (argv[i] == NULL)
+            continue;
 
         DRIVER_CONFIG_OPTIONS(PARSE_TOGGLE_OPTION)
 
-        if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+        if (strcmp(argv[i], "--pipeline-cache") == 0) {
+            argv[i] = NULL;
+            i++;
+            if (i == argc)
+                shd_error("Missing pipeline cache directory");
+            config->pipeline_cache_path = argv[i];
+        } else if (strcmp(argv[i], "--worker-threads") == 0) {
+            argv[i] = NULL;
+            i++;
+            if (i == argc)
+                shd_error("Missing worker threads count");
+            config->worker_threads = strtol(argv[i], NULL, 10);
+        } else if (strcmp(argv[i], "--profile-trace") == 0) {
+            argv[i] = NULL;
+            i++;
+            if (i == argc)
+                shd_error("Missing profiling trace filename");
+            config->profile_trace_path = argv[i];
+        } else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
             help = true;
             continue;
         } else {
@@ -43,6 +66,10 @@ void shd_rt_cli_parse_runtime_config(RuntimeConfig* config, int* pargc, char** a
         shd_error_print("  --dump-cfg <filename>                     Dumps the control flow graph of the final IR\n");
         shd_error_print("  --dump-loop-tree <filename>\n");
         shd_error_print("  --dump-ir <filename>                      Dumps the final IR\n");
+        shd_error_print("  --pipeline-cache <directory>              Persists compiled pipelines across runs\n");
+        shd_error_print("  --worker-threads N                        Threads used for background kernel compilation (default=one per CPU)\n");
+        shd_error_print("  --profile                                 Prints per-kernel device timings on shutdown\n");
+        shd_error_print("  --profile-trace <filename>                Writes a Chrome trace of host and device activity on shutdown\n");
     }
 
     shd_pack_remaining_args(pargc, argv);
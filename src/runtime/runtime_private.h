@@ -2,6 +2,10 @@
 #define SHADY_RUNTIME_PRIVATE
 #include "shady/runtime.h"
 #include "shady/ir.h"
+#include "shady/driver.h"
+
+#include "thread_pool.h"
+#include "growy.h"
 
 #define CHECK(x, failure_handler) { if (!(x)) { shd_error_print(#x " failed\n"); failure_handler; } }
 
@@ -13,13 +17,19 @@ struct Runtime_ {
     struct List* backends;
     struct List* devices;
     struct List* programs;
+
+    /// runs background kernel specialisation
+    ThreadPool* workers;
 };
 
 typedef enum {
     VulkanRuntimeBackend,
     CUDARuntimeBackend,
+    CPURuntimeBackend,
 } ShdRuntimeBackend;
 
+typedef struct Profiler_ Profiler;
+
 typedef struct Backend_ Backend;
 struct Backend_ {
     Runtime* runtime;
@@ -31,9 +41,21 @@ struct Device_ {
     String (*get_name)(Device*);
 
     Command* (*launch_kernel)(Device*, Program*, const char* entry_point, int dimx, int dimy, int dimz, int args_count, void** args, ExtraKernelOptions*);
+    Command* (*launch_kernel_indirect)(Device*, Program*, const char* entry_point, Buffer* dimensions, size_t offset, int args_count, void** args, ExtraKernelOptions*);
+    Batch* (*begin_batch)(Device*);
+    KernelLaunchTemplate* (*begin_launch_template)(Device*);
     Buffer* (*allocate_buffer)(Device*, size_t bytes);
     Buffer* (*import_host_memory_as_buffer)(Device*, void* base, size_t bytes);
     bool (*can_import_host_memory)(Device*);
+
+    KernelFuture* (*prepare_kernel)(Device*, Program*, const char* entry_point);
+    bool (*flush_pipeline_cache)(Device*);
+    bool (*get_buffer_allocator_stats)(Device*, BufferAllocatorStats*);
+    /// optional: frees what the device specialised from the program, once the work in flight is done with it
+    void (*unload_program)(Device*, Program*);
+
+    /// NULL unless profiling was enabled in the runtime config
+    Profiler* profiler;
 };
 
 typedef struct {
@@ -48,13 +70,34 @@ struct Program_ {
     const CompilerConfig* base_config;
     /// owns the module, may be NULL if module is owned by someone else
     IrArena* arena;
+    /// NULL for programs loaded from a kernel bundle
     Module* module;
+    /// owned by the program, NULL unless it was loaded from a kernel bundle
+    KernelBundle* bundle;
 };
 
 struct Command_ {
     bool (*wait_for_completion)(Command*);
 };
 
+struct Batch_ {
+    bool (*launch_kernel)(Batch*, Program*, const char* entry_point, int dimx, int dimy, int dimz, int args_count, void** args);
+    bool (*launch_kernel_indirect)(Batch*, Program*, const char* entry_point, Buffer* dimensions, size_t offset, int args_count, void** args);
+    Command* (*submit)(Batch*);
+};
+
+struct KernelLaunchTemplate_ {
+    bool (*record_launch)(KernelLaunchTemplate*, Program*, const char* entry_point, int dimx, int dimy, int dimz, int args_count, void** args);
+    bool (*record_launch_indirect)(KernelLaunchTemplate*, Program*, const char* entry_point, Buffer* dimensions, size_t offset, int args_count, void** args);
+    Command* (*submit)(KernelLaunchTemplate*, size_t patches_count, void** patches, size_t dependencies_count, Command** dependencies);
+    void (*destroy)(KernelLaunchTemplate*);
+};
+
+struct KernelFuture_ {
+    bool (*is_ready)(KernelFuture*);
+    bool (*wait)(KernelFuture*);
+};
+
 struct Buffer_ {
     ShdRuntimeBackend backend_tag;
     void     (*destroy)(Buffer*);
@@ -62,11 +105,25 @@ struct Buffer_ {
     uint64_t (*get_device_ptr)(Buffer*);
     bool     (*copy_into)(Buffer* dst, size_t buffer_offset, void* src, size_t bytes);
     bool     (*copy_from)(Buffer* src, size_t buffer_offset, void* dst, size_t bytes);
+    Command* (*copy_into_async)(Buffer* dst, size_t buffer_offset, void* src, size_t bytes, size_t dependencies_count, Command** dependencies);
+    Command* (*copy_from_async)(Buffer* src, size_t buffer_offset, void* dst, size_t bytes, size_t dependencies_count, Command** dependencies);
 };
 
 void shd_rt_unload_program(Program* program);
 
+Profiler* shd_rt_new_profiler(void);
+void shd_rt_destroy_profiler(Profiler* profiler);
+/// Records a span of host time, from `start_ns` (as given by shd_get_time_nano) until now
+void shd_rt_profile_host_event(Profiler* profiler, String name, String category, uint64_t start_ns);
+/// Records a span of device time. Device timestamps come from their own clock,
+/// the host time at which the work was submitted is used to line it up with the host's.
+void shd_rt_profile_device_event(Profiler* profiler, String name, String category, uint64_t submitted_ns, uint64_t start_ns, uint64_t end_ns);
+size_t shd_rt_profiler_get_kernel_profiles(Profiler* profiler, size_t capacity, KernelProfile* profiles);
+/// Appends the profiler's events as comma-separated Chrome trace events, under the given process id
+void shd_rt_profiler_write_trace(Profiler* profiler, Growy* g, size_t pid, String process_name);
+
 Backend* shd_rt_initialize_vk_backend(Runtime*);
-Backend* shd_rt_shd_rt_initialize_cuda_backend(Runtime*);
+Backend* shd_rt_initialize_cuda_backend(Runtime*);
+Backend* shd_rt_initialize_cpu_backend(Runtime*);
 
 #endif
@@ -0,0 +1,217 @@
+#include "runtime_private.h"
+
+#include "log.h"
+#include "list.h"
+#include "dict.h"
+#include "arena.h"
+#include "growy.h"
+#include "util.h"
+#include "portability.h"
+#include "threads.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+typedef struct {
+    String name;
+    String category;
+    bool on_device;
+    /// host events are on the host clock, device events on the device's
+    uint64_t start_ns;
+    uint64_t duration_ns;
+} ProfileEvent;
+
+struct Profiler_ {
+    /// events come in from every thread using the device
+    Mutex* mutex;
+    Arena* arena;
+    /// interned names, the ones we are given may not outlive the events
+    struct Dict* names;
+    struct List* events;
+
+    /// Added to device timestamps to put them on the host clock.
+    /// Work can't start on the device before it was submitted, so the largest (submitted - start) seen so far is our best guess.
+    int64_t device_clock_offset;
+    bool has_device_clock_offset;
+};
+
+static KeyHash hash_string(String* s) {
+    return shd_hash(*s, strlen(*s));
+}
+
+static bool compare_strings(String* a, String* b) {
+    return strcmp(*a, *b) == 0;
+}
+
+Profiler* shd_rt_new_profiler(void) {
+    Profiler* profiler = calloc(1, sizeof(Profiler));
+    profiler->mutex = shd_new_mutex();
+    profiler->arena = shd_new_arena();
+    profiler->names = shd_new_set(String, (HashFn) hash_string, (CmpFn) compare_strings);
+    profiler->events = shd_new_list(ProfileEvent);
+    return profiler;
+}
+
+void shd_rt_destroy_profiler(Profiler* profiler) {
+    shd_destroy_list(profiler->events);
+    shd_destroy_dict(profiler->names);
+    shd_destroy_arena(profiler->arena);
+    shd_destroy_mutex(profiler->mutex);
+    free(profiler);
+}
+
+static String intern_name(Profiler* profiler, String name) {
+    String* found = shd_dict_find_key(String, profiler->names, name);
+    if (found)
+        return *found;
+    char* copy = shd_arena_alloc(profiler->arena, strlen(name) + 1);
+    strcpy(copy, name);
+    String interned = copy;
+    shd_set_insert_get_result(String, profiler->names, interned);
+    return interned;
+}
+
+void shd_rt_profile_host_event(Profiler* profiler, String name, String category, uint64_t start_ns) {
+    uint64_t end_ns = shd_get_time_nano();
+    shd_mutex_lock(profiler->mutex);
+    ProfileEvent event = {
+        .name = intern_name(profiler, name),
+        .category = category,
+        .on_device = false,
+        .start_ns = start_ns,
+        .duration_ns = end_ns - start_ns,
+    };
+    shd_list_append(ProfileEvent, profiler->events, event);
+    shd_mutex_unlock(profiler->mutex);
+}
+
+void shd_rt_profile_device_event(Profiler* profiler, String name, String category, uint64_t submitted_ns, uint64_t start_ns, uint64_t end_ns) {
+    int64_t offset = (int64_t) submitted_ns - (int64_t) start_ns;
+    shd_mutex_lock(profiler->mutex);
+    if (!profiler->has_device_clock_offset || offset > profiler->device_clock_offset) {
+        profiler->device_clock_offset = offset;
+        profiler->has_device_clock_offset = true;
+    }
+
+    ProfileEvent event = {
+        .name = intern_name(profiler, name),
+        .category = category,
+        .on_device = true,
+        .start_ns = start_ns,
+        .duration_ns = end_ns - start_ns,
+    };
+    shd_list_append(ProfileEvent, profiler->events, event);
+    shd_mutex_unlock(profiler->mutex);
+}
+
+static int compare_durations(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*) a;
+    uint64_t y = *(const uint64_t*) b;
+    return (x > y) - (x < y);
+}
+
+static int compare_profiles(const void* a, const void* b) {
+    uint64_t x = ((const KernelProfile*) a)->total_ns;
+    uint64_t y = ((const KernelProfile*) b)->total_ns;
+    return (x < y) - (x > y);
+}
+
+/// Nearest-rank percentile of a sorted array
+static uint64_t percentile(const uint64_t* sorted, size_t count, size_t p) {
+    size_t rank = (count * p + 99) / 100;
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+size_t shd_rt_profiler_get_kernel_profiles(Profiler* profiler, size_t capacity, KernelProfile* profiles) {
+    // names are interned, so their addresses identify them
+    struct Dict* durations = shd_new_dict(String, struct List*, (HashFn) shd_hash_ptr, (CmpFn) shd_compare_ptrs);
+    shd_mutex_lock(profiler->mutex);
+    size_t events_count = shd_list_count(profiler->events);
+    ProfileEvent* events = shd_read_list(ProfileEvent, profiler->events);
+    for (size_t i = 0; i < events_count; i++) {
+        if (!events[i].on_device || strcmp(events[i].category, "kernel") != 0)
+            continue;
+        struct List** found = shd_dict_find_value(String, struct List*, durations, events[i].name);
+        struct List* list = found ? *found : NULL;
+        if (!list) {
+            list = shd_new_list(uint64_t);
+            shd_dict_insert(String, struct List*, durations, events[i].name, list);
+        }
+        shd_list_append(uint64_t, list, events[i].duration_ns);
+    }
+    shd_mutex_unlock(profiler->mutex);
+
+    size_t profiles_count = shd_dict_count(durations);
+    if (profiles_count == 0) {
+        shd_destroy_dict(durations);
+        return 0;
+    }
+    LARRAY(KernelProfile, all_profiles, profiles_count);
+    size_t iter = 0, j = 0;
+    String name;
+    struct List* list;
+    while (shd_dict_iter(durations, &iter, &name, &list)) {
+        size_t count = shd_list_count(list);
+        uint64_t* sorted = shd_read_list(uint64_t, list);
+        qsort(sorted, count, sizeof(uint64_t), compare_durations);
+        uint64_t total = 0;
+        for (size_t k = 0; k < count; k++)
+            total += sorted[k];
+        all_profiles[j++] = (KernelProfile) {
+            .entry_point = name,
+            .count = count,
+            .total_ns = total,
+            .min_ns = sorted[0],
+            .mean_ns = total / count,
+            .p50_ns = percentile(sorted, count, 50),
+            .p99_ns = percentile(sorted, count, 99),
+        };
+        shd_destroy_list(list);
+    }
+    shd_destroy_dict(durations);
+
+    qsort(all_profiles, profiles_count, sizeof(KernelProfile), compare_profiles);
+    for (size_t k = 0; k < profiles_count && k < capacity; k++)
+        profiles[k] = all_profiles[k];
+    return profiles_count;
+}
+
+static void append_json_string(Growy* g, String s) {
+    shd_growy_append_string(g, "\"");
+    for (const char* c = s; *c; c++) {
+        if (*c == '"' || *c == '\\')
+            shd_growy_append_formatted(g, "\\%c", *c);
+        else if ((unsigned char) *c < 0x20)
+            shd_growy_append_formatted(g, "\\u%04x", (unsigned) *c);
+        else
+            shd_growy_append_bytes(g, 1, c);
+    }
+    shd_growy_append_string(g, "\"");
+}
+
+/// Host work goes on the first track of the device's process, device work on the second one
+#define HOST_TRACK 0
+#define DEVICE_TRACK 1
+
+void shd_rt_profiler_write_trace(Profiler* profiler, Growy* g, size_t pid, String process_name) {
+    shd_growy_append_formatted(g, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%zu,\"args\":{\"name\":", pid);
+    append_json_string(g, process_name);
+    shd_growy_append_string(g, "}}");
+    shd_growy_append_formatted(g, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%zu,\"tid\":%d,\"args\":{\"name\":\"host\"}}", pid, HOST_TRACK);
+    shd_growy_append_formatted(g, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%zu,\"tid\":%d,\"args\":{\"name\":\"device\"}}", pid, DEVICE_TRACK);
+
+    shd_mutex_lock(profiler->mutex);
+    size_t events_count = shd_list_count(profiler->events);
+    ProfileEvent* events = shd_read_list(ProfileEvent, profiler->events);
+    for (size_t i = 0; i < events_count; i++) {
+        ProfileEvent* event = &events[i];
+        int64_t start = (int64_t) event->start_ns;
+        if (event->on_device)
+            start += profiler->device_clock_offset;
+        shd_growy_append_string(g, ",\n{\"name\":");
+        append_json_string(g, event->name);
+        shd_growy_append_formatted(g, ",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%zu,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", event->category, pid, event->on_device ? DEVICE_TRACK : HOST_TRACK, (double) start / 1000.0, (double) event->duration_ns / 1000.0);
+    }
+    shd_mutex_unlock(profiler->mutex);
+}
@@ -49,9 +49,30 @@ Program* shd_rt_load_program_from_disk(Runtime* runtime, const CompilerConfig* b
     return program;
 }
 
+Program* shd_rt_load_program_bundle(Runtime* runtime, const CompilerConfig* base_config, const char* path) {
+    KernelBundle* bundle = shd_read_kernel_bundle(path);
+    if (!bundle) {
+        shd_error_print("Failed to load kernel bundle '%s'\n", path);
+        return NULL;
+    }
+
+    Program* program = shd_rt_new_program_from_module(runtime, base_config, NULL);
+    program->bundle = bundle;
+    return program;
+}
+
 void shd_rt_unload_program(Program* program) {
-    // TODO iterate over the specialized stuff
+    Runtime* runtime = program->runtime;
+    // specialisations still compiling read the program's module
+    shd_thread_pool_wait_idle(runtime->workers);
+    for (size_t i = 0; i < shd_list_count(runtime->devices); i++) {
+        Device* device = shd_read_list(Device*, runtime->devices)[i];
+        if (device->unload_program)
+            device->unload_program(device, program);
+    }
     if (program->arena) // if the program owns an arena
         shd_destroy_ir_arena(program->arena);
+    if (program->bundle)
+        shd_destroy_kernel_bundle(program->bundle);
     free(program);
 }
@@ -0,0 +1,148 @@
+#include "shady/runtime.h"
+#include "shady/ir.h"
+#include "shady/driver.h"
+
+#include "runtime_app_common.h"
+
+#include "log.h"
+#include "portability.h"
+#include "threads.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/// Launches the same kernel from many host threads at once, each thread accumulating into a buffer of its own.
+/// Every launch depends on the previous one from its thread, so the final contents tell whether any launch got lost.
+/// Usage: runtime_stress_test [threads] [launches per thread]. Works on any device, including lavapipe.
+
+#define DEFAULT_LAUNCHES 256
+#define ELEMENTS 256
+#define WORKGROUP_SIZE 64
+
+static const char* stress_shader =
+"@Builtin(\"GlobalInvocationId\")\n"
+"var uniform input pack[u32; 3] global_id;\n"
+"\n"
+"@EntryPoint(\"Compute\") @Exported @WorkgroupSize(64, 1, 1) fn add(uniform i32 value, uniform ptr global [i32] p) {\n"
+"    val x = reinterpret[i32](global_id#0);\n"
+"    *p#x = *p#x + value;\n"
+"    return ();\n"
+"}";
+
+typedef struct {
+    DriverConfig driver_config;
+    RuntimeConfig runtime_config;
+    CommonAppArgs common_app_args;
+    size_t threads;
+    size_t launches;
+} Args;
+
+typedef struct {
+    Device* device;
+    Program* program;
+    size_t launches;
+    int32_t value;
+    bool ok;
+} Worker;
+
+static void run_worker(void* uptr) {
+    Worker* worker = uptr;
+    int32_t contents[ELEMENTS] = { 0 };
+    Buffer* buffer = shd_rt_allocate_buffer_device(worker->device, sizeof(contents));
+    if (!buffer)
+        return;
+    if (!shd_rt_copy_to_buffer(buffer, 0, contents, sizeof(contents)))
+        goto done;
+    uint64_t address = shd_rt_get_buffer_device_pointer(buffer);
+
+    // keeps one launch in flight while the next one gets recorded and submitted
+    Command* previous = NULL;
+    for (size_t i = 0; i < worker->launches; i++) {
+        ExtraKernelOptions options = {
+            .dependencies = previous ? &previous : NULL,
+            .dependencies_count = previous ? 1 : 0,
+        };
+        Command* launch = shd_rt_launch_kernel(worker->program, worker->device, "add", ELEMENTS / WORKGROUP_SIZE, 1, 1, 2, (void*[]) { &worker->value, &address }, &options);
+        if (previous && !shd_rt_wait_completion(previous))
+            launch = NULL;
+        previous = launch;
+        if (!launch)
+            goto done;
+    }
+    if (previous && !shd_rt_wait_completion(previous))
+        goto done;
+
+    if (!shd_rt_copy_from_buffer(buffer, 0, contents, sizeof(contents)))
+        goto done;
+    int32_t expected = (int32_t) worker->launches * worker->value;
+    worker->ok = true;
+    for (size_t i = 0; i < ELEMENTS; i++) {
+        if (contents[i] != expected) {
+            shd_error_print("Element %zu holds %d instead of %d\n", i, contents[i], expected);
+            worker->ok = false;
+            break;
+        }
+    }
+
+done:
+    shd_rt_destroy_buffer(buffer);
+}
+
+int main(int argc, char* argv[]) {
+    shd_log_set_level(INFO);
+    Args args = {
+        .driver_config = shd_default_driver_config(),
+        .runtime_config = shd_rt_default_config(),
+        .threads = shd_get_cpu_count(),
+        .launches = DEFAULT_LAUNCHES,
+    };
+    cli_parse_common_app_arguments(&args.common_app_args, &argc, argv);
+    shd_parse_common_args(&argc, argv);
+    shd_rt_cli_parse_runtime_config(&args.runtime_config, &argc, argv);
+    shd_parse_compiler_config_args(&args.driver_config.config, &argc, argv);
+    if (argc > 1)
+        args.threads = strtoull(argv[1], NULL, 10);
+    if (argc > 2)
+        args.launches = strtoull(argv[2], NULL, 10);
+    if (args.threads == 0)
+        args.threads = 1;
+
+    Runtime* runtime = shd_rt_initialize(args.runtime_config);
+    Device* device = shd_rt_get_device(runtime, args.common_app_args.device);
+    assert(device);
+
+    Module* module;
+    shd_driver_load_source_file(&args.driver_config.config, SrcSlim, strlen(stress_shader), stress_shader, "runtime_stress_test", &module);
+    // the kernel is left for the threads to specialise, which they all ask for at once
+    Program* program = shd_rt_new_program_from_module(runtime, &args.driver_config.config, module);
+
+    shd_info_print("Launching %zu kernels from each of %zu threads on %s\n", args.launches, args.threads, shd_rt_get_device_name(device));
+    LARRAY(Worker, workers, args.threads);
+    LARRAY(Thread*, threads, args.threads);
+    uint64_t start = shd_get_time_nano();
+    for (size_t i = 0; i < args.threads; i++) {
+        workers[i] = (Worker) {
+            .device = device,
+            .program = program,
+            .launches = args.launches,
+            .value = (int32_t) i + 1,
+        };
+        threads[i] = shd_spawn_thread(run_worker, &workers[i]);
+    }
+
+    size_t failures = 0;
+    for (size_t i = 0; i < args.threads; i++) {
+        shd_join_thread(threads[i]);
+        if (!workers[i].ok) {
+            shd_error_print("Thread %zu failed\n", i);
+            failures++;
+        }
+    }
+    uint64_t elapsed = shd_get_time_nano() - start;
+    shd_info_print("%zu launches in %.2f ms, %.1f us per launch\n", args.threads * args.launches, (double) elapsed / 1e6, (double) elapsed / 1e3 / (double) (args.threads * args.launches));
+
+    shd_rt_shutdown(runtime);
+    shd_destroy_driver_config(&args.driver_config);
+    return failures > 0 ? 1 : 0;
+}
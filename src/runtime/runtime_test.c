@@ -68,9 +68,43 @@ int main(int argc, char* argv[]) {
     shd_rt_copy_to_buffer(buffer, 0, stuff, sizeof(stuff));
     shd_rt_copy_from_buffer(buffer, 0, stuff, sizeof(stuff));
 
+    // the launch waits for the upload
+    Command* upload = shd_rt_copy_to_buffer_async(buffer, 0, stuff, sizeof(stuff), 0, NULL);
+    ExtraKernelOptions options = {
+        .dependencies = &upload,
+        .dependencies_count = 1,
+    };
+
+    String entry_point = args.driver_config.config.specialization.entry_point ? args.driver_config.config.specialization.entry_point : "my_kernel";
     int32_t a0 = 42;
     uint64_t a1 = shd_rt_get_buffer_device_pointer(buffer);
-    shd_rt_wait_completion(shd_rt_launch_kernel(program, device, args.driver_config.config.specialization.entry_point ? args.driver_config.config.specialization.entry_point : "my_kernel", 1, 1, 1, 2, (void* []) { &a0, &a1 }, NULL));
+    Command* launch = shd_rt_launch_kernel(program, device, entry_point, 1, 1, 1, 2, (void* []) { &a0, &a1 }, &options);
+    // the readback waits for the kernel, all three are in flight at once
+    Command* readback = shd_rt_copy_from_buffer_async(buffer, 0, stuff, sizeof(stuff), 1, &launch);
+    shd_rt_wait_completion(readback);
+    shd_rt_wait_completion(launch);
+    shd_rt_wait_completion(upload);
+
+    // same launch, with the workgroup counts read from a buffer
+    uint32_t dims[] = { 1, 1, 1 };
+    Buffer* dims_buffer = shd_rt_allocate_buffer_device(device, sizeof(dims));
+    shd_rt_copy_to_buffer(dims_buffer, 0, dims, sizeof(dims));
+    Command* indirect = shd_rt_launch_kernel_indirect(program, device, entry_point, dims_buffer, 0, 2, (void* []) { &a0, &a1 }, NULL);
+    if (indirect)
+        shd_rt_wait_completion(indirect);
+    shd_rt_destroy_buffer(dims_buffer);
+
+    // and from a template, with the scalar argument patched in at every submission
+    KernelLaunchTemplate* template = shd_rt_begin_launch_template(device);
+    if (template && shd_rt_record_launch(template, program, entry_point, 1, 1, 1, 2, (void* []) { NULL, &a1 })) {
+        for (int32_t i = 0; i < 3; i++) {
+            Command* submission = shd_rt_submit_launch_template(template, 1, (void* []) { &i }, 0, NULL);
+            if (submission)
+                shd_rt_wait_completion(submission);
+        }
+    }
+    if (template)
+        shd_rt_destroy_launch_template(template);
 
     shd_rt_destroy_buffer(buffer);
 
@@ -1,43 +1,14 @@
 #include "vk_runtime_private.h"
 
 #include "log.h"
+#include "list.h"
 
 #include <string.h>
-
-typedef enum {
-    AllocDeviceLocal,
-    AllocHostVisible
-} AllocHeap;
-
-static uint32_t find_suitable_memory_type(VkrDevice* device, uint32_t memory_type_bits, AllocHeap heap) {
-    VkPhysicalDeviceMemoryProperties device_memory_properties;
-    vkGetPhysicalDeviceMemoryProperties(device->caps.physical_device, &device_memory_properties);
-    for (size_t bit = 0; bit < 32; bit++) {
-        VkMemoryType memory_type = device_memory_properties.memoryTypes[bit];
-
-        bool is_host_visible = (memory_type.propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0;
-        bool is_host_coherent = (memory_type.propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
-        bool is_device_local = (memory_type.propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != 0;
-
-        if ((memory_type_bits & (1 << bit)) != 0) {
-            switch (heap) {
-                case AllocDeviceLocal:
-                    if (is_device_local)
-                        return bit;
-                    break;
-                case AllocHostVisible:
-                    if (is_host_visible && is_host_coherent)
-                        return bit;
-                    break;
-            }
-        }
-    }
-    shd_error("Unable to find a suitable memory type")
-}
+#include <assert.h>
 
 static Buffer make_base_buffer(VkrDevice*);
 
-static VkrBuffer* vkr_allocate_buffer_device_(VkrDevice* device, size_t size, AllocHeap heap) {
+static VkrBuffer* vkr_allocate_buffer_device_(VkrDevice* device, size_t size, VkrMemoryHeap heap) {
     if (!device->caps.features.buffer_device_address.bufferDeviceAddress) {
         shd_error_print("device buffers require VK_KHR_buffer_device_address\n");
         return NULL;
@@ -46,66 +17,24 @@ static VkrBuffer* vkr_allocate_buffer_device_(VkrDevice* device, size_t size, Al
     VkrBuffer* buffer = calloc(sizeof(VkrBuffer), 1);
     buffer->base = make_base_buffer(device);
     buffer->device = device;
-    buffer->imported = true;
-    buffer->offset = 0;
-    buffer->host_ptr = NULL;
+    buffer->imported = false;
     buffer->size = size;
 
-    VkBufferCreateInfo buffer_create_info = {
-        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-        .pNext = NULL,
-        .size = size,
-        .flags = 0,
-        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-        .queueFamilyIndexCount = 0,
-        .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_EXT
-    };
-    CHECK_VK(vkCreateBuffer(device->device, &buffer_create_info, NULL, &buffer->buffer), goto err_post_obj_create);
-
-    VkBufferMemoryRequirementsInfo2 buf_mem_requirements = {
-        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2,
-        .pNext = NULL,
-        .buffer = buffer->buffer
-    };
-    VkMemoryRequirements2 mem_requirements = {
-        .sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2,
-        .pNext = NULL,
-    };
-    vkGetBufferMemoryRequirements2(device->device, &buf_mem_requirements, &mem_requirements);
-
-    VkMemoryAllocateInfo allocation_info = {
-        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        .pNext = NULL,
-        .allocationSize = mem_requirements.memoryRequirements.size,
-        .memoryTypeIndex = find_suitable_memory_type(device, mem_requirements.memoryRequirements.memoryTypeBits, heap),
-    };
-    VkMemoryAllocateFlagsInfo allocate_flags =  {
-        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO,
-        .pNext = NULL,
-        .flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR,
-        .deviceMask = 0
-    };
-    append_pnext((VkBaseOutStructure*) &allocation_info, &allocate_flags);
-
-    CHECK_VK(vkAllocateMemory(device->device, &allocation_info, NULL, &buffer->memory), goto err_post_buffer_create);
-
-    CHECK_VK(vkBindBufferMemory(device->device, buffer->buffer, buffer->memory, 0), goto err_post_mem_alloc);
-
+    if (!shd_rt_vk_allocate_buffer_memory(device, heap, size, buffer)) {
+        free(buffer);
+        return NULL;
+    }
     return buffer;
-
-err_post_mem_alloc:
-    vkFreeMemory(buffer->device->device, buffer->memory, NULL);
-err_post_buffer_create:
-    vkDestroyBuffer(buffer->device->device, buffer->buffer, NULL);
-err_post_obj_create:
-    free(buffer);
-    return NULL;
 }
 
 VkrBuffer* shd_rt_vk_allocate_buffer_device(VkrDevice* device, size_t size) {
     return vkr_allocate_buffer_device_(device, size, AllocDeviceLocal);
 }
 
+VkrBuffer* shd_rt_vk_allocate_staging_buffer(VkrDevice* device, size_t size) {
+    return vkr_allocate_buffer_device_(device, size, AllocHostVisible);
+}
+
 static bool vkr_can_import_host_memory_(VkrDevice* device, bool log) {
     if (!device->caps.supported_extensions[ShadySupportsEXT_external_memory_host]) {
         if (log)
@@ -132,6 +61,7 @@ VkrBuffer* shd_rt_vk_import_buffer_host(VkrDevice* device, void* ptr, size_t siz
     VkrBuffer* buffer = calloc(sizeof(VkrBuffer), 1);
     buffer->base = make_base_buffer(device);
     buffer->device = device;
+    buffer->imported = true;
     buffer->host_ptr = ptr;
 
     // align the bugger first ...
@@ -153,7 +83,7 @@ VkrBuffer* shd_rt_vk_import_buffer_host(VkrDevice* device, void* ptr, size_t siz
     shd_debug_print("aligned start %zu end %zu\n", aligned_addr, aligned_end);
 
     buffer->host_ptr = (void*) aligned_addr;
-    buffer->size = aligned_size;
+    buffer->size = aligned_size - buffer->offset;
 
     VkBufferCreateInfo buffer_create_info = {
         .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
@@ -162,8 +92,10 @@ VkrBuffer* shd_rt_vk_import_buffer_host(VkrDevice* device, void* ptr, size_t siz
         .flags = 0,
         .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
         .queueFamilyIndexCount = 0,
-        .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_EXT
+        .usage = VKR_BUFFER_USAGE_FLAGS,
     };
+    uint32_t queue_families[2];
+    shd_rt_vk_set_buffer_sharing_mode(device, &buffer_create_info, queue_families);
     VkExternalMemoryBufferCreateInfo ext_memory_buffer_create_info = {
         .sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO,
         .pNext = NULL,
@@ -177,7 +109,7 @@ VkrBuffer* shd_rt_vk_import_buffer_host(VkrDevice* device, void* ptr, size_t siz
         .pNext = NULL
     };
     CHECK_VK(device->extensions.EXT_external_memory_host.vkGetMemoryHostPointerPropertiesEXT(device->device, VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT, (void*) aligned_addr, &host_ptr_properties), goto err_post_buffer_create);
-    uint32_t memory_type_index = find_suitable_memory_type(device, host_ptr_properties.memoryTypeBits, AllocHostVisible);
+    uint32_t memory_type_index = shd_rt_vk_find_memory_type(device, host_ptr_properties.memoryTypeBits, AllocHostVisible);
     VkPhysicalDeviceMemoryProperties device_memory_properties;
     vkGetPhysicalDeviceMemoryProperties(device->caps.physical_device, &device_memory_properties);
     shd_debug_print("memory type index: %d heap: %d\n", memory_type_index, device_memory_properties.memoryTypes[memory_type_index].heapIndex);
@@ -219,8 +151,13 @@ err_post_obj_create:
 }
 
 void shd_rt_vk_destroy_buffer(VkrBuffer* buffer) {
-    vkDestroyBuffer(buffer->device->device, buffer->buffer, NULL);
-    vkFreeMemory(buffer->device->device, buffer->memory, NULL);
+    if (buffer->imported) {
+        vkDestroyBuffer(buffer->device->device, buffer->buffer, NULL);
+        vkFreeMemory(buffer->device->device, buffer->memory, NULL);
+    } else {
+        shd_rt_vk_free_buffer_memory(buffer->device, buffer);
+    }
+    free(buffer);
 }
 
 static VkDeviceAddress vkr_get_buffer_device_pointer(VkrBuffer* buf) {
@@ -232,72 +169,197 @@ static VkDeviceAddress vkr_get_buffer_device_pointer(VkrBuffer* buf) {
 }
 
 static void* vkr_get_buffer_host_pointer(VkrBuffer* buf) {
+    if (!buf->host_ptr)
+        return NULL;
     return ((char*) buf->host_ptr) + buf->offset;
 }
 
-static VkrCommand* submit_buffer_copy(VkrDevice* device, VkBuffer src, size_t src_offset, VkBuffer dst, size_t dst_offset, size_t size) {
-    VkrCommand* commands = shd_rt_vk_begin_command(device);
-    if (!commands)
+void shd_rt_vk_set_buffer_sharing_mode(VkrDevice* device, VkBufferCreateInfo* create_info, uint32_t queue_families[2]) {
+    if (!shd_rt_vk_has_transfer_queue(device))
+        return;
+    queue_families[0] = device->caps.compute_queue_family;
+    queue_families[1] = device->caps.transfer_queue_family;
+    create_info->sharingMode = VK_SHARING_MODE_CONCURRENT;
+    create_info->queueFamilyIndexCount = 2;
+    create_info->pQueueFamilyIndices = queue_families;
+}
+
+/// Takes ownership of transient_buffer, which is released once the copy completes
+static VkrCommand* submit_buffer_copy(VkrDevice* device, VkrQueue* queue, VkBuffer src, size_t src_offset, VkBuffer dst, size_t dst_offset, size_t size, VkrBuffer* transient_buffer, size_t dependencies_count, Command** dependencies) {
+    VkrCommand* commands = shd_rt_vk_begin_command(device, queue);
+    if (!commands) {
+        if (transient_buffer)
+            shd_rt_vk_destroy_buffer(transient_buffer);
         return NULL;
+    }
+    commands->transient_buffer = transient_buffer;
 
     vkCmdCopyBuffer(commands->cmd_buf, src, dst, 1, (VkBufferCopy[]) { { .srcOffset = src_offset, .dstOffset = dst_offset, .size = size } });
 
-    if (!shd_rt_vk_submit_command(commands))
+    if (!shd_rt_vk_submit_command(commands, dependencies_count, dependencies))
         goto err_post_commands_create;
 
     return commands;
 
 err_post_commands_create:
-    shd_rt_vk_destroy_command(commands);
+    shd_rt_vk_recycle_command(commands);
     return NULL;
 }
 
-static bool vkr_copy_to_buffer_fallback(VkrBuffer* dst, size_t buffer_offset, void* src, size_t size) {
-    CHECK(dst->base.backend_tag == VulkanRuntimeBackend, return false);
-    VkrDevice* device = dst->device;
+/// Size of the persistently mapped buffer copies are streamed through
+#define STAGING_RING_SIZE ((size_t) 8 * 1024 * 1024)
+/// Copies are split into chunks of this size so that the memcpy of one chunk overlaps the transfer of the previous ones
+#define STAGING_CHUNK_SIZE (STAGING_RING_SIZE / 4)
+/// Past this size, importing the host memory (when supported) beats copying it twice
+#define STAGING_IMPORT_THRESHOLD STAGING_RING_SIZE
+
+typedef struct {
+    size_t offset;
+    size_t size;
+    VkrCommand* cmd;
+    /// where the region's contents go once the copy completes, for copies from the device
+    void* readback;
+} VkrStagingRegion;
+
+bool shd_rt_vk_create_staging_ring(VkrDevice* device) {
+    device->staging.mutex = shd_new_mutex();
+    device->staging.buffer = NULL;
+    device->staging.head = 0;
+    device->staging.in_flight = shd_new_list(VkrStagingRegion);
+    return true;
+}
 
-    VkrBuffer* src_buf = vkr_allocate_buffer_device_(device, size, AllocHostVisible);
-    if (!src_buf)
+/// Waits on the oldest region in flight and makes its space available again
+static bool retire_staging_region(VkrDevice* device) {
+    VkrStagingRegion region = shd_list_remove(VkrStagingRegion, device->staging.in_flight, 0);
+    if (!shd_rt_vk_wait_completion(region.cmd))
         return false;
+    if (region.readback)
+        memcpy(region.readback, (char*) vkr_get_buffer_host_pointer(device->staging.buffer) + region.offset, region.size);
+    return true;
+}
 
-    void* mapped;
-    CHECK_VK(vkMapMemory(device->device, src_buf->memory, src_buf->offset, src_buf->size, 0, &mapped), goto err_post_buffer_create);
-    memcpy(mapped, src, size);
+static bool drain_staging_ring(VkrDevice* device) {
+    bool ok = true;
+    while (shd_list_count(device->staging.in_flight) > 0)
+        ok &= retire_staging_region(device);
+    return ok;
+}
+
+/// Regions are handed out and retired in FIFO order, so the free space is whatever lies between the newest and the oldest region in flight.
+/// Emptiness is told by the in-flight list rather than by head == tail, so a region may fill the gap up to the oldest one exactly.
+static bool reserve_staging_region(VkrDevice* device, size_t size, size_t* offset) {
+    assert(size <= STAGING_CHUNK_SIZE);
+    if (!device->staging.buffer) {
+        device->staging.buffer = vkr_allocate_buffer_device_(device, STAGING_RING_SIZE, AllocHostVisible);
+        if (!device->staging.buffer)
+            return false;
+    }
 
-    if (!shd_rt_wait_completion((Command*) submit_buffer_copy(device, src_buf->buffer, src_buf->offset, dst->buffer, dst->offset + buffer_offset, size)))
-        goto err_post_buffer_create;
+    while (true) {
+        if (shd_list_count(device->staging.in_flight) == 0) {
+            device->staging.head = 0;
+            break;
+        }
+        size_t head = device->staging.head;
+        size_t tail = shd_read_list(VkrStagingRegion, device->staging.in_flight)[0].offset;
+        if (head > tail) {
+            if (head + size <= STAGING_RING_SIZE)
+                break;
+            if (size <= tail) {
+                device->staging.head = 0;
+                break;
+            }
+        } else if (head + size <= tail) {
+            break;
+        }
+        if (!retire_staging_region(device))
+            return false;
+    }
 
-    vkUnmapMemory(device->device, src_buf->memory);
-    shd_rt_vk_destroy_buffer(src_buf);
+    *offset = device->staging.head;
+    device->staging.head += size;
     return true;
+}
 
-    err_post_buffer_create:
-    shd_rt_vk_destroy_buffer(src_buf);
-    return false;
+static bool submit_staged_copy(VkrDevice* device, size_t staging_offset, VkBuffer buffer, size_t buffer_offset, size_t size, bool upload, void* readback) {
+    VkrBuffer* ring = device->staging.buffer;
+    VkrCommand* cmd;
+    if (upload)
+        cmd = submit_buffer_copy(device, &device->compute_queue, ring->buffer, ring->offset + staging_offset, buffer, buffer_offset, size, NULL, 0, NULL);
+    else
+        cmd = submit_buffer_copy(device, &device->compute_queue, buffer, buffer_offset, ring->buffer, ring->offset + staging_offset, size, NULL, 0, NULL);
+    if (!cmd)
+        return false;
+    VkrStagingRegion region = {
+        .offset = staging_offset,
+        .size = size,
+        .cmd = cmd,
+        .readback = readback,
+    };
+    shd_list_append(VkrStagingRegion, device->staging.in_flight, region);
+    return true;
 }
 
-static bool vkr_copy_from_buffer_fallback(VkrBuffer* src, size_t buffer_offset, void* dst, size_t size) {
-    CHECK(src->base.backend_tag == VulkanRuntimeBackend, return false);
-    VkrDevice* device = src->device;
+void shd_rt_vk_destroy_staging_ring(VkrDevice* device) {
+    drain_staging_ring(device);
+    shd_destroy_list(device->staging.in_flight);
+    if (device->staging.buffer)
+        shd_rt_vk_destroy_buffer(device->staging.buffer);
+    shd_destroy_mutex(device->staging.mutex);
+}
 
-    VkrBuffer* dst_buf = vkr_allocate_buffer_device_(device, size, AllocHostVisible);
-    if (!dst_buf)
-        return false;
+/// The ring is shared by the device's threads, they take turns going through it
+static bool vkr_copy_to_buffer_staged(VkrBuffer* dst, size_t buffer_offset, void* src, size_t size) {
+    CHECK(dst->base.backend_tag == VulkanRuntimeBackend, return false);
+    VkrDevice* device = dst->device;
 
-    void* mapped;
-    CHECK_VK(vkMapMemory(device->device, dst_buf->memory, dst_buf->offset, dst_buf->size, 0, &mapped), goto err_post_buffer_create);
+    shd_mutex_lock(device->staging.mutex);
+    bool ok = true;
+    for (size_t done = 0; done < size;) {
+        size_t chunk = size - done < STAGING_CHUNK_SIZE ? size - done : STAGING_CHUNK_SIZE;
+        size_t staging_offset;
+        if (!reserve_staging_region(device, chunk, &staging_offset)) {
+            ok = false;
+            break;
+        }
+        memcpy((char*) vkr_get_buffer_host_pointer(device->staging.buffer) + staging_offset, (char*) src + done, chunk);
+        if (!submit_staged_copy(device, staging_offset, dst->buffer, dst->offset + buffer_offset + done, chunk, true, NULL)) {
+            ok = false;
+            break;
+        }
+        done += chunk;
+    }
 
-    if (!shd_rt_wait_completion((Command*) submit_buffer_copy(device, src->buffer, src->offset + buffer_offset, dst_buf->buffer, dst_buf->offset, size)))
-        goto err_post_buffer_create;
+    ok &= drain_staging_ring(device);
+    shd_mutex_unlock(device->staging.mutex);
+    return ok;
+}
 
-    memcpy(dst, mapped, size);
-    vkUnmapMemory(device->device, dst_buf->memory);
-    shd_rt_vk_destroy_buffer(dst_buf);
-    return true;
+static bool vkr_copy_from_buffer_staged(VkrBuffer* src, size_t buffer_offset, void* dst, size_t size) {
+    CHECK(src->base.backend_tag == VulkanRuntimeBackend, return false);
+    VkrDevice* device = src->device;
 
-    err_post_buffer_create:
-    shd_rt_vk_destroy_buffer(dst_buf);
-    return false;
+    // readbacks happen as regions get retired, either to make room for the next chunk or when draining
+    shd_mutex_lock(device->staging.mutex);
+    bool ok = true;
+    for (size_t done = 0; done < size;) {
+        size_t chunk = size - done < STAGING_CHUNK_SIZE ? size - done : STAGING_CHUNK_SIZE;
+        size_t staging_offset;
+        if (!reserve_staging_region(device, chunk, &staging_offset)) {
+            ok = false;
+            break;
+        }
+        if (!submit_staged_copy(device, staging_offset, src->buffer, src->offset + buffer_offset + done, chunk, false, (char*) dst + done)) {
+            ok = false;
+            break;
+        }
+        done += chunk;
+    }
+
+    ok &= drain_staging_ring(device);
+    shd_mutex_unlock(device->staging.mutex);
+    return ok;
 }
 
 static bool vkr_copy_to_buffer_importing(VkrBuffer* dst, size_t buffer_offset, void* src, size_t size) {
@@ -308,15 +370,8 @@ static bool vkr_copy_to_buffer_importing(VkrBuffer* dst, size_t buffer_offset, v
     if (!src_buf)
         return false;
 
-    if (!shd_rt_wait_completion((Command*) submit_buffer_copy(device, src_buf->buffer, src_buf->offset, dst->buffer, dst->offset + buffer_offset, size)))
-        goto err_post_buffer_import;
-
-    shd_rt_vk_destroy_buffer(src_buf);
-    return true;
-
-err_post_buffer_import:
-    shd_rt_vk_destroy_buffer(src_buf);
-    return false;
+    VkrCommand* cmd = submit_buffer_copy(device, &device->compute_queue, src_buf->buffer, src_buf->offset, dst->buffer, dst->offset + buffer_offset, size, src_buf, 0, NULL);
+    return cmd && shd_rt_vk_wait_completion(cmd);
 }
 
 static bool vkr_copy_from_buffer_importing(VkrBuffer* src, size_t buffer_offset, void* dst, size_t size) {
@@ -327,29 +382,99 @@ static bool vkr_copy_from_buffer_importing(VkrBuffer* src, size_t buffer_offset,
     if (!dst_buf)
         return false;
 
-    if (!shd_rt_wait_completion((Command*) submit_buffer_copy(device, src->buffer, src->offset + buffer_offset, dst_buf->buffer, dst_buf->offset, size)))
-        goto err_post_buffer_import;
+    VkrCommand* cmd = submit_buffer_copy(device, &device->compute_queue, src->buffer, src->offset + buffer_offset, dst_buf->buffer, dst_buf->offset, size, dst_buf, 0, NULL);
+    return cmd && shd_rt_vk_wait_completion(cmd);
+}
 
-    shd_rt_vk_destroy_buffer(dst_buf);
-    return true;
+static bool copy_to_buffer(VkrBuffer* dst, size_t buffer_offset, void* src, size_t size) {
+    void* mapped = vkr_get_buffer_host_pointer(dst);
+    if (mapped) {
+        memcpy((char*) mapped + buffer_offset, src, size);
+        return true;
+    }
+    if (size >= STAGING_IMPORT_THRESHOLD && shd_rt_vk_can_import_host_memory(dst->device))
+        return vkr_copy_to_buffer_importing(dst, buffer_offset, src, size);
+    return vkr_copy_to_buffer_staged(dst, buffer_offset, src, size);
+}
+
+static bool copy_from_buffer(VkrBuffer* src, size_t buffer_offset, void* dst, size_t size) {
+    void* mapped = vkr_get_buffer_host_pointer(src);
+    if (mapped) {
+        memcpy(dst, (char*) mapped + buffer_offset, size);
+        return true;
+    }
+    if (size >= STAGING_IMPORT_THRESHOLD && shd_rt_vk_can_import_host_memory(src->device))
+        return vkr_copy_from_buffer_importing(src, buffer_offset, dst, size);
+    return vkr_copy_from_buffer_staged(src, buffer_offset, dst, size);
+}
 
-err_post_buffer_import:
-    shd_rt_vk_destroy_buffer(dst_buf);
-    return false;
+static bool vkr_copy_to_buffer(VkrBuffer* dst, size_t buffer_offset, void* src, size_t size) {
+    uint64_t start = shd_get_time_nano();
+    bool ok = copy_to_buffer(dst, buffer_offset, src, size);
+    if (dst->device->base.profiler)
+        shd_rt_profile_host_event(dst->device->base.profiler, "copy_to_buffer", "copy", start);
+    return ok;
 }
 
-static Buffer make_base_buffer(VkrDevice* device) {
+static bool vkr_copy_from_buffer(VkrBuffer* src, size_t buffer_offset, void* dst, size_t size) {
+    uint64_t start = shd_get_time_nano();
+    bool ok = copy_from_buffer(src, buffer_offset, dst, size);
+    if (src->device->base.profiler)
+        shd_rt_profile_host_event(src->device->base.profiler, "copy_from_buffer", "copy", start);
+    return ok;
+}
+
+/// Async copies get staging memory of their own rather than going through the ring, so they never wait on each other for space
+static VkrCommand* vkr_copy_to_buffer_async(VkrBuffer* dst, size_t buffer_offset, void* src, size_t size, size_t dependencies_count, Command** dependencies) {
+    CHECK(dst->base.backend_tag == VulkanRuntimeBackend, return NULL);
+    VkrDevice* device = dst->device;
+
+    VkrBuffer* src_buf;
+    if (size >= STAGING_IMPORT_THRESHOLD && shd_rt_vk_can_import_host_memory(device)) {
+        src_buf = shd_rt_vk_import_buffer_host(device, src, size);
+    } else {
+        src_buf = vkr_allocate_buffer_device_(device, size, AllocHostVisible);
+        if (src_buf)
+            memcpy(vkr_get_buffer_host_pointer(src_buf), src, size);
+    }
+    if (!src_buf)
+        return NULL;
+
+    return submit_buffer_copy(device, shd_rt_vk_get_transfer_queue(device), src_buf->buffer, src_buf->offset, dst->buffer, dst->offset + buffer_offset, size, src_buf, dependencies_count, dependencies);
+}
+
+static VkrCommand* vkr_copy_from_buffer_async(VkrBuffer* src, size_t buffer_offset, void* dst, size_t size, size_t dependencies_count, Command** dependencies) {
+    CHECK(src->base.backend_tag == VulkanRuntimeBackend, return NULL);
+    VkrDevice* device = src->device;
+
+    bool import = size >= STAGING_IMPORT_THRESHOLD && shd_rt_vk_can_import_host_memory(device);
+    VkrBuffer* dst_buf;
+    if (import)
+        dst_buf = shd_rt_vk_import_buffer_host(device, dst, size);
+    else
+        dst_buf = vkr_allocate_buffer_device_(device, size, AllocHostVisible);
+    if (!dst_buf)
+        return NULL;
+
+    VkrCommand* cmd = submit_buffer_copy(device, shd_rt_vk_get_transfer_queue(device), src->buffer, src->offset + buffer_offset, dst_buf->buffer, dst_buf->offset, size, dst_buf, dependencies_count, dependencies);
+    if (cmd && !import) {
+        cmd->readback_dst = dst;
+        cmd->readback_src = vkr_get_buffer_host_pointer(dst_buf);
+        cmd->readback_size = size;
+    }
+    return cmd;
+}
+
+static Buffer make_base_buffer(SHADY_UNUSED VkrDevice* device) {
     Buffer buffer = {
         .backend_tag = VulkanRuntimeBackend,
         .destroy = (void (*)(Buffer*)) shd_rt_vk_destroy_buffer,
         .get_device_ptr = (uint64_t(*)(Buffer*)) vkr_get_buffer_device_pointer,
         .get_host_ptr = (void*(*)(Buffer*)) vkr_get_buffer_host_pointer,
-        .copy_into = (bool(*)(Buffer*, size_t, void*, size_t)) vkr_copy_to_buffer_fallback,
-        .copy_from = (bool(*)(Buffer*, size_t, void*, size_t)) vkr_copy_from_buffer_fallback,
+        .copy_into = (bool(*)(Buffer*, size_t, void*, size_t)) vkr_copy_to_buffer,
+        .copy_from = (bool(*)(Buffer*, size_t, void*, size_t)) vkr_copy_from_buffer,
+        .copy_into_async = (Command*(*)(Buffer*, size_t, void*, size_t, size_t, Command**)) vkr_copy_to_buffer_async,
+        .copy_from_async = (Command*(*)(Buffer*, size_t, void*, size_t, size_t, Command**)) vkr_copy_from_buffer_async,
     };
-    if (shd_rt_vk_can_import_host_memory(device)) {
-        buffer.copy_from = (bool(*)(Buffer*, size_t, void*, size_t)) vkr_copy_from_buffer_importing;
-        buffer.copy_into = (bool(*)(Buffer*, size_t, void*, size_t)) vkr_copy_to_buffer_importing;
-    }
     return buffer;
 }
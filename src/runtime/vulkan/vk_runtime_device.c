@@ -105,6 +105,11 @@ static bool fill_device_properties(VkrDeviceCaps* caps) {
         append_pnext((VkBaseOutStructure*) &caps->properties.base, &caps->properties.driver_properties);
     }
 
+    if (caps->supported_extensions[ShadySupportsKHR_push_descriptor]) {
+        caps->properties.push_descriptor.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PUSH_DESCRIPTOR_PROPERTIES_KHR;
+        append_pnext((VkBaseOutStructure*) &caps->properties.base, &caps->properties.push_descriptor);
+    }
+
     vkGetPhysicalDeviceProperties2(caps->physical_device, &caps->properties.base);
 
     if (caps->supported_extensions[ShadySupportsEXT_subgroup_size_control] || caps->properties.base.properties.apiVersion >= VK_MAKE_VERSION(1, 3, 0)) {
@@ -154,6 +159,11 @@ static bool fill_device_features(VkrDeviceCaps* caps) {
         append_pnext((VkBaseOutStructure*) &caps->features.base, &caps->features.storage16);
     }
 
+    if (caps->supported_extensions[ShadySupportsKHR_timeline_semaphore]) {
+        caps->features.timeline_semaphore.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+        append_pnext((VkBaseOutStructure*) &caps->features.base, &caps->features.timeline_semaphore);
+    }
+
     vkGetPhysicalDeviceFeatures2(caps->physical_device, &caps->features.base);
 
     if (!caps->features.subgroup_size_control.computeFullSubgroups) {
@@ -187,6 +197,19 @@ static bool fill_queue_properties(VkrDeviceCaps* caps) {
         return false;
     }
     caps->compute_queue_family = compute_queue_family;
+    caps->timestamp_valid_bits = queue_families_properties[compute_queue_family].queueFamilyProperties.timestampValidBits;
+
+    // a transfer-only family usually maps to the copy engines, which can run alongside compute work
+    caps->transfer_queue_family = compute_queue_family;
+    for (uint32_t i = 0; i < queue_families_count; i++) {
+        VkQueueFlags flags = queue_families_properties[i].queueFamilyProperties.queueFlags;
+        if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_COMPUTE_BIT | VK_QUEUE_GRAPHICS_BIT))) {
+            caps->transfer_queue_family = i;
+            break;
+        }
+    }
+    if (caps->transfer_queue_family != compute_queue_family)
+        shd_debug_print("Using queue family %d for transfers on device '%s'\n", caps->transfer_queue_family, caps->properties.base.properties.deviceName);
     return true;
 }
 
@@ -233,6 +256,58 @@ static void obtain_device_pointers(VkrDevice* device) {
 #undef X
 }
 
+/// Queues of destroyed devices may leave stale entries in the threads' pool caches, so their ids are never reused
+static volatile uint64_t queues_created;
+
+static bool create_queue(VkrDevice* device, uint32_t family, VkrQueue* queue) {
+    queue->family = family;
+    vkGetDeviceQueue(device->device, family, 0, &queue->queue);
+    queue->id = shd_atomic_fetch_add(&queues_created, 1) + 1;
+
+    queue->timeline = VK_NULL_HANDLE;
+    queue->last_submitted = 0;
+    if (device->use_timeline_semaphores) {
+        VkSemaphoreTypeCreateInfoKHR type_info = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR,
+            .pNext = NULL,
+            .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR,
+            .initialValue = 0,
+        };
+        CHECK_VK(vkCreateSemaphore(device->device, &(VkSemaphoreCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+            .pNext = &type_info,
+            .flags = 0,
+        }, NULL, &queue->timeline), return false);
+    }
+
+    // command pools get created by the threads recording commands, see shd_rt_vk_begin_command
+    queue->pools_mutex = shd_new_mutex();
+    queue->command_pools = shd_new_dict(void*, VkrCommandPool*, (HashFn) shd_hash_ptr, (CmpFn) shd_compare_ptrs);
+    queue->submit_mutex = shd_new_mutex();
+    return true;
+}
+
+static void destroy_queue(VkrDevice* device, VkrQueue* queue) {
+    size_t i = 0;
+    void* thread;
+    VkrCommandPool* pool;
+    while (shd_dict_iter(queue->command_pools, &i, &thread, &pool))
+        shd_rt_vk_destroy_command_pool(device, pool);
+    shd_destroy_dict(queue->command_pools);
+    shd_destroy_mutex(queue->pools_mutex);
+    shd_destroy_mutex(queue->submit_mutex);
+    if (queue->timeline)
+        vkDestroySemaphore(device->device, queue->timeline, NULL);
+}
+
+bool shd_rt_vk_has_transfer_queue(VkrDevice* device) {
+    return device->caps.transfer_queue_family != device->caps.compute_queue_family;
+}
+
+VkrQueue* shd_rt_vk_get_transfer_queue(VkrDevice* device) {
+    return shd_rt_vk_has_transfer_queue(device) ? &device->transfer_queue : &device->compute_queue;
+}
+
 static VkrDevice* create_vkr_device(SHADY_UNUSED VkrBackend* runtime, VkPhysicalDevice physical_device) {
     VkrDevice* device = calloc(1, sizeof(VkrDevice));
     device->runtime = runtime;
@@ -243,20 +318,32 @@ static VkrDevice* create_vkr_device(SHADY_UNUSED VkrBackend* runtime, VkPhysical
     size_t enabled_device_exts_count;
     CHECK(fill_available_extensions(physical_device, &enabled_device_exts_count, enabled_device_exts, NULL), assert(false));
 
+    bool has_transfer_queue = shd_rt_vk_has_transfer_queue(device);
+    const float queue_priorities[] = { 1.0f };
+    VkDeviceQueueCreateInfo queue_create_infos[] = {
+        {
+            .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+            .flags = 0,
+            .pQueuePriorities = queue_priorities,
+            .queueCount = 1,
+            .queueFamilyIndex = device->caps.compute_queue_family,
+            .pNext = NULL,
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+            .flags = 0,
+            .pQueuePriorities = queue_priorities,
+            .queueCount = 1,
+            .queueFamilyIndex = device->caps.transfer_queue_family,
+            .pNext = NULL,
+        },
+    };
+
     CHECK_VK(vkCreateDevice(physical_device, &(VkDeviceCreateInfo) {
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
         .flags = 0,
-        .queueCreateInfoCount = 1,
-        .pQueueCreateInfos = (const VkDeviceQueueCreateInfo []) {
-            {
-                .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-                .flags = 0,
-                .pQueuePriorities = (const float []) { 1.0f },
-                .queueCount = 1,
-                .queueFamilyIndex = device->caps.compute_queue_family,
-                .pNext = NULL,
-            }
-        },
+        .queueCreateInfoCount = has_transfer_queue ? 2 : 1,
+        .pQueueCreateInfos = queue_create_infos,
         .enabledLayerCount = 0,
         .enabledExtensionCount = enabled_device_exts_count,
         .ppEnabledExtensionNames = enabled_device_exts,
@@ -264,21 +351,39 @@ static VkrDevice* create_vkr_device(SHADY_UNUSED VkrBackend* runtime, VkPhysical
         .pNext = &device->caps.features.base,
     }, NULL, &device->device), goto fail;)
 
-    CHECK_VK(vkCreateCommandPool(device->device, &(VkCommandPoolCreateInfo) {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-        .pNext = NULL,
-        .queueFamilyIndex = device->caps.compute_queue_family,
-        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT
-    }, NULL, &device->cmd_pool), goto delete_device);
+    obtain_device_pointers(device);
+    device->use_timeline_semaphores = device->extensions.KHR_timeline_semaphore.enabled && device->caps.features.timeline_semaphore.timelineSemaphore;
 
-    device->specialized_programs = shd_new_dict(SpecProgramKey, VkrSpecProgram*, (HashFn) hash_spec_program_key, (CmpFn) cmp_spec_program_keys);
+    CHECK(create_queue(device, device->caps.compute_queue_family, &device->compute_queue), goto delete_device);
+    if (has_transfer_queue)
+        CHECK(create_queue(device, device->caps.transfer_queue_family, &device->transfer_queue), goto delete_compute_queue);
 
-    vkGetDeviceQueue(device->device, device->caps.compute_queue_family, 0, &device->compute_queue);
+    device->timestamp_queries.mutex = shd_new_mutex();
+    device->timestamp_queries.pools = shd_new_list(VkQueryPool);
+    device->timestamp_queries.free_slots = shd_new_list(VkrTimestampSlot);
 
-    obtain_device_pointers(device);
+    CHECK(shd_rt_vk_create_pipeline_cache(device), goto delete_queues);
+    CHECK(shd_rt_vk_create_memory_allocator(device), goto delete_pipeline_cache);
+    CHECK(shd_rt_vk_create_staging_ring(device), goto delete_memory_allocator);
+
+    device->specialized_programs_mutex = shd_new_mutex();
+    device->specialized_programs_cond = shd_new_cond_var();
+    device->specialized_programs = shd_new_dict(SpecProgramKey, VkrSpecProgram*, (HashFn) hash_spec_program_key, (CmpFn) cmp_spec_program_keys);
 
     return device;
 
+    delete_memory_allocator:
+    shd_rt_vk_destroy_memory_allocator(device);
+    delete_pipeline_cache:
+    shd_rt_vk_destroy_pipeline_cache(device);
+    delete_queues:
+    shd_destroy_mutex(device->timestamp_queries.mutex);
+    shd_destroy_list(device->timestamp_queries.pools);
+    shd_destroy_list(device->timestamp_queries.free_slots);
+    if (has_transfer_queue)
+        destroy_queue(device, &device->transfer_queue);
+    delete_compute_queue:
+    destroy_queue(device, &device->compute_queue);
     delete_device:
     vkDestroyDevice(device->device, NULL);
 
@@ -287,6 +392,8 @@ static VkrDevice* create_vkr_device(SHADY_UNUSED VkrBackend* runtime, VkPhysical
 }
 
 static void shutdown_vkr_device(VkrDevice* device) {
+    vkDeviceWaitIdle(device->device);
+
     size_t i = 0;
     SpecProgramKey k;
     VkrSpecProgram* sp;
@@ -294,13 +401,54 @@ static void shutdown_vkr_device(VkrDevice* device) {
         shd_rt_vk_destroy_specialized_program(sp);
     }
     shd_destroy_dict(device->specialized_programs);
-    vkDestroyCommandPool(device->device, device->cmd_pool, NULL);
+    shd_destroy_cond_var(device->specialized_programs_cond);
+    shd_destroy_mutex(device->specialized_programs_mutex);
+    shd_rt_vk_destroy_staging_ring(device);
+    shd_rt_vk_destroy_memory_allocator(device);
+    shd_rt_vk_destroy_pipeline_cache(device);
+    for (size_t j = 0; j < shd_list_count(device->timestamp_queries.pools); j++)
+        vkDestroyQueryPool(device->device, shd_read_list(VkQueryPool, device->timestamp_queries.pools)[j], NULL);
+    shd_destroy_mutex(device->timestamp_queries.mutex);
+    shd_destroy_list(device->timestamp_queries.pools);
+    shd_destroy_list(device->timestamp_queries.free_slots);
+    if (shd_rt_vk_has_transfer_queue(device))
+        destroy_queue(device, &device->transfer_queue);
+    destroy_queue(device, &device->compute_queue);
     vkDestroyDevice(device->device, NULL);
     free(device);
 }
 
+static void unload_vkr_program(VkrDevice* device, Program* program) {
+    // pipelines of the program might still be used by submitted work
+    vkDeviceWaitIdle(device->device);
+
+    shd_mutex_lock(device->specialized_programs_mutex);
+    struct List* unloaded = shd_new_list(VkrSpecProgram*);
+    size_t i = 0;
+    SpecProgramKey k;
+    VkrSpecProgram* sp;
+    while (shd_dict_iter(device->specialized_programs, &i, &k, &sp)) {
+        if (k.base != program)
+            continue;
+        while (sp->state == SpecCompiling || sp->state == SpecPreparingResources)
+            shd_cond_var_wait(device->specialized_programs_cond, device->specialized_programs_mutex);
+        shd_list_append(VkrSpecProgram*, unloaded, sp);
+    }
+    for (size_t j = 0; j < shd_list_count(unloaded); j++) {
+        sp = shd_read_list(VkrSpecProgram*, unloaded)[j];
+        shd_dict_remove(SpecProgramKey, device->specialized_programs, sp->key);
+        shd_rt_vk_destroy_specialized_program(sp);
+    }
+    shd_mutex_unlock(device->specialized_programs_mutex);
+    shd_destroy_list(unloaded);
+}
+
 static const char* get_vkr_device_name(VkrDevice* device) { return device->caps.properties.base.properties.deviceName; }
 
+static KernelFuture* vkr_prepare_kernel(VkrDevice* device, Program* program, String entry_point) {
+    return (KernelFuture*) shd_rt_vk_prepare_specialized_program(program, entry_point, device);
+}
+
 bool shd_rt_vk_probe_devices(VkrBackend* runtime) {
     uint32_t devices_count;
     CHECK_VK(vkEnumeratePhysicalDevices(runtime->instance, &devices_count, NULL), return false)
@@ -324,7 +472,14 @@ bool shd_rt_vk_probe_devices(VkrBackend* runtime) {
                 .allocate_buffer = (Buffer* (*)(Device*, size_t)) shd_rt_vk_allocate_buffer_device,
                 .import_host_memory_as_buffer = (Buffer* (*)(Device*, void*, size_t)) shd_rt_vk_import_buffer_host,
                 .launch_kernel = (Command* (*)(Device*, Program*, String, int, int, int, int, void**, ExtraKernelOptions*)) shd_rt_vk_launch_kernel,
+                .launch_kernel_indirect = (Command* (*)(Device*, Program*, String, Buffer*, size_t, int, void**, ExtraKernelOptions*)) shd_rt_vk_launch_kernel_indirect,
+                .begin_batch = (Batch* (*)(Device*)) shd_rt_vk_begin_batch,
+                .begin_launch_template = (KernelLaunchTemplate* (*)(Device*)) shd_rt_vk_begin_launch_template,
                 .can_import_host_memory = (bool (*)(Device*)) shd_rt_vk_can_import_host_memory,
+                .prepare_kernel = (KernelFuture* (*)(Device*, Program*, String)) vkr_prepare_kernel,
+                .flush_pipeline_cache = (bool (*)(Device*)) shd_rt_vk_flush_pipeline_cache,
+                .get_buffer_allocator_stats = (bool (*)(Device*, BufferAllocatorStats*)) shd_rt_vk_get_buffer_allocator_stats,
+                .unload_program = (void (*)(Device*, Program*)) unload_vkr_program,
             };
             shd_list_append(Device*, runtime->base.runtime->devices, device);
         }
@@ -2,53 +2,48 @@
 
 #include "log.h"
 #include "portability.h"
+#include "list.h"
+#include "dict.h"
 
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 
-static void bind_program_resources(VkrCommand* cmd, VkrSpecProgram* prog) {
+static void bind_program_resources(VkCommandBuffer cmd_buf, VkrSpecProgram* prog) {
     if (prog->resources.num_resources == 0)
         return;
 
+    // descriptor sets are written once when the resources get created, there is nothing to update from here
+    if (prog->push_descriptor_set < 0) {
+        vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, prog->layout, 0, MAX_DESCRIPTOR_SETS, prog->sets, 0, NULL);
+        return;
+    }
+
     LARRAY(VkWriteDescriptorSet, write_descriptor_sets, prog->resources.num_resources);
     LARRAY(VkDescriptorBufferInfo, descriptor_buffer_info, prog->resources.num_resources);
     size_t write_descriptor_sets_count = 0;
-
-    LARRAY(VkDescriptorSet, bind_sets, prog->resources.num_resources);
-    size_t bind_sets_count = 0;
-
     for (size_t i = 0; i < prog->resources.num_resources; i++) {
         ProgramResourceInfo* resource = prog->resources.resources[i];
         if (resource->is_bound) {
             descriptor_buffer_info[write_descriptor_sets_count] = (VkDescriptorBufferInfo) {
                 .buffer = resource->buffer->buffer,
                 .offset = resource->buffer->offset,
-                .range = resource->buffer->size - resource->buffer->offset,
+                .range = resource->buffer->size,
             };
-
             write_descriptor_sets[write_descriptor_sets_count] = (VkWriteDescriptorSet) {
                 .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
                 .pNext = NULL,
                 .descriptorType = shd_rt_vk_as_to_descriptor_type(resource->as),
                 .descriptorCount = 1,
-                .dstSet = prog->sets[resource->set],
+                .dstSet = VK_NULL_HANDLE,
                 .dstBinding = resource->binding,
                 .pBufferInfo = &descriptor_buffer_info[write_descriptor_sets_count],
             };
-
             write_descriptor_sets_count++;
         }
     }
 
-    vkUpdateDescriptorSets(prog->device->device, write_descriptor_sets_count, write_descriptor_sets, 0, NULL);
-
-    for (size_t set = 0; set < MAX_DESCRIPTOR_SETS; set++) {
-        bind_sets[set] = prog->sets[set];
-    }
-    bind_sets_count = MAX_DESCRIPTOR_SETS;
-
-    vkCmdBindDescriptorSets(cmd->cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, prog->layout, 0, bind_sets_count, bind_sets, 0, NULL);
+    prog->device->extensions.KHR_push_descriptor.vkCmdPushDescriptorSetKHR(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, prog->layout, prog->push_descriptor_set, write_descriptor_sets_count, write_descriptor_sets);
 }
 
 static Command make_command_base() {
@@ -57,134 +52,744 @@ static Command make_command_base() {
     };
 }
 
-VkrCommand* shd_rt_vk_launch_kernel(VkrDevice* device, Program* program, String entry_point, int dimx, int dimy, int dimz, int args_count, void** args, ExtraKernelOptions* options) {
+/// Lays out the arguments the way the entry point expects them in its push constants, NULL arguments are left alone
+static void marshal_arguments(VkrSpecProgram* prog, int args_count, void** args, unsigned char* push_constants) {
+    ProgramParamsInfo entrypoint_info = prog->parameters;
+    assert(args_count == entrypoint_info.num_args && "number of arguments must match number of entrypoint arguments");
+    for (int i = 0; i < entrypoint_info.num_args; ++i) {
+        if (args[i])
+            memcpy(push_constants + entrypoint_info.arg_offset[i], args[i], entrypoint_info.arg_size[i]);
+    }
+}
+
+/// Records everything a dispatch of this program needs besides the dispatch itself
+static void record_marshalled_bindings(VkCommandBuffer cmd_buf, VkrSpecProgram* prog, const unsigned char* push_constants) {
+    if (prog->parameters.args_size)
+        vkCmdPushConstants(cmd_buf, prog->layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, prog->parameters.args_size, push_constants);
+
+    vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, prog->pipeline);
+    bind_program_resources(cmd_buf, prog);
+}
+
+static void record_kernel_bindings(VkrCommand* cmd, VkrSpecProgram* prog, int args_count, void** args) {
+    LARRAY(unsigned char, push_constants, prog->parameters.args_size > 0 ? prog->parameters.args_size : 1);
+    if (prog->parameters.args_size)
+        marshal_arguments(prog, args_count, args, push_constants);
+    record_marshalled_bindings(cmd->cmd_buf, prog, push_constants);
+}
+
+/// Brackets the next dispatch with a pair of timestamps, returns false if the queue can't write them
+static bool begin_timed_dispatch(VkrCommand* cmd, String entry_point) {
+    VkrDevice* device = cmd->device;
+    VkrTimedDispatch dispatch = { .entry_point = entry_point };
+    if (device->caps.timestamp_valid_bits == 0 || !shd_rt_vk_acquire_timestamp_slot(device, &dispatch.timestamps))
+        return false;
+    vkCmdResetQueryPool(cmd->cmd_buf, dispatch.timestamps.pool, dispatch.timestamps.first, 2);
+    vkCmdWriteTimestamp(cmd->cmd_buf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dispatch.timestamps.pool, dispatch.timestamps.first);
+    shd_list_append(VkrTimedDispatch, cmd->timed_dispatches, dispatch);
+    return true;
+}
+
+static void end_timed_dispatch(VkrCommand* cmd) {
+    VkrTimedDispatch* dispatch = &shd_read_list(VkrTimedDispatch, cmd->timed_dispatches)[shd_list_count(cmd->timed_dispatches) - 1];
+    vkCmdWriteTimestamp(cmd->cmd_buf, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, dispatch->timestamps.pool, dispatch->timestamps.first + 1);
+}
+
+/// Either workgroup counts given by the host, or a buffer the device reads them from
+typedef struct {
+    uint32_t dims[3];
+    VkrBuffer* indirect;
+    size_t indirect_offset;
+} DispatchSize;
+
+static DispatchSize direct_dispatch_size(int dimx, int dimy, int dimz) {
+    return (DispatchSize) { .dims = { dimx, dimy, dimz } };
+}
+
+static bool indirect_dispatch_size(Buffer* dimensions, size_t offset, DispatchSize* size) {
+    CHECK(dimensions->backend_tag == VulkanRuntimeBackend, return false);
+    VkrBuffer* buffer = (VkrBuffer*) dimensions;
+    CHECK(offset % 4 == 0 && offset + sizeof(VkDispatchIndirectCommand) <= buffer->size, return false);
+    *size = (DispatchSize) { .indirect = buffer, .indirect_offset = buffer->offset + offset };
+    return true;
+}
+
+static void record_dispatch(VkCommandBuffer cmd_buf, DispatchSize size) {
+    if (size.indirect)
+        vkCmdDispatchIndirect(cmd_buf, size.indirect->buffer, size.indirect_offset);
+    else
+        vkCmdDispatch(cmd_buf, size.dims[0], size.dims[1], size.dims[2]);
+}
+
+/// Sequences of dispatches are assumed to depend on their predecessors, which may also have computed their dispatch size
+static void record_dependency_on_previous_dispatch(VkCommandBuffer cmd_buf, DispatchSize size) {
+    VkPipelineStageFlags dst_stages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    VkAccessFlags dst_access = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    if (size.indirect) {
+        dst_stages |= VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT;
+        dst_access |= VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    }
+    vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, dst_stages, 0, 1, (VkMemoryBarrier[]) { {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .pNext = NULL,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = dst_access,
+    } }, 0, NULL, 0, NULL);
+}
+
+static VkrCommand* launch_kernel(VkrDevice* device, Program* program, String entry_point, DispatchSize size, int args_count, void** args, ExtraKernelOptions* options) {
     assert(program && device);
+    uint64_t start = shd_get_time_nano();
 
     VkrSpecProgram* prog = shd_rt_vk_get_specialized_program(program, entry_point, device);
+    if (!prog)
+        return NULL;
 
     shd_debug_print("Dispatching kernel on %s\n", device->caps.properties.base.properties.deviceName);
 
-    VkrCommand* cmd = shd_rt_vk_begin_command(device);
+    VkrCommand* cmd = shd_rt_vk_begin_command(device, &device->compute_queue);
     if (!cmd)
         return NULL;
 
-    ProgramParamsInfo entrypoint_info = prog->parameters;
-    if (entrypoint_info.args_size) {
-        assert(args_count == entrypoint_info.num_args && "number of arguments must match number of entrypoint arguments");
+    record_kernel_bindings(cmd, prog, args_count, args);
+
+    bool timed = false;
+    if (device->base.profiler || (options && options->profiled_gpu_time))
+        timed = begin_timed_dispatch(cmd, prog->key.entry_point);
+    if (timed && options)
+        cmd->profiled_gpu_time = options->profiled_gpu_time;
+
+    record_dispatch(cmd->cmd_buf, size);
+
+    if (timed)
+        end_timed_dispatch(cmd);
+
+    size_t dependencies_count = options ? options->dependencies_count : 0;
+    Command** dependencies = options ? options->dependencies : NULL;
+    if (!shd_rt_vk_submit_command(cmd, dependencies_count, dependencies))
+        goto err_post_commands_create;
+
+    if (device->base.profiler)
+        shd_rt_profile_host_event(device->base.profiler, prog->key.entry_point, "launch", start);
+    return cmd;
+
+err_post_commands_create:
+    shd_rt_vk_recycle_command(cmd);
+    return NULL;
+}
 
-        size_t push_constant_buffer_size = entrypoint_info.args_size;
-        LARRAY(unsigned char, push_constant_buffer, push_constant_buffer_size);
-        for (int i = 0; i < entrypoint_info.num_args; ++i)
-            memcpy(push_constant_buffer + entrypoint_info.arg_offset[i], args[i], entrypoint_info.arg_size[i]);
+VkrCommand* shd_rt_vk_launch_kernel(VkrDevice* device, Program* program, String entry_point, int dimx, int dimy, int dimz, int args_count, void** args, ExtraKernelOptions* options) {
+    return launch_kernel(device, program, entry_point, direct_dispatch_size(dimx, dimy, dimz), args_count, args, options);
+}
+
+VkrCommand* shd_rt_vk_launch_kernel_indirect(VkrDevice* device, Program* program, String entry_point, Buffer* dimensions, size_t offset, int args_count, void** args, ExtraKernelOptions* options) {
+    DispatchSize size;
+    if (!indirect_dispatch_size(dimensions, offset, &size))
+        return NULL;
+    return launch_kernel(device, program, entry_point, size, args_count, args, options);
+}
+
+VkrBatch* shd_rt_vk_begin_batch(VkrDevice* device) {
+    VkrCommand* cmd = shd_rt_vk_begin_command(device, &device->compute_queue);
+    if (!cmd)
+        return NULL;
+
+    VkrBatch* batch = calloc(1, sizeof(VkrBatch));
+    *batch = (VkrBatch) {
+        .base = {
+            .launch_kernel = (bool (*)(Batch*, Program*, String, int, int, int, int, void**)) shd_rt_vk_launch_kernel_in_batch,
+            .launch_kernel_indirect = (bool (*)(Batch*, Program*, String, Buffer*, size_t, int, void**)) shd_rt_vk_launch_kernel_indirect_in_batch,
+            .submit = (Command* (*)(Batch*)) shd_rt_vk_submit_batch,
+        },
+        .device = device,
+        .cmd = cmd,
+    };
+    return batch;
+}
 
-        vkCmdPushConstants(cmd->cmd_buf, prog->layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, push_constant_buffer_size, push_constant_buffer);
+static bool launch_kernel_in_batch(VkrBatch* batch, Program* program, String entry_point, DispatchSize size, int args_count, void** args) {
+    uint64_t start = shd_get_time_nano();
+    VkrSpecProgram* prog = shd_rt_vk_get_specialized_program(program, entry_point, batch->device);
+    if (!prog)
+        return false;
+
+    if (batch->dispatches_count > 0)
+        record_dependency_on_previous_dispatch(batch->cmd->cmd_buf, size);
+
+    record_kernel_bindings(batch->cmd, prog, args_count, args);
+    bool timed = batch->device->base.profiler && begin_timed_dispatch(batch->cmd, prog->key.entry_point);
+    record_dispatch(batch->cmd->cmd_buf, size);
+    if (timed)
+        end_timed_dispatch(batch->cmd);
+    batch->dispatches_count++;
+
+    if (batch->device->base.profiler)
+        shd_rt_profile_host_event(batch->device->base.profiler, prog->key.entry_point, "launch", start);
+    return true;
+}
+
+bool shd_rt_vk_launch_kernel_in_batch(VkrBatch* batch, Program* program, String entry_point, int dimx, int dimy, int dimz, int args_count, void** args) {
+    return launch_kernel_in_batch(batch, program, entry_point, direct_dispatch_size(dimx, dimy, dimz), args_count, args);
+}
+
+bool shd_rt_vk_launch_kernel_indirect_in_batch(VkrBatch* batch, Program* program, String entry_point, Buffer* dimensions, size_t offset, int args_count, void** args) {
+    DispatchSize size;
+    if (!indirect_dispatch_size(dimensions, offset, &size))
+        return false;
+    return launch_kernel_in_batch(batch, program, entry_point, size, args_count, args);
+}
+
+VkrCommand* shd_rt_vk_submit_batch(VkrBatch* batch) {
+    uint64_t start = shd_get_time_nano();
+    VkrCommand* cmd = batch->cmd;
+    Profiler* profiler = batch->device->base.profiler;
+    shd_debug_print("Submitting a batch of %zu dispatches on %s\n", batch->dispatches_count, batch->device->caps.properties.base.properties.deviceName);
+    free(batch);
+
+    if (!shd_rt_vk_submit_command(cmd, 0, NULL)) {
+        shd_rt_vk_recycle_command(cmd);
+        return NULL;
     }
+    if (profiler)
+        shd_rt_profile_host_event(profiler, "batch", "submit", start);
+    return cmd;
+}
 
-    vkCmdBindPipeline(cmd->cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, prog->pipeline);
-    bind_program_resources(cmd, prog);
+/// A dispatch captured by a launch template
+typedef struct {
+    VkrSpecProgram* prog;
+    DispatchSize size;
+    /// marshalled arguments, with zeroes in place of the patched ones
+    unsigned char* push_constants;
+    /// whether some of the arguments are only given at submission
+    bool patched;
+    /// Everything the dispatch records, bindings included, for unpatched dispatches once the template is sealed
+    VkCommandBuffer secondary;
+} RecordedDispatch;
+
+/// Where an argument given at submission time goes
+typedef struct {
+    size_t dispatch;
+    size_t offset;
+    size_t size;
+} PatchSlot;
+
+VkrLaunchTemplate* shd_rt_vk_begin_launch_template(VkrDevice* device) {
+    VkrLaunchTemplate* template = calloc(1, sizeof(VkrLaunchTemplate));
+    *template = (VkrLaunchTemplate) {
+        .base = {
+            .record_launch = (bool (*)(KernelLaunchTemplate*, Program*, String, int, int, int, int, void**)) shd_rt_vk_record_launch,
+            .record_launch_indirect = (bool (*)(KernelLaunchTemplate*, Program*, String, Buffer*, size_t, int, void**)) shd_rt_vk_record_launch_indirect,
+            .submit = (Command* (*)(KernelLaunchTemplate*, size_t, void**, size_t, Command**)) shd_rt_vk_submit_launch_template,
+            .destroy = (void (*)(KernelLaunchTemplate*)) shd_rt_vk_destroy_launch_template,
+        },
+        .device = device,
+        .arena = shd_new_arena(),
+        .dispatches = shd_new_list(RecordedDispatch),
+        .patch_slots = shd_new_list(PatchSlot),
+        .mutex = shd_new_mutex(),
+    };
+    return template;
+}
 
-    if (options && options->profiled_gpu_time) {
-        VkQueryPoolCreateInfo qpci = {
-            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
-            .pNext = NULL,
-            .queryType = VK_QUERY_TYPE_TIMESTAMP,
-            .queryCount = 2,
+static bool record_launch(VkrLaunchTemplate* template, Program* program, String entry_point, DispatchSize size, int args_count, void** args) {
+    VkrSpecProgram* prog = shd_rt_vk_get_specialized_program(program, entry_point, template->device);
+    if (!prog)
+        return false;
+
+    shd_mutex_lock(template->mutex);
+    // submissions may have recorded the template already
+    CHECK(!template->sealed, { shd_mutex_unlock(template->mutex); return false; });
+
+    size_t dispatch_index = shd_list_count(template->dispatches);
+    RecordedDispatch dispatch = { .prog = prog, .size = size };
+    size_t args_size = prog->parameters.args_size;
+    if (args_size > 0) {
+        dispatch.push_constants = shd_arena_alloc(template->arena, args_size);
+        marshal_arguments(prog, args_count, args, dispatch.push_constants);
+    }
+    if (args_size > template->max_args_size)
+        template->max_args_size = args_size;
+
+    for (int i = 0; i < args_count; i++) {
+        if (args[i])
+            continue;
+        dispatch.patched = true;
+        PatchSlot slot = {
+            .dispatch = dispatch_index,
+            .offset = prog->parameters.arg_offset[i],
+            .size = prog->parameters.arg_size[i],
         };
-        CHECK_VK(vkCreateQueryPool(device->device, &qpci, NULL, &cmd->query_pool), {});
-        cmd->profiled_gpu_time = options->profiled_gpu_time;
-        vkCmdResetQueryPool(cmd->cmd_buf, cmd->query_pool, 0, 2);
-        vkCmdWriteTimestamp(cmd->cmd_buf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, cmd->query_pool, 0);
+        shd_list_append(PatchSlot, template->patch_slots, slot);
     }
+    shd_list_append(RecordedDispatch, template->dispatches, dispatch);
+    shd_mutex_unlock(template->mutex);
+    return true;
+}
+
+bool shd_rt_vk_record_launch(VkrLaunchTemplate* template, Program* program, String entry_point, int dimx, int dimy, int dimz, int args_count, void** args) {
+    return record_launch(template, program, entry_point, direct_dispatch_size(dimx, dimy, dimz), args_count, args);
+}
 
-    vkCmdDispatch(cmd->cmd_buf, dimx, dimy, dimz);
+bool shd_rt_vk_record_launch_indirect(VkrLaunchTemplate* template, Program* program, String entry_point, Buffer* dimensions, size_t offset, int args_count, void** args) {
+    DispatchSize size;
+    if (!indirect_dispatch_size(dimensions, offset, &size))
+        return false;
+    return record_launch(template, program, entry_point, size, args_count, args);
+}
 
-    if (options && options->profiled_gpu_time) {
-        vkCmdWriteTimestamp(cmd->cmd_buf, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, cmd->query_pool, 1);
+/// Records one dispatch of the template, bindings included, with the given patches applied
+static void record_template_dispatch(VkrLaunchTemplate* template, VkCommandBuffer cmd_buf, size_t i, void** patches) {
+    RecordedDispatch* dispatch = &shd_read_list(RecordedDispatch, template->dispatches)[i];
+    size_t slots_count = shd_list_count(template->patch_slots);
+    PatchSlot* slots = shd_read_list(PatchSlot, template->patch_slots);
+
+    LARRAY(unsigned char, push_constants, template->max_args_size > 0 ? template->max_args_size : 1);
+    if (dispatch->push_constants)
+        memcpy(push_constants, dispatch->push_constants, dispatch->prog->parameters.args_size);
+    for (size_t j = 0; j < slots_count; j++) {
+        if (slots[j].dispatch == i)
+            memcpy(push_constants + slots[j].offset, patches[j], slots[j].size);
     }
+    record_marshalled_bindings(cmd_buf, dispatch->prog, push_constants);
+    record_dispatch(cmd_buf, dispatch->size);
+}
 
-    if (!shd_rt_vk_submit_command(cmd))
-        goto err_post_commands_create;
+/// Records the template's dispatches with the given patches applied. Dispatches are only timed if a command is given.
+/// Push constants can only come from a command buffer, so only the patched dispatches get recorded again,
+/// the others are executed from their secondary command buffers, with the timestamps written around them.
+static void replay_dispatches(VkrLaunchTemplate* template, VkCommandBuffer cmd_buf, VkrCommand* timed_cmd, void** patches) {
+    size_t dispatches_count = shd_list_count(template->dispatches);
+    RecordedDispatch* dispatches = shd_read_list(RecordedDispatch, template->dispatches);
+    for (size_t i = 0; i < dispatches_count; i++) {
+        RecordedDispatch* dispatch = &dispatches[i];
+        if (i > 0)
+            record_dependency_on_previous_dispatch(cmd_buf, dispatch->size);
+        bool timed = timed_cmd && begin_timed_dispatch(timed_cmd, dispatch->prog->key.entry_point);
+        if (dispatch->secondary)
+            vkCmdExecuteCommands(cmd_buf, 1, &dispatch->secondary);
+        else
+            record_template_dispatch(template, cmd_buf, i, patches);
+        if (timed)
+            end_timed_dispatch(timed_cmd);
+    }
+}
 
+static bool begin_template_command_buffer(VkrLaunchTemplate* template, VkCommandBufferLevel level, VkCommandBuffer* cmd_buf) {
+    CHECK_VK(vkAllocateCommandBuffers(template->device->device, &(VkCommandBufferAllocateInfo) {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .pNext = NULL,
+        .commandPool = template->cmd_pool,
+        .level = level,
+        .commandBufferCount = 1
+    }, cmd_buf), return false);
+
+    // compute work inherits nothing, but secondary command buffers have to say so
+    VkCommandBufferInheritanceInfo inheritance = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+        .pNext = NULL,
+    };
+    CHECK_VK(vkBeginCommandBuffer(*cmd_buf, &(VkCommandBufferBeginInfo) {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .pNext = NULL,
+        .flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT,
+        .pInheritanceInfo = level == VK_COMMAND_BUFFER_LEVEL_SECONDARY ? &inheritance : NULL
+    }), return false);
+    return true;
+}
+
+/// Records the template once, in command buffers that can be pending several times at once: a secondary one for each dispatch
+/// taking no patches, and a primary one running the whole template if none of them does.
+/// They come from a pool of their own, since the template may be submitted from a thread other than the one recording it.
+/// The pool is freed as a whole, so nothing needs undoing on failure. Called with the template's mutex held.
+static bool record_template_command_buffers(VkrLaunchTemplate* template) {
+    VkrDevice* device = template->device;
+    CHECK_VK(vkCreateCommandPool(device->device, &(VkCommandPoolCreateInfo) {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .pNext = NULL,
+        .queueFamilyIndex = device->compute_queue.family,
+        .flags = 0
+    }, NULL, &template->cmd_pool), return false);
+
+    size_t dispatches_count = shd_list_count(template->dispatches);
+    RecordedDispatch* dispatches = shd_read_list(RecordedDispatch, template->dispatches);
+    for (size_t i = 0; i < dispatches_count; i++) {
+        if (dispatches[i].patched)
+            continue;
+        VkCommandBuffer secondary;
+        CHECK(begin_template_command_buffer(template, VK_COMMAND_BUFFER_LEVEL_SECONDARY, &secondary), return false);
+        record_template_dispatch(template, secondary, i, NULL);
+        CHECK_VK(vkEndCommandBuffer(secondary), return false);
+        dispatches[i].secondary = secondary;
+    }
+
+    if (shd_list_count(template->patch_slots) == 0) {
+        VkCommandBuffer cmd_buf;
+        CHECK(begin_template_command_buffer(template, VK_COMMAND_BUFFER_LEVEL_PRIMARY, &cmd_buf), return false);
+        replay_dispatches(template, cmd_buf, NULL, NULL);
+        CHECK_VK(vkEndCommandBuffer(cmd_buf), return false);
+        template->cmd_buf = cmd_buf;
+    }
+    return true;
+}
+
+VkrCommand* shd_rt_vk_submit_launch_template(VkrLaunchTemplate* template, size_t patches_count, void** patches, size_t dependencies_count, Command** dependencies) {
+    uint64_t start = shd_get_time_nano();
+    VkrDevice* device = template->device;
+    CHECK(patches_count == shd_list_count(template->patch_slots), return NULL);
+
+    // the first submissions may race to seal and record the template, only one of them does
+    shd_mutex_lock(template->mutex);
+    if (!template->sealed) {
+        template->sealed = true;
+        template->recorded = record_template_command_buffers(template);
+    }
+    bool recorded = template->recorded;
+    shd_mutex_unlock(template->mutex);
+    CHECK(recorded, return NULL);
+    bool prerecorded = template->cmd_buf && !device->base.profiler;
+
+    VkrCommand* cmd = shd_rt_vk_begin_command(device, &device->compute_queue);
+    if (!cmd)
+        return NULL;
+
+    // patched arguments and timestamps change with every submission, those get recorded around the pre-recorded dispatches
+    if (prerecorded)
+        cmd->prerecorded = template->cmd_buf;
+    else
+        replay_dispatches(template, cmd->cmd_buf, device->base.profiler ? cmd : NULL, patches);
+
+    if (!shd_rt_vk_submit_command(cmd, dependencies_count, dependencies))
+        goto err_post_cmd_acquire;
+
+    if (device->base.profiler)
+        shd_rt_profile_host_event(device->base.profiler, "template", "submit", start);
     return cmd;
 
-err_post_commands_create:
-    shd_rt_vk_destroy_command(cmd);
+err_post_cmd_acquire:
+    shd_rt_vk_recycle_command(cmd);
     return NULL;
 }
 
-VkrCommand* shd_rt_vk_begin_command(VkrDevice* device) {
+void shd_rt_vk_destroy_launch_template(VkrLaunchTemplate* template) {
+    VkrDevice* device = template->device;
+    // this frees the recorded command buffers as well
+    if (template->cmd_pool)
+        vkDestroyCommandPool(device->device, template->cmd_pool, NULL);
+    shd_destroy_list(template->patch_slots);
+    shd_destroy_list(template->dispatches);
+    shd_destroy_arena(template->arena);
+    shd_destroy_mutex(template->mutex);
+    free(template);
+}
+
+/// Query pools are allocated in blocks of this many timestamp pairs
+#define TIMESTAMP_SLOTS_PER_POOL 64
+
+bool shd_rt_vk_acquire_timestamp_slot(VkrDevice* device, VkrTimestampSlot* slot) {
+    shd_mutex_lock(device->timestamp_queries.mutex);
+    if (shd_list_count(device->timestamp_queries.free_slots) == 0) {
+        VkQueryPool pool;
+        CHECK_VK(vkCreateQueryPool(device->device, &(VkQueryPoolCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .pNext = NULL,
+            .queryType = VK_QUERY_TYPE_TIMESTAMP,
+            .queryCount = TIMESTAMP_SLOTS_PER_POOL * 2,
+        }, NULL, &pool), { shd_mutex_unlock(device->timestamp_queries.mutex); return false; });
+        shd_list_append(VkQueryPool, device->timestamp_queries.pools, pool);
+        for (uint32_t i = 0; i < TIMESTAMP_SLOTS_PER_POOL; i++) {
+            VkrTimestampSlot new_slot = { .pool = pool, .first = i * 2 };
+            shd_list_append(VkrTimestampSlot, device->timestamp_queries.free_slots, new_slot);
+        }
+    }
+    *slot = shd_list_pop(VkrTimestampSlot, device->timestamp_queries.free_slots);
+    shd_mutex_unlock(device->timestamp_queries.mutex);
+    return true;
+}
+
+void shd_rt_vk_release_timestamp_slot(VkrDevice* device, VkrTimestampSlot slot) {
+    shd_mutex_lock(device->timestamp_queries.mutex);
+    shd_list_append(VkrTimestampSlot, device->timestamp_queries.free_slots, slot);
+    shd_mutex_unlock(device->timestamp_queries.mutex);
+}
+
+static VkrCommandPool* create_command_pool(VkrDevice* device, VkrQueue* queue) {
+    VkrCommandPool* pool = calloc(1, sizeof(VkrCommandPool));
+    CHECK_VK(vkCreateCommandPool(device->device, &(VkCommandPoolCreateInfo) {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .pNext = NULL,
+        .queueFamilyIndex = queue->family,
+        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT
+    }, NULL, &pool->pool), { free(pool); return NULL; });
+    pool->mutex = shd_new_mutex();
+    pool->free_commands = shd_new_list(VkrCommand*);
+    return pool;
+}
+
+/// The commands still in flight at this point are leaked, like they always were
+void shd_rt_vk_destroy_command_pool(VkrDevice* device, VkrCommandPool* pool) {
+    for (size_t i = 0; i < shd_list_count(pool->free_commands); i++)
+        shd_rt_vk_destroy_command(shd_read_list(VkrCommand*, pool->free_commands)[i]);
+    shd_destroy_list(pool->free_commands);
+    shd_destroy_mutex(pool->mutex);
+    vkDestroyCommandPool(device->device, pool->pool, NULL);
+    free(pool);
+}
+
+/// Threads remember the last few pools they used, so they only take the queue's lock the first time around
+#define THREAD_POOLS_CACHE_SIZE 4
+
+static SHADY_THREAD_LOCAL struct {
+    uint64_t queue_id;
+    VkrCommandPool* pool;
+} thread_pools_cache[THREAD_POOLS_CACHE_SIZE];
+static SHADY_THREAD_LOCAL size_t thread_pools_cache_next;
+
+static VkrCommandPool* get_thread_command_pool(VkrDevice* device, VkrQueue* queue) {
+    for (size_t i = 0; i < THREAD_POOLS_CACHE_SIZE; i++) {
+        if (thread_pools_cache[i].queue_id == queue->id)
+            return thread_pools_cache[i].pool;
+    }
+
+    // thread-locals live at a different address in every thread, which makes for a cheap thread identifier
+    void* thread = &thread_pools_cache_next;
+    shd_mutex_lock(queue->pools_mutex);
+    VkrCommandPool** found = shd_dict_find_value(void*, VkrCommandPool*, queue->command_pools, thread);
+    VkrCommandPool* pool = found ? *found : create_command_pool(device, queue);
+    if (pool && !found)
+        shd_dict_insert(void*, VkrCommandPool*, queue->command_pools, thread, pool);
+    shd_mutex_unlock(queue->pools_mutex);
+    if (!pool)
+        return NULL;
+
+    size_t entry = thread_pools_cache_next++ % THREAD_POOLS_CACHE_SIZE;
+    thread_pools_cache[entry].queue_id = queue->id;
+    thread_pools_cache[entry].pool = pool;
+    return pool;
+}
+
+static VkrCommand* allocate_command(VkrDevice* device, VkrQueue* queue, VkrCommandPool* pool) {
     VkrCommand* cmd = calloc(1, sizeof(VkrCommand));
     cmd->base = make_command_base();
     cmd->device = device;
+    cmd->queue = queue;
+    cmd->pool = pool;
 
     CHECK_VK(vkAllocateCommandBuffers(device->device, &(VkCommandBufferAllocateInfo) {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
         .pNext = NULL,
-        .commandPool = device->cmd_pool,
+        .commandPool = pool->pool,
         .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
         .commandBufferCount = 1
     }, &cmd->cmd_buf), goto err_post_commands_create);
 
+    CHECK_VK(vkCreateFence(device->device, &(VkFenceCreateInfo) {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0
+    }, NULL, &cmd->done_fence), goto err_post_cmd_buf_create);
+
+    cmd->timed_dispatches = shd_new_list(VkrTimedDispatch);
+    return cmd;
+
+err_post_cmd_buf_create:
+    vkFreeCommandBuffers(device->device, pool->pool, 1, &cmd->cmd_buf);
+err_post_commands_create:
+    free(cmd);
+    return NULL;
+}
+
+VkrCommand* shd_rt_vk_begin_command(VkrDevice* device, VkrQueue* queue) {
+    VkrCommandPool* pool = get_thread_command_pool(device, queue);
+    if (!pool)
+        return NULL;
+
+    VkrCommand* cmd = NULL;
+    shd_mutex_lock(pool->mutex);
+    if (shd_list_count(pool->free_commands) > 0)
+        cmd = shd_list_pop(VkrCommand*, pool->free_commands);
+    shd_mutex_unlock(pool->mutex);
+    if (!cmd)
+        cmd = allocate_command(device, queue, pool);
+    if (!cmd)
+        return NULL;
+
+    // this implicitly resets the command buffer, which has to happen on the thread owning the pool
     CHECK_VK(vkBeginCommandBuffer(cmd->cmd_buf, &(VkCommandBufferBeginInfo) {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
         .pNext = NULL,
         .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
         .pInheritanceInfo = NULL
-    }), goto err_post_cmd_buf_create);
+    }), goto err_post_cmd_acquire);
 
     return cmd;
 
-err_post_cmd_buf_create:
-    vkFreeCommandBuffers(device->device, device->cmd_pool, 1, &cmd->cmd_buf);
-err_post_commands_create:
-    free(cmd);
+err_post_cmd_acquire:
+    shd_rt_vk_recycle_command(cmd);
     return NULL;
 }
 
-bool shd_rt_vk_submit_command(VkrCommand* cmd) {
+/// Without timeline semaphores, the host has to wait for dependencies before submitting
+static bool wait_dependencies_on_host(VkrDevice* device, size_t dependencies_count, Command** dependencies) {
+    if (dependencies_count == 0)
+        return true;
+    LARRAY(VkFence, fences, dependencies_count);
+    for (size_t i = 0; i < dependencies_count; i++)
+        fences[i] = ((VkrCommand*) dependencies[i])->done_fence;
+    CHECK_VK(vkWaitForFences(device->device, dependencies_count, fences, true, UINT64_MAX), return false);
+    return true;
+}
+
+bool shd_rt_vk_submit_command(VkrCommand* cmd, size_t dependencies_count, Command** dependencies) {
+    VkrDevice* device = cmd->device;
+    VkrQueue* queue = cmd->queue;
     CHECK_VK(vkEndCommandBuffer(cmd->cmd_buf), return false);
 
-    CHECK_VK(vkCreateFence(cmd->device->device, &(VkFenceCreateInfo) {
-        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-        .pNext = NULL,
-        .flags = 0
-    }, NULL, &cmd->done_fence), return false);
+    for (size_t i = 0; i < dependencies_count; i++)
+        assert(((VkrCommand*) dependencies[i])->submitted && "Dependencies must be in flight, and not have been waited on yet");
 
-    CHECK_VK(vkQueueSubmit(cmd->device->compute_queue, 1, &(VkSubmitInfo) {
-        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+    if (!device->use_timeline_semaphores) {
+        if (!wait_dependencies_on_host(device, dependencies_count, dependencies))
+            return false;
+        shd_mutex_lock(queue->submit_mutex);
+        cmd->submitted_ns = shd_get_time_nano();
+        CHECK_VK(vkQueueSubmit(queue->queue, 1, &(VkSubmitInfo) {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .pNext = NULL,
+            .waitSemaphoreCount = 0,
+            .commandBufferCount = 1,
+            .pCommandBuffers = cmd->prerecorded ? &cmd->prerecorded : &cmd->cmd_buf,
+            .signalSemaphoreCount = 0
+        }, cmd->done_fence), { shd_mutex_unlock(queue->submit_mutex); return false; });
+        shd_mutex_unlock(queue->submit_mutex);
+        cmd->submitted = true;
+        return true;
+    }
+
+    // waiting on a semaphore also makes the dependency's writes visible, even on the same queue
+    LARRAY(VkSemaphore, wait_semaphores, dependencies_count + 1);
+    LARRAY(uint64_t, wait_values, dependencies_count + 1);
+    LARRAY(VkPipelineStageFlags, wait_stages, dependencies_count + 1);
+    for (size_t i = 0; i < dependencies_count; i++) {
+        VkrCommand* dependency = (VkrCommand*) dependencies[i];
+        wait_semaphores[i] = dependency->queue->timeline;
+        wait_values[i] = dependency->timeline_value;
+        wait_stages[i] = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    }
+
+    // timeline values have to be signalled in increasing order, so they are only picked once we hold the queue
+    shd_mutex_lock(queue->submit_mutex);
+    uint64_t signal_value = ++queue->last_submitted;
+    VkTimelineSemaphoreSubmitInfoKHR timeline_info = {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR,
         .pNext = NULL,
-        .waitSemaphoreCount = 0,
+        .waitSemaphoreValueCount = dependencies_count,
+        .pWaitSemaphoreValues = wait_values,
+        .signalSemaphoreValueCount = 1,
+        .pSignalSemaphoreValues = &signal_value,
+    };
+    cmd->submitted_ns = shd_get_time_nano();
+    CHECK_VK(vkQueueSubmit(queue->queue, 1, &(VkSubmitInfo) {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = &timeline_info,
+        .waitSemaphoreCount = dependencies_count,
+        .pWaitSemaphores = wait_semaphores,
+        .pWaitDstStageMask = wait_stages,
         .commandBufferCount = 1,
-        .pCommandBuffers = (VkCommandBuffer[]) { cmd->cmd_buf },
-        .signalSemaphoreCount = 0
-    }, cmd->done_fence), goto err_post_fence_create);
+        .pCommandBuffers = cmd->prerecorded ? &cmd->prerecorded : &cmd->cmd_buf,
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores = &queue->timeline,
+    }, VK_NULL_HANDLE), { shd_mutex_unlock(queue->submit_mutex); return false; });
+    shd_mutex_unlock(queue->submit_mutex);
 
+    cmd->timeline_value = signal_value;
     cmd->submitted = true;
+    return true;
+}
 
+static bool wait_command(VkrCommand* cmd) {
+    VkrDevice* device = cmd->device;
+    if (device->use_timeline_semaphores) {
+        CHECK_VK(device->extensions.KHR_timeline_semaphore.vkWaitSemaphoresKHR(device->device, &(VkSemaphoreWaitInfoKHR) {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR,
+            .pNext = NULL,
+            .flags = 0,
+            .semaphoreCount = 1,
+            .pSemaphores = &cmd->queue->timeline,
+            .pValues = &cmd->timeline_value,
+        }, UINT64_MAX), return false);
+        return true;
+    }
+    CHECK_VK(vkWaitForFences(device->device, 1, (VkFence[]) { cmd->done_fence }, true, UINT64_MAX), return false);
     return true;
+}
 
-err_post_fence_create:
-    vkDestroyFence(cmd->device->device, cmd->done_fence, NULL);
-    return false;
+/// Only called on completed commands, so the results are available and this does not stall
+static void read_timestamps(VkrCommand* cmd) {
+    VkrDevice* device = cmd->device;
+    double period = device->caps.properties.base.properties.limits.timestampPeriod;
+    uint32_t valid_bits = device->caps.timestamp_valid_bits;
+    uint64_t mask = valid_bits >= 64 ? UINT64_MAX : (UINT64_C(1) << valid_bits) - 1;
+
+    size_t count = shd_list_count(cmd->timed_dispatches);
+    VkrTimedDispatch* dispatches = shd_read_list(VkrTimedDispatch, cmd->timed_dispatches);
+    for (size_t i = 0; i < count; i++) {
+        uint64_t ts[2];
+        CHECK_VK(vkGetQueryPoolResults(device->device, dispatches[i].timestamps.pool, dispatches[i].timestamps.first, 2, sizeof(uint64_t) * 2, ts, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT), continue);
+        uint64_t start = (uint64_t) ((double) (ts[0] & mask) * period);
+        uint64_t duration = (uint64_t) ((double) ((ts[1] - ts[0]) & mask) * period);
+        if (i == 0 && cmd->profiled_gpu_time)
+            *cmd->profiled_gpu_time = duration;
+        if (device->base.profiler)
+            shd_rt_profile_device_event(device->base.profiler, dispatches[i].entry_point, "kernel", cmd->submitted_ns, start, start + duration);
+    }
 }
 
 bool shd_rt_vk_wait_completion(VkrCommand* cmd) {
     assert(cmd->submitted && "Command must be submitted before they can be waited on");
-    CHECK_VK(vkWaitForFences(cmd->device->device, 1, (VkFence[]) { cmd->done_fence }, true, UINT32_MAX), return false);
-    if (cmd->profiled_gpu_time) {
-        uint64_t ts[2];
-        CHECK_VK(vkGetQueryPoolResults(cmd->device->device, cmd->query_pool, 0, 2, sizeof(uint64_t) * 2, ts, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT), {});
-        *cmd->profiled_gpu_time = (ts[1] - ts[0]) * cmd->device->caps.properties.base.properties.limits.timestampPeriod;
-    }
-    shd_rt_vk_destroy_command(cmd);
+    uint64_t start = shd_get_time_nano();
+    if (!wait_command(cmd))
+        return false;
+    Profiler* profiler = cmd->device->base.profiler;
+    if (profiler)
+        shd_rt_profile_host_event(profiler, "wait", "wait", start);
+    read_timestamps(cmd);
+    if (cmd->readback_dst)
+        memcpy(cmd->readback_dst, cmd->readback_src, cmd->readback_size);
+    shd_rt_vk_recycle_command(cmd);
     return true;
 }
 
+void shd_rt_vk_recycle_command(VkrCommand* cmd) {
+    VkrDevice* device = cmd->device;
+    if (cmd->submitted && !device->use_timeline_semaphores)
+        CHECK_VK(vkResetFences(device->device, 1, &cmd->done_fence), {});
+    for (size_t i = 0; i < shd_list_count(cmd->timed_dispatches); i++)
+        shd_rt_vk_release_timestamp_slot(device, shd_read_list(VkrTimedDispatch, cmd->timed_dispatches)[i].timestamps);
+    shd_clear_list(cmd->timed_dispatches);
+    if (cmd->transient_buffer)
+        shd_rt_vk_destroy_buffer(cmd->transient_buffer);
+    // submitted commands get reset when they are begun again, by their pool's thread. The others never left it.
+    if (!cmd->submitted)
+        CHECK_VK(vkResetCommandBuffer(cmd->cmd_buf, 0), { shd_rt_vk_destroy_command(cmd); return; });
+
+    cmd->submitted = false;
+    cmd->timeline_value = 0;
+    cmd->submitted_ns = 0;
+    cmd->profiled_gpu_time = NULL;
+    cmd->transient_buffer = NULL;
+    cmd->prerecorded = VK_NULL_HANDLE;
+    cmd->readback_dst = NULL;
+    cmd->readback_src = NULL;
+    cmd->readback_size = 0;
+    shd_mutex_lock(cmd->pool->mutex);
+    shd_list_append(VkrCommand*, cmd->pool->free_commands, cmd);
+    shd_mutex_unlock(cmd->pool->mutex);
+}
+
 void shd_rt_vk_destroy_command(VkrCommand* cmd) {
-    if (cmd->submitted)
-        vkDestroyFence(cmd->device->device, cmd->done_fence, NULL);
-    if (cmd->query_pool)
-        vkDestroyQueryPool(cmd->device->device, cmd->query_pool, NULL);
-    vkFreeCommandBuffers(cmd->device->device, cmd->device->cmd_pool, 1, &cmd->cmd_buf);
+    shd_destroy_list(cmd->timed_dispatches);
+    vkDestroyFence(cmd->device->device, cmd->done_fence, NULL);
+    vkFreeCommandBuffers(cmd->device->device, cmd->pool->pool, 1, &cmd->cmd_buf);
     free(cmd);
 }
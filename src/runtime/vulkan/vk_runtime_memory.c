@@ -0,0 +1,280 @@
+#include "vk_runtime_private.h"
+
+#include "log.h"
+#include "list.h"
+#include "portability.h"
+#include "buddy_allocator.h"
+
+#include <stdlib.h>
+#include <assert.h>
+
+/// Size of the device memory blocks small buffers are carved out of
+#define MEMORY_BLOCK_SIZE ((size_t) 64 * 1024 * 1024)
+/// Allocation granularity inside a block, this is also the upper bound Vulkan puts on minStorageBufferOffsetAlignment
+#define MEMORY_BLOCK_UNIT ((size_t) 256)
+/// Buffers bigger than this get their own device memory allocation
+#define MAX_SUBALLOCATION_SIZE (MEMORY_BLOCK_SIZE / 4)
+
+struct VkrMemoryBlock_ {
+    VkrMemoryHeap heap;
+    /// blocks are pooled by memory type, two types on the same heap can still differ in caching or coherency
+    uint32_t memory_type;
+    VkBuffer buffer;
+    VkDeviceMemory memory;
+    /// persistently mapped once host-visible memory was carved out of it, NULL until then
+    void* mapped;
+    BuddyAllocator* allocator;
+};
+
+static uint32_t find_suitable_memory_type(VkrDevice* device, uint32_t memory_type_bits, VkrMemoryHeap heap) {
+    VkPhysicalDeviceMemoryProperties device_memory_properties;
+    vkGetPhysicalDeviceMemoryProperties(device->caps.physical_device, &device_memory_properties);
+    for (size_t bit = 0; bit < 32; bit++) {
+        VkMemoryType memory_type = device_memory_properties.memoryTypes[bit];
+
+        bool is_host_visible = (memory_type.propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0;
+        bool is_host_coherent = (memory_type.propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+        bool is_device_local = (memory_type.propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != 0;
+
+        if ((memory_type_bits & (1 << bit)) != 0) {
+            switch (heap) {
+                case AllocDeviceLocal:
+                    if (is_device_local)
+                        return bit;
+                    break;
+                case AllocHostVisible:
+                    if (is_host_visible && is_host_coherent)
+                        return bit;
+                    break;
+            }
+        }
+    }
+    shd_error("Unable to find a suitable memory type")
+}
+
+uint32_t shd_rt_vk_find_memory_type(VkrDevice* device, uint32_t memory_type_bits, VkrMemoryHeap heap) {
+    return find_suitable_memory_type(device, memory_type_bits, heap);
+}
+
+/// Creates a buffer backed by a memory allocation of its own, host-visible memory gets mapped.
+static bool create_buffer_with_memory(VkrDevice* device, size_t size, VkrMemoryHeap heap, VkBuffer* buffer, VkDeviceMemory* memory, void** mapped, uint32_t* memory_type) {
+    VkBufferCreateInfo buffer_create_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .pNext = NULL,
+        .size = size,
+        .flags = 0,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .queueFamilyIndexCount = 0,
+        .usage = VKR_BUFFER_USAGE_FLAGS,
+    };
+    uint32_t queue_families[2];
+    shd_rt_vk_set_buffer_sharing_mode(device, &buffer_create_info, queue_families);
+    CHECK_VK(vkCreateBuffer(device->device, &buffer_create_info, NULL, buffer), return false);
+
+    VkBufferMemoryRequirementsInfo2 buf_mem_requirements = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2,
+        .pNext = NULL,
+        .buffer = *buffer
+    };
+    VkMemoryRequirements2 mem_requirements = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2,
+        .pNext = NULL,
+    };
+    vkGetBufferMemoryRequirements2(device->device, &buf_mem_requirements, &mem_requirements);
+    // all our buffers have the same usage, and therefore the same requirements
+    device->memory.buffer_memory_type_bits = mem_requirements.memoryRequirements.memoryTypeBits;
+    *memory_type = find_suitable_memory_type(device, mem_requirements.memoryRequirements.memoryTypeBits, heap);
+
+    VkMemoryAllocateInfo allocation_info = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .pNext = NULL,
+        .allocationSize = mem_requirements.memoryRequirements.size,
+        .memoryTypeIndex = *memory_type,
+    };
+    VkMemoryAllocateFlagsInfo allocate_flags =  {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO,
+        .pNext = NULL,
+        .flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR,
+        .deviceMask = 0
+    };
+    append_pnext((VkBaseOutStructure*) &allocation_info, &allocate_flags);
+
+    CHECK_VK(vkAllocateMemory(device->device, &allocation_info, NULL, memory), goto err_post_buffer_create);
+    CHECK_VK(vkBindBufferMemory(device->device, *buffer, *memory, 0), goto err_post_mem_alloc);
+
+    *mapped = NULL;
+    if (heap == AllocHostVisible)
+        CHECK_VK(vkMapMemory(device->device, *memory, 0, VK_WHOLE_SIZE, 0, mapped), goto err_post_mem_alloc);
+
+    return true;
+
+err_post_mem_alloc:
+    vkFreeMemory(device->device, *memory, NULL);
+err_post_buffer_create:
+    vkDestroyBuffer(device->device, *buffer, NULL);
+    return false;
+}
+
+static VkrMemoryBlock* create_memory_block(VkrDevice* device, VkrMemoryHeap heap) {
+    VkrMemoryBlock* block = calloc(1, sizeof(VkrMemoryBlock));
+    block->heap = heap;
+    if (!create_buffer_with_memory(device, MEMORY_BLOCK_SIZE, heap, &block->buffer, &block->memory, &block->mapped, &block->memory_type)) {
+        free(block);
+        return NULL;
+    }
+    block->allocator = shd_new_buddy_allocator(MEMORY_BLOCK_UNIT, MEMORY_BLOCK_SIZE / MEMORY_BLOCK_UNIT);
+    shd_list_append(VkrMemoryBlock*, device->memory.blocks, block);
+    shd_debug_print("Created a new %s memory block of type %u, %zu blocks in use\n", heap == AllocHostVisible ? "host-visible" : "device-local", block->memory_type, shd_list_count(device->memory.blocks));
+    return block;
+}
+
+static void destroy_memory_block(VkrDevice* device, VkrMemoryBlock* block) {
+    if (block->mapped)
+        vkUnmapMemory(device->device, block->memory);
+    vkDestroyBuffer(device->device, block->buffer, NULL);
+    vkFreeMemory(device->device, block->memory, NULL);
+    shd_destroy_buddy_allocator(block->allocator);
+    free(block);
+}
+
+static bool suballocate(VkrDevice* device, VkrMemoryHeap heap, size_t size, VkrBuffer* buffer) {
+    size_t alignment = device->caps.properties.base.properties.limits.minStorageBufferOffsetAlignment;
+    size_t offset;
+    VkrMemoryBlock* found = NULL;
+    size_t blocks_count = shd_list_count(device->memory.blocks);
+    // there are no blocks to look into before the first one tells us the memory type bits
+    uint32_t memory_type = blocks_count > 0 ? find_suitable_memory_type(device, device->memory.buffer_memory_type_bits, heap) : 0;
+    for (size_t i = 0; i < blocks_count; i++) {
+        VkrMemoryBlock* block = shd_read_list(VkrMemoryBlock*, device->memory.blocks)[i];
+        if (block->memory_type == memory_type && shd_buddy_alloc(block->allocator, size, alignment, &offset)) {
+            found = block;
+            break;
+        }
+    }
+    if (!found) {
+        found = create_memory_block(device, heap);
+        if (!found)
+            return false;
+        CHECK(shd_buddy_alloc(found->allocator, size, alignment, &offset), return false);
+    }
+    // when device-local and host-visible memory share a type, so do their blocks: map the device-local ones on first host use
+    if (heap == AllocHostVisible && !found->mapped)
+        CHECK_VK(vkMapMemory(device->device, found->memory, 0, VK_WHOLE_SIZE, 0, &found->mapped), { shd_buddy_free(found->allocator, offset); return false; });
+
+    buffer->block = found;
+    buffer->buffer = found->buffer;
+    buffer->memory = found->memory;
+    buffer->offset = offset;
+    buffer->host_ptr = found->mapped;
+    return true;
+}
+
+static void release_suballocation(VkrDevice* device, VkrBuffer* buffer) {
+    VkrMemoryBlock* block = buffer->block;
+    shd_buddy_free(block->allocator, buffer->offset);
+    if (shd_buddy_used(block->allocator) > 0)
+        return;
+
+    // keep one empty block per memory type around, so that allocation churn does not keep creating and destroying blocks
+    size_t blocks_count = shd_list_count(device->memory.blocks);
+    size_t index = blocks_count;
+    bool other_empty_block = false;
+    for (size_t i = 0; i < blocks_count; i++) {
+        VkrMemoryBlock* other = shd_read_list(VkrMemoryBlock*, device->memory.blocks)[i];
+        if (other == block)
+            index = i;
+        else if (other->memory_type == block->memory_type && shd_buddy_used(other->allocator) == 0)
+            other_empty_block = true;
+    }
+    assert(index < blocks_count);
+    if (other_empty_block) {
+        shd_list_remove(VkrMemoryBlock*, device->memory.blocks, index);
+        destroy_memory_block(device, block);
+    }
+}
+
+bool shd_rt_vk_allocate_buffer_memory(VkrDevice* device, VkrMemoryHeap heap, size_t size, VkrBuffer* buffer) {
+    uint64_t start = shd_get_time_nano();
+    shd_mutex_lock(device->memory.mutex);
+
+    bool ok;
+    if (size <= MAX_SUBALLOCATION_SIZE) {
+        ok = suballocate(device, heap, size, buffer);
+        if (ok)
+            device->memory.stats.requested_bytes += size;
+    } else {
+        buffer->block = NULL;
+        buffer->offset = 0;
+        uint32_t memory_type;
+        ok = create_buffer_with_memory(device, size, heap, &buffer->buffer, &buffer->memory, &buffer->host_ptr, &memory_type);
+        if (ok) {
+            device->memory.stats.dedicated_count++;
+            device->memory.stats.dedicated_bytes += size;
+        }
+    }
+
+    if (ok)
+        device->memory.stats.allocations_count++;
+    device->memory.stats.allocator_time_ns += shd_get_time_nano() - start;
+    shd_mutex_unlock(device->memory.mutex);
+    return ok;
+}
+
+void shd_rt_vk_free_buffer_memory(VkrDevice* device, VkrBuffer* buffer) {
+    uint64_t start = shd_get_time_nano();
+    shd_mutex_lock(device->memory.mutex);
+
+    if (buffer->block) {
+        release_suballocation(device, buffer);
+        device->memory.stats.requested_bytes -= buffer->size;
+    } else {
+        if (buffer->host_ptr)
+            vkUnmapMemory(device->device, buffer->memory);
+        vkDestroyBuffer(device->device, buffer->buffer, NULL);
+        vkFreeMemory(device->device, buffer->memory, NULL);
+        device->memory.stats.dedicated_count--;
+        device->memory.stats.dedicated_bytes -= buffer->size;
+    }
+
+    device->memory.stats.frees_count++;
+    device->memory.stats.allocator_time_ns += shd_get_time_nano() - start;
+    shd_mutex_unlock(device->memory.mutex);
+}
+
+bool shd_rt_vk_create_memory_allocator(VkrDevice* device) {
+    device->memory.mutex = shd_new_mutex();
+    device->memory.blocks = shd_new_list(VkrMemoryBlock*);
+    device->memory.stats = (BufferAllocatorStats) { 0 };
+    device->memory.buffer_memory_type_bits = 0;
+    return true;
+}
+
+void shd_rt_vk_destroy_memory_allocator(VkrDevice* device) {
+    for (size_t i = 0; i < shd_list_count(device->memory.blocks); i++) {
+        VkrMemoryBlock* block = shd_read_list(VkrMemoryBlock*, device->memory.blocks)[i];
+        if (shd_buddy_used(block->allocator) > 0)
+            shd_warn_print("Leaked %zu bytes of buffers on device shutdown\n", shd_buddy_used(block->allocator));
+        destroy_memory_block(device, block);
+    }
+    shd_destroy_list(device->memory.blocks);
+    shd_destroy_mutex(device->memory.mutex);
+}
+
+bool shd_rt_vk_get_buffer_allocator_stats(VkrDevice* device, BufferAllocatorStats* stats) {
+    shd_mutex_lock(device->memory.mutex);
+    *stats = device->memory.stats;
+    stats->blocks_count = shd_list_count(device->memory.blocks);
+    stats->reserved_bytes = 0;
+    stats->used_bytes = 0;
+    stats->largest_free_range = 0;
+    for (size_t i = 0; i < stats->blocks_count; i++) {
+        VkrMemoryBlock* block = shd_read_list(VkrMemoryBlock*, device->memory.blocks)[i];
+        stats->reserved_bytes += shd_buddy_capacity(block->allocator);
+        stats->used_bytes += shd_buddy_used(block->allocator);
+        size_t largest = shd_buddy_largest_free_range(block->allocator);
+        if (largest > stats->largest_free_range)
+            stats->largest_free_range = largest;
+    }
+    shd_mutex_unlock(device->memory.mutex);
+    return true;
+}
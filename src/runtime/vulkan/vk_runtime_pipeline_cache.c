@@ -0,0 +1,113 @@
+#include "vk_runtime_private.h"
+
+#include "log.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// The cache blob is only useful to the exact same device and driver build, so we key the file on both.
+static String make_pipeline_cache_filename(VkrDevice* device, String dir) {
+    const VkPhysicalDeviceProperties* props = &device->caps.properties.base.properties;
+    char uuid[VK_UUID_SIZE * 2 + 1];
+    for (size_t i = 0; i < VK_UUID_SIZE; i++)
+        snprintf(&uuid[i * 2], 3, "%02x", props->pipelineCacheUUID[i]);
+    return shd_format_string_new("%s/%s-%x.vkpc", dir, uuid, props->driverVersion);
+}
+
+/// Some drivers do not behave well when given blobs from another device, so we check the header ourselves.
+static bool is_pipeline_cache_data_compatible(VkrDevice* device, size_t size, const char* data) {
+    const VkPhysicalDeviceProperties* props = &device->caps.properties.base.properties;
+    VkPipelineCacheHeaderVersionOne header;
+    if (size < sizeof(header))
+        return false;
+    memcpy(&header, data, sizeof(header));
+    if (header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE)
+        return false;
+    if (header.vendorID != props->vendorID || header.deviceID != props->deviceID)
+        return false;
+    return memcmp(header.pipelineCacheUUID, props->pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+bool shd_rt_vk_create_pipeline_cache(VkrDevice* device) {
+    String dir = device->runtime->base.runtime->config.pipeline_cache_path;
+
+    size_t initial_size = 0;
+    char* initial_data = NULL;
+    if (dir) {
+        device->pipeline_cache_filename = make_pipeline_cache_filename(device, dir);
+        if (shd_read_file(device->pipeline_cache_filename, &initial_size, &initial_data)) {
+            if (is_pipeline_cache_data_compatible(device, initial_size, initial_data)) {
+                shd_info_print("Loaded %zu bytes of pipeline cache from '%s'\n", initial_size, device->pipeline_cache_filename);
+            } else {
+                shd_warn_print("Ignoring incompatible pipeline cache '%s'\n", device->pipeline_cache_filename);
+                free(initial_data);
+                initial_data = NULL;
+                initial_size = 0;
+            }
+        }
+    }
+
+    VkResult result = vkCreatePipelineCache(device->device, &(VkPipelineCacheCreateInfo) {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .initialDataSize = initial_size,
+        .pInitialData = initial_data,
+    }, NULL, &device->pipeline_cache);
+    free(initial_data);
+
+    // a rejected blob is not fatal, we just start from scratch
+    if (result != VK_SUCCESS && initial_size > 0) {
+        shd_warn_print("Driver rejected pipeline cache '%s' (code %d)\n", device->pipeline_cache_filename, result);
+        result = vkCreatePipelineCache(device->device, &(VkPipelineCacheCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        }, NULL, &device->pipeline_cache);
+    }
+    CHECK_VK(result, goto fail);
+    return true;
+
+fail:
+    // the device gets torn down without a pipeline cache to destroy
+    free((void*) device->pipeline_cache_filename);
+    device->pipeline_cache_filename = NULL;
+    return false;
+}
+
+bool shd_rt_vk_flush_pipeline_cache(VkrDevice* device) {
+    if (!device->pipeline_cache_filename)
+        return true;
+
+    size_t size;
+    CHECK_VK(vkGetPipelineCacheData(device->device, device->pipeline_cache, &size, NULL), return false);
+    char* data = malloc(size);
+    CHECK_VK(vkGetPipelineCacheData(device->device, device->pipeline_cache, &size, data), goto err_post_alloc);
+
+    // write to a temporary file first so a concurrent reader never sees a truncated cache
+    String tmp_filename = shd_format_string_new("%s.tmp", device->pipeline_cache_filename);
+    bool ok = shd_write_file(tmp_filename, size, data);
+    if (ok) {
+#ifdef _WIN32
+        remove(device->pipeline_cache_filename);
+#endif
+        ok = rename(tmp_filename, device->pipeline_cache_filename) == 0;
+    }
+    if (ok)
+        shd_debug_print("Wrote %zu bytes of pipeline cache to '%s'\n", size, device->pipeline_cache_filename);
+    else
+        shd_error_print("Failed to write pipeline cache to '%s'\n", device->pipeline_cache_filename);
+    free((void*) tmp_filename);
+    free(data);
+    return ok;
+
+err_post_alloc:
+    free(data);
+    return false;
+}
+
+void shd_rt_vk_destroy_pipeline_cache(VkrDevice* device) {
+    shd_rt_vk_flush_pipeline_cache(device);
+    vkDestroyPipelineCache(device->device, device->pipeline_cache, NULL);
+    free((void*) device->pipeline_cache_filename);
+}
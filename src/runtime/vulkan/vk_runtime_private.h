@@ -6,6 +6,7 @@
 
 #include "portability.h"
 #include "arena.h"
+#include "threads.h"
 
 #include "vulkan/vulkan.h"
 
@@ -20,6 +21,12 @@ Y(vkDestroyDebugUtilsMessengerEXT) \
 #define external_memory_host_fns(Y) \
 Y(vkGetMemoryHostPointerPropertiesEXT) \
 
+#define push_descriptor_fns(Y) \
+Y(vkCmdPushDescriptorSetKHR) \
+
+#define timeline_semaphore_fns(Y) \
+Y(vkWaitSemaphoresKHR) \
+
 #define INSTANCE_EXTENSIONS(X) \
 X(0, EXT_debug_utils,                debug_utils_fns) \
 X(0, KHR_portability_enumeration,          empty_fns) \
@@ -40,6 +47,8 @@ X(0, KHR_shader_float16_int8,            empty_fns) \
 X(0, KHR_8bit_storage,                   empty_fns) \
 X(0, KHR_16bit_storage,                  empty_fns) \
 X(0, KHR_driver_properties,              empty_fns) \
+X(0, KHR_push_descriptor,                push_descriptor_fns) \
+X(0, KHR_timeline_semaphore,             timeline_semaphore_fns) \
 
 #define E(is_required, name, _) ShadySupports##name,
 typedef enum {
@@ -65,6 +74,7 @@ SHADY_UNUSED static const bool is_device_ext_required[] = { DEVICE_EXTENSIONS(R)
 #define CHECK_VK(x, failure_handler) { VkResult the_result_ = x; if (the_result_ != VK_SUCCESS) { shd_error_print(#x " failed (code %d)\n", the_result_); failure_handler; } }
 
 typedef struct VkrSpecProgram_ VkrSpecProgram;
+typedef struct VkrMemoryBlock_ VkrMemoryBlock;
 
 typedef struct VkrBackend_ {
     Backend base;
@@ -97,6 +107,10 @@ typedef struct {
     bool supported_extensions[ShadySupportedDeviceExtensionsCount];
 
     uint32_t compute_queue_family;
+    /// Same as compute_queue_family when the device has no dedicated transfer family
+    uint32_t transfer_queue_family;
+    /// 0 if the compute queue can't write timestamps
+    uint32_t timestamp_valid_bits;
 
     struct {
         uint8_t major;
@@ -113,6 +127,7 @@ typedef struct {
         VkPhysicalDeviceShaderFloat16Int8Features float_16_int8;
         VkPhysicalDevice8BitStorageFeatures storage8;
         VkPhysicalDevice16BitStorageFeatures storage16;
+        VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timeline_semaphore;
     } features;
     struct {
         VkPhysicalDeviceProperties2 base;
@@ -120,6 +135,7 @@ typedef struct {
         VkPhysicalDeviceSubgroupSizeControlPropertiesEXT subgroup_size_control;
         VkPhysicalDeviceExternalMemoryHostPropertiesEXT external_memory_host;
         VkPhysicalDeviceDriverPropertiesKHR driver_properties;
+        VkPhysicalDevicePushDescriptorPropertiesKHR push_descriptor;
     } properties;
     struct {
         bool is_moltenvk;
@@ -133,13 +149,46 @@ typedef struct {
 
 typedef struct VkrDevice_ VkrDevice;
 
+/// Command pools can only be used by one thread at a time, so every thread recording commands gets its own
+typedef struct {
+    VkCommandPool pool;
+    /// guards free_commands, as commands can be recycled from any thread
+    Mutex* mutex;
+    /// Command buffers and fences from completed commands, ready to be used again by the pool's thread
+    struct List* free_commands;
+} VkrCommandPool;
+
+/// A queue, along with the command buffers recorded for it
+typedef struct {
+    uint32_t family;
+    VkQueue queue;
+    /// Identifies the queue in the threads' caches of command pools, never reused
+    uint64_t id;
+    /// guards command_pools
+    Mutex* pools_mutex;
+    /// VkrCommandPool* for every thread that recorded commands for this queue
+    struct Dict* command_pools;
+    /// Submissions are the only point where threads using the queue serialise, it also guards last_submitted
+    Mutex* submit_mutex;
+    /// Every submission signals the next value, so that commands can wait on each other on the device
+    VkSemaphore timeline;
+    uint64_t last_submitted;
+} VkrQueue;
+
 struct VkrDevice_ {
     Device base;
     VkrBackend* runtime;
     VkrDeviceCaps caps;
     VkDevice device;
-    VkCommandPool cmd_pool;
-    VkQueue compute_queue;
+    VkrQueue compute_queue;
+    /// Only set up when the device has a dedicated transfer family, see shd_rt_vk_get_transfer_queue
+    VkrQueue transfer_queue;
+    /// Otherwise commands complete through fences and dependencies are waited on by the host
+    bool use_timeline_semaphores;
+
+    VkPipelineCache pipeline_cache;
+    /// NULL when the cache is not persisted
+    String pipeline_cache_filename;
 
     struct {
     #define Y(fn_name) PFN_##fn_name fn_name;
@@ -153,46 +202,187 @@ struct VkrDevice_ {
     #undef X
     } extensions;
 
+    /// guards specialized_programs and the state of its entries, which are compiled on the runtime's workers
+    Mutex* specialized_programs_mutex;
+    CondVar* specialized_programs_cond;
     struct Dict* specialized_programs;
+
+    struct {
+        Mutex* mutex;
+        struct List* pools;
+        struct List* free_slots;
+    } timestamp_queries;
+
+    /// Large device memory blocks that buffers get sub-allocated from, see vk_runtime_memory.c
+    struct {
+        Mutex* mutex;
+        struct List* blocks;
+        /// memoryTypeBits of buffers created with VKR_BUFFER_USAGE_FLAGS, known once the first block exists
+        uint32_t buffer_memory_type_bits;
+        BufferAllocatorStats stats;
+    } memory;
+
+    /// Persistently mapped buffer that copies to and from device-local buffers are streamed through, created on first use
+    struct {
+        /// held for the whole of a staged copy
+        Mutex* mutex;
+        struct VkrBuffer_* buffer;
+        size_t head;
+        struct List* in_flight;
+    } staging;
 };
 
 bool shd_rt_vk_probe_devices(VkrBackend* runtime);
 
+bool shd_rt_vk_has_transfer_queue(VkrDevice* device);
+/// Copies go there so they can overlap with kernels, this is the compute queue if there is no dedicated transfer queue
+VkrQueue* shd_rt_vk_get_transfer_queue(VkrDevice* device);
+
+bool shd_rt_vk_create_pipeline_cache(VkrDevice* device);
+bool shd_rt_vk_flush_pipeline_cache(VkrDevice* device);
+void shd_rt_vk_destroy_pipeline_cache(VkrDevice* device);
+
+#define VKR_BUFFER_USAGE_FLAGS (VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_EXT)
+
+typedef enum {
+    AllocDeviceLocal,
+    AllocHostVisible
+} VkrMemoryHeap;
+
 typedef struct VkrBuffer_ {
     Buffer base;
     VkrDevice* device;
     bool imported;
+    /// the block this buffer was carved out of, NULL if it owns its memory
+    VkrMemoryBlock* block;
     VkBuffer buffer;
     VkDeviceMemory memory;
+    /// where the contents start in `buffer`
     size_t offset;
+    /// usable size, starting at `offset`
     size_t size;
+    /// host address of `buffer`'s start, for host-visible memory
     void* host_ptr;
 } VkrBuffer;
 
+bool shd_rt_vk_create_memory_allocator(VkrDevice* device);
+void shd_rt_vk_destroy_memory_allocator(VkrDevice* device);
+uint32_t shd_rt_vk_find_memory_type(VkrDevice* device, uint32_t memory_type_bits, VkrMemoryHeap heap);
+/// Fills in the block, buffer, memory, offset and host_ptr fields of a VkrBuffer of the given size.
+bool shd_rt_vk_allocate_buffer_memory(VkrDevice* device, VkrMemoryHeap heap, size_t size, VkrBuffer* buffer);
+void shd_rt_vk_free_buffer_memory(VkrDevice* device, VkrBuffer* buffer);
+bool shd_rt_vk_get_buffer_allocator_stats(VkrDevice* device, BufferAllocatorStats* stats);
+
 VkrBuffer* shd_rt_vk_allocate_buffer_device(VkrDevice* device, size_t size);
+/// Host-visible and persistently mapped
+VkrBuffer* shd_rt_vk_allocate_staging_buffer(VkrDevice* device, size_t size);
 VkrBuffer* shd_rt_vk_import_buffer_host(VkrDevice* device, void* ptr, size_t size);
 bool shd_rt_vk_can_import_host_memory(VkrDevice* device);
 void shd_rt_vk_destroy_buffer(VkrBuffer* buffer);
+/// Exclusive ownership would need queue family transfers between the compute and transfer queues, so buffers are shared when both exist
+void shd_rt_vk_set_buffer_sharing_mode(VkrDevice* device, VkBufferCreateInfo* create_info, uint32_t queue_families[2]);
+
+bool shd_rt_vk_create_staging_ring(VkrDevice* device);
+void shd_rt_vk_destroy_staging_ring(VkrDevice* device);
+
+/// A pair of timestamp queries, carved out of one of the device's query pools
+typedef struct {
+    VkQueryPool pool;
+    uint32_t first;
+} VkrTimestampSlot;
+
+bool shd_rt_vk_acquire_timestamp_slot(VkrDevice* device, VkrTimestampSlot* slot);
+void shd_rt_vk_release_timestamp_slot(VkrDevice* device, VkrTimestampSlot slot);
+
+typedef struct {
+    String entry_point;
+    VkrTimestampSlot timestamps;
+} VkrTimedDispatch;
 
 typedef struct VkrCommand_ VkrCommand;
 
 struct VkrCommand_ {
     Command base;
     VkrDevice* device;
+    VkrQueue* queue;
+    /// belongs to the thread that allocated the command, which is the only one to record it
+    VkrCommandPool* pool;
     VkCommandBuffer cmd_buf;
     VkFence done_fence;
     bool submitted;
+    /// value of the queue's timeline semaphore once this command completes
+    uint64_t timeline_value;
+
+    /// host time at which the command was handed to the queue
+    uint64_t submitted_ns;
 
     uint64_t* profiled_gpu_time;
-    VkQueryPool query_pool;
+    /// Dispatches bracketed by timestamps, which are read once the command completes
+    struct List* timed_dispatches;
+
+    /// Submitted instead of cmd_buf, which stays empty. Owned by a launch template.
+    VkCommandBuffer prerecorded;
+
+    /// Staging or imported memory used by a copy, released once the command completes
+    struct VkrBuffer_* transient_buffer;
+    /// For readbacks through transient_buffer: copied from readback_src to readback_dst on completion
+    void* readback_dst;
+    const void* readback_src;
+    size_t readback_size;
 };
 
-VkrCommand* shd_rt_vk_begin_command(VkrDevice* device);
-bool shd_rt_vk_submit_command(VkrCommand* cmd);
+/// Hands out a recycled command from the calling thread's pool if one is available
+VkrCommand* shd_rt_vk_begin_command(VkrDevice* device, VkrQueue* queue);
+/// The command will only start executing once its dependencies completed
+bool shd_rt_vk_submit_command(VkrCommand* cmd, size_t dependencies_count, Command** dependencies);
+/// Returns the command to its pool's free list, it gets reset once it is begun again. It must not be in flight.
+void shd_rt_vk_recycle_command(VkrCommand* cmd);
 void shd_rt_vk_destroy_command(VkrCommand* cmd);
+void shd_rt_vk_destroy_command_pool(VkrDevice* device, VkrCommandPool* pool);
 bool shd_rt_vk_wait_completion(VkrCommand* cmd);
 
 VkrCommand* shd_rt_vk_launch_kernel(VkrDevice* device, Program* program, String entry_point, int dimx, int dimy, int dimz, int args_count, void** args, ExtraKernelOptions* options);
+VkrCommand* shd_rt_vk_launch_kernel_indirect(VkrDevice* device, Program* program, String entry_point, Buffer* dimensions, size_t offset, int args_count, void** args, ExtraKernelOptions* options);
+
+/// Several dispatches recorded into a single command buffer, separated by compute-to-compute barriers
+typedef struct {
+    Batch base;
+    VkrDevice* device;
+    VkrCommand* cmd;
+    size_t dispatches_count;
+} VkrBatch;
+
+VkrBatch* shd_rt_vk_begin_batch(VkrDevice* device);
+bool shd_rt_vk_launch_kernel_in_batch(VkrBatch* batch, Program* program, String entry_point, int dimx, int dimy, int dimz, int args_count, void** args);
+bool shd_rt_vk_launch_kernel_indirect_in_batch(VkrBatch* batch, Program* program, String entry_point, Buffer* dimensions, size_t offset, int args_count, void** args);
+VkrCommand* shd_rt_vk_submit_batch(VkrBatch* batch);
+
+/// Dispatches captured once and submitted many times
+typedef struct {
+    KernelLaunchTemplate base;
+    VkrDevice* device;
+    Arena* arena;
+    struct List* dispatches;
+    /// where each argument given at submission goes, in order
+    struct List* patch_slots;
+    size_t max_args_size;
+    /// guards sealed and the recording of the command buffers, submissions may come from several threads at once
+    Mutex* mutex;
+    /// set on the first submission, after which no launches can be recorded
+    bool sealed;
+    /// whether the command buffers below were successfully recorded when the template got sealed
+    bool recorded;
+    /// Recorded on the first submission, see shd_rt_vk_submit_launch_template. The dispatches' secondary command buffers come from there too.
+    VkCommandPool cmd_pool;
+    /// The whole template, for templates taking no patches
+    VkCommandBuffer cmd_buf;
+} VkrLaunchTemplate;
+
+VkrLaunchTemplate* shd_rt_vk_begin_launch_template(VkrDevice* device);
+bool shd_rt_vk_record_launch(VkrLaunchTemplate* template, Program* program, String entry_point, int dimx, int dimy, int dimz, int args_count, void** args);
+bool shd_rt_vk_record_launch_indirect(VkrLaunchTemplate* template, Program* program, String entry_point, Buffer* dimensions, size_t offset, int args_count, void** args);
+VkrCommand* shd_rt_vk_submit_launch_template(VkrLaunchTemplate* template, size_t patches_count, void** patches, size_t dependencies_count, Command** dependencies);
+void shd_rt_vk_destroy_launch_template(VkrLaunchTemplate* template);
 
 typedef struct ProgramResourceInfo_ ProgramResourceInfo;
 struct ProgramResourceInfo_ {
@@ -211,7 +401,8 @@ struct ProgramResourceInfo_ {
     size_t size;
     VkrBuffer* buffer;
 
-    unsigned char* default_data;
+    /// points into the kernel bundle
+    const unsigned char* default_data;
 };
 
 typedef struct {
@@ -223,15 +414,27 @@ typedef struct {
 
 VkDescriptorType shd_rt_vk_as_to_descriptor_type(AddressSpace as);
 
+typedef enum {
+    /// waiting for or running on a worker thread
+    SpecCompiling,
+    /// the pipeline exists, but the runtime-managed resources need to be set up
+    SpecCompiled,
+    SpecPreparingResources,
+    SpecReady,
+    SpecFailed,
+} VkrSpecProgramState;
+
 struct VkrSpecProgram_ {
+    KernelFuture future;
     SpecProgramKey key;
     VkrDevice* device;
     Arena* arena;
+    /// guarded by VkrDevice::specialized_programs_mutex
+    VkrSpecProgramState state;
 
-    Module* specialized_module;
-
-    size_t spirv_size;
-    char* spirv_bytes;
+    /// owned by the program's bundle, or by own_bundle when the kernel was compiled here
+    const CompiledKernel* kernel;
+    KernelBundle* own_bundle;
 
     ProgramParamsInfo parameters;
     ProgramResourcesInfo resources;
@@ -241,6 +444,8 @@ struct VkrSpecProgram_ {
     VkShaderModule shader_module;
 
     VkDescriptorSetLayout set_layouts[MAX_DESCRIPTOR_SETS];
+    /// set whose bindings are pushed with VK_KHR_push_descriptor at launch time, or -1 if we use a descriptor pool
+    int push_descriptor_set;
     size_t required_descriptor_counts_count;
     VkDescriptorPoolSize required_descriptor_counts[16];
 
@@ -248,6 +453,9 @@ struct VkrSpecProgram_ {
     VkDescriptorSet sets[MAX_DESCRIPTOR_SETS];
 };
 
+/// Looks up or starts the specialisation of a program without waiting for it.
+VkrSpecProgram* shd_rt_vk_prepare_specialized_program(Program* program, String entry_point, VkrDevice* device);
+/// Waits for the specialisation to complete, returns NULL if it failed.
 VkrSpecProgram* shd_rt_vk_get_specialized_program(Program* program, String entry_point, VkrDevice* device);
 void shd_rt_vk_destroy_specialized_program(VkrSpecProgram* spec);
 
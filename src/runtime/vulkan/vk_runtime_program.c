@@ -1,7 +1,6 @@
 #include "vk_runtime_private.h"
 
 #include "shady/driver.h"
-#include "shady/ir/memory_layout.h"
 
 #include "log.h"
 #include "portability.h"
@@ -41,131 +40,74 @@ VkDescriptorType shd_rt_vk_as_to_descriptor_type(AddressSpace as) {
     }
 }
 
-static void write_value(unsigned char* tgt, const Node* value) {
-    IrArena* a = value->arena;
-    switch (value->tag) {
-        case IntLiteral_TAG: {
-            switch (value->payload.int_literal.width) {
-                case IntTy8: *((uint8_t*) tgt) = (uint8_t) (value->payload.int_literal.value & 0xFF); break;
-                case IntTy16: *((uint16_t*) tgt) = (uint16_t) (value->payload.int_literal.value & 0xFFFF); break;
-                case IntTy32: *((uint32_t*) tgt) = (uint32_t) (value->payload.int_literal.value & 0xFFFFFFFF); break;
-                case IntTy64: *((uint64_t*) tgt) = (uint64_t) (value->payload.int_literal.value); break;
-            }
-            break;
-        }
-        case Composite_TAG: {
-            Nodes values = value->payload.composite.contents;
-            const Type* struct_t = value->payload.composite.type;
-            struct_t = shd_get_maybe_nominal_type_body(struct_t);
-
-            if (struct_t->tag == RecordType_TAG) {
-                LARRAY(FieldLayout, fields, values.count);
-                shd_get_record_layout(a, struct_t, fields);
-                for (size_t i = 0; i < values.count; i++) {
-                    // TypeMemLayout layout = get_mem_layout(value->arena, get_unqualified_type(element->type));
-                    write_value(tgt + fields->offset_in_bytes, values.nodes[i]);
-                }
-            } else if (struct_t->tag == ArrType_TAG) {
-                for (size_t i = 0; i < values.count; i++) {
-                    TypeMemLayout layout = shd_get_mem_layout(value->arena, shd_get_unqualified_type(values.nodes[i]->type));
-                    write_value(tgt, values.nodes[i]);
-                    tgt += layout.size_in_bytes;
-                }
-            } else {
-                assert(false);
-            }
-            break;
+static bool extract_resources_layout(VkrSpecProgram* program, VkDescriptorSetLayout layouts[]) {
+    const CompiledKernel* kernel = program->kernel;
+    for (size_t i = 0; i < kernel->resources_count; i++) {
+        if (kernel->resources[i].parent < 0 && (kernel->resources[i].set < 0 || kernel->resources[i].set >= MAX_DESCRIPTOR_SETS)) {
+            shd_error_print("Descriptor set %d is out of range\n", kernel->resources[i].set);
+            return false;
         }
-        default:
-            assert(false);
     }
-}
 
-static bool extract_resources_layout(VkrSpecProgram* program, VkDescriptorSetLayout layouts[]) {
     VkDescriptorSetLayoutCreateInfo layout_create_infos[MAX_DESCRIPTOR_SETS] = { 0 };
     Growy* bindings_lists[MAX_DESCRIPTOR_SETS] = { 0 };
-    Growy* resources = shd_new_growy();
-
-    Nodes decls = shd_module_get_declarations(program->specialized_module);
-    for (size_t i = 0; i < decls.count; i++) {
-        const Node* decl = decls.nodes[i];
-        if (decl->tag != GlobalVariable_TAG) continue;
-
-        if (shd_lookup_annotation(decl, "Constants")) {
-            AddressSpace as = decl->payload.global_variable.address_space;
-            switch (as) {
-                case AsShaderStorageBufferObject:
-                case AsUniform: break;
-                default: continue;
-            }
+    program->resources.num_resources = kernel->resources_count;
+    program->resources.resources = calloc(kernel->resources_count ? kernel->resources_count : 1, sizeof(ProgramResourceInfo*));
+    for (size_t i = 0; i < kernel->resources_count; i++) {
+        const KernelResourceLayout* layout = &kernel->resources[i];
+        ProgramResourceInfo* res_info = shd_arena_alloc(program->arena, sizeof(ProgramResourceInfo));
+        *res_info = (ProgramResourceInfo) {
+            .as = layout->as,
+            .offset = layout->offset,
+            .size = layout->size,
+            .default_data = layout->default_data,
+        };
+        program->resources.resources[i] = res_info;
 
-            int set = shd_get_int_literal_value(*shd_resolve_to_int_literal(shd_get_annotation_value(shd_lookup_annotation(decl, "DescriptorSet"))), false);
-            int binding = shd_get_int_literal_value(*shd_resolve_to_int_literal(shd_get_annotation_value(shd_lookup_annotation(decl, "DescriptorBinding"))), false);
-
-            ProgramResourceInfo* res_info = shd_arena_alloc(program->arena, sizeof(ProgramResourceInfo));
-            *res_info = (ProgramResourceInfo) {
-                .is_bound = true,
-                .as = as,
-                .set = set,
-                .binding = binding,
-            };
-            shd_growy_append_object(resources, res_info);
-            program->resources.num_resources++;
-
-            const Type* struct_t = decl->payload.global_variable.type;
-            assert(struct_t->tag == RecordType_TAG && struct_t->payload.record_type.special == DecorateBlock);
-
-            for (size_t j = 0; j < struct_t->payload.record_type.members.count; j++) {
-                const Type* member_t = struct_t->payload.record_type.members.nodes[j];
-                assert(member_t->tag == PtrType_TAG);
-                member_t = shd_get_pointee_type(member_t->arena, member_t);
-                TypeMemLayout layout = shd_get_mem_layout(shd_module_get_arena(program->specialized_module), member_t);
-
-                ProgramResourceInfo* constant_res_info = shd_arena_alloc(program->arena, sizeof(ProgramResourceInfo));
-                *constant_res_info = (ProgramResourceInfo) {
-                    .parent = res_info,
-                    .as = as,
-                };
-                shd_growy_append_object(resources, constant_res_info);
-                program->resources.num_resources++;
-
-                constant_res_info->size = layout.size_in_bytes;
-                constant_res_info->offset = res_info->size;
-                res_info->size += sizeof(void*);
-
-                // TODO initial value
-                Nodes annotations = get_declaration_annotations(decl);
-                for (size_t k = 0; k < annotations.count; k++) {
-                    const Node* a = annotations.nodes[k];
-                    if ((strcmp(get_annotation_name(a), "InitialValue") == 0) && shd_resolve_to_int_literal(shd_first(shd_get_annotation_values(a)))->value == j) {
-                        constant_res_info->default_data = calloc(1, layout.size_in_bytes);
-                        write_value(constant_res_info->default_data, shd_get_annotation_values(a).nodes[1]);
-                        //printf("wowie");
-                    }
-                }
-            }
+        // constants come after the block holding their addresses
+        if (layout->parent >= 0) {
+            res_info->parent = program->resources.resources[layout->parent];
+            continue;
+        }
 
-            if (shd_rt_vk_can_import_host_memory(program->device))
-                res_info->host_backed_allocation = true;
-            else
-                res_info->staging = calloc(1, res_info->size);
-
-            VkDescriptorSetLayoutBinding vk_binding = {
-                .binding = binding,
-                .descriptorType = shd_rt_vk_as_to_descriptor_type(as),
-                .descriptorCount = 1,
-                .stageFlags = VK_SHADER_STAGE_ALL,
-                .pImmutableSamplers = NULL,
-            };
-            register_required_descriptors(program, &vk_binding);
-            add_binding(layout_create_infos, bindings_lists, set, vk_binding);
+        res_info->is_bound = true;
+        res_info->set = layout->set;
+        res_info->binding = layout->binding;
+
+        if (shd_rt_vk_can_import_host_memory(program->device))
+            res_info->host_backed_allocation = true;
+        else
+            res_info->staging = calloc(1, res_info->size);
+
+        VkDescriptorSetLayoutBinding vk_binding = {
+            .binding = layout->binding,
+            .descriptorType = shd_rt_vk_as_to_descriptor_type(layout->as),
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_ALL,
+            .pImmutableSamplers = NULL,
+        };
+        register_required_descriptors(program, &vk_binding);
+        add_binding(layout_create_infos, bindings_lists, layout->set, vk_binding);
+    }
+
+    // if all the bindings live in one set, we can push them at launch time instead of managing a descriptor pool
+    program->push_descriptor_set = -1;
+    if (program->device->extensions.KHR_push_descriptor.enabled) {
+        int used_sets = 0;
+        for (int set = 0; set < MAX_DESCRIPTOR_SETS; set++) {
+            if (layout_create_infos[set].bindingCount > 0) {
+                program->push_descriptor_set = set;
+                used_sets++;
+            }
         }
+        if (used_sets != 1 || layout_create_infos[program->push_descriptor_set].bindingCount > program->device->caps.properties.push_descriptor.maxPushDescriptors)
+            program->push_descriptor_set = -1;
     }
 
     for (size_t set = 0; set < MAX_DESCRIPTOR_SETS; set++) {
         layouts[set] = 0;
         layout_create_infos[set].sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-        layout_create_infos[set].flags = 0;
+        layout_create_infos[set].flags = (int) set == program->push_descriptor_set ? VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR : 0;
         layout_create_infos[set].pNext = NULL;
         vkCreateDescriptorSetLayout(program->device->device, &layout_create_infos[set], NULL, &layouts[set]);
         if (bindings_lists[set] != NULL) {
@@ -173,8 +115,6 @@ static bool extract_resources_layout(VkrSpecProgram* program, VkDescriptorSetLay
         }
     }
 
-    program->resources.resources = (ProgramResourceInfo**) shd_growy_deconstruct(resources);
-
     return true;
 }
 
@@ -206,8 +146,8 @@ static bool create_vk_pipeline(VkrSpecProgram* program) {
         .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
         .pNext = NULL,
         .flags = 0,
-        .codeSize = program->spirv_size,
-        .pCode = (uint32_t*) program->spirv_bytes
+        .codeSize = program->kernel->spirv_size,
+        .pCode = (const uint32_t*) program->kernel->spirv
     }, NULL, &program->shader_module), return false);
 
     VkPipelineShaderStageCreateInfo stage_create_info = {
@@ -230,7 +170,7 @@ static bool create_vk_pipeline(VkrSpecProgram* program) {
         append_pnext((VkBaseOutStructure*) &stage_create_info, &pipeline_shader_stage_required_subgroup_size_create_info_ext);
     }
 
-    CHECK_VK(vkCreateComputePipelines(program->device->device, VK_NULL_HANDLE, 1, (VkComputePipelineCreateInfo []) { {
+    CHECK_VK(vkCreateComputePipelines(program->device->device, program->device->pipeline_cache, 1, (VkComputePipelineCreateInfo []) { {
         .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
         .pNext = NULL,
         .flags = 0,
@@ -271,139 +211,71 @@ static CompilerConfig get_compiler_config_for_device(VkrDevice* device, const Co
     return config;
 }
 
-static bool extract_parameters_info(ProgramParamsInfo* parameters, Module* mod) {
-    Nodes decls = shd_module_get_declarations(mod);
-
-    const Node* args_struct_annotation;
-    const Node* args_struct_type = NULL;
-    const Node* entry_point_function = NULL;
-
-    for (int i = 0; i < decls.count; ++i) {
-        const Node* node = decls.nodes[i];
-
-        switch (node->tag) {
-            case GlobalVariable_TAG: {
-                const Node* entry_point_args_annotation = shd_lookup_annotation(node, "EntryPointArgs");
-                if (entry_point_args_annotation) {
-                    if (node->payload.global_variable.type->tag != RecordType_TAG) {
-                        shd_error_print("EntryPointArgs must be a struct\n");
-                        return false;
-                    }
-
-                    if (args_struct_type) {
-                        shd_error_print("there cannot be more than one EntryPointArgs\n");
-                        return false;
-                    }
-
-                    args_struct_annotation = entry_point_args_annotation;
-                    args_struct_type = node->payload.global_variable.type;
-                }
-                break;
-            }
-            case Function_TAG: {
-                if (shd_lookup_annotation(node, "EntryPoint")) {
-                    if (node->payload.fun.params.count != 0) {
-                        shd_error_print("EntryPoint cannot have parameters\n");
-                        return false;
-                    }
-
-                    if (entry_point_function) {
-                        shd_error_print("there cannot be more than one EntryPoint\n");
-                        return false;
-                    }
-
-                    entry_point_function = node;
-                }
-                break;
-            }
-            default: break;
-        }
-    }
-
-    if (!entry_point_function) {
-        shd_error_print("could not find EntryPoint\n");
-        return false;
-    }
+static bool compile_specialized_program(VkrSpecProgram* spec) {
+    CompilerConfig config = get_compiler_config_for_device(spec->device, spec->key.base->base_config);
+    config.specialization.entry_point = spec->key.entry_point;
 
-    if (!args_struct_type) {
-        *parameters = (ProgramParamsInfo) { .num_args = 0 };
-        return true;
-    }
+    Module* mod = spec->key.base->module;
+    CHECK(mod, return false);
+    Module* specialized = mod;
+    CHECK(shd_run_compiler_passes(&config, &specialized) == CompilationNoError, return false);
 
-    if (args_struct_annotation->tag != AnnotationValue_TAG) {
-        shd_error_print("EntryPointArgs annotation must contain exactly one value\n");
-        return false;
-    }
+    size_t spirv_size;
+    char* spirv;
+    Module* final_mod;
+    shd_emit_spirv(&config, specialized, &spirv_size, &spirv, &final_mod);
 
-    const Node* annotation_fn = args_struct_annotation->payload.annotation_value.value;
-    assert(annotation_fn->tag == FnAddr_TAG);
-    if (annotation_fn->payload.fn_addr.fn != entry_point_function) {
-        shd_error_print("EntryPointArgs annotation refers to different EntryPoint\n");
-        return false;
+    if (spec->key.base->runtime->config.dump_spv) {
+        // entry points are specialised concurrently, each one needs a file of its own
+        String file_name = shd_format_string_new("%s.%s.spv", shd_module_get_name(final_mod), spec->key.entry_point);
+        shd_write_file(file_name, spirv_size, (const char*) spirv);
+        free((void*) file_name);
     }
 
-    size_t num_args = args_struct_type->payload.record_type.members.count;
+    spec->own_bundle = shd_new_kernel_bundle(shd_driver_config_fingerprint(&config));
+    spec->kernel = shd_kernel_bundle_add(spec->own_bundle, spec->key.entry_point, final_mod, spirv_size, spirv);
+    free(spirv);
+    if (shd_module_get_arena(final_mod) != shd_module_get_arena(specialized))
+        shd_destroy_ir_arena(shd_module_get_arena(final_mod));
+    if (shd_module_get_arena(specialized) != shd_module_get_arena(mod))
+        shd_destroy_ir_arena(shd_module_get_arena(specialized));
+    return spec->kernel != NULL;
+}
 
-    if (num_args == 0) {
-        shd_error_print("EntryPointArgs cannot be shd_empty\n");
+static bool find_bundled_kernel(VkrSpecProgram* spec) {
+    KernelBundle* bundle = spec->key.base->bundle;
+    CompilerConfig config = get_compiler_config_for_device(spec->device, spec->key.base->base_config);
+    if (shd_driver_config_fingerprint(&config) != shd_kernel_bundle_fingerprint(bundle)) {
+        shd_error_print("The kernel bundle was not compiled for the configuration of '%s': subgroup size %u, SPIR-V %d.%d\n",
+                        spec->device->caps.properties.base.properties.deviceName, config.specialization.subgroup_size, config.target_spirv_version.major, config.target_spirv_version.minor);
         return false;
     }
-
-    IrArena* a = shd_module_get_arena(mod);
-
-    LARRAY(FieldLayout, fields, num_args);
-    shd_get_record_layout(a, args_struct_type, fields);
-
-    size_t* offset_size_buffer = calloc(1, 2 * num_args * sizeof(size_t));
-    if (!offset_size_buffer) {
-        shd_error_print("failed to allocate EntryPointArgs offsets and sizes array\n");
+    spec->kernel = shd_kernel_bundle_find(bundle, spec->key.entry_point);
+    if (!spec->kernel) {
+        shd_error_print("The kernel bundle has no entry point named '%s'\n", spec->key.entry_point);
         return false;
     }
-    size_t* offsets = offset_size_buffer;
-    size_t* sizes = offset_size_buffer + num_args;
-
-    for (int i = 0; i < num_args; ++i) {
-        offsets[i] = fields[i].offset_in_bytes;
-        sizes[i] = fields[i].mem_layout.size_in_bytes;
-    }
-
-    parameters->num_args = num_args;
-    parameters->arg_offset = offsets;
-    parameters->arg_size = sizes;
-    parameters->args_size = offsets[num_args - 1] + sizes[num_args - 1];
     return true;
 }
 
-static bool compile_specialized_program(VkrSpecProgram* spec) {
-    CompilerConfig config = get_compiler_config_for_device(spec->device, spec->key.base->base_config);
-    config.specialization.entry_point = spec->key.entry_point;
-
-    CHECK(shd_run_compiler_passes(&config, &spec->specialized_module) == CompilationNoError, return false);
-
-    Module* final_mod;
-    shd_emit_spirv(&config, spec->specialized_module, &spec->spirv_size, &spec->spirv_bytes, &final_mod);
-
-    CHECK(extract_parameters_info(&spec->parameters, final_mod), return false);
-
-    spec->specialized_module = final_mod;
-
-    if (spec->key.base->runtime->config.dump_spv) {
-        String module_name = shd_module_get_name(spec->specialized_module);
-        String file_name = shd_format_string_new("%s.spv", module_name);
-        shd_write_file(file_name, spec->spirv_size, (const char*) spec->spirv_bytes);
-        free((void*) file_name);
-    }
-
-    String override_file = getenv("SHADY_OVERRIDE_SPV");
-    if (override_file) {
-        shd_read_file(override_file, &spec->spirv_size, &spec->spirv_bytes);
-        return true;
-    }
+static bool get_compiled_kernel(VkrSpecProgram* spec) {
+    bool found = spec->key.base->bundle ? find_bundled_kernel(spec) : compile_specialized_program(spec);
+    CHECK(found, return false);
 
+    const CompiledKernel* kernel = spec->kernel;
+    spec->parameters = (ProgramParamsInfo) {
+        .num_args = kernel->args_count,
+        .arg_offset = kernel->arg_offsets,
+        .arg_size = kernel->arg_sizes,
+        .args_size = kernel->args_size,
+    };
     return true;
 }
 
 static bool allocate_sets(VkrSpecProgram* program) {
+    if (program->push_descriptor_set >= 0)
+        return true;
+
     if (program->required_descriptor_counts_count > 0) {
         VkDescriptorPoolCreateInfo create_info = {
             .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
@@ -428,14 +300,99 @@ static bool allocate_sets(VkrSpecProgram* program) {
     return true;
 }
 
-static void flush_staged_data(VkrSpecProgram* program) {
+/// Where the initial contents of a resource come from, NULL if it starts out zeroed
+static const void* initial_contents(ProgramResourceInfo* resource) {
+    if (resource->staging)
+        return resource->staging;
+    return resource->default_data;
+}
+
+/// Initialises every resource with a single submission: zeroes are filled on the device, and all initial data goes through one staging buffer.
+static bool upload_initial_contents(VkrSpecProgram* program) {
+    VkrDevice* device = program->device;
+
+    size_t upload_size = 0;
     for (size_t i = 0; i < program->resources.num_resources; i++) {
         ProgramResourceInfo* resource = program->resources.resources[i];
-        if (resource->staging) {
-            shd_rt_copy_to_buffer((Buffer*) resource->buffer, 0, resource->buffer, resource->size);
-            free(resource->staging);
+        if (!resource->host_backed_allocation && initial_contents(resource))
+            upload_size += (resource->size + 15) & ~(size_t) 15;
+    }
+
+    VkrCommand* cmd = shd_rt_vk_begin_command(device, &device->compute_queue);
+    if (!cmd)
+        return false;
+
+    VkrBuffer* staging = NULL;
+    if (upload_size > 0) {
+        staging = shd_rt_vk_allocate_staging_buffer(device, upload_size);
+        if (!staging)
+            goto err_post_cmd_begin;
+        cmd->transient_buffer = staging;
+    }
+
+    size_t staging_offset = 0;
+    for (size_t i = 0; i < program->resources.num_resources; i++) {
+        ProgramResourceInfo* resource = program->resources.resources[i];
+        if (resource->host_backed_allocation || resource->size == 0)
+            continue;
+        VkrBuffer* buffer = resource->buffer;
+        const void* contents = initial_contents(resource);
+        if (contents) {
+            memcpy((char*) shd_rt_get_buffer_host_pointer((Buffer*) staging) + staging_offset, contents, resource->size);
+            vkCmdCopyBuffer(cmd->cmd_buf, staging->buffer, buffer->buffer, 1, (VkBufferCopy[]) { {
+                .srcOffset = staging->offset + staging_offset,
+                .dstOffset = buffer->offset,
+                .size = resource->size,
+            } });
+            staging_offset += (resource->size + 15) & ~(size_t) 15;
+        } else {
+            // fills work in words: sub-allocated buffers always have room to round up, dedicated ones are filled whole
+            VkDeviceSize fill_size = buffer->block ? (resource->size + 3) & ~(size_t) 3 : VK_WHOLE_SIZE;
+            vkCmdFillBuffer(cmd->cmd_buf, buffer->buffer, buffer->offset, fill_size, 0);
         }
     }
+
+    if (!shd_rt_vk_submit_command(cmd, 0, NULL))
+        goto err_post_cmd_begin;
+    return shd_rt_vk_wait_completion(cmd);
+
+err_post_cmd_begin:
+    shd_rt_vk_recycle_command(cmd);
+    return false;
+}
+
+/// Resources keep their buffers for as long as the program lives, so the sets only need to be written once.
+/// Launches then merely bind them, which is safe to do from several threads at once.
+static void write_descriptor_sets(VkrSpecProgram* program) {
+    if (program->push_descriptor_set >= 0 || program->resources.num_resources == 0)
+        return;
+
+    LARRAY(VkWriteDescriptorSet, write_descriptor_sets, program->resources.num_resources);
+    LARRAY(VkDescriptorBufferInfo, descriptor_buffer_info, program->resources.num_resources);
+    size_t write_descriptor_sets_count = 0;
+    for (size_t i = 0; i < program->resources.num_resources; i++) {
+        ProgramResourceInfo* resource = program->resources.resources[i];
+        if (!resource->is_bound)
+            continue;
+        descriptor_buffer_info[write_descriptor_sets_count] = (VkDescriptorBufferInfo) {
+            .buffer = resource->buffer->buffer,
+            .offset = resource->buffer->offset,
+            .range = resource->buffer->size,
+        };
+        write_descriptor_sets[write_descriptor_sets_count] = (VkWriteDescriptorSet) {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .pNext = NULL,
+            .descriptorType = shd_rt_vk_as_to_descriptor_type(resource->as),
+            .descriptorCount = 1,
+            .dstSet = program->sets[resource->set],
+            .dstBinding = resource->binding,
+            .pBufferInfo = &descriptor_buffer_info[write_descriptor_sets_count],
+        };
+        write_descriptor_sets_count++;
+    }
+
+    if (write_descriptor_sets_count > 0)
+        vkUpdateDescriptorSets(program->device->device, write_descriptor_sets_count, write_descriptor_sets, 0, NULL);
 }
 
 static bool prepare_resources(VkrSpecProgram* program) {
@@ -445,18 +402,16 @@ static bool prepare_resources(VkrSpecProgram* program) {
         if (resource->host_backed_allocation) {
             assert(shd_rt_vk_can_import_host_memory(program->device));
             resource->host_ptr = shd_alloc_aligned(resource->size, program->device->caps.properties.external_memory_host.minImportedHostPointerAlignment);
+            // host-backed memory is initialised in place
+            if (resource->default_data)
+                memcpy(resource->host_ptr, resource->default_data, resource->size);
+            else
+                memset(resource->host_ptr, 0, resource->size);
             resource->buffer = shd_rt_vk_import_buffer_host(program->device, resource->host_ptr, resource->size);
         } else {
             resource->buffer = shd_rt_vk_allocate_buffer_device(program->device, resource->size);
         }
-
-        if (resource->default_data) {
-            shd_rt_copy_to_buffer((Buffer*) resource->buffer, 0, resource->default_data, resource->size);
-        } else {
-            char* zeroes = calloc(1, resource->size);
-            shd_rt_copy_to_buffer((Buffer*) resource->buffer, 0, zeroes, resource->size);
-            free(zeroes);
-        }
+        CHECK(resource->buffer, return false);
 
         if (resource->parent) {
             char* dst = resource->parent->host_ptr;
@@ -468,9 +423,63 @@ static bool prepare_resources(VkrSpecProgram* program) {
         }
     }
 
-    flush_staged_data(program);
+    write_descriptor_sets(program);
+    bool ok = upload_initial_contents(program);
 
-    return true;
+    for (size_t i = 0; i < program->resources.num_resources; i++) {
+        ProgramResourceInfo* resource = program->resources.resources[i];
+        free(resource->staging);
+        resource->staging = NULL;
+    }
+
+    return ok;
+}
+
+static void set_spec_program_state(VkrSpecProgram* spec, VkrSpecProgramState state) {
+    VkrDevice* device = spec->device;
+    shd_mutex_lock(device->specialized_programs_mutex);
+    spec->state = state;
+    shd_cond_var_broadcast(device->specialized_programs_cond);
+    shd_mutex_unlock(device->specialized_programs_mutex);
+}
+
+/// Runs on the runtime's worker threads. Everything touching the queue is left for prepare_resources.
+static void compile_specialized_program_job(VkrSpecProgram* spec) {
+    uint64_t tsn = shd_get_time_nano();
+    bool ok = true;
+    CHECK(get_compiled_kernel(spec),         ok = false);
+    if (ok) CHECK(extract_layout(spec),      ok = false);
+    if (ok) CHECK(create_vk_pipeline(spec),  ok = false);
+    if (ok) CHECK(allocate_sets(spec),       ok = false);
+    uint64_t tpn = shd_get_time_nano();
+    shd_debug_print("Specialising '%s' took %zu us\n", spec->key.entry_point, (size_t) ((tpn - tsn) / 1000));
+    set_spec_program_state(spec, ok ? SpecCompiled : SpecFailed);
+}
+
+static bool is_spec_program_ready(VkrSpecProgram* spec) {
+    shd_mutex_lock(spec->device->specialized_programs_mutex);
+    bool ready = spec->state == SpecReady || spec->state == SpecFailed;
+    shd_mutex_unlock(spec->device->specialized_programs_mutex);
+    return ready;
+}
+
+static bool wait_spec_program(VkrSpecProgram* spec) {
+    VkrDevice* device = spec->device;
+    shd_mutex_lock(device->specialized_programs_mutex);
+    while (spec->state == SpecCompiling || spec->state == SpecPreparingResources)
+        shd_cond_var_wait(device->specialized_programs_cond, device->specialized_programs_mutex);
+    if (spec->state == SpecCompiled) {
+        // the first waiter gets to upload the resources
+        spec->state = SpecPreparingResources;
+        shd_mutex_unlock(device->specialized_programs_mutex);
+        bool ok = true;
+        CHECK(prepare_resources(spec), ok = false);
+        set_spec_program_state(spec, ok ? SpecReady : SpecFailed);
+        return ok;
+    }
+    bool ok = spec->state == SpecReady;
+    shd_mutex_unlock(device->specialized_programs_mutex);
+    return ok;
 }
 
 static VkrSpecProgram* create_specialized_program(SpecProgramKey key, VkrDevice* device) {
@@ -478,27 +487,42 @@ static VkrSpecProgram* create_specialized_program(SpecProgramKey key, VkrDevice*
     if (!spec_program)
         return NULL;
 
+    spec_program->future = (KernelFuture) {
+        .is_ready = (bool (*)(KernelFuture*)) is_spec_program_ready,
+        .wait = (bool (*)(KernelFuture*)) wait_spec_program,
+    };
+    spec_program->arena = shd_new_arena();
+    // the caller's string might not outlive the specialisation
+    char* entry_point = shd_arena_alloc(spec_program->arena, strlen(key.entry_point) + 1);
+    strcpy(entry_point, key.entry_point);
+    key.entry_point = entry_point;
     spec_program->key = key;
     spec_program->device = device;
-    spec_program->specialized_module = key.base->module;
-    spec_program->arena = shd_new_arena();
-
-    CHECK(compile_specialized_program(spec_program), return NULL);
-    CHECK(extract_layout(spec_program),              return NULL);
-    CHECK(create_vk_pipeline(spec_program),          return NULL);
-    CHECK(allocate_sets(spec_program),               return NULL);
-    CHECK(prepare_resources(spec_program),           return NULL);
+    spec_program->state = SpecCompiling;
     return spec_program;
 }
 
-VkrSpecProgram* shd_rt_vk_get_specialized_program(Program* program, String entry_point, VkrDevice* device) {
+VkrSpecProgram* shd_rt_vk_prepare_specialized_program(Program* program, String entry_point, VkrDevice* device) {
     SpecProgramKey key = { .base = program, .entry_point = entry_point };
+    shd_mutex_lock(device->specialized_programs_mutex);
     VkrSpecProgram** found = shd_dict_find_value(SpecProgramKey, VkrSpecProgram*, device->specialized_programs, key);
-    if (found)
+    if (found) {
+        shd_mutex_unlock(device->specialized_programs_mutex);
         return *found;
+    }
     VkrSpecProgram* spec = create_specialized_program(key, device);
     assert(spec);
-    shd_dict_insert(SpecProgramKey, VkrSpecProgram*, device->specialized_programs, key, spec);
+    shd_dict_insert(SpecProgramKey, VkrSpecProgram*, device->specialized_programs, spec->key, spec);
+    shd_mutex_unlock(device->specialized_programs_mutex);
+
+    shd_thread_pool_submit(program->runtime->workers, (void (*)(void*)) compile_specialized_program_job, spec);
+    return spec;
+}
+
+VkrSpecProgram* shd_rt_vk_get_specialized_program(Program* program, String entry_point, VkrDevice* device) {
+    VkrSpecProgram* spec = shd_rt_vk_prepare_specialized_program(program, entry_point, device);
+    if (!wait_spec_program(spec))
+        return NULL;
     return spec;
 }
 
@@ -508,10 +532,6 @@ void shd_rt_vk_destroy_specialized_program(VkrSpecProgram* spec) {
         vkDestroyDescriptorSetLayout(spec->device->device, spec->set_layouts[set], NULL);
     vkDestroyPipelineLayout(spec->device->device, spec->layout, NULL);
     vkDestroyShaderModule(spec->device->device, spec->shader_module, NULL);
-    free( (void*) spec->parameters.arg_offset);
-    free(spec->spirv_bytes);
-    if (shd_module_get_arena(spec->specialized_module) != shd_module_get_arena(spec->key.base->module))
-        shd_destroy_ir_arena(shd_module_get_arena(spec->specialized_module));
     for (size_t i = 0; i < spec->resources.num_resources; i++) {
         ProgramResourceInfo* resource = spec->resources.resources[i];
         if (resource->buffer)
@@ -521,6 +541,8 @@ void shd_rt_vk_destroy_specialized_program(VkrSpecProgram* spec) {
     }
     free(spec->resources.resources);
     vkDestroyDescriptorPool(spec->device->device, spec->descriptor_pool, NULL);
+    if (spec->own_bundle)
+        shd_destroy_kernel_bundle(spec->own_bundle);
     shd_destroy_arena(spec->arena);
     free(spec);
 }
@@ -0,0 +1,367 @@
+#include "uniformity.h"
+
+#include "shady/ir/builtin.h"
+
+#include "list.h"
+#include "dict.h"
+#include "log.h"
+#include "portability.h"
+
+#include <stdlib.h>
+#include <assert.h>
+
+KeyHash shd_hash_node(const Node**);
+bool shd_compare_node(const Node**, const Node**);
+
+/// How values get to the params of a merge target, and the conditions of the branches taken since the construct was entered
+typedef struct {
+    Nodes args;
+    Nodes guards;
+} Edge;
+
+/// An abstraction whose params are only given values by structured control flow
+typedef struct {
+    /// @ref List of @ref Edge
+    struct List* incoming;
+    /// loop bodies only, @ref List of @ref Nodes: the guards of the breaks out of it. If the invocations don't all leave together,
+    /// those staying in the loop overwrite the params the others might still read afterwards.
+    struct List* exits;
+} MergeTarget;
+
+struct UniformityAnalysis_ {
+    /// from the abstractions to their @ref MergeTarget*
+    struct Dict* targets;
+    /// from the params of the function and of the targets to the @ref ShdScope they are (still thought to be) uniform over
+    struct Dict* params;
+    /// from values to their @ref ShdScope, only valid while params doesn't change
+    struct Dict* memo;
+    bool unstructured;
+};
+
+typedef struct {
+    /// the conditions of all the branches taken since the function was entered
+    Nodes guards;
+    const Node* selection;
+    size_t selection_guards;
+    const Node* loop;
+    size_t loop_guards;
+} WalkContext;
+
+static MergeTarget* get_target(UniformityAnalysis* analysis, const Node* abs) {
+    MergeTarget** found = shd_dict_find_value(const Node*, MergeTarget*, analysis->targets, abs);
+    if (found)
+        return *found;
+    MergeTarget* target = calloc(1, sizeof(MergeTarget));
+    target->incoming = shd_new_list(Edge);
+    target->exits = shd_new_list(Nodes);
+    shd_dict_insert(const Node*, MergeTarget*, analysis->targets, abs, target);
+    return target;
+}
+
+static Nodes guards_since(IrArena* a, WalkContext ctx, size_t start) {
+    return shd_nodes(a, ctx.guards.count - start, &ctx.guards.nodes[start]);
+}
+
+static void add_incoming(UniformityAnalysis* analysis, const Node* abs, Nodes args, Nodes guards) {
+    Edge edge = { .args = args, .guards = guards };
+    shd_list_append(Edge, get_target(analysis, abs)->incoming, edge);
+}
+
+static void walk(UniformityAnalysis* analysis, WalkContext ctx, const Node* abs);
+
+static void walk_case(UniformityAnalysis* analysis, WalkContext ctx, const Node* construct, const Node* selector, const Node* case_body) {
+    WalkContext case_ctx = ctx;
+    case_ctx.selection = construct;
+    case_ctx.selection_guards = ctx.guards.count;
+    // unless every invocation takes the same way, some of them might skip this case
+    case_ctx.guards = shd_nodes_append(construct->arena, ctx.guards, selector);
+    walk(analysis, case_ctx, case_body);
+}
+
+static void walk(UniformityAnalysis* analysis, WalkContext ctx, const Node* abs) {
+    IrArena* a = abs->arena;
+    const Node* terminator = get_abstraction_body(abs);
+    if (!terminator)
+        return;
+    switch (terminator->tag) {
+        case If_TAG: {
+            If payload = terminator->payload.if_instr;
+            get_target(analysis, payload.tail);
+            walk_case(analysis, ctx, terminator, payload.condition, payload.if_true);
+            if (payload.if_false)
+                walk_case(analysis, ctx, terminator, payload.condition, payload.if_false);
+            walk(analysis, ctx, payload.tail);
+            return;
+        }
+        case Match_TAG: {
+            Match payload = terminator->payload.match_instr;
+            get_target(analysis, payload.tail);
+            for (size_t i = 0; i < payload.cases.count; i++)
+                walk_case(analysis, ctx, terminator, payload.inspect, payload.cases.nodes[i]);
+            walk_case(analysis, ctx, terminator, payload.inspect, payload.default_case);
+            walk(analysis, ctx, payload.tail);
+            return;
+        }
+        case Loop_TAG: {
+            Loop payload = terminator->payload.loop_instr;
+            add_incoming(analysis, payload.body, payload.initial_args, shd_empty(a));
+            get_target(analysis, payload.tail);
+            WalkContext body_ctx = ctx;
+            body_ctx.loop = terminator;
+            body_ctx.loop_guards = ctx.guards.count;
+            body_ctx.selection = NULL;
+            walk(analysis, body_ctx, payload.body);
+            walk(analysis, ctx, payload.tail);
+            return;
+        }
+        case MergeSelection_TAG: {
+            assert(ctx.selection);
+            const Node* tail = ctx.selection->tag == If_TAG ? ctx.selection->payload.if_instr.tail : ctx.selection->payload.match_instr.tail;
+            add_incoming(analysis, tail, terminator->payload.merge_selection.args, guards_since(a, ctx, ctx.selection_guards));
+            return;
+        }
+        case MergeContinue_TAG: {
+            assert(ctx.loop);
+            add_incoming(analysis, ctx.loop->payload.loop_instr.body, terminator->payload.merge_continue.args, guards_since(a, ctx, ctx.loop_guards));
+            return;
+        }
+        case MergeBreak_TAG: {
+            assert(ctx.loop);
+            Loop loop = ctx.loop->payload.loop_instr;
+            Nodes guards = guards_since(a, ctx, ctx.loop_guards);
+            add_incoming(analysis, loop.tail, terminator->payload.merge_break.args, guards);
+            shd_list_append(Nodes, get_target(analysis, loop.body)->exits, guards);
+            return;
+        }
+        // the invocations leaving the function don't get to read anything anymore
+        case Return_TAG:
+        case Unreachable_TAG:
+            return;
+        default:
+            analysis->unstructured = true;
+            return;
+    }
+}
+
+static bool is_op_lane_invariant(Op op) {
+    if (shd_get_primop_class(op) & (OcArithmetic | OcLogic | OcCompare | OcShift | OcMath))
+        return true;
+    switch (op) {
+        case select_op:
+        case convert_op:
+        case reinterpret_op:
+        case extract_op:
+        case extract_dynamic_op:
+        case insert_op:
+        case shuffle_op: return true;
+        default: return false;
+    }
+}
+
+static ShdScope narrowest(ShdScope a, ShdScope b) {
+    return a < b ? a : b;
+}
+
+static ShdScope get_values_scope(UniformityAnalysis* analysis, Nodes values) {
+    ShdScope scope = ShdScopeWorkgroup;
+    for (size_t i = 0; i < values.count && scope > ShdScopeInvocation; i++)
+        scope = narrowest(scope, shd_get_value_scope(analysis, values.nodes[i]));
+    return scope;
+}
+
+static ShdScope get_builtin_scope(Builtin b) {
+    switch (b) {
+        case BuiltinWorkgroupId:
+        case BuiltinWorkgroupSize:
+        case BuiltinNumWorkgroups:
+        case BuiltinNumSubgroups:
+        case BuiltinSubgroupSize: return ShdScopeWorkgroup;
+        case BuiltinSubgroupId: return ShdScopeSubgroup;
+        default: return ShdScopeInvocation;
+    }
+}
+
+/// Nothing writes to those while a dispatch runs, so all the subgroups of a workgroup read the same thing out of them
+static bool is_addr_space_read_only(AddressSpace as) {
+    switch (as) {
+        case AsUInput:
+        case AsPushConstant:
+        case AsUniform:
+        case AsUniformConstant: return true;
+        default: return false;
+    }
+}
+
+/// Follows the rules of the type checker, only with what we know of the params
+static ShdScope compute_scope(UniformityAnalysis* analysis, const Node* value) {
+    switch (value->tag) {
+        case IntLiteral_TAG:
+        case FloatLiteral_TAG:
+        case StringLiteral_TAG:
+        case True_TAG:
+        case False_TAG:
+        case NullPtr_TAG:
+        case Undef_TAG:
+        case FnAddr_TAG: return ShdScopeWorkgroup;
+        case RefDecl_TAG: {
+            // every invocation has a variable of its own in those, even though they go by the same name
+            const Node* decl = value->payload.ref_decl.decl;
+            if (decl->tag == GlobalVariable_TAG && !shd_is_addr_space_uniform(value->arena, decl->payload.global_variable.address_space))
+                return ShdScopeInvocation;
+            return ShdScopeWorkgroup;
+        }
+        case Param_TAG: {
+            ShdScope* found = shd_dict_find_value(const Node*, ShdScope, analysis->params, value);
+            return found ? *found : ShdScopeInvocation;
+        }
+        case PrimOp_TAG: {
+            PrimOp payload = value->payload.prim_op;
+            if (!is_op_lane_invariant(payload.op))
+                return ShdScopeInvocation;
+            return get_values_scope(analysis, payload.operands);
+        }
+        case Load_TAG: {
+            Builtin b;
+            if (shd_is_builtin_load_op(value, &b))
+                return get_builtin_scope(b);
+            const Type* ptr_type = shd_get_unqualified_type(value->payload.load.ptr->type);
+            if (ptr_type->tag != PtrType_TAG || !shd_is_addr_space_uniform(value->arena, ptr_type->payload.ptr_type.address_space))
+                return ShdScopeInvocation;
+            ShdScope scope = shd_get_value_scope(analysis, value->payload.load.ptr);
+            // the subgroups of a workgroup don't run in lockstep, so they might see each other's stores between their loads
+            if (!is_addr_space_read_only(ptr_type->payload.ptr_type.address_space))
+                scope = narrowest(scope, ShdScopeSubgroup);
+            return scope;
+        }
+        case PtrArrayElementOffset_TAG:
+            return narrowest(shd_get_value_scope(analysis, value->payload.ptr_array_element_offset.ptr), shd_get_value_scope(analysis, value->payload.ptr_array_element_offset.offset));
+        case PtrCompositeElement_TAG:
+            return narrowest(shd_get_value_scope(analysis, value->payload.ptr_composite_element.ptr), shd_get_value_scope(analysis, value->payload.ptr_composite_element.index));
+        case Composite_TAG: return get_values_scope(analysis, value->payload.composite.contents);
+        case Fill_TAG: return shd_get_value_scope(analysis, value->payload.fill.value);
+        default: return ShdScopeInvocation;
+    }
+}
+
+ShdScope shd_get_value_scope(UniformityAnalysis* analysis, const Node* value) {
+    if (!value->type)
+        return ShdScopeInvocation;
+    ShdScope* found = shd_dict_find_value(const Node*, ShdScope, analysis->memo, value);
+    if (found)
+        return *found;
+    ShdScope scope = compute_scope(analysis, value);
+    if (scope < ShdScopeSubgroup && shd_is_qualified_type_uniform(value->type))
+        scope = ShdScopeSubgroup;
+    shd_dict_insert(const Node*, ShdScope, analysis->memo, value, scope);
+    return scope;
+}
+
+bool shd_is_value_uniform(UniformityAnalysis* analysis, const Node* value) {
+    return shd_get_value_scope(analysis, value) >= ShdScopeSubgroup;
+}
+
+static ShdScope get_exits_scope(UniformityAnalysis* analysis, MergeTarget* target) {
+    ShdScope scope = ShdScopeWorkgroup;
+    for (size_t k = 0; k < shd_list_count(target->exits); k++)
+        scope = narrowest(scope, get_values_scope(analysis, shd_read_list(Nodes, target->exits)[k]));
+    return scope;
+}
+
+ShdScope shd_get_branch_scope(UniformityAnalysis* analysis, const Node* terminator) {
+    switch (terminator->tag) {
+        case If_TAG: return shd_get_value_scope(analysis, terminator->payload.if_instr.condition);
+        case Match_TAG: return shd_get_value_scope(analysis, terminator->payload.match_instr.inspect);
+        case Branch_TAG: return shd_get_value_scope(analysis, terminator->payload.branch.condition);
+        case Switch_TAG: return shd_get_value_scope(analysis, terminator->payload.br_switch.switch_value);
+        case Loop_TAG: {
+            MergeTarget** found = shd_dict_find_value(const Node*, MergeTarget*, analysis->targets, terminator->payload.loop_instr.body);
+            if (!found || analysis->unstructured)
+                return ShdScopeInvocation;
+            return get_exits_scope(analysis, *found);
+        }
+        // there is only one way to go
+        default: return ShdScopeWorkgroup;
+    }
+}
+
+/// Starts from every param being uniform over the workgroup and narrows that down for those that get a divergent argument, until nothing changes
+static void solve(UniformityAnalysis* analysis) {
+    size_t i = 0;
+    const Node* abs;
+    MergeTarget* target;
+    while (shd_dict_iter(analysis->targets, &i, &abs, &target)) {
+        Nodes params = get_abstraction_params(abs);
+        for (size_t j = 0; j < params.count; j++) {
+            ShdScope scope = analysis->unstructured ? ShdScopeInvocation : ShdScopeWorkgroup;
+            shd_dict_insert(const Node*, ShdScope, analysis->params, params.nodes[j], scope);
+        }
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        shd_dict_clear(analysis->memo);
+        i = 0;
+        while (shd_dict_iter(analysis->targets, &i, &abs, &target)) {
+            Nodes params = get_abstraction_params(abs);
+            size_t incoming_count = shd_list_count(target->incoming);
+            Edge* incoming = shd_read_list(Edge, target->incoming);
+            ShdScope exits_scope = get_exits_scope(analysis, target);
+            for (size_t j = 0; j < params.count; j++) {
+                ShdScope* scope = shd_dict_find_value(const Node*, ShdScope, analysis->params, params.nodes[j]);
+                if (*scope == ShdScopeInvocation)
+                    continue;
+                ShdScope new_scope = narrowest(*scope, exits_scope);
+                for (size_t k = 0; k < incoming_count && new_scope > ShdScopeInvocation; k++) {
+                    assert(incoming[k].args.count == params.count);
+                    new_scope = narrowest(new_scope, get_values_scope(analysis, incoming[k].guards));
+                    new_scope = narrowest(new_scope, shd_get_value_scope(analysis, incoming[k].args.nodes[j]));
+                }
+                if (new_scope != *scope) {
+                    *scope = new_scope;
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
+static void seed_fn_params(UniformityAnalysis* analysis, const Node* fn) {
+    // the arguments of a dispatch are the same for all of it
+    bool is_entry_point = shd_lookup_annotation(fn, "EntryPoint");
+    Nodes params = get_abstraction_params(fn);
+    for (size_t i = 0; i < params.count; i++) {
+        ShdScope scope = is_entry_point ? ShdScopeWorkgroup : ShdScopeInvocation;
+        shd_dict_insert(const Node*, ShdScope, analysis->params, params.nodes[i], scope);
+    }
+}
+
+UniformityAnalysis* shd_new_uniformity_analysis(const Node* fn) {
+    assert(fn->tag == Function_TAG);
+    UniformityAnalysis* analysis = calloc(1, sizeof(UniformityAnalysis));
+    *analysis = (UniformityAnalysis) {
+        .targets = shd_new_dict(const Node*, MergeTarget*, (HashFn) shd_hash_node, (CmpFn) shd_compare_node),
+        .params = shd_new_dict(const Node*, ShdScope, (HashFn) shd_hash_node, (CmpFn) shd_compare_node),
+        .memo = shd_new_dict(const Node*, ShdScope, (HashFn) shd_hash_node, (CmpFn) shd_compare_node),
+    };
+    seed_fn_params(analysis, fn);
+    if (fn->payload.fun.body) {
+        walk(analysis, (WalkContext) { 0 }, fn);
+        solve(analysis);
+    }
+    return analysis;
+}
+
+void shd_destroy_uniformity_analysis(UniformityAnalysis* analysis) {
+    size_t i = 0;
+    MergeTarget* target;
+    while (shd_dict_iter(analysis->targets, &i, NULL, &target)) {
+        shd_destroy_list(target->incoming);
+        shd_destroy_list(target->exits);
+        free(target);
+    }
+    shd_destroy_dict(analysis->targets);
+    shd_destroy_dict(analysis->params);
+    shd_destroy_dict(analysis->memo);
+    free(analysis);
+}
@@ -0,0 +1,35 @@
+#ifndef SHADY_UNIFORMITY_H
+#define SHADY_UNIFORMITY_H
+
+#include "shady/ir.h"
+
+/// How many invocations are known to agree on a value, from the narrowest to the widest.
+typedef enum {
+    /// Nothing is known, the value might differ from one invocation to the next
+    ShdScopeInvocation,
+    /// The same for all the invocations of a subgroup, which is what the `uniform` qualifier of types stands for
+    ShdScopeSubgroup,
+    /// The same for all the invocations of a workgroup, such as the workgroup id or the kernel arguments
+    ShdScopeWorkgroup,
+} ShdScope;
+
+/// Tells which values of a function are the same for all the invocations of a subgroup, or of a workgroup, that compute them,
+/// beyond what their types say. Builtins and entry point arguments seed the workgroup scope, the qualifiers of types the subgroup one.
+/// The params of structured control flow constructs are uniform when all their arguments are, and when the invocations that reach the
+/// construct pass them together, which the type checker alone cannot see: loop counters for instance start out uniform and stay so.
+/// Only structured control flow is understood, functions using anything else get nothing more than their types and seeds.
+typedef struct UniformityAnalysis_ UniformityAnalysis;
+
+UniformityAnalysis* shd_new_uniformity_analysis(const Node* fn);
+void shd_destroy_uniformity_analysis(UniformityAnalysis* analysis);
+
+/// The widest scope over which the value is known to be the same
+ShdScope shd_get_value_scope(UniformityAnalysis* analysis, const Node* value);
+/// The widest scope over which the invocations reaching the terminator are known to take the same way out of it.
+/// For loops, this is about them leaving the loop on the same iteration.
+ShdScope shd_get_branch_scope(UniformityAnalysis* analysis, const Node* terminator);
+
+/// Same as the value's scope being at least @ref ShdScopeSubgroup
+bool shd_is_value_uniform(UniformityAnalysis* analysis, const Node* value);
+
+#endif
@@ -0,0 +1,116 @@
+#include "shady/pass.h"
+
+#include "../analysis/uniformity.h"
+
+#include "dict.h"
+#include "portability.h"
+#include "log.h"
+
+typedef struct {
+    Rewriter rewriter;
+    UniformityAnalysis* uniformity;
+    struct Dict* loop_bodies;
+    /// the rewritten body of the innermost loop, whose params the continues inside it pass values to
+    const Node* loop_body;
+} Context;
+
+/// The analysis only finds a param uniform if all its arguments are, but those can still be typed varying: the params need them retyped too.
+static Nodes match_params_uniformity(IrArena* a, Nodes args, Nodes params) {
+    LARRAY(const Node*, nargs, args.count);
+    for (size_t i = 0; i < args.count; i++) {
+        nargs[i] = args.nodes[i];
+        if (shd_is_qualified_type_uniform(params.nodes[i]->type) && !shd_is_qualified_type_uniform(args.nodes[i]->type))
+            nargs[i] = prim_op_helper(a, subgroup_assume_uniform_op, shd_empty(a), shd_singleton(args.nodes[i]));
+    }
+    return shd_nodes(a, args.count, nargs);
+}
+
+/// Only the params of loop bodies are retyped: the tails of the other constructs get their types from the yield types, which are always varying.
+static const Node* process_loop_body(Context* ctx, const Node* node) {
+    IrArena* a = ctx->rewriter.dst_arena;
+    Nodes old_params = get_abstraction_params(node);
+    LARRAY(const Node*, new_params, old_params.count);
+    for (size_t i = 0; i < old_params.count; i++) {
+        const Node* old_param = old_params.nodes[i];
+        new_params[i] = shd_recreate_param(&ctx->rewriter, old_param);
+        if (!shd_is_qualified_type_uniform(old_param->type) && shd_is_value_uniform(ctx->uniformity, old_param)) {
+            const Type* t = shd_get_unqualified_type(new_params[i]->type);
+            new_params[i] = param(a, shd_as_qualified_type(t, true), old_param->payload.param.name);
+            shd_debugv_print("Loop parameter ");
+            shd_log_node(DEBUGV, old_param);
+            shd_debugv_print(" is uniform.\n");
+        }
+        shd_register_processed(&ctx->rewriter, old_param, new_params[i]);
+    }
+    Node* new = basic_block(a, shd_nodes(a, old_params.count, new_params), shd_get_abstraction_name_unsafe(node));
+    shd_register_processed(&ctx->rewriter, node, new);
+    Context body_ctx = *ctx;
+    body_ctx.loop_body = new;
+    shd_set_abstraction_body(new, shd_rewrite_node(&body_ctx.rewriter, get_abstraction_body(node)));
+    return new;
+}
+
+static const Node* process(Context* ctx, const Node* node) {
+    IrArena* a = ctx->rewriter.dst_arena;
+    switch (node->tag) {
+        case Function_TAG: {
+            Context fn_ctx = *ctx;
+            fn_ctx.uniformity = shd_new_uniformity_analysis(node);
+            fn_ctx.loop_body = NULL;
+            Node* new = shd_recreate_node_head(&fn_ctx.rewriter, node);
+            shd_recreate_node_body(&fn_ctx.rewriter, node, new);
+            shd_destroy_uniformity_analysis(fn_ctx.uniformity);
+            return new;
+        }
+        case Loop_TAG: {
+            Loop payload = node->payload.loop_instr;
+            shd_set_insert_get_result(const Node*, ctx->loop_bodies, payload.body);
+            if (!ctx->uniformity)
+                break;
+            const Node* mem = shd_rewrite_node(&ctx->rewriter, payload.mem);
+            Nodes initial_args = shd_rewrite_nodes(&ctx->rewriter, payload.initial_args);
+            const Node* body = shd_rewrite_node(&ctx->rewriter, payload.body);
+            return loop_instr(a, (Loop) {
+                .mem = mem,
+                .yield_types = shd_rewrite_nodes(&ctx->rewriter, payload.yield_types),
+                .initial_args = match_params_uniformity(a, initial_args, get_abstraction_params(body)),
+                .body = body,
+                .tail = shd_rewrite_node(&ctx->rewriter, payload.tail),
+            });
+        }
+        case MergeContinue_TAG: {
+            if (!ctx->loop_body)
+                break;
+            MergeContinue payload = node->payload.merge_continue;
+            const Node* mem = shd_rewrite_node(&ctx->rewriter, payload.mem);
+            return merge_continue(a, (MergeContinue) {
+                .mem = mem,
+                .args = match_params_uniformity(a, shd_rewrite_nodes(&ctx->rewriter, payload.args), get_abstraction_params(ctx->loop_body)),
+            });
+        }
+        case BasicBlock_TAG: {
+            if (ctx->uniformity && shd_dict_find_key(const Node*, ctx->loop_bodies, node))
+                return process_loop_body(ctx, node);
+            break;
+        }
+        default: break;
+    }
+    return shd_recreate_node(&ctx->rewriter, node);
+}
+
+KeyHash shd_hash_node(Node** pnode);
+bool shd_compare_node(Node** pa, Node** pb);
+
+Module* shd_pass_infer_uniformity(SHADY_UNUSED const CompilerConfig* config, Module* src) {
+    ArenaConfig aconfig = *shd_get_arena_config(shd_module_get_arena(src));
+    IrArena* a = shd_new_ir_arena(&aconfig);
+    Module* dst = shd_new_module(a, shd_module_get_name(src));
+    Context ctx = {
+        .rewriter = shd_create_node_rewriter(src, dst, (RewriteNodeFn) process),
+        .loop_bodies = shd_new_set(const Node*, (HashFn) shd_hash_node, (CmpFn) shd_compare_node),
+    };
+    shd_rewrite_module(&ctx.rewriter);
+    shd_destroy_dict(ctx.loop_bodies);
+    shd_destroy_rewriter(&ctx.rewriter);
+    return dst;
+}
@@ -1,5 +1,8 @@
 #include "shady/pass.h"
 #include "shady/ir/type.h"
+#include "shady/ir/ext.h"
+#include "shady/ir/builtin.h"
+#include "shady/ir/builder.h"
 
 #include "log.h"
 #include "portability.h"
@@ -10,10 +13,12 @@
 
 typedef struct {
     Rewriter rewriter;
+    const CompilerConfig* config;
 } Context;
 
 typedef struct {
     SpvOp spv_op;
+    /// PRIMOPS_COUNT when there is no scalar equivalent to emulate the scan with
     Op scalar;
     const Node* (*I)(IrArena*, const Type* t);
 } GroupOp;
@@ -51,7 +56,7 @@ static GroupOp group_operations[] = {
     { SpvOpGroupFMax, max_op, },
     { SpvOpGroupUMax, max_op },
     { SpvOpGroupSMax, max_op },
-    { SpvOpGroupNonUniformBallotBitCount, /* todo */ },
+    { SpvOpGroupNonUniformBallotBitCount, PRIMOPS_COUNT /* todo */ },
     { SpvOpGroupNonUniformIAdd, add_op },
     { SpvOpGroupNonUniformFAdd, add_op },
     { SpvOpGroupNonUniformIMul, mul_op },
@@ -68,28 +73,55 @@ static GroupOp group_operations[] = {
     { SpvOpGroupNonUniformLogicalAnd, and_op },
     { SpvOpGroupNonUniformLogicalOr, or_op },
     { SpvOpGroupNonUniformLogicalXor, xor_op },
-    { SpvOpGroupIAddNonUniformAMD, /* todo: map to std */ },
-    { SpvOpGroupFAddNonUniformAMD, /* todo: map to std */ },
-    { SpvOpGroupFMinNonUniformAMD, /* todo: map to std */ },
-    { SpvOpGroupUMinNonUniformAMD, /* todo: map to std */ },
-    { SpvOpGroupSMinNonUniformAMD, /* todo: map to std */ },
-    { SpvOpGroupFMaxNonUniformAMD, /* todo: map to std */ },
-    { SpvOpGroupUMaxNonUniformAMD, /* todo: map to std */ },
-    { SpvOpGroupSMaxNonUniformAMD, /* todo: map to std */ },
-    { SpvOpGroupIMulKHR, /* todo: map to std */ },
-    { SpvOpGroupFMulKHR, /* todo: map to std */ },
-    { SpvOpGroupBitwiseAndKHR, /* todo: map to std */ },
-    { SpvOpGroupBitwiseOrKHR, /* todo: map to std */ },
-    { SpvOpGroupBitwiseXorKHR, /* todo: map to std */ },
-    { SpvOpGroupLogicalAndKHR, /* todo: map to std */ },
-    { SpvOpGroupLogicalOrKHR, /* todo: map to std */ },
-    { SpvOpGroupLogicalXorKHR, /* todo: map to std */ },
+    { SpvOpGroupIAddNonUniformAMD, PRIMOPS_COUNT /* todo: map to std */ },
+    { SpvOpGroupFAddNonUniformAMD, PRIMOPS_COUNT /* todo: map to std */ },
+    { SpvOpGroupFMinNonUniformAMD, PRIMOPS_COUNT /* todo: map to std */ },
+    { SpvOpGroupUMinNonUniformAMD, PRIMOPS_COUNT /* todo: map to std */ },
+    { SpvOpGroupSMinNonUniformAMD, PRIMOPS_COUNT /* todo: map to std */ },
+    { SpvOpGroupFMaxNonUniformAMD, PRIMOPS_COUNT /* todo: map to std */ },
+    { SpvOpGroupUMaxNonUniformAMD, PRIMOPS_COUNT /* todo: map to std */ },
+    { SpvOpGroupSMaxNonUniformAMD, PRIMOPS_COUNT /* todo: map to std */ },
+    { SpvOpGroupIMulKHR, PRIMOPS_COUNT /* todo: map to std */ },
+    { SpvOpGroupFMulKHR, PRIMOPS_COUNT /* todo: map to std */ },
+    { SpvOpGroupBitwiseAndKHR, PRIMOPS_COUNT /* todo: map to std */ },
+    { SpvOpGroupBitwiseOrKHR, PRIMOPS_COUNT /* todo: map to std */ },
+    { SpvOpGroupBitwiseXorKHR, PRIMOPS_COUNT /* todo: map to std */ },
+    { SpvOpGroupLogicalAndKHR, PRIMOPS_COUNT /* todo: map to std */ },
+    { SpvOpGroupLogicalOrKHR, PRIMOPS_COUNT /* todo: map to std */ },
+    { SpvOpGroupLogicalXorKHR, PRIMOPS_COUNT /* todo: map to std */ },
 };
 
 enum {
     NumGroupOps = sizeof(group_operations) / sizeof(group_operations[0])
 };
 
+/// ISPC's standard library only has exclusive scans for additions and bitwise ands and ors
+static bool has_exclusive_scan(SpvOp op) {
+    switch (op) {
+        case SpvOpGroupIAdd:
+        case SpvOpGroupFAdd:
+        case SpvOpGroupNonUniformIAdd:
+        case SpvOpGroupNonUniformFAdd:
+        case SpvOpGroupNonUniformBitwiseAnd:
+        case SpvOpGroupNonUniformBitwiseOr: return true;
+        default: return false;
+    }
+}
+
+/// Hillis-Steele scan: log2(subgroup size) rounds, where every invocation combines its value with the one `offset` lanes below
+static const Node* emulate_inclusive_scan(Context* ctx, BodyBuilder* bb, const GroupOp* op, const Node* scope, const Node* value) {
+    IrArena* a = ctx->rewriter.dst_arena;
+    const Type* t = shd_get_unqualified_type(value->type);
+    const Node* lane = shd_bld_builtin_load(ctx->rewriter.dst_module, bb, BuiltinSubgroupLocalInvocationId);
+    for (uint32_t offset = 1; offset < ctx->config->specialization.subgroup_size; offset *= 2) {
+        const Node* below = shd_bld_ext_instruction(bb, "spirv.core", SpvOpGroupNonUniformShuffleUp, shd_as_qualified_type(t, false), mk_nodes(a, scope, value, shd_uint32_literal(a, offset)));
+        const Node* combined = prim_op_helper(a, op->scalar, shd_empty(a), mk_nodes(a, value, below));
+        const Node* has_below = prim_op_helper(a, gte_op, shd_empty(a), mk_nodes(a, lane, shd_uint32_literal(a, offset)));
+        value = prim_op_helper(a, select_op, shd_empty(a), mk_nodes(a, has_below, combined, value));
+    }
+    return value;
+}
+
 static const Node* process(Context* ctx, const Node* node) {
     Rewriter* r = &ctx->rewriter;
     IrArena* a = r->dst_arena;
@@ -100,13 +132,21 @@ static const Node* process(Context* ctx, const Node* node) {
                 for (size_t i = 0; i < NumGroupOps; i++) {
                     if (payload.opcode == group_operations[i].spv_op) {
                         if (shd_get_int_value(payload.operands.nodes[1], false) == SpvGroupOperationInclusiveScan) {
-                            //assert(group_operations[i].I);
                             IrArena* oa = node->arena;
-                            payload.operands = shd_change_node_at_index(oa, payload.operands, 1, shd_uint32_literal(a, SpvGroupOperationReduce));
-                            const Node* new = shd_recreate_node(r, ext_instr(oa, payload));
-                            // new = prim_op_helper(a, group_operations[i].scalar, shd_empty(a), mk_nodes(a, new, group_operations[i].I(a, new->type) ));
-                            new = prim_op_helper(a, group_operations[i].scalar, shd_empty(a), mk_nodes(a, new, shd_recreate_node(r, payload.operands.nodes[2]) ));
-                            return new;
+                            if (has_exclusive_scan(payload.opcode)) {
+                                payload.operands = shd_change_node_at_index(oa, payload.operands, 1, shd_uint32_literal(a, SpvGroupOperationExclusiveScan));
+                                const Node* new = shd_recreate_node(r, ext_instr(oa, payload));
+                                return prim_op_helper(a, group_operations[i].scalar, shd_empty(a), mk_nodes(a, new, shd_recreate_node(r, payload.operands.nodes[2]) ));
+                            }
+
+                            const IntLiteral* scope = shd_resolve_to_int_literal(payload.operands.nodes[0]);
+                            if (group_operations[i].scalar == PRIMOPS_COUNT || !scope || scope->value != SpvScopeSubgroup) {
+                                shd_log_fmt(ERROR, "Inclusive scans with opcode %d are not supported by ISPC, nor can they be emulated with subgroup shuffles.\n", payload.opcode);
+                                shd_error_die();
+                            }
+                            BodyBuilder* bb = shd_bld_begin(a, shd_rewrite_node(r, payload.mem));
+                            const Node* scanned = emulate_inclusive_scan(ctx, bb, &group_operations[i], shd_rewrite_node(r, payload.operands.nodes[0]), shd_rewrite_node(r, payload.operands.nodes[2]));
+                            return shd_bld_to_instr_yield_values(bb, shd_singleton(scanned));
                         }
                     }
                 }
@@ -122,12 +162,14 @@ static const Node* process(Context* ctx, const Node* node) {
 /// SpvOpGroupXXX(Scope, 'GroupOperationInclusiveScan', v)
 /// into
 /// SpvOpGroupXXX(Scope, 'GroupOperationExclusiveScan', v) op v
-Module* shd_pass_lower_inclusive_scan(SHADY_UNUSED const CompilerConfig* config, Module* src) {
+/// or, for the operations without an exclusive scan, into a scan made of subgroup shuffles
+Module* shd_pass_lower_inclusive_scan(const CompilerConfig* config, Module* src) {
     ArenaConfig aconfig = *shd_get_arena_config(shd_module_get_arena(src));
     IrArena* a = shd_new_ir_arena(&aconfig);
     Module* dst = shd_new_module(a, shd_module_get_name(src));
     Context ctx = {
         .rewriter = shd_create_node_rewriter(src, dst, (RewriteNodeFn) process),
+        .config = config,
     };
     shd_rewrite_module(&ctx.rewriter);
     shd_destroy_rewriter(&ctx.rewriter);
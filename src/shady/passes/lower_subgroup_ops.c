@@ -6,6 +6,8 @@
 #include "shady/ir/composite.h"
 #include "shady/ir/function.h"
 
+#include "../analysis/uniformity.h"
+
 #include "portability.h"
 #include "log.h"
 #include "dict.h"
@@ -18,6 +20,7 @@ typedef struct {
     Rewriter rewriter;
     const CompilerConfig* config;
     struct Dict* fns;
+    UniformityAnalysis* uniformity;
 } Context;
 
 static bool is_extended_type(SHADY_UNUSED IrArena* a, const Type* t, bool allow_vectors) {
@@ -130,14 +133,42 @@ static const Node* build_subgroup_first(Context* ctx, BodyBuilder* bb, const Nod
     return shd_first(shd_bld_call(bb, fn_addr_helper(a, fn), shd_singleton(src)));
 }
 
+/// Whether all the invocations in the scope of the (old) operation already agree on the value
+static bool is_already_uniform(Context* ctx, const Node* scope, const Node* value) {
+    if (!ctx->uniformity)
+        return false;
+    const IntLiteral* lit = shd_resolve_to_int_literal(scope);
+    if (!lit)
+        return false;
+    switch (lit->value) {
+        // a subgroup of one invocation, like the CPU targets run them, has nobody to disagree with
+        case SpvScopeSubgroup: return ctx->config->specialization.subgroup_size == 1 || shd_get_value_scope(ctx->uniformity, value) >= ShdScopeSubgroup;
+        case SpvScopeWorkgroup: return shd_get_value_scope(ctx->uniformity, value) >= ShdScopeWorkgroup;
+        default: return false;
+    }
+}
+
 static const Node* process(Context* ctx, const Node* node) {
     IrArena* a = ctx->rewriter.dst_arena;
     Rewriter* r = &ctx->rewriter;
     switch (node->tag) {
+        case Function_TAG: {
+            Context fn_ctx = *ctx;
+            fn_ctx.uniformity = shd_new_uniformity_analysis(node);
+            Node* new = shd_recreate_node_head(&fn_ctx.rewriter, node);
+            shd_recreate_node_body(&fn_ctx.rewriter, node, new);
+            shd_destroy_uniformity_analysis(fn_ctx.uniformity);
+            return new;
+        }
         case ExtInstr_TAG: {
             ExtInstr payload = node->payload.ext_instr;
             if (strcmp(payload.set, "spirv.core") == 0 && payload.opcode == SpvOpGroupNonUniformBroadcastFirst) {
                 BodyBuilder* bb = shd_bld_begin(a, shd_rewrite_node(r, payload.mem));
+                // nothing to broadcast, the type just needs to say so
+                if (is_already_uniform(ctx, payload.operands.nodes[0], payload.operands.nodes[1])) {
+                    const Node* value = shd_rewrite_node(r, payload.operands.nodes[1]);
+                    return shd_bld_to_instr_yield_values(bb, shd_singleton(prim_op_helper(a, subgroup_assume_uniform_op, shd_empty(a), shd_singleton(value))));
+                }
                 return shd_bld_to_instr_yield_values(bb, shd_singleton(
                     build_subgroup_first(ctx, bb, shd_rewrite_node(r, payload.operands.nodes[0]), shd_rewrite_node(r, payload.operands.nodes[1]))));
             }
@@ -8,6 +8,8 @@
 typedef struct {
     Rewriter rewriter;
     const CompilerConfig* config;
+    /// keeps the packs that C vector extensions can hold, see shd_pass_lower_vec_arr_partial
+    bool keep_native_vectors;
 } Context;
 
 static const Node* scalarify_primop(Context* ctx, const Node* old) {
@@ -19,12 +21,26 @@ static const Node* scalarify_primop(Context* ctx, const Node* old) {
         return shd_recreate_node(&ctx->rewriter, old);
     LARRAY(const Node*, elements, width);
     BodyBuilder* bb = shd_bld_begin_pure(a);
-    Nodes noperands = shd_rewrite_nodes(&ctx->rewriter, old->payload.prim_op.operands);
+    Nodes operands = old->payload.prim_op.operands;
+    Nodes noperands = shd_rewrite_nodes(&ctx->rewriter, operands);
+    // conversions are told the packed type they convert to
+    Nodes type_arguments = old->payload.prim_op.type_arguments;
+    LARRAY(const Type*, ntype_arguments, type_arguments.count);
+    for (size_t j = 0; j < type_arguments.count; j++) {
+        const Type* t = type_arguments.nodes[j];
+        shd_deconstruct_maybe_packed_type(&t);
+        ntype_arguments[j] = shd_rewrite_node(&ctx->rewriter, t);
+    }
     for (size_t i = 0; i < width; i++) {
         LARRAY(const Node*, nops, noperands.count);
-        for (size_t j = 0; j < noperands.count; j++)
-            nops[j] = shd_extract_helper(a, noperands.nodes[j], shd_singleton(shd_int32_literal(a, i)));
-        elements[i] = prim_op_helper(a, old->payload.prim_op.op, shd_empty(a), shd_nodes(a, noperands.count, nops));
+        for (size_t j = 0; j < noperands.count; j++) {
+            // scalar operands, like the condition of a select, apply to every lane
+            if (shd_get_unqualified_type(operands.nodes[j]->type)->tag == PackType_TAG)
+                nops[j] = shd_extract_helper(a, noperands.nodes[j], shd_singleton(shd_int32_literal(a, i)));
+            else
+                nops[j] = noperands.nodes[j];
+        }
+        elements[i] = prim_op_helper(a, old->payload.prim_op.op, shd_nodes(a, type_arguments.count, ntype_arguments), shd_nodes(a, noperands.count, nops));
     }
     const Type* t = arr_type(a, (ArrType) {
         .element_type = shd_rewrite_node(&ctx->rewriter, dst_type),
@@ -33,18 +49,94 @@ static const Node* scalarify_primop(Context* ctx, const Node* old) {
     return shd_bld_to_instr_yield_values(bb, shd_singleton(composite_helper(a, t, shd_nodes(a, width, elements))));
 }
 
+/// Vector extensions only hold integers and floats, in counts that are powers of two
+static bool is_native_vector(const Type* t) {
+    if (t->tag != PackType_TAG)
+        return false;
+    size_t width = t->payload.pack_type.width;
+    NodeTag element = t->payload.pack_type.element_type->tag;
+    return (element == Int_TAG || element == Float_TAG) && width >= 2 && (width & (width - 1)) == 0;
+}
+
+static bool is_native_operand(const Node* operand) {
+    const Type* t = shd_get_unqualified_type(operand->type);
+    return t->tag != PackType_TAG || is_native_vector(t);
+}
+
+/// Whether the C emitter can apply the operation to vector extension types directly
+static bool is_natively_vectorised(const Node* old) {
+    PrimOp payload = old->payload.prim_op;
+    const Type* t = shd_get_unqualified_type(old->type);
+    if (!is_native_vector(t))
+        return false;
+    for (size_t i = 0; i < payload.operands.count; i++) {
+        if (!is_native_operand(payload.operands.nodes[i]))
+            return false;
+    }
+    switch (payload.op) {
+        case add_op: case sub_op: case mul_op: case div_op: case neg_op:
+        case and_op: case or_op: case xor_op:
+        case lshift_op: case rshift_arithm_op: case rshift_logical_op:
+        case convert_op: case reinterpret_op:
+            return true;
+        // a packed condition would need a mask, a uniform one is a plain ternary
+        case select_op: return shd_get_unqualified_type(shd_first(payload.operands)->type)->tag != PackType_TAG;
+        // `%` takes integer vectors only, and fmaf has no vector overload: floats go one lane at a time
+        case mod_op: return t->payload.pack_type.element_type->tag == Int_TAG;
+        default: return false;
+    }
+}
+
+/// __builtin_shufflevector wants both sides to have the same vector type
+static bool is_native_shuffle(const Node* old) {
+    Nodes operands = old->payload.prim_op.operands;
+    const Type* lhs = shd_get_unqualified_type(operands.nodes[0]->type);
+    const Type* rhs = shd_get_unqualified_type(operands.nodes[1]->type);
+    return is_native_vector(shd_get_unqualified_type(old->type)) && is_native_vector(lhs) && lhs == rhs;
+}
+
+static const Node* lower_shuffle(Context* ctx, const Node* old) {
+    IrArena* a = ctx->rewriter.dst_arena;
+    Nodes operands = old->payload.prim_op.operands;
+    const Node* lhs = shd_rewrite_node(&ctx->rewriter, operands.nodes[0]);
+    const Node* rhs = shd_rewrite_node(&ctx->rewriter, operands.nodes[1]);
+    size_t left_width = shd_get_unqualified_type(operands.nodes[0]->type)->payload.pack_type.width;
+    size_t width = operands.count - 2;
+    LARRAY(const Node*, elements, width);
+    for (size_t i = 0; i < width; i++) {
+        size_t selector = shd_get_int_literal_value(*shd_resolve_to_int_literal(operands.nodes[i + 2]), false);
+        if (selector < left_width)
+            elements[i] = shd_extract_helper(a, lhs, shd_singleton(shd_int32_literal(a, selector)));
+        else
+            elements[i] = shd_extract_helper(a, rhs, shd_singleton(shd_int32_literal(a, selector - left_width)));
+    }
+    const Type* t = shd_rewrite_node(&ctx->rewriter, shd_get_unqualified_type(old->type));
+    return composite_helper(a, t, shd_nodes(a, width, elements));
+}
+
 static const Node* process(Context* ctx, const Node* node) {
     IrArena* a = ctx->rewriter.dst_arena;
 
     switch (node->tag) {
         case PackType_TAG: {
+            if (ctx->keep_native_vectors && is_native_vector(node))
+                break;
             return arr_type(a, (ArrType) {
                 .element_type = shd_rewrite_node(&ctx->rewriter, node->payload.pack_type.element_type),
                 .size = shd_int32_literal(a, node->payload.pack_type.width)
             });
         }
         case PrimOp_TAG: {
-            if (shd_get_primop_class(node->payload.prim_op.op) & (OcArithmetic | OcLogic | OcCompare | OcShift | OcMath))
+            Op op = node->payload.prim_op.op;
+            if (ctx->keep_native_vectors) {
+                if (is_natively_vectorised(node))
+                    break;
+                if (op == shuffle_op && !is_native_shuffle(node))
+                    return lower_shuffle(ctx, node);
+                if (op == select_op || op == convert_op)
+                    return scalarify_primop(ctx, node);
+            }
+            if (shd_get_primop_class(op) & (OcArithmetic | OcLogic | OcCompare | OcShift | OcMath))
                 return scalarify_primop(ctx, node);
         }
         default: break;
@@ -53,7 +145,7 @@ static const Node* process(Context* ctx, const Node* node) {
     return shd_recreate_node(&ctx->rewriter, node);
 }
 
-Module* shd_pass_lower_vec_arr(const CompilerConfig* config, Module* src) {
+static Module* lower_vec_arr(const CompilerConfig* config, Module* src, bool keep_native_vectors) {
     ArenaConfig aconfig = *shd_get_arena_config(shd_module_get_arena(src));
     aconfig.validate_builtin_types = false; // TODO: hacky
     IrArena* a = shd_new_ir_arena(&aconfig);
@@ -61,8 +153,17 @@ Module* shd_pass_lower_vec_arr(const CompilerConfig* config, Module* src) {
     Context ctx = {
         .rewriter = shd_create_node_rewriter(src, dst, (RewriteNodeFn) process),
         .config = config,
+        .keep_native_vectors = keep_native_vectors,
     };
     shd_rewrite_module(&ctx.rewriter);
     shd_destroy_rewriter(&ctx.rewriter);
     return dst;
 }
+
+Module* shd_pass_lower_vec_arr(const CompilerConfig* config, Module* src) {
+    return lower_vec_arr(config, src, false);
+}
+
+Module* shd_pass_lower_vec_arr_partial(const CompilerConfig* config, Module* src) {
+    return lower_vec_arr(config, src, true);
+}
@@ -89,6 +89,8 @@ RewritePass shd_pass_lower_mask;
 /// Emulates unsupported integer datatypes and operations
 RewritePass shd_pass_lower_int;
 RewritePass shd_pass_lower_vec_arr;
+/// Only lowers the packs and operations that GCC/Clang vector extensions cannot express: booleans, odd widths, comparisons and maths
+RewritePass shd_pass_lower_vec_arr_partial;
 RewritePass shd_pass_lower_workgroups;
 RewritePass shd_pass_lower_fill;
 RewritePass shd_pass_lower_nullptr;
@@ -105,6 +107,8 @@ RewritePass shd_pass_eliminate_constants;
 RewritePass shd_pass_eliminate_inlineable_constants;
 /// Tags all functions that don't need special handling
 RewritePass shd_pass_mark_leaf_functions;
+/// Gives uniform types to the loop parameters the uniformity analysis proves uniform, and so to everything computed from them
+RewritePass shd_pass_infer_uniformity;
 /// In addition, also inlines function calls according to heuristics
 RewritePass shd_pass_inline;
 OptPass shd_opt_mem2reg;
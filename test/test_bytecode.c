@@ -0,0 +1,149 @@
+#include "shady/ir.h"
+#include "shady/driver.h"
+#include "shady/be/bytecode.h"
+
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHECK(x, failure_handler) { if (!(x)) { shd_error_print(#x " failed\n"); failure_handler; } }
+
+static const char* kernel_src =
+    "@Builtin(\"GlobalInvocationId\")\n"
+    "var uniform input pack[u32; 3] global_id;\n"
+    "\n"
+    "fn fib varying u32(varying u32 n) {\n"
+    "  if (n <= u32 1) { return (u32 1); }\n"
+    "  return (fib(n - u32 1) + fib(n - u32 2));\n"
+    "}\n"
+    "\n"
+    "@EntryPoint(\"Compute\") @Exported @WorkgroupSize(4, 1, 1) fn main(uniform ptr global [u32] out, uniform u32 bias) {\n"
+    "    val thread_id = global_id;\n"
+    "    val x = thread_id#0;\n"
+    "    val i = reinterpret[i32](x);\n"
+    "    if ((x % u32 2) == u32 0) {\n"
+    "        *out#(i) = fib(x) + bias;\n"
+    "    } else {\n"
+    "        *out#(i) = x * x;\n"
+    "    }\n"
+    "    return ();\n"
+    "}\n";
+
+/// Each invocation reads what its neighbour stored in shared memory, which the interpreter only gets right by switching invocations at the barrier
+static const char* shared_kernel_src =
+    "@Builtin(\"GlobalInvocationId\")\n"
+    "var uniform input pack[u32; 3] global_id;\n"
+    "@Builtin(\"LocalInvocationId\")\n"
+    "var input pack[u32; 3] local_id;\n"
+    "\n"
+    "var shared [u32; 4] tile;\n"
+    "\n"
+    "@EntryPoint(\"Compute\") @Exported @WorkgroupSize(4, 1, 1) fn main(uniform ptr global [u32] out) {\n"
+    "    val thread_id = global_id;\n"
+    "    val x = thread_id#0;\n"
+    "    val local = local_id;\n"
+    "    val lx = local#0;\n"
+    "    tile#(reinterpret[i32](lx)) = x * u32 3;\n"
+    "    ext_instr[\"spirv.core\", 224, uniform struct {}](u32 2, u32 2, u32 264);\n"
+    "    val neighbour = reinterpret[i32]((lx + u32 1) % u32 4);\n"
+    "    *out#(reinterpret[i32](x)) = tile#(neighbour);\n"
+    "    return ();\n"
+    "}\n";
+
+/// Every invocation must find the private variable as initialised, not as the invocation before it left it
+static const char* private_kernel_src =
+    "@Builtin(\"GlobalInvocationId\")\n"
+    "var uniform input pack[u32; 3] global_id;\n"
+    "\n"
+    "var private u32 counter = u32 5;\n"
+    "\n"
+    "@EntryPoint(\"Compute\") @Exported @WorkgroupSize(4, 1, 1) fn main(uniform ptr global [u32] out) {\n"
+    "    val thread_id = global_id;\n"
+    "    val x = thread_id#0;\n"
+    "    counter = counter + x;\n"
+    "    *out#(reinterpret[i32](x)) = counter;\n"
+    "    return ();\n"
+    "}\n";
+
+static uint32_t fib(uint32_t n) {
+    return n <= 1 ? 1 : fib(n - 1) + fib(n - 2);
+}
+
+enum { Workgroups = 3, Invocations = Workgroups * 4 };
+
+static void run_kernel(CompilerConfig* config, const char* name, const char* src, void* kernel_args[], uint32_t out[Invocations]) {
+    Module* mod;
+    CHECK(shd_driver_load_source_file(config, SrcSlim, strlen(src), src, name, &mod) == NoError, exit(-1));
+    Module* specialized = mod;
+    CHECK(shd_run_compiler_passes(config, &specialized) == CompilationNoError, exit(-1));
+
+    Module* final_mod;
+    BytecodeProgram* program = shd_emit_bytecode(config, specialized, &final_mod);
+    CHECK(program, exit(-1));
+    size_t listing_size;
+    char* listing;
+    shd_print_bytecode(program, &listing_size, &listing);
+    shd_debug_print("%s", listing);
+    free(listing);
+
+    memset(out, 0xFF, Invocations * sizeof(uint32_t));
+    CHECK(shd_interpret_bytecode(program, "main", kernel_args, (uint32_t[]) { Workgroups, 1, 1 }), exit(-1));
+
+    shd_destroy_bytecode(program);
+    if (shd_module_get_arena(final_mod) != shd_module_get_arena(specialized))
+        shd_destroy_ir_arena(shd_module_get_arena(final_mod));
+    if (shd_module_get_arena(specialized) != shd_module_get_arena(mod))
+        shd_destroy_ir_arena(shd_module_get_arena(specialized));
+    shd_destroy_ir_arena(shd_module_get_arena(mod));
+}
+
+static void check_output(const char* name, uint32_t out[Invocations], uint32_t (*expected)(uint32_t x)) {
+    for (uint32_t x = 0; x < Invocations; x++) {
+        if (out[x] != expected(x)) {
+            shd_error_print("%s: out[%u] = %u, expected %u\n", name, x, out[x], expected(x));
+            exit(-1);
+        }
+    }
+}
+
+static uint32_t expected_divergent(uint32_t x) {
+    return x % 2 == 0 ? fib(x) + 1000 : x * x;
+}
+
+static uint32_t expected_shared(uint32_t x) {
+    return (x - x % 4 + (x + 1) % 4) * 3;
+}
+
+static uint32_t expected_private(uint32_t x) {
+    return 5 + x;
+}
+
+int main(int argc, char** argv) {
+    DriverConfig args = shd_default_driver_config();
+    shd_parse_common_args(&argc, argv);
+    shd_parse_compiler_config_args(&args.config, &argc, argv);
+
+    CompilerConfig* config = &args.config;
+    // the interpreter runs subgroups of a single invocation
+    config->specialization.subgroup_size = 1;
+    config->specialization.entry_point = "main";
+    config->dynamic_scheduling = false;
+
+    uint32_t out[Invocations];
+    uint32_t* out_ptr = out;
+    uint32_t bias = 1000;
+
+    run_kernel(config, "test_bytecode", kernel_src, (void*[]) { &out_ptr, &bias }, out);
+    check_output("test_bytecode", out, expected_divergent);
+
+    run_kernel(config, "test_bytecode_shared", shared_kernel_src, (void*[]) { &out_ptr }, out);
+    check_output("test_bytecode_shared", out, expected_shared);
+
+    run_kernel(config, "test_bytecode_private", private_kernel_src, (void*[]) { &out_ptr }, out);
+    check_output("test_bytecode_private", out, expected_private);
+
+    shd_destroy_driver_config(&args);
+    return 0;
+}
@@ -0,0 +1,106 @@
+#include "shady/ir.h"
+#include "shady/driver.h"
+#include "shady/visit.h"
+#include "shady/be/c.h"
+
+#include "log.h"
+#include "dict.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHECK(x, failure_handler) { if (!(x)) { shd_error_print(#x " failed\n"); failure_handler; } }
+
+static const char* kernel_src =
+    "@Exported\n"
+    "fn vec_fma varying pack[f32; 4](varying pack[f32; 4] a, varying pack[f32; 4] b, varying pack[f32; 4] c) {\n"
+    "    return (fma(a, b, c));\n"
+    "}\n"
+    "\n"
+    "@Exported\n"
+    "fn vec_fmod varying pack[f32; 4](varying pack[f32; 4] a, varying pack[f32; 4] b) {\n"
+    "    return (a % b);\n"
+    "}\n"
+    "\n"
+    "@Exported\n"
+    "fn vec_imod varying pack[u32; 4](varying pack[u32; 4] a, varying pack[u32; 4] b) {\n"
+    "    return (a % b);\n"
+    "}\n";
+
+typedef struct {
+    Visitor visitor;
+    struct Dict* once;
+    size_t packed_fma, packed_fmod, packed_imod;
+} PackedOpsVisitor;
+
+static void visit_packed_ops(PackedOpsVisitor* visitor, const Node* node) {
+    if (shd_dict_find_key(const Node*, visitor->once, node))
+        return;
+    shd_set_insert_get_result(const Node*, visitor->once, node);
+    if (node->tag == PrimOp_TAG && node->type) {
+        const Type* t = shd_get_unqualified_type(node->type);
+        if (t->tag == PackType_TAG) {
+            bool is_float = t->payload.pack_type.element_type->tag == Float_TAG;
+            switch (node->payload.prim_op.op) {
+                case fma_op: visitor->packed_fma++; break;
+                case mod_op: if (is_float) visitor->packed_fmod++; else visitor->packed_imod++; break;
+                default: break;
+            }
+        }
+    }
+    shd_visit_node_operands(&visitor->visitor, 0, node);
+}
+
+int main(int argc, char** argv) {
+    DriverConfig args = shd_default_driver_config();
+    shd_parse_common_args(&argc, argv);
+    shd_parse_compiler_config_args(&args.config, &argc, argv);
+    CompilerConfig* config = &args.config;
+
+    Module* mod;
+    CHECK(shd_driver_load_source_file(config, SrcSlim, strlen(kernel_src), kernel_src, "test_c_vectors", &mod) == NoError, exit(-1));
+    Module* specialized = mod;
+    CHECK(shd_run_compiler_passes(config, &specialized) == CompilationNoError, exit(-1));
+
+    CEmitterConfig emitter_config = shd_default_c_emitter_config();
+    emitter_config.dialect = CDialect_C11;
+    emitter_config.native_vectors = true;
+    size_t output_size;
+    char* output;
+    Module* final_mod;
+    shd_emit_c(config, emitter_config, specialized, &output_size, &output, &final_mod);
+    shd_debug_print("%s", output);
+
+    // fmaf and `%` on floats have no vector forms, only integer `%` can stay on vector extension types
+    PackedOpsVisitor visitor = {
+        .visitor = {
+            .visit_node_fn = (VisitNodeFn) visit_packed_ops,
+        },
+        // nodes are hash-consed, their addresses are enough to tell them apart
+        .once = shd_new_set(const Node*, (HashFn) shd_hash_ptr, (CmpFn) shd_compare_ptrs),
+    };
+    shd_visit_module(&visitor.visitor, final_mod);
+    shd_destroy_dict(visitor.once);
+    CHECK(visitor.packed_fma == 0, exit(-1));
+    CHECK(visitor.packed_fmod == 0, exit(-1));
+    CHECK(visitor.packed_imod == 1, exit(-1));
+
+    // the vector extensions have to be accepted by the compiler the CPU runtime builds kernels with
+    CHECK(shd_write_file("test_c_vectors_out.c", strlen(output), output), exit(-1));
+    const char* cc = getenv("SHADY_CC");
+    char* command = shd_format_string_new("%s -std=gnu11 -c -o test_c_vectors_out.o test_c_vectors_out.c", cc ? cc : "cc");
+    int status = system(command);
+    free(command);
+    CHECK(status == 0, exit(-1));
+
+    free(output);
+    if (shd_module_get_arena(final_mod) != shd_module_get_arena(specialized))
+        shd_destroy_ir_arena(shd_module_get_arena(final_mod));
+    if (shd_module_get_arena(specialized) != shd_module_get_arena(mod))
+        shd_destroy_ir_arena(shd_module_get_arena(specialized));
+    shd_destroy_ir_arena(shd_module_get_arena(mod));
+    shd_destroy_driver_config(&args);
+    return 0;
+}
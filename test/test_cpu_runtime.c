@@ -0,0 +1,80 @@
+#include "shady/runtime.h"
+#include "shady/ir.h"
+#include "shady/driver.h"
+
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHECK(x, failure_handler) { if (!(x)) { shd_error_print(#x " failed\n"); failure_handler; } }
+
+/// The host runner calls the kernel once per invocation on the same thread, each one must find the private variable as initialised
+static const char* private_kernel_src =
+    "@Builtin(\"GlobalInvocationId\")\n"
+    "var uniform input pack[u32; 3] global_id;\n"
+    "\n"
+    "var private u32 counter = u32 5;\n"
+    "\n"
+    "@EntryPoint(\"Compute\") @Exported @WorkgroupSize(4, 1, 1) fn main(uniform ptr global [u32] out) {\n"
+    "    val thread_id = global_id;\n"
+    "    val x = thread_id#0;\n"
+    "    counter = counter + x;\n"
+    "    *out#(reinterpret[i32](x)) = counter;\n"
+    "    return ();\n"
+    "}\n";
+
+enum { Workgroups = 3, Invocations = Workgroups * 4 };
+
+static Device* find_cpu_device(Runtime* runtime) {
+    for (size_t i = 0; i < shd_rt_device_count(runtime); i++) {
+        Device* device = shd_rt_get_device(runtime, i);
+        if (strncmp(shd_rt_get_device_name(device), "Host CPU", strlen("Host CPU")) == 0)
+            return device;
+    }
+    return NULL;
+}
+
+int main(int argc, char** argv) {
+    DriverConfig args = shd_default_driver_config();
+    RuntimeConfig runtime_config = shd_rt_default_config();
+    runtime_config.allow_no_devices = true;
+    shd_parse_common_args(&argc, argv);
+    shd_rt_cli_parse_runtime_config(&runtime_config, &argc, argv);
+    shd_parse_compiler_config_args(&args.config, &argc, argv);
+
+    Runtime* runtime = shd_rt_initialize(runtime_config);
+    CHECK(runtime, exit(-1));
+    Device* device = find_cpu_device(runtime);
+    CHECK(device, exit(-1));
+
+    Module* mod;
+    CHECK(shd_driver_load_source_file(&args.config, SrcSlim, strlen(private_kernel_src), private_kernel_src, "test_cpu_runtime_private", &mod) == NoError, exit(-1));
+    Program* program = shd_rt_new_program_from_module(runtime, &args.config, mod);
+    CHECK(program, exit(-1));
+
+    uint32_t out[Invocations];
+    memset(out, 0xFF, sizeof(out));
+    Buffer* buffer = shd_rt_allocate_buffer_device(device, sizeof(out));
+    CHECK(buffer, exit(-1));
+    CHECK(shd_rt_copy_to_buffer(buffer, 0, out, sizeof(out)), exit(-1));
+    uint64_t out_ptr = shd_rt_get_buffer_device_pointer(buffer);
+    Command* launch = shd_rt_launch_kernel(program, device, "main", Workgroups, 1, 1, 1, (void*[]) { &out_ptr }, NULL);
+    CHECK(launch, exit(-1));
+    CHECK(shd_rt_wait_completion(launch), exit(-1));
+    CHECK(shd_rt_copy_from_buffer(buffer, 0, out, sizeof(out)), exit(-1));
+
+    for (uint32_t x = 0; x < Invocations; x++) {
+        if (out[x] != 5 + x) {
+            shd_error_print("test_cpu_runtime_private: out[%u] = %u, expected %u\n", x, out[x], 5 + x);
+            exit(-1);
+        }
+    }
+
+    shd_rt_destroy_buffer(buffer);
+    shd_rt_shutdown(runtime);
+    shd_destroy_ir_arena(shd_module_get_arena(mod));
+    shd_destroy_driver_config(&args);
+    return 0;
+}